@@ -7,7 +7,8 @@
  * This program connects to an E22-900T22D LoRa module by either USB or DIP (UART and GPIO),
  * switches to configuration mode, reads its configuration registers in configuration mode,
  * and updates them as needed to match the desired configuration, then switches back to
- * transmission mode.
+ * transmission mode. It then displays packets as received, and with --capture=<file> also
+ * writes them to a capture that e22900t22tomqtt can replay.
  *
  * DIP wiring (Pi → E22 DIP):
  *   VCC  → 3.3V (Pin 1)
@@ -27,6 +28,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if defined(E22900T22_SUPPORT_MODULE_DIP)
 #include <gpiod.h>
@@ -73,6 +75,12 @@ void __sleep_ms(const uint32_t ms) {
     usleep((useconds_t)ms * 1000);
 }
 
+#include "include/capture_linux.h"
+
+void packet_capture(const uint8_t *packet, const int packet_size, const uint8_t rssi) {
+    capture_write(packet, packet_size, rssi, _e22900txx_config.rssi_packet, E22900T22_MODULE, (uint64_t)serial_read_first.tv_sec * 1000000ULL + (uint64_t)serial_read_first.tv_nsec / 1000ULL);
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // DIP
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -203,7 +211,7 @@ void signal_handler(int sig __attribute__((unused))) {
     }
 }
 
-int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused))) {
+int main(int argc, char *argv[]) {
 
     setbuf(stdout, NULL);
     printf("starting\n");
@@ -211,6 +219,8 @@ int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    const char *capture_path = (argc > 1 && strncmp(argv[1], "--capture=", 10) == 0) ? argv[1] + 10 : NULL;
+
 #if defined(E22900T22_SUPPORT_MODULE_DIP)
     if (!gpio_begin()) {
         fprintf(stderr, "gpio: failed to initialise\n");
@@ -226,10 +236,14 @@ int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
     if (!device_connect(E22900T22_MODULE, &e22900t22_config))
         goto exit_fail_serial;
     printf("device: connected (port=%s, rate=%d, bits=%s)\n", serial_config.port, serial_config.rate, serial_bits_str(serial_config.bits));
+    serial_gap_begin(device_frame_gap_us(serial_config.rate), true);
     if (!(device_mode_config() && device_info_read() && device_config_read_and_update() && device_mode_transfer()))
         goto exit_fail_device;
 
-    device_packet_read_and_display(&running);
+    if (capture_path != NULL && !capture_begin(capture_path))
+        goto exit_fail_device;
+    device_packet_read_and_display(&running, capture_path != NULL ? packet_capture : NULL);
+    capture_end();
 
 exit_fail_device:
     device_disconnect();
@@ -0,0 +1,2987 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * E22-900T22 hot-path benchmarks
+ *
+ * Drives the per-packet code of the gateway (routing, conversion, validation, statistics, configuration
+ * and sinks) over synthetic packet corpora, reporting ns/op, ops/s and cycles/byte, and optionally
+ * writing the results as JSON so that runs can be compared across commits.
+ */
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/util_linux.h"
+#include "include/metrics_linux.h"
+#include "include/latency_linux.h"
+#include "include/stats_linux.h"
+#include "include/capture_linux.h"
+#include "include/trace_linux.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void printf_null(const char *format __attribute__((unused)), ...) {
+}
+void printf_stderr(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+#define PRINTF_DEBUG printf_null
+#define PRINTF_INFO  printf_null
+#define PRINTF_ERROR printf_stderr
+
+#include "include/serial_linux.h"
+
+#undef E22900T22_SUPPORT_MODULE_DIP
+#define E22900T22_SUPPORT_MODULE_USB
+#include "include/e22xxxtxx.h"
+
+void __sleep_ms(const uint32_t ms) {
+    usleep((useconds_t)ms * 1000);
+}
+
+#include "include/config_linux.h"
+#include "include/json_linux.h"
+#include "include/sink_linux.h"
+#include "include/filter_linux.h"
+#include "include/packet_linux.h"
+#include "include/schema_linux.h"
+#include "include/health_linux.h"
+#include "include/admission_linux.h"
+#include "include/tdma_linux.h"
+#include "include/dedup_linux.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_TIME_MS_DEFAULT 250
+#define BENCH_RESULTS_MAX     256
+#define BENCH_NAME_MAX        64
+
+typedef struct {
+    char name[BENCH_NAME_MAX];
+    uint64_t ops, elapsed_ns, cycles, bytes_per_op;
+} bench_result_t;
+
+typedef uint64_t (*bench_fn_t)(void *context, const uint64_t iterations);
+
+bench_result_t bench_results[BENCH_RESULTS_MAX];
+int bench_result_count = 0;
+uint32_t bench_time_ms = BENCH_TIME_MS_DEFAULT;
+const char *bench_filter = NULL;
+int bench_failures = 0; // of the checks, across the suites; any fail the run
+volatile uint64_t bench_blackhole;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES_AVAILABLE 1
+#define BENCH_CYCLES_SOURCE    "rdtsc"
+static inline uint64_t bench_cycles(void) {
+    return __builtin_ia32_rdtsc();
+}
+#else
+#define BENCH_CYCLES_AVAILABLE 0
+#define BENCH_CYCLES_SOURCE    "unavailable"
+static inline uint64_t bench_cycles(void) {
+    return 0;
+}
+#endif
+
+// stops the compiler from hoisting loop-invariant work out of a benchmark loop
+static inline void bench_clobber(void *pointer) {
+    __asm__ volatile("" : : "r"(pointer) : "memory");
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// fixed-point helpers: the build has no floating point, so fractional figures are carried in thousandths
+static void bench_format_milli(char *buffer, const size_t length, const uint64_t value_milli) {
+    snprintf(buffer, length, "%" PRIu64 ".%03" PRIu64, value_milli / 1000, value_milli % 1000);
+}
+
+void bench_run(const char *name, const bench_fn_t fn, void *context, const uint64_t bytes_per_op) {
+    if (bench_filter && !strstr(name, bench_filter))
+        return;
+    if (bench_result_count >= BENCH_RESULTS_MAX)
+        return;
+    const uint64_t target_ns = (uint64_t)bench_time_ms * 1000000ULL;
+    uint64_t iterations = 16, elapsed_ns;
+    for (;;) {
+        const uint64_t started_ns = bench_now_ns();
+        bench_blackhole += fn(context, iterations);
+        elapsed_ns = bench_now_ns() - started_ns;
+        if (elapsed_ns >= target_ns / 8 || iterations >= (1ULL << 40))
+            break;
+        iterations *= 2;
+    }
+    if (elapsed_ns > 0 && elapsed_ns < target_ns)
+        iterations = iterations * target_ns / elapsed_ns;
+    bench_result_t *result = &bench_results[bench_result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    const uint64_t started_cycles = bench_cycles(), started_ns = bench_now_ns();
+    bench_blackhole += fn(context, iterations);
+    result->elapsed_ns = bench_now_ns() - started_ns;
+    result->cycles = bench_cycles() - started_cycles;
+    result->ops = iterations;
+    result->bytes_per_op = bytes_per_op;
+    if (result->elapsed_ns == 0)
+        result->elapsed_ns = 1;
+
+    char ns_per_op[32], cycles_per_byte[32] = "-", gb_per_sec[32] = "-";
+    bench_format_milli(ns_per_op, sizeof(ns_per_op), result->elapsed_ns * 1000 / result->ops);
+    if (BENCH_CYCLES_AVAILABLE && bytes_per_op > 0)
+        bench_format_milli(cycles_per_byte, sizeof(cycles_per_byte), result->cycles * 1000 / (result->ops * bytes_per_op));
+    if (bytes_per_op > 0)
+        bench_format_milli(gb_per_sec, sizeof(gb_per_sec), result->ops * bytes_per_op * 1000 / result->elapsed_ns);
+    printf("%-48s %14s ns/op %14" PRIu64 " ops/s %12s cycles/byte %10s GB/s\n", result->name, ns_per_op, result->ops * (uint64_t)1000000000 / result->elapsed_ns, cycles_per_byte, gb_per_sec);
+}
+
+bool bench_write_json(const char *filename, const char *label) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "bench: could not write '%s'\n", filename);
+        return false;
+    }
+    fprintf(file, "{\n  \"label\": \"%s\",\n  \"time_ms\": %" PRIu32 ",\n  \"cycles_source\": \"%s\",\n  \"results\": [\n", label ? label : "", bench_time_ms, BENCH_CYCLES_SOURCE);
+    for (int i = 0; i < bench_result_count; i++) {
+        const bench_result_t *result = &bench_results[i];
+        char ns_per_op[32], cycles_per_byte[32] = "null", gb_per_sec[32] = "null";
+        bench_format_milli(ns_per_op, sizeof(ns_per_op), result->elapsed_ns * 1000 / result->ops);
+        if (BENCH_CYCLES_AVAILABLE && result->bytes_per_op > 0)
+            bench_format_milli(cycles_per_byte, sizeof(cycles_per_byte), result->cycles * 1000 / (result->ops * result->bytes_per_op));
+        if (result->bytes_per_op > 0)
+            bench_format_milli(gb_per_sec, sizeof(gb_per_sec), result->ops * result->bytes_per_op * 1000 / result->elapsed_ns);
+        fprintf(file, "    { \"name\": \"%s\", \"ops\": %" PRIu64 ", \"ns_per_op\": %s, \"ops_per_sec\": %" PRIu64 ", \"bytes_per_op\": %" PRIu64 ", \"cycles_per_byte\": %s, \"gb_per_sec\": %s }%s\n", result->name, result->ops,
+                ns_per_op, result->ops * (uint64_t)1000000000 / result->elapsed_ns, result->bytes_per_op, cycles_per_byte, gb_per_sec, i + 1 < bench_result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("bench: results written to '%s'\n", filename);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_PACKET_SIZES_COUNT 3
+static const int bench_packet_sizes[BENCH_PACKET_SIZES_COUNT] = { 32, 128, E22900T22_PACKET_MAXSIZE };
+
+typedef struct {
+    uint8_t data[E22900T22_PACKET_MAXSIZE];
+    int size;
+} bench_packet_t;
+
+static uint32_t bench_random_state = 0x2545F491;
+static uint32_t bench_random(void) {
+    bench_random_state ^= bench_random_state << 13;
+    bench_random_state ^= bench_random_state >> 17;
+    bench_random_state ^= bench_random_state << 5;
+    return bench_random_state;
+}
+
+// JSON sensor report padded out to exactly 'size' bytes, e.g. {"id":"node-07","type":"icedepth","seq":12,...}
+static void bench_packet_json(bench_packet_t *packet, const int size, const char *type) {
+    char buffer[E22900T22_PACKET_MAXSIZE + 64];
+    int length = snprintf(buffer, sizeof(buffer), "{\"id\":\"node-%02" PRIu32 "\",\"type\":\"%s\",\"seq\":%" PRIu32 ",\"depth\":%" PRIu32 ",\"temp\":-%" PRIu32, bench_random() % 100, type, bench_random() % 10000,
+                          bench_random() % 1000, bench_random() % 20);
+    if (length + 10 <= size) {
+        length += snprintf(buffer + length, sizeof(buffer) - (size_t)length, ",\"pad\":\"");
+        while (length < size - 2)
+            buffer[length++] = (char)('a' + (bench_random() % 26));
+        buffer[length++] = '"';
+    }
+    buffer[length++] = '}';
+    length = length > size ? size : length;
+    buffer[length - 1] = '}';
+    memcpy(packet->data, buffer, (size_t)length);
+    packet->size = length;
+}
+
+static void bench_packet_binary(bench_packet_t *packet, const int size, const uint8_t type) {
+    for (int i = 0; i < size; i++)
+        packet->data[i] = (uint8_t)bench_random();
+    packet->data[0] = type;
+    packet->size = size;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_ROUTE_STRING_MAX 32
+#define BENCH_ROUTES_MAX       4096
+#define BENCH_ROUTE_BYTES      128
+
+static char bench_route_strings[BENCH_ROUTES_MAX][3][BENCH_ROUTE_STRING_MAX];
+
+// routes are numbered so that a packet can hit the last one (worst case scan) or miss all of them: binary routes
+// match bytes 0x80-0xFF, spread over as many offsets as needed, so packets with bytes below 0x80 never match
+static void bench_routes_setup(const int count, const data_type_t data_type) {
+    topic_routes_reset();
+    for (int i = 0; i < count && i < BENCH_ROUTES_MAX; i++) {
+        char(*strings)[BENCH_ROUTE_STRING_MAX] = bench_route_strings[i];
+        if (data_type == DATA_TYPE_JSON) {
+            snprintf(strings[0], BENCH_ROUTE_STRING_MAX, "type");
+            snprintf(strings[1], BENCH_ROUTE_STRING_MAX, "route%d", i);
+        } else {
+            snprintf(strings[0], BENCH_ROUTE_STRING_MAX, "%d", i / BENCH_ROUTE_BYTES);
+            snprintf(strings[1], BENCH_ROUTE_STRING_MAX, "%02X", 0x80 + (i % BENCH_ROUTE_BYTES));
+        }
+        snprintf(strings[2], BENCH_ROUTE_STRING_MAX, "e22900t22/route%d", i);
+        topic_route_add(strings[0], strings[1], strings[2], 1);
+    }
+    topic_routes_compile();
+    topic_route_default.topic = "e22900t22";
+    topic_route_default.sinks = 1;
+}
+
+static void bench_routes_setup_path(const int count) {
+    topic_routes_reset();
+    for (int i = 0; i < count && i < BENCH_ROUTES_MAX; i++) {
+        char(*strings)[BENCH_ROUTE_STRING_MAX] = bench_route_strings[i];
+        snprintf(strings[0], BENCH_ROUTE_STRING_MAX, "type");
+        snprintf(strings[1], BENCH_ROUTE_STRING_MAX, "route%d", i);
+        snprintf(strings[2], BENCH_ROUTE_STRING_MAX, "e22900t22/route%d", i);
+        topic_route_add_path(strings[0], NULL, strings[1], strings[2], 1);
+    }
+    topic_routes_compile();
+}
+
+static void bench_packet_binary_route(bench_packet_t *packet, const int route) {
+    bench_packet_binary(packet, E22900T22_PACKET_MAXSIZE, 0x00);
+    for (int i = 0; i < packet->size; i++)
+        packet->data[i] &= 0x7F;
+    if (route >= 0)
+        packet->data[route / BENCH_ROUTE_BYTES] = (uint8_t)(0x80 + (route % BENCH_ROUTE_BYTES));
+}
+
+typedef struct {
+    bench_packet_t packet;
+    data_type_t data_type;
+} bench_route_context_t;
+
+static uint64_t bench_fn_route_select(void *context, const uint64_t iterations) {
+    const bench_route_context_t *ctx = (const bench_route_context_t *)context;
+    uint64_t matched = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        matched += route_topic_select(ctx->packet.data, ctx->packet.size, ctx->data_type, false) != NULL;
+    return matched;
+}
+
+static uint64_t bench_fn_route_select_json_linear(void *context, const uint64_t iterations) {
+    const bench_route_context_t *ctx = (const bench_route_context_t *)context;
+    uint64_t matched = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        matched += __route_select_json_linear(ctx->packet.data, ctx->packet.size) != NULL;
+    return matched;
+}
+
+#define BENCH_ROUTE_CHECK_SETS    400
+#define BENCH_ROUTE_CHECK_PACKETS 200
+
+// a random string from a small alphabet, including '"', ':' and ',', so that route patterns overlap, are prefixes and
+// suffixes of each other, and are duplicated
+static void bench_route_string(char *string, const int length_min, const int length_max, const char *alphabet) {
+    const int length = length_min + (int)(bench_random() % (uint32_t)(length_max - length_min + 1)), count = (int)strlen(alphabet);
+    for (int i = 0; i < length; i++)
+        string[i] = alphabet[bench_random() % (uint32_t)count];
+    string[length] = '\0';
+}
+
+// either a soup of route patterns and alphabet characters, or a JSON object of keys and values from the same alphabets
+static void bench_route_packet(bench_packet_t *packet, const bool object) {
+    char buffer[E22900T22_PACKET_MAXSIZE], piece[BENCH_ROUTE_STRING_MAX * 2];
+    int length = 0;
+    buffer[length++] = '{';
+    for (int pieces = 1 + (int)(bench_random() % 6), i = 0; i < pieces; i++) {
+        if (object) {
+            char key[8], value[8];
+            bench_route_string(key, 1, 2, "ab");
+            bench_route_string(value, 0, 2, "xy");
+            snprintf(piece, sizeof(piece), "%s\"%s\":\"%s\"", i == 0 ? "" : ",", key, value);
+        } else if (topic_route_count > 0 && bench_random() % 2 == 0) {
+            const topic_route_t *route = &topic_routes[bench_random() % topic_route_count];
+            snprintf(piece, sizeof(piece), "%s", route->pattern != NULL ? route->pattern : "");
+            if (bench_random() % 4 == 0 && strlen(piece) > 1)
+                piece[bench_random() % strlen(piece)] = '\0'; // a prefix of the pattern, cut short
+        } else
+            bench_route_string(piece, 1, 3, "ab\":,xy");
+        const int piece_length = (int)strlen(piece);
+        if (length + piece_length + 1 >= (int)sizeof(buffer))
+            break;
+        memcpy(buffer + length, piece, (size_t)piece_length);
+        length += piece_length;
+    }
+    buffer[length++] = '}';
+    memcpy(packet->data, buffer, (size_t)length);
+    packet->size = length;
+}
+
+// the per route scan, as the reference: the first route, in configuration order, whose literal pattern is found or
+// whose path matches on its own
+static const topic_route_t *bench_route_select_reference(const uint8_t *packet, const int packet_size) {
+    for (size_t i = 0; i < topic_route_count; i++)
+        if (topic_routes[i].match >= 0 ? json_match_first(packet, packet_size, &topic_route_matches[topic_routes[i].match], 1) >= 0 : __route_match_json(packet, packet_size, &topic_routes[i]))
+            return &topic_routes[i];
+    return NULL;
+}
+
+// the automaton (and the path routes after it) must select the same route as the per route scan, over random route
+// sets, with and without path routes, and random packets, including those where route 0 matches after others
+static int bench_route_check(void) {
+    int failures = 0;
+    bench_packet_t packet;
+    for (int set = 0; set < BENCH_ROUTE_CHECK_SETS; set++) {
+        const bool paths = set % 2 == 1;
+        const int count = 1 + (int)(bench_random() % (set < BENCH_ROUTE_CHECK_SETS / 2 ? 8 : 64));
+        topic_routes_reset();
+        for (int i = 0; i < count; i++) {
+            char(*strings)[BENCH_ROUTE_STRING_MAX] = bench_route_strings[i];
+            snprintf(strings[2], BENCH_ROUTE_STRING_MAX, "e22900t22/route%d", i);
+            if (paths && bench_random() % 3 == 0) {
+                bench_route_string(strings[0], 1, 2, "ab");
+                bench_route_string(strings[1] + 1, 0, 2, "xy");
+                strings[1][0] = '"';
+                strcat(strings[1], "\"");
+                topic_route_add_path(strings[0], NULL, strings[1], strings[2], 1);
+            } else {
+                bench_route_string(strings[0], 1, 3, paths ? "ab" : "ab\":,");
+                bench_route_string(strings[1], 0, 4, paths ? "xy" : "xy\":,");
+                topic_route_add(strings[0], strings[1], strings[2], 1);
+            }
+        }
+        topic_routes_compile();
+        for (int p = 0; p < BENCH_ROUTE_CHECK_PACKETS; p++) {
+            bench_route_packet(&packet, paths || p % 4 == 0);
+            if (p % 8 == 1 && topic_routes[0].pattern != NULL && packet.size + topic_routes[0].pattern_length < (int)sizeof(packet.data)) {
+                // route 0 after whatever else matched, to exercise the early exit
+                memcpy(packet.data + packet.size - 1, topic_routes[0].pattern, (size_t)topic_routes[0].pattern_length);
+                packet.size += topic_routes[0].pattern_length;
+                packet.data[packet.size - 1] = '}';
+            }
+            uint8_t *copy = (uint8_t *)malloc((size_t)packet.size); // exactly the size, so that reads past it are caught by the sanitizers
+            memcpy(copy, packet.data, (size_t)packet.size);
+            const topic_route_t *expected = bench_route_select_reference(copy, packet.size);
+            const topic_route_t *linear = paths ? expected : __route_select_json_linear(copy, packet.size);
+            const topic_route_t *literal = paths ? expected : __route_select_json_literal(copy, packet.size);
+            const topic_route_t *selected = __route_select_json(copy, packet.size);
+            if (linear != expected || literal != expected || selected != expected || route_topic_select(copy, packet.size, DATA_TYPE_JSON, false) != expected) {
+                printf("bench: route: set %d (%d routes%s), packet '%.*s': expected %d, linear %d, literal %d, selected %d\n", set, count, paths ? ", with paths" : "", packet.size, (const char *)packet.data,
+                       expected ? (int)(expected - topic_routes) : -1, linear ? (int)(linear - topic_routes) : -1, literal ? (int)(literal - topic_routes) : -1, selected ? (int)(selected - topic_routes) : -1);
+                failures++;
+            }
+            free(copy);
+        }
+    }
+    topic_routes_reset();
+    return failures;
+}
+
+static void bench_suite_route(void) {
+    static const int route_counts_json[] = { 1, 16, 128, 1024 };
+    static const int route_counts_binary[] = { 1, 16, 256, BENCH_ROUTES_MAX };
+    const int failures = bench_route_check();
+    printf("bench: route: %d route sets, %d packets each, %d failures\n", BENCH_ROUTE_CHECK_SETS, BENCH_ROUTE_CHECK_PACKETS, failures);
+    bench_failures += failures;
+    char name[BENCH_NAME_MAX], type[BENCH_ROUTE_STRING_MAX];
+    bench_route_context_t ctx;
+    ctx.data_type = DATA_TYPE_JSON;
+    for (int r = 0; r < (int)(sizeof(route_counts_json) / sizeof(route_counts_json[0])); r++) {
+        const int routes = route_counts_json[r];
+        bench_routes_setup(routes, DATA_TYPE_JSON);
+        snprintf(type, sizeof(type), "route%d", routes - 1);
+        bench_packet_json(&ctx.packet, E22900T22_PACKET_MAXSIZE, type);
+        snprintf(name, sizeof(name), "route-select/json/hit-last/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+        snprintf(name, sizeof(name), "route-select/json-linear/hit-last/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select_json_linear, &ctx, (uint64_t)ctx.packet.size);
+        bench_packet_json(&ctx.packet, E22900T22_PACKET_MAXSIZE, "unrouted");
+        snprintf(name, sizeof(name), "route-select/json/miss/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+        snprintf(name, sizeof(name), "route-select/json-linear/miss/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select_json_linear, &ctx, (uint64_t)ctx.packet.size);
+    }
+    for (int r = 0; r < (int)(sizeof(route_counts_json) / sizeof(route_counts_json[0])) && route_counts_json[r] <= 128; r++) {
+        const int routes = route_counts_json[r];
+        bench_routes_setup_path(routes);
+        snprintf(type, sizeof(type), "route%d", routes - 1);
+        bench_packet_json(&ctx.packet, E22900T22_PACKET_MAXSIZE, type);
+        snprintf(name, sizeof(name), "route-select/json-path/hit-last/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+        bench_packet_json(&ctx.packet, E22900T22_PACKET_MAXSIZE, "unrouted");
+        snprintf(name, sizeof(name), "route-select/json-path/miss/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+    }
+    ctx.data_type = DATA_TYPE_JSON_CONVERT;
+    for (int r = 0; r < (int)(sizeof(route_counts_binary) / sizeof(route_counts_binary[0])); r++) {
+        const int routes = route_counts_binary[r];
+        bench_routes_setup(routes, DATA_TYPE_JSON_CONVERT);
+        bench_packet_binary_route(&ctx.packet, routes - 1);
+        snprintf(name, sizeof(name), "route-select/binary/hit-last/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+        bench_packet_binary_route(&ctx.packet, -1);
+        snprintf(name, sizeof(name), "route-select/binary/miss/routes=%d/size=%d", routes, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+    }
+    ctx.data_type = DATA_TYPE_JSON;
+    bench_routes_setup(16, DATA_TYPE_JSON);
+    for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+        bench_packet_json(&ctx.packet, bench_packet_sizes[s], "unrouted");
+        snprintf(name, sizeof(name), "route-select/json/miss/routes=%d/size=%d", 16, ctx.packet.size);
+        bench_run(name, bench_fn_route_select, &ctx, (uint64_t)ctx.packet.size);
+    }
+    topic_routes_reset();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    int routes;
+    data_type_t data_type;
+} bench_reload_context_t;
+
+// as a reload: the routes in use are held aside, the new ones built, and the held ones freed
+static uint64_t bench_fn_route_reload(void *context, const uint64_t iterations) {
+    const bench_reload_context_t *ctx = (const bench_reload_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        topic_routes_table_t held;
+        memset(&held, 0, sizeof(held));
+        topic_routes_swap(&held);
+        bench_routes_setup(ctx->routes, ctx->data_type);
+        topic_routes_table_free(&held);
+    }
+    return iterations;
+}
+
+// routes built while others are held aside must select as their own, and those held must select as before once
+// swapped back, whether the new ones are kept or dropped
+static int bench_route_reload_check(void) {
+    int failures = 0;
+    bench_packet_t packet;
+    bench_routes_setup(16, DATA_TYPE_JSON_CONVERT);
+    bench_packet_binary_route(&packet, 15);
+    const topic_route_t *route = route_topic_select(packet.data, packet.size, DATA_TYPE_JSON_CONVERT, false);
+    const char *topic_before = route != NULL ? route->topic : NULL;
+    topic_routes_table_t held;
+    memset(&held, 0, sizeof(held));
+    topic_routes_swap(&held);
+    if (topic_route_count != 0 || route_topic_select(packet.data, packet.size, DATA_TYPE_JSON_CONVERT, false) != &topic_route_default) {
+        printf("bench: reload: routes still in use after being held aside\n");
+        failures++;
+    }
+    bench_routes_setup(8, DATA_TYPE_JSON_CONVERT);
+    if (topic_route_count != 8 || route_topic_select(packet.data, packet.size, DATA_TYPE_JSON_CONVERT, false) != NULL) {
+        printf("bench: reload: new routes do not select as their own\n");
+        failures++;
+    }
+    topic_routes_swap(&held); // dropped: the held routes back, the new ones held and then freed
+    topic_routes_table_free(&held);
+    route = route_topic_select(packet.data, packet.size, DATA_TYPE_JSON_CONVERT, false);
+    if (topic_route_count != 16 || held.routes != NULL || route == NULL || topic_before == NULL || strcmp(route->topic, topic_before) != 0) {
+        printf("bench: reload: held routes do not select as before once swapped back\n");
+        failures++;
+    }
+    topic_routes_reset();
+    return failures;
+}
+
+static void bench_suite_reload(void) {
+    static const int route_counts[] = { 16, 256, BENCH_ROUTES_MAX };
+    char name[BENCH_NAME_MAX];
+    const int failures = bench_route_reload_check();
+    printf("bench: reload: %d failures\n", failures);
+    bench_failures += failures;
+    bench_reload_context_t ctx;
+    for (int r = 0; r < (int)(sizeof(route_counts) / sizeof(route_counts[0])); r++) {
+        ctx.routes = route_counts[r];
+        ctx.data_type = DATA_TYPE_JSON_CONVERT;
+        snprintf(name, sizeof(name), "route-reload/binary/routes=%d", ctx.routes);
+        bench_run(name, bench_fn_route_reload, &ctx, 0);
+        ctx.data_type = DATA_TYPE_JSON;
+        snprintf(name, sizeof(name), "route-reload/json/routes=%d", ctx.routes);
+        bench_run(name, bench_fn_route_reload, &ctx, 0);
+    }
+    topic_routes_reset();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t bench_fn_route_topic(void *context, const uint64_t iterations) {
+    const bench_route_context_t *ctx = (const bench_route_context_t *)context;
+    char topic[TOPIC_LENGTH_MAX];
+    uint64_t length = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const topic_route_t *route = route_topic_select(ctx->packet.data, ctx->packet.size, ctx->data_type, false);
+        const char *rendered = route ? route_topic_render(route, ctx->packet.data, ctx->packet.size, topic, TOPIC_LENGTH_MAX) : NULL;
+        length += rendered ? (uint64_t)rendered[0] : 0;
+    }
+    return length;
+}
+
+// templates the compiler must reject (each error that returns NULL, and a topic without extractors), and known
+// answers for each extractor against a fixed binary and JSON packet, where a missing field or one past the end of the
+// packet has no topic; each answer is also rendered into every smaller buffer, which must fail rather than truncate
+static int bench_topic_check(int *rejected_count, int *answer_count) {
+    static const char *const rejected[] = {
+        "e22900t22/plain",                                                      // no extractors
+        "e22900t22/{byte:0",                                                    // expected '{type:argument}'
+        "e22900t22/{byte}",                                                     // expected '{type:argument}'
+        "e22900t22/{}",                                                         // expected '{type:argument}'
+        "e22900t22/{json:}",                                                    // invalid json path
+        "e22900t22/{json:a..b}",                                                // invalid json path
+        "e22900t22/{json:a[x]}",                                                // invalid json path
+        "{json:a}/{json:b}/{json:c}/{json:d}/{json:e}",                         // invalid json path, too many
+        "e22900t22/{hex:}",                                                     // invalid offset
+        "e22900t22/{hex:x}",                                                    // invalid offset
+        "e22900t22/{hex:-1}",                                                   // invalid offset
+        "e22900t22/{hex:1024}",                                                 // invalid offset
+        "e22900t22/{hex:4-2}",                                                  // invalid range
+        "e22900t22/{hex:1-}",                                                   // invalid range
+        "e22900t22/{hex:1-1024}",                                               // invalid range
+        "e22900t22/{hex:1x}",                                                   // expected '}'
+        "e22900t22/{float:0}",                                                  // unknown type
+        "e22900t22/{u24le:0}",                                                  // unknown type
+        "e22900t22/{bytes:0}",                                                  // unknown type
+        "e22900t22/{byte:}",                                                    // invalid offset
+        "e22900t22/{u16le:-1}",                                                 // invalid offset
+        "e22900t22/{u8:1024}",                                                  // invalid offset
+        "e22900t22/{byte:0 }",                                                  // expected '}'
+        "a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a", // too many parts
+    };
+    static const uint8_t packet_binary[8] = { 0x01, 0x02, 0x03, 0x04, 0xFF, 0xFE, 0x80, 0x00 };
+    static const char packet_json[] = "{\"id\":\"node/07+#x\",\"n\":-12.5,\"ok\":true,\"z\":null,\"o\":{\"a\":1},\"arr\":[1,2],\"sp\":\"a b\\\\c\",\"deep\":{\"x\":{\"y\":\"v\"}}}";
+    static const struct {
+        const char *topic;
+        bool json;
+        int size;             // of the packet, from its start
+        const char *expected; // NULL for no topic
+    } answers[] = {
+        // bytes and hex ranges
+        { "e22900t22/{byte:0}", false, 8, "e22900t22/1" },
+        { "e22900t22/{byte:4}/x", false, 8, "e22900t22/255/x" },
+        { "{hex:1-4}", false, 8, "020304ff" },
+        { "{hex:7}", false, 8, "00" },
+        { "e22900t22/{hex:0-7}", false, 8, "e22900t22/01020304fffe8000" },
+        { "a/{byte:0}/b/{hex:2-3}/c", false, 8, "a/1/b/0304/c" },
+        { "{byte:0}{byte:1}{byte:2}{byte:3}{byte:4}{byte:5}{byte:6}{byte:7}", false, 8, "12342552541280" },
+        // signed and 16/32 bit fields
+        { "{u8:6}", false, 8, "128" },
+        { "{i8:4}", false, 8, "-1" },
+        { "{i8:6}", false, 8, "-128" },
+        { "{u16le:0}", false, 8, "513" },
+        { "{u16le:4}", false, 8, "65279" },
+        { "{u16be:4}", false, 8, "65534" },
+        { "{i16le:4}", false, 8, "-257" },
+        { "{i16be:4}", false, 8, "-2" },
+        { "{u32le:0}", false, 8, "67305985" },
+        { "{u32be:0}", false, 8, "16909060" },
+        { "{u32be:4}", false, 8, "4294868992" },
+        { "{i32be:4}", false, 8, "-98304" },
+        { "{i32le:4}", false, 8, "8453887" },
+        // missing fields and offsets beyond the packet
+        { "{byte:7}", false, 7, NULL },
+        { "{byte:1000}", false, 8, NULL },
+        { "{hex:7-8}", false, 8, NULL },
+        { "{hex:4-7}", false, 7, NULL },
+        { "{u16le:7}", false, 8, NULL },
+        { "{u32be:5}", false, 8, NULL },
+        { "{i32le:4}", false, 7, NULL },
+        { "{byte:0}", false, 0, NULL },
+        { "{json:id}", false, 8, NULL },
+        // json values, with characters not valid in a topic level as '_', and objects, arrays and absent keys as missing
+        { "sensors/{json:id}", true, 0, "sensors/node_07__x" },
+        { "{json:n}", true, 0, "-12.5" },
+        { "{json:ok}/{json:z}", true, 0, "true/null" },
+        { "{json:arr[1]}", true, 0, "2" },
+        { "{json:deep.x.y}", true, 0, "v" },
+        { "{json:sp}", true, 0, "a_b__c" },
+        { "{json:o}", true, 0, NULL },
+        { "{json:arr}", true, 0, NULL },
+        { "{json:missing}", true, 0, NULL },
+        { "{json:deep.x.z}", true, 0, NULL },
+        { "{json:id}/{json:missing}", true, 0, NULL },
+        // too long for any topic
+        { "{hex:0-63}", false, 8, NULL },
+    };
+    int failures = 0;
+    for (int i = 0; i < (int)(sizeof(rejected) / sizeof(rejected[0])); i++) {
+        topic_template_t *topic_template = topic_template_compile(rejected[i]);
+        if (topic_template != NULL) {
+            printf("bench: topic: accepted '%s'\n", rejected[i]);
+            topic_template_free(topic_template);
+            failures++;
+        }
+    }
+    // at the limits: 16 parts and 4 json paths fit
+    static const char *const limits[] = { "a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}a{byte:0}", "{json:a}/{json:b}/{json:c}/{json:d}" };
+    for (int i = 0; i < (int)(sizeof(limits) / sizeof(limits[0])); i++) {
+        topic_template_t *topic_template = topic_template_compile(limits[i]);
+        if (topic_template == NULL) {
+            printf("bench: topic: rejected '%s'\n", limits[i]);
+            failures++;
+        }
+        topic_template_free(topic_template);
+    }
+    *rejected_count = (int)(sizeof(rejected) / sizeof(rejected[0]));
+
+    for (int i = 0; i < (int)(sizeof(answers) / sizeof(answers[0])); i++) {
+        topic_template_t *topic_template = topic_template_compile(answers[i].topic);
+        if (topic_template == NULL) {
+            printf("bench: topic: rejected '%s'\n", answers[i].topic);
+            failures++;
+            continue;
+        }
+        // exactly the size, so that reads past it are caught by the sanitizers
+        const int size = answers[i].json ? (int)strlen(packet_json) : answers[i].size;
+        uint8_t *packet = (uint8_t *)malloc(size > 0 ? (size_t)size : 1);
+        memcpy(packet, answers[i].json ? (const uint8_t *)packet_json : packet_binary, (size_t)size);
+        char topic[TOPIC_LENGTH_MAX];
+        const int length = topic_template_render(topic_template, packet, size, topic, TOPIC_LENGTH_MAX);
+        if (answers[i].expected == NULL ? length != -1 : (length != (int)strlen(answers[i].expected) || strcmp(topic, answers[i].expected) != 0)) {
+            printf("bench: topic: '%s' on %d bytes rendered '%s' (%d), expected '%s'\n", answers[i].topic, size, length < 0 ? "" : topic, length, answers[i].expected ? answers[i].expected : "(none)");
+            failures++;
+        }
+        // a smaller buffer must fail, and one that fits (numeric fields need room for the widest) must render the same
+        for (int topic_size = 1; answers[i].expected != NULL && topic_size < length + 12; topic_size++) {
+            char *small = (char *)malloc((size_t)topic_size);
+            const int small_length = topic_template_render(topic_template, packet, size, small, topic_size);
+            if (topic_size <= length ? small_length != -1 : (small_length != -1 && (small_length != length || strcmp(small, answers[i].expected) != 0)) || (topic_size == length + 11 && small_length != length)) {
+                printf("bench: topic: '%s' into %d bytes rendered %d, expected %s\n", answers[i].topic, topic_size, small_length, topic_size <= length ? "-1" : "the topic");
+                failures++;
+            }
+            free(small);
+        }
+        free(packet);
+        topic_template_free(topic_template);
+    }
+    *answer_count = (int)(sizeof(answers) / sizeof(answers[0]));
+    return failures;
+}
+
+// one route per sensor id (a byte at offset 0) against one template route, then the other extractors
+static void bench_suite_topic(void) {
+    static const struct {
+        const char *name;
+        const char *topic;
+        data_type_t data_type;
+    } templates[] = {
+        { "byte", "e22900t22/{byte:0}", DATA_TYPE_ANY },
+        { "hex-range", "e22900t22/{byte:0}/{hex:1-4}", DATA_TYPE_ANY },
+        { "u16le", "e22900t22/{u16le:1}", DATA_TYPE_ANY },
+        { "json", "sensors/{json:type}", DATA_TYPE_JSON },
+    };
+    int rejected_count, answer_count;
+    const int failures = bench_topic_check(&rejected_count, &answer_count);
+    printf("bench: topic: %d rejected, %d known answers, %d failures\n", rejected_count, answer_count, failures);
+    bench_failures += failures;
+    char name[BENCH_NAME_MAX];
+    bench_route_context_t ctx;
+    ctx.data_type = DATA_TYPE_ANY;
+    topic_routes_reset();
+    for (int i = 0; i < 256; i++) {
+        char(*strings)[BENCH_ROUTE_STRING_MAX] = bench_route_strings[i];
+        snprintf(strings[0], BENCH_ROUTE_STRING_MAX, "0");
+        snprintf(strings[1], BENCH_ROUTE_STRING_MAX, "%02X", i);
+        snprintf(strings[2], BENCH_ROUTE_STRING_MAX, "e22900t22/%d", i);
+        topic_route_add(strings[0], strings[1], strings[2], 1);
+    }
+    topic_routes_compile();
+    bench_packet_binary(&ctx.packet, 32, 0xC8);
+    snprintf(name, sizeof(name), "route-topic/route-list/routes=%d", 256);
+    bench_run(name, bench_fn_route_topic, &ctx, (uint64_t)ctx.packet.size);
+    for (int t = 0; t < (int)(sizeof(templates) / sizeof(templates[0])); t++) {
+        topic_routes_reset();
+        topic_route_default.topic = templates[t].topic;
+        topic_template_free(topic_route_default.topic_template);
+        topic_route_default.topic_template = topic_template_compile(templates[t].topic);
+        ctx.data_type = templates[t].data_type;
+        if (ctx.data_type == DATA_TYPE_JSON)
+            bench_packet_json(&ctx.packet, 128, "sensor-0042");
+        else
+            bench_packet_binary(&ctx.packet, 32, 0xC8);
+        snprintf(name, sizeof(name), "route-topic/template/%s", templates[t].name);
+        bench_run(name, bench_fn_route_topic, &ctx, (uint64_t)ctx.packet.size);
+    }
+    topic_template_free(topic_route_default.topic_template);
+    topic_route_default.topic_template = NULL;
+    topic_route_default.topic = "e22900t22";
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    bench_packet_t packet;
+    filter_program_t program;
+} bench_filter_context_t;
+
+static uint64_t bench_fn_filter_run(void *context, const uint64_t iterations) {
+    const bench_filter_context_t *ctx = (const bench_filter_context_t *)context;
+    uint64_t matched = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        matched += filter_run(&ctx->program, ctx->packet.data, ctx->packet.size);
+    return matched;
+}
+
+// an over-long expression: 'count' masked ranges, each of four instructions, joined by &&
+static void bench_filter_long(char *expression, const size_t size, const int count) {
+    size_t used = 0;
+    for (int i = 0; i < count && used < size; i++)
+        used += (size_t)snprintf(expression + used, size - used, "%su8[%d] & 0x7F in 1..9", i == 0 ? "" : " && ", i);
+}
+
+// expressions the compiler must reject, and known answers for each load, comparison and combination against a fixed
+// packet (and short ones), where a load past the end ends the program as no-match
+static int bench_filter_check(int *rejected_count, int *answer_count) {
+    static const char *const rejected[] = {
+        "",
+        "u8[0]",
+        "u8[0] ==",
+        "u9[0] == 1",
+        "u8[0 == 1",
+        "u8[] == 1",
+        "u8[-1] == 1",
+        "u8[1024] == 1",
+        "u16le[1023] == 1",
+        "u32be[1021] == 1",
+        "len =< 1",
+        "u8[0] in 1",
+        "u8[0] in 1..",
+        "u8[0] == 99999999999999999999",
+        "u8[0] == 1 &&",
+        "u8[0] == 1 junk",
+        "u8[0] == 1)",
+        "(u8[0] == 1",
+        "!",
+    };
+    static const uint8_t packet[8] = { 0x01, 0x02, 0x03, 0x04, 0xFF, 0xFE, 0x80, 0x00 };
+    static const struct {
+        const char *expression;
+        int size; // of the packet, which is cut short
+        bool hit;
+    } answers[] = {
+        // each load, width and endianness, signed and unsigned
+        { "u8[0] == 1", 8, true },
+        { "u8[4] == 255", 8, true },
+        { "u8[4] == -1", 8, false },
+        { "i8[4] == -1", 8, true },
+        { "i8[6] == -128", 8, true },
+        { "i8[6] == 128", 8, false },
+        { "u16le[0] == 0x0201", 8, true },
+        { "u16le[0] == 0x0102", 8, false },
+        { "u16be[0] == 0x0102", 8, true },
+        { "u16le[4] == 65279", 8, true },
+        { "i16le[4] == -257", 8, true },
+        { "i16be[4] == -2", 8, true },
+        { "i16be[4] == 65534", 8, false },
+        { "u16be[4] == 65534", 8, true },
+        { "u32le[0] == 0x04030201", 8, true },
+        { "u32be[0] == 0x01020304", 8, true },
+        { "u32be[0] == 0x04030201", 8, false },
+        { "u32be[4] == 4294868992", 8, true },
+        { "i32be[4] == -98304", 8, true },
+        { "i32le[4] == 8453887", 8, true },
+        { "i32le[4] == -0x7F0101", 8, false },
+        // comparisons, masks and ranges
+        { "len == 8", 8, true },
+        { "len != 8", 8, false },
+        { "len < 8", 8, false },
+        { "len <= 8", 8, true },
+        { "len > 7", 8, true },
+        { "len >= 9", 8, false },
+        { "u8[1] > 1", 8, true },
+        { "i8[4] < 0", 8, true },
+        { "u8[4] & 0x0F == 0x0F", 8, true },
+        { "u16be[0] & 0xFF00 == 0x0100", 8, true },
+        { "u32le[0] & 0xFF == 2", 8, false },
+        { "i16be[4] & 0xFF00 == -256", 8, false }, // the mask is of the sign extended value, so 0xFF00
+        { "u8[2] in 3..3", 8, true },
+        { "u8[2] in 4..10", 8, false },
+        { "u8[2] in 0..2", 8, false },
+        { "i8[4] in -1..0", 8, true },
+        { "u16le[4] & 0x0FFF in 0x0EFF..0x0F00", 8, true },
+        // !, && and || with their precedence
+        { "!(u8[0] == 1)", 8, false },
+        { "!!(u8[0] == 1)", 8, true },
+        { "!(len < 8)", 8, true },
+        { "u8[0] == 1 && u8[1] == 2", 8, true },
+        { "u8[0] == 1 && u8[1] == 3", 8, false },
+        { "u8[0] == 9 || u8[1] == 2", 8, true },
+        { "u8[0] == 9 || u8[1] == 9", 8, false },
+        { "u8[0] == 9 && u8[1] == 9 || u8[2] == 3", 8, true },
+        { "u8[0] == 9 && (u8[1] == 9 || u8[2] == 3)", 8, false },
+        { "!(u8[0] == 1 && u8[1] == 2) || len == 8", 8, true },
+        // short-circuiting, seen through loads past the end, which are not reached, or end as no-match if they are
+        { "u8[0] == 1 || u8[100] == 0", 8, true },
+        { "u8[0] == 9 && u8[100] == 0", 8, false },
+        { "u8[100] == 0 || u8[0] == 1", 8, false },
+        { "!(u8[100] == 0)", 8, false },
+        { "u8[0] == 9 && u8[100] == 0 || u8[1] == 2", 8, true },
+        // short packets
+        { "u8[7] == 0", 8, true },
+        { "u8[7] == 0", 7, false },
+        { "u16le[7] == 0", 8, false },
+        { "u16be[6] == 0x8000", 7, false },
+        { "u32be[4] == 4294868992", 7, false },
+        { "u8[0] == 0", 0, false },
+        { "len == 0", 0, true },
+        { "len < 2 || u8[1023] == 0", 1, true },
+        { "u8[1023] == 0 || len < 2", 1, false },
+    };
+    int failures = 0;
+    filter_program_t program;
+    char expression[1024];
+    for (int i = 0; i < (int)(sizeof(rejected) / sizeof(rejected[0])); i++)
+        if (filter_compile(rejected[i], &program)) {
+            printf("bench: filter: accepted '%s'\n", rejected[i]);
+            failures++;
+        }
+    // 15 masked ranges fit (60 instructions and the two returns), 16 do not; 33 comparisons are too many nodes
+    bench_filter_long(expression, sizeof(expression), 15);
+    const bool long_fits = filter_compile(expression, &program);
+    bench_filter_long(expression, sizeof(expression), 16);
+    const bool long_rejected = !filter_compile(expression, &program);
+    snprintf(expression, sizeof(expression), "len == 0");
+    for (int i = 1; i < 33; i++)
+        snprintf(expression + strlen(expression), sizeof(expression) - strlen(expression), " || len == %d", i);
+    const bool complex_rejected = !filter_compile(expression, &program);
+    if (!long_fits || !long_rejected || !complex_rejected) {
+        printf("bench: filter: length check failed (fits=%d, long=%d, complex=%d)\n", long_fits, long_rejected, complex_rejected);
+        failures++;
+    }
+    *rejected_count = (int)(sizeof(rejected) / sizeof(rejected[0])) + 2;
+
+    for (int i = 0; i < (int)(sizeof(answers) / sizeof(answers[0])); i++) {
+        if (!filter_compile(answers[i].expression, &program)) {
+            printf("bench: filter: rejected '%s'\n", answers[i].expression);
+            failures++;
+            continue;
+        }
+        uint8_t copy[8]; // exactly the size, so that reads past it are caught by the sanitizers
+        memcpy(copy, packet, sizeof(copy));
+        const bool hit = filter_run(&program, copy + (8 - answers[i].size), answers[i].size) == answers[i].hit;
+        if (!hit) {
+            printf("bench: filter: '%s' on %d bytes should %s\n", answers[i].expression, answers[i].size, answers[i].hit ? "hit" : "miss");
+            failures++;
+        }
+    }
+    *answer_count = (int)(sizeof(answers) / sizeof(answers[0]));
+    return failures;
+}
+
+// typical sensor filters, each against a packet it matches and one it rejects as late as possible
+static void bench_suite_filter(void) {
+    static const struct {
+        const char *name;
+        const char *expression;
+        uint8_t hit[8], miss[8];
+    } filters[] = {
+        { "byte", "u8[0] == 0x5B", { 0x5B, 0, 0, 0, 0, 0, 0, 0 }, { 0x5A, 0, 0, 0, 0, 0, 0, 0 } },
+        { "masked-range", "u8[0] == 0x5B && u16le[1] & 0x0FFF in 100..200 && len >= 8", { 0x5B, 150, 0xF0, 0, 0, 0, 0, 0 }, { 0x5B, 250, 0xF0, 0, 0, 0, 0, 0 } },
+        { "ids-or", "u16be[2] == 1001 || u16be[2] == 1002 || u16be[2] == 1003 || u16be[2] == 1004 || u16be[2] == 1005 || u16be[2] == 1006 || u16be[2] == 1007 || u16be[2] == 1008",
+          { 0, 0, 0x03, 0xF0, 0, 0, 0, 0 }, { 0, 0, 0x03, 0xF1, 0, 0, 0, 0 } },
+        { "signed-not", "!(i16be[4] < -40 || i16be[4] > 85) && u32le[0] & 0xFF000000 != 0", { 0, 0, 0, 1, 0, 20, 0, 0 }, { 0, 0, 0, 1, 0xFF, 0x00, 0, 0 } },
+    };
+    char name[BENCH_NAME_MAX];
+    bench_filter_context_t ctx;
+    int rejected_count, answer_count, failures = bench_filter_check(&rejected_count, &answer_count);
+    for (int f = 0; f < (int)(sizeof(filters) / sizeof(filters[0])); f++) {
+        if (!filter_compile(filters[f].expression, &ctx.program)) {
+            printf("bench: filter: '%s' failed to compile\n", filters[f].name);
+            failures++;
+            continue;
+        }
+        bench_packet_binary(&ctx.packet, 32, 0x00);
+        memcpy(ctx.packet.data, filters[f].miss, sizeof(filters[f].miss));
+        const bool missed = !filter_run(&ctx.program, ctx.packet.data, ctx.packet.size);
+        memcpy(ctx.packet.data, filters[f].hit, sizeof(filters[f].hit));
+        if (!missed || !filter_run(&ctx.program, ctx.packet.data, ctx.packet.size)) {
+            printf("bench: filter: '%s' should hit and miss its packets\n", filters[f].name);
+            failures++;
+        }
+        snprintf(name, sizeof(name), "filter-run/%s/hit/insns=%d", filters[f].name, ctx.program.length);
+        bench_run(name, bench_fn_filter_run, &ctx, (uint64_t)ctx.packet.size);
+        memcpy(ctx.packet.data, filters[f].miss, sizeof(filters[f].miss));
+        snprintf(name, sizeof(name), "filter-run/%s/miss/insns=%d", filters[f].name, ctx.program.length);
+        bench_run(name, bench_fn_filter_run, &ctx, (uint64_t)ctx.packet.size);
+    }
+    printf("bench: filter: %d rejected, %d known answers, %d timed, %d failures\n", rejected_count, answer_count, (int)(sizeof(filters) / sizeof(filters[0])), failures);
+    bench_failures += failures;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_CONVERT_BUFFER_MAX ((E22900T22_PACKET_MAXSIZE * 2) + 4)
+
+typedef struct {
+    bench_packet_t packet;
+    packet_encode_fn_t encode;
+    uint8_t buffer[BENCH_CONVERT_BUFFER_MAX];
+} bench_convert_context_t;
+
+static uint64_t bench_fn_packet_encode(void *context, const uint64_t iterations) {
+    bench_convert_context_t *ctx = (bench_convert_context_t *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += (uint64_t)(ctx->encode(ctx->buffer, ctx->packet.data, ctx->packet.size) - ctx->buffer);
+        bench_clobber(ctx->buffer);
+    }
+    return total;
+}
+
+static uint64_t bench_fn_convert_json(void *context, const uint64_t iterations) {
+    bench_convert_context_t *ctx = (bench_convert_context_t *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += (uint64_t)packet_convert_json(ctx->buffer, BENCH_CONVERT_BUFFER_MAX, ctx->packet.data, ctx->packet.size);
+        bench_clobber(ctx->buffer);
+    }
+    return total;
+}
+
+#define BENCH_ENVELOPE_BUFFER_MAX (BENCH_CONVERT_BUFFER_MAX + ENVELOPE_OVERHEAD_MAX)
+
+typedef struct {
+    bench_packet_t packet;
+    bool packet_convert;
+    uint8_t buffer[BENCH_ENVELOPE_BUFFER_MAX];
+} bench_envelope_context_t;
+
+static uint64_t bench_fn_envelope_build(void *context, const uint64_t iterations) {
+    bench_envelope_context_t *ctx = (bench_envelope_context_t *)context;
+    envelope_values_t values = { .ts = 1760000000000, .rssi = -87, .rssi_valid = true, .channel = 23, .seq = 0 };
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        values.seq = (uint32_t)i;
+        total += (uint64_t)packet_envelope_build(ctx->buffer, BENCH_ENVELOPE_BUFFER_MAX, ctx->packet.data, ctx->packet.size, ctx->packet_convert, &values);
+        bench_clobber(ctx->buffer);
+    }
+    return total;
+}
+
+#define BENCH_JSON_CORPUS_SIZE JSON_SCAN_SIZE_MAX
+
+typedef struct {
+    uint8_t data[BENCH_JSON_CORPUS_SIZE];
+    int size;
+    uint32_t indices[BENCH_JSON_CORPUS_SIZE];
+} bench_json_context_t;
+
+static uint64_t bench_fn_json_structurals(void *context, const uint64_t iterations) {
+    bench_json_context_t *ctx = (bench_json_context_t *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += (uint64_t)json_structurals(ctx->data, ctx->size, ctx->indices);
+        bench_clobber(ctx->indices);
+    }
+    return total;
+}
+
+static void bench_suite_json(void) {
+    static const simd_level_t levels[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2 };
+    static bench_json_context_t ctx;
+    char name[BENCH_NAME_MAX];
+    for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+        if (!simd_supports(levels[l]))
+            continue;
+        json_scanner_select(simd_level_tostring(levels[l]));
+        for (int s = 0; s <= BENCH_PACKET_SIZES_COUNT; s++) {
+            bench_packet_t packet;
+            if (s < BENCH_PACKET_SIZES_COUNT) {
+                bench_packet_json(&packet, bench_packet_sizes[s], "icedepth");
+                memcpy(ctx.data, packet.data, (size_t)packet.size);
+                ctx.size = packet.size;
+            } else
+                for (ctx.size = 0; ctx.size + E22900T22_PACKET_MAXSIZE + 1 <= BENCH_JSON_CORPUS_SIZE;) {
+                    bench_packet_json(&packet, E22900T22_PACKET_MAXSIZE, "icedepth");
+                    memcpy(ctx.data + ctx.size, packet.data, (size_t)packet.size);
+                    ctx.size += packet.size;
+                    ctx.data[ctx.size++] = '\n';
+                }
+            snprintf(name, sizeof(name), "json-scan/%s/size=%d", simd_level_tostring(levels[l]), ctx.size);
+            bench_run(name, bench_fn_json_structurals, &ctx, (uint64_t)ctx.size);
+        }
+    }
+    json_scanner_select(NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the check json_validate replaced, kept as the baseline: bracket ends and every byte isprint
+static bool bench_is_reasonable_json(const uint8_t *packet, const int length) {
+    if (length < 2)
+        return false;
+    if (!(packet[0] == '{' || packet[0] == '[') || !(packet[length - 1] == '}' || packet[length - 1] == ']'))
+        return false;
+    for (int index = 0; index < length; index++)
+        if (!isprint(packet[index]))
+            return false;
+    return true;
+}
+
+// fuzz corpus: seeds for the mutations, and known answers for each kernel
+static const struct {
+    const char *text;
+    bool valid;
+} bench_json_corpus[] = {
+    { "{}", true },
+    { "[]", true },
+    { " \t\r\n{ \"a\" : [ 1 , 2 ] }\n", true },
+    { "{\"id\":\"node-07\",\"type\":\"icedepth\",\"seq\":12,\"depth\":348,\"temp\":-4}", true },
+    { "[0,-0,1.5,-12.25e3,6E-2,1e+9,123456789012345678901234567890]", true },
+    { "[true,false,null,\"\",{},[]]", true },
+    { "{\"a\":{\"b\":{\"c\":[{\"d\":null}]}}}", true },
+    { "[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\uD83D\\uDE00\"]", true },
+    { "[\"caf\xc3\xa9\",\"\xe2\x82\xac\",\"\xf0\x9f\x98\x80\",\"\xed\x9f\xbf\",\"\xf4\x8f\xbf\xbf\",\"\x7f\"]", true },
+    { "{\"long\":\"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyz\"}", true },
+    { "", false },
+    { "   ", false },
+    { "\"string\"", false },
+    { "42", false },
+    { "{", false },
+    { "[1,2", false },
+    { "{}}", false },
+    { "{} {}", false },
+    { "[1,]", false },
+    { "[,1]", false },
+    { "{\"a\":1,}", false },
+    { "{\"a\" 1}", false },
+    { "{a:1}", false },
+    { "{\"a\":1 \"b\":2}", false },
+    { "[01]", false },
+    { "[1.]", false },
+    { "[.5]", false },
+    { "[1e]", false },
+    { "[+1]", false },
+    { "[-]", false },
+    { "[0x10]", false },
+    { "[tru]", false },
+    { "[truex]", false },
+    { "[nul]", false },
+    { "[\"unterminated]", false },
+    { "[\"bad \\x escape\"]", false },
+    { "[\"\\u12\"]", false },
+    { "[\"\\uD83D\"]", false },
+    { "[\"\\uDE00\"]", false },
+    { "[\"tab\there\"]", false },
+    { "[\"\xc0\xaf\"]", false },
+    { "[\"\xe0\x80\xaf\"]", false },
+    { "[\"\xed\xa0\x80\"]", false },
+    { "[\"\xf4\x90\x80\x80\"]", false },
+    { "[\"\xf5\x80\x80\x80\"]", false },
+    { "[\"\xc3\"]", false },
+    { "[\"\x80\"]", false },
+    { "[\xc3\xa9]", false },
+    { "{\"a\":1}]", false },
+    { "[1}", false },
+    { "{\"a\":[1}", false },
+};
+#define BENCH_JSON_CORPUS_COUNT (int)(sizeof(bench_json_corpus) / sizeof(bench_json_corpus[0]))
+#define BENCH_JSON_FUZZ_ROUNDS  20000
+
+static uint64_t bench_fn_json_validate(void *context, const uint64_t iterations) {
+    const bench_packet_t *packet = (const bench_packet_t *)context;
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        valid += json_validate(packet->data, packet->size);
+    return valid;
+}
+
+static uint64_t bench_fn_is_reasonable_json(void *context, const uint64_t iterations) {
+    const bench_packet_t *packet = (const bench_packet_t *)context;
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        valid += bench_is_reasonable_json(packet->data, packet->size);
+    return valid;
+}
+
+// checks the known answers and nesting limit, then that every kernel agrees on mutated seeds, returning the failures
+static int bench_json_validate_check(const simd_level_t *levels, const int level_count) {
+    int failures = 0;
+    bench_packet_t packet;
+    for (int l = 0; l < level_count; l++) {
+        json_scanner_select(simd_level_tostring(levels[l]));
+        for (int c = 0; c < BENCH_JSON_CORPUS_COUNT; c++)
+            if (json_validate((const uint8_t *)bench_json_corpus[c].text, (int)strlen(bench_json_corpus[c].text)) != bench_json_corpus[c].valid) {
+                fprintf(stderr, "bench: json-validate: corpus[%d] should be %s (%s)\n", c, bench_json_corpus[c].valid ? "valid" : "invalid", simd_level_tostring(levels[l]));
+                failures++;
+            }
+        for (int depth = JSON_VALIDATE_DEPTH_MAX; depth <= JSON_VALIDATE_DEPTH_MAX + 1; depth++) {
+            for (int i = 0; i < depth; i++) {
+                packet.data[i] = '[';
+                packet.data[(depth * 2) - 1 - i] = ']';
+            }
+            if (json_validate(packet.data, depth * 2) != (depth <= JSON_VALIDATE_DEPTH_MAX)) {
+                fprintf(stderr, "bench: json-validate: depth %d (%s)\n", depth, simd_level_tostring(levels[l]));
+                failures++;
+            }
+        }
+    }
+    for (int round = 0; round < BENCH_JSON_FUZZ_ROUNDS; round++) {
+        if (round % 2) {
+            const char *seed = bench_json_corpus[bench_random() % BENCH_JSON_CORPUS_COUNT].text;
+            packet.size = (int)strlen(seed);
+            memcpy(packet.data, seed, (size_t)packet.size);
+        } else
+            bench_packet_json(&packet, 8 + (int)(bench_random() % (E22900T22_PACKET_MAXSIZE - 8)), "icedepth");
+        for (int m = (int)(bench_random() % 3); m >= 0 && packet.size > 0; m--) {
+            const uint32_t r = bench_random();
+            const int at = (int)((r >> 8) % (uint32_t)packet.size);
+            if (r & 1)
+                packet.data[at] = (uint8_t)(r >> 24);
+            else
+                packet.data[at] = (uint8_t)"{}[]\":,\\ -0.eu\x80\xc3"[(r >> 24) % 17];
+        }
+        int expected = -1;
+        for (int l = 0; l < level_count; l++) {
+            json_scanner_select(simd_level_tostring(levels[l]));
+            const int valid = json_validate(packet.data, packet.size);
+            if (expected >= 0 && valid != expected) {
+                fprintf(stderr, "bench: json-validate: kernels disagree on fuzz round %d (%s)\n", round, simd_level_tostring(levels[l]));
+                failures++;
+            }
+            expected = valid;
+        }
+    }
+    return failures;
+}
+
+static void bench_suite_json_validate(void) {
+    static const simd_level_t all_levels[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2 };
+    simd_level_t levels[3];
+    int level_count = 0;
+    for (int l = 0; l < (int)(sizeof(all_levels) / sizeof(all_levels[0])); l++)
+        if (simd_supports(all_levels[l]))
+            levels[level_count++] = all_levels[l];
+    const int failures = bench_json_validate_check(levels, level_count);
+    printf("bench: json-validate: %d corpus entries, %d fuzz rounds, %d kernels, %d failures\n", BENCH_JSON_CORPUS_COUNT, BENCH_JSON_FUZZ_ROUNDS, level_count, failures);
+    bench_failures += failures;
+    char name[BENCH_NAME_MAX];
+    bench_packet_t packet;
+    for (int l = 0; l < level_count; l++) {
+        json_scanner_select(simd_level_tostring(levels[l]));
+        for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+            bench_packet_json(&packet, bench_packet_sizes[s], "icedepth");
+            snprintf(name, sizeof(name), "json-validate/%s/json/size=%d", simd_level_tostring(levels[l]), packet.size);
+            bench_run(name, bench_fn_json_validate, &packet, (uint64_t)packet.size);
+        }
+        bench_packet_binary(&packet, E22900T22_PACKET_MAXSIZE, '{');
+        snprintf(name, sizeof(name), "json-validate/%s/binary/size=%d", simd_level_tostring(levels[l]), packet.size);
+        bench_run(name, bench_fn_json_validate, &packet, (uint64_t)packet.size);
+    }
+    json_scanner_select(NULL);
+    for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+        bench_packet_json(&packet, bench_packet_sizes[s], "icedepth");
+        snprintf(name, sizeof(name), "is-reasonable-json/json/size=%d", packet.size);
+        bench_run(name, bench_fn_is_reasonable_json, &packet, (uint64_t)packet.size);
+    }
+    bench_packet_binary(&packet, E22900T22_PACKET_MAXSIZE, '{');
+    packet.data[packet.size - 1] = '}';
+    snprintf(name, sizeof(name), "is-reasonable-json/binary/size=%d", packet.size);
+    bench_run(name, bench_fn_is_reasonable_json, &packet, (uint64_t)packet.size);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    bench_packet_t packet;
+    schema_t schema;
+    uint8_t buffer[SCHEMA_OUTPUT_MAX];
+} bench_schema_context_t;
+
+static uint64_t bench_fn_schema_decode(void *context, const uint64_t iterations) {
+    bench_schema_context_t *ctx = (bench_schema_context_t *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_clobber(ctx->packet.data);
+        total += (uint64_t)schema_decode(&ctx->schema, ctx->packet.data, ctx->buffer);
+    }
+    return total;
+}
+
+// a typical sensor frame, one with scaling on every field, and a wide frame of plain integers, each as published
+// decodes a fixed packet through schemas covering each field type and endianness, scale and bias, and bits, against
+// their JSON; each also at the size it needs (all fields, nothing past them), one byte short (not selected), and the
+// largest packet (the same JSON), and with its discriminator changed (not selected)
+static int bench_schema_check(int *rejected_count, int *answer_count) {
+    static const char *const rejected[][2] = {
+        { NULL, "" },
+        { NULL, "a:u24@0" },
+        { NULL, "a:u8" },
+        { NULL, "a u8@0" },
+        { NULL, "a b:u8@0" },
+        { NULL, ":u8@0" },
+        { NULL, "a:u8@240" },
+        { NULL, "a:u8@-1" },
+        { NULL, "a:u8@0 junk" },
+        { NULL, "a:u8@0*" },
+        { NULL, "a:u8@0*x" },
+        { NULL, "a:bits@0" },
+        { NULL, "a:bits@0.5-3" },
+        { NULL, "a:bits@0.0-32" },
+        { NULL, "a:u32le@0*99999999999999" },
+        { NULL, "a:u8@0+9999999999999999" },
+        { NULL, "name_of_twenty_five_chars:u8@0" },
+        { "1FF", "a:u8@0" },
+        { "A5@240", "a:u8@0" },
+        { "A5@", "a:u8@0" },
+        { "G5", "a:u8@0" },
+    };
+    static const uint8_t packet[31] = {
+        0xA5, 0xE9, 0x03, 0x08, 0x66, 0x64, 0x0B, 0x00, 0x3C, 0xFF, 0xFE, 0x80, 0x00, 0x00, 0xC0, 0x00,
+        0x3E, 0x7C, 0x00, 0xFF, 0x7B, 0x55, 0x35, 0xFC, 0x00, 0x00, 0x80, 0x34, 0x12, 0xF0, 0x80,
+    };
+    static const struct {
+        const char *discriminator;
+        const char *fields;
+        int size_min;
+        const char *json;
+    } answers[] = {
+        { "A5", "id:u16le@1, temp:i16be@3*0.01, battery:u8@5*0.02+2, alarm:bits@6.0, mode:bits@6.1-3, pressure:float16@7", 9,
+          "{\"id\":1001,\"temp\":21.5,\"battery\":4,\"alarm\":1,\"mode\":5,\"pressure\":1}" },
+        { NULL, "a:i8@9, b:i16le@9, c:u16be@9, d:i32le@9, e:u32be@9, f:i32be@9, g:u32le@9, h:u8@9, i:u16le@9, j:i16be@9", 13,
+          "{\"a\":-1,\"b\":-257,\"c\":65534,\"d\":8453887,\"e\":4294868992,\"f\":-98304,\"g\":8453887,\"h\":255,\"i\":65279,\"j\":-2}" },
+        { "C0@14", "a:float16@13, b:float16be@13, c:float16@15*2.5, d:float16be@17, e:float16@19, f:float16@21, g:float16be@23, h:float16@25", 27,
+          "{\"a\":-2,\"b\":0.000011,\"c\":3.75,\"d\":null,\"e\":65504,\"f\":0.333252,\"g\":null,\"h\":0}" },
+        { NULL, "a:bits@27.0-15, b:bits@27.4-11, c:bits@27.31, d:bits@27.8-23*0.5-1", 31, "{\"a\":4660,\"b\":35,\"c\":1,\"d\":30728}" },
+        { "A5", "a:i16le@1*-0.5, b:u8@5*0.001-0.5, c:i8@9*1000000+0.000001", 10, "{\"a\":-500.5,\"b\":-0.4,\"c\":-999999.999999}" },
+        { NULL, "first:u8@0, last:u8@239", 240, "{\"first\":165,\"last\":238}" },
+        { NULL, "name_of_twenty_four_char:u8@0", 1, "{\"name_of_twenty_four_char\":165}" },
+    };
+    int failures = 0;
+    schema_t schema;
+    for (int i = 0; i < (int)(sizeof(rejected) / sizeof(rejected[0])); i++)
+        if (schema_compile(&schema, rejected[i][0], rejected[i][1])) {
+            printf("bench: schema: accepted '%s' '%s'\n", rejected[i][0] ? rejected[i][0] : "any", rejected[i][1]);
+            failures++;
+        }
+    // 14 fields with one character names fit the output, 15 do not; 8 with 24 character names fit, 9 do not
+    char fields[1024];
+    int fits = 0;
+    for (int count = 14; count <= 15; count++) {
+        fields[0] = '\0';
+        for (int f = 0; f < count; f++)
+            snprintf(fields + strlen(fields), sizeof(fields) - strlen(fields), "%s%c:u8@%d", f ? "," : "", 'a' + f, f);
+        fits += schema_compile(&schema, NULL, fields) ? (count == 14 ? 1 : -1) : 0;
+    }
+    for (int count = 8; count <= 9; count++) {
+        fields[0] = '\0';
+        for (int f = 0; f < count; f++)
+            snprintf(fields + strlen(fields), sizeof(fields) - strlen(fields), "%sfield_name_of_24_chars_%d:u8@%d", f ? "," : "", f, f);
+        fits += schema_compile(&schema, NULL, fields) ? (count == 8 ? 1 : -1) : 0;
+    }
+    if (fits != 2) {
+        printf("bench: schema: field count and output size limits failed\n");
+        failures++;
+    }
+    *rejected_count = (int)(sizeof(rejected) / sizeof(rejected[0])) + 2;
+
+    uint8_t output[SCHEMA_OUTPUT_MAX];
+    for (int i = 0; i < (int)(sizeof(answers) / sizeof(answers[0])); i++) {
+        if (!schema_compile(&schemas[0], answers[i].discriminator, answers[i].fields)) {
+            printf("bench: schema: rejected '%s'\n", answers[i].fields);
+            failures++;
+            continue;
+        }
+        schema_count = 1;
+        const int json_length = (int)strlen(answers[i].json), sizes[] = { answers[i].size_min, answers[i].size_min - 1, E22900T22_PACKET_MAXSIZE };
+        for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+            uint8_t copy[E22900T22_PACKET_MAXSIZE]; // the packet ends with the copy, so that reads past it are caught by the sanitizers
+            memset(copy, 0xEE, sizeof(copy));
+            uint8_t *start = copy + (E22900T22_PACKET_MAXSIZE - sizes[s]);
+            memcpy(start, packet, (size_t)(sizes[s] < (int)sizeof(packet) ? sizes[s] : (int)sizeof(packet)));
+            const schema_t *selected = schema_select(start, sizes[s]);
+            const bool expected = sizes[s] >= answers[i].size_min;
+            if ((selected != NULL) != expected || schemas[0].size_min != answers[i].size_min) {
+                printf("bench: schema: '%s' on %d bytes should %sbe selected (size>=%d)\n", answers[i].fields, sizes[s], expected ? "" : "not ", schemas[0].size_min);
+                failures++;
+                continue;
+            }
+            if (selected == NULL)
+                continue;
+            const int length = schema_decode(selected, start, output);
+            if (length != json_length || memcmp(output, answers[i].json, (size_t)json_length) != 0) {
+                printf("bench: schema: '%s' on %d bytes decoded '%.*s', expected '%s'\n", answers[i].fields, sizes[s], length, output, answers[i].json);
+                failures++;
+            }
+            if (schemas[0].discriminator_offset >= 0) {
+                start[schemas[0].discriminator_offset] ^= 0x01;
+                if (schema_select(start, sizes[s]) != NULL) {
+                    printf("bench: schema: '%s' selected with the discriminator changed\n", answers[i].fields);
+                    failures++;
+                }
+            }
+        }
+    }
+    schema_count = 0;
+    *answer_count = (int)(sizeof(answers) / sizeof(answers[0]));
+    return failures;
+}
+
+static void bench_suite_schema(void) {
+    static const struct {
+        const char *name;
+        const char *fields;
+        int size;
+    } cases[] = {
+        { "sensor", "id:u16le@1, temp:i16be@3*0.01, battery:u8@5*0.02+2, alarm:bits@6.0, mode:bits@6.1-3, pressure:float16@7", 16 },
+        { "scaled", "a:i16le@1*0.01, b:i16le@3*0.01, c:i16le@5*0.01-40, d:u16be@7*0.1, e:float16@9, f:float16be@11*2.5, g:u8@13*0.5", 16 },
+        { "integers", "a:u32le@1, b:u32le@5, c:i32le@9, d:u16le@13, e:u16le@15, f:i16be@17, g:u8@19, h:u8@20, i:u32be@21, j:u32be@25, k:i8@29, l:u8@30", 32 },
+    };
+    char name[BENCH_NAME_MAX];
+    static bench_schema_context_t ctx;
+    int rejected_count, answer_count, failures = bench_schema_check(&rejected_count, &answer_count);
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+        if (!schema_compile(&ctx.schema, "A5", cases[c].fields)) {
+            printf("bench: schema: '%s' failed to compile\n", cases[c].name);
+            failures++;
+            continue;
+        }
+        bench_packet_binary(&ctx.packet, cases[c].size, 0xA5);
+        snprintf(name, sizeof(name), "schema-decode/%s/fields=%d/size=%d", cases[c].name, ctx.schema.field_count, ctx.packet.size);
+        bench_run(name, bench_fn_schema_decode, &ctx, (uint64_t)ctx.packet.size);
+    }
+    printf("bench: schema: %d rejected, %d known answers, %d timed, %d failures\n", rejected_count, answer_count, (int)(sizeof(cases) / sizeof(cases[0])), failures);
+    bench_failures += failures;
+}
+
+// the byte at a time encoders, as references for the kernels
+static uint8_t *bench_encode_hex_reference(uint8_t *output, const uint8_t *data, const int length) {
+    for (int i = 0; i < length; i++) {
+        *output++ = (uint8_t)"0123456789abcdef"[data[i] >> 4];
+        *output++ = (uint8_t)"0123456789abcdef"[data[i] & 0x0F];
+    }
+    return output;
+}
+
+static uint8_t *bench_encode_base64_reference(uint8_t *output, const uint8_t *data, const int length) {
+    for (int i = 0; i < length; i += 3) {
+        const int available = length - i < 3 ? length - i : 3;
+        uint32_t word = 0;
+        for (int b = 0; b < 3; b++)
+            word = (word << 8) | (b < available ? data[i + b] : 0);
+        for (int c = 0; c < 4; c++)
+            *output++ = c <= available ? (uint8_t)__packet_base64_alphabet[(word >> (18 - (c * 6))) & 0x3F] : '=';
+    }
+    return output;
+}
+
+#define BENCH_PACKET_CHECK_ROUNDS 10000
+
+// encodes random packets of 0 to 240 bytes with each kernel, against the references and with nothing written past
+// the end, and checks that every scanner kernel finds the converted packet valid, and agrees on the packet itself,
+// raw and as the contents of a string; returns the failures
+static int bench_packet_check(const simd_level_t *levels, const int level_count) {
+    int failures = 0;
+    bench_packet_t packet;
+    uint8_t expected[BENCH_CONVERT_BUFFER_MAX], output[BENCH_CONVERT_BUFFER_MAX + 1];
+    for (int round = 0; round < BENCH_PACKET_CHECK_ROUNDS; round++) {
+        packet.size = (int)(bench_random() % (E22900T22_PACKET_MAXSIZE + 1));
+        for (int i = 0; i < packet.size; i++)
+            packet.data[i] = (uint8_t)(bench_random() >> 24);
+        for (int e = PACKET_ENCODING_HEX; e <= PACKET_ENCODING_BASE64; e++) {
+            const int size = packet_encoded_size((packet_encoding_t)e, packet.size);
+            (e == PACKET_ENCODING_BASE64 ? bench_encode_base64_reference : bench_encode_hex_reference)(expected, packet.data, packet.size);
+            for (int l = 0; l < level_count; l++) {
+                packet_encoders_select(simd_level_tostring(levels[l]));
+                memset(output, 0xEE, sizeof(output));
+                const uint8_t *end = (e == PACKET_ENCODING_BASE64 ? packet_encode_base64 : packet_encode_hex)(output, packet.data, packet.size);
+                if (end - output != size || memcmp(output, expected, (size_t)size) != 0 || output[size] != 0xEE) {
+                    fprintf(stderr, "bench: packet: %s (%s) differs from the reference on %d bytes, round %d\n", packet_encoding_tostring((packet_encoding_t)e), simd_level_tostring(levels[l]), packet.size, round);
+                    failures++;
+                }
+                packet_encoding = (packet_encoding_t)e;
+                const int json_size = packet_convert_json(output, BENCH_CONVERT_BUFFER_MAX, packet.data, packet.size);
+                for (int j = 0; j < level_count; j++) {
+                    json_scanner_select(simd_level_tostring(levels[j]));
+                    if (json_size != size + 4 || !json_validate(output, json_size)) {
+                        fprintf(stderr, "bench: packet: convert-json %s (%s) is not valid (%s) on %d bytes, round %d\n", packet_encoding_tostring((packet_encoding_t)e), simd_level_tostring(levels[l]), simd_level_tostring(levels[j]), packet.size, round);
+                        failures++;
+                    }
+                }
+            }
+        }
+        output[0] = '[';
+        output[1] = '"';
+        memcpy(output + 2, packet.data, (size_t)packet.size);
+        output[packet.size + 2] = '"';
+        output[packet.size + 3] = ']';
+        for (int wrapped = 0; wrapped <= 1; wrapped++) {
+            const uint8_t *data = wrapped ? output : packet.data;
+            const int size = wrapped ? packet.size + 4 : packet.size;
+            int valid = -1;
+            for (int l = 0; l < level_count; l++) {
+                json_scanner_select(simd_level_tostring(levels[l]));
+                const int result = json_validate(data, size);
+                if (valid >= 0 && result != valid) {
+                    fprintf(stderr, "bench: packet: json-validate kernels disagree on %d bytes%s, round %d (%s)\n", size, wrapped ? " as a string" : "", round, simd_level_tostring(levels[l]));
+                    failures++;
+                }
+                valid = result;
+            }
+        }
+    }
+    packet_encoding = PACKET_ENCODING_HEX;
+    packet_encoders_select(NULL);
+    json_scanner_select(NULL);
+    return failures;
+}
+
+static void bench_suite_packet(void) {
+    char name[BENCH_NAME_MAX];
+    static const simd_level_t levels[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2 };
+    static bench_convert_context_t ctx;
+    simd_level_t supported[3];
+    int supported_count = 0;
+    for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++)
+        if (simd_supports(levels[l]))
+            supported[supported_count++] = levels[l];
+    const int failures = bench_packet_check(supported, supported_count);
+    printf("bench: packet: %d rounds, %d kernels, %d failures\n", BENCH_PACKET_CHECK_ROUNDS, supported_count, failures);
+    bench_failures += failures;
+    for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+        if (!simd_supports(levels[l]))
+            continue;
+        packet_encoders_select(simd_level_tostring(levels[l]));
+        for (int e = PACKET_ENCODING_HEX; e <= PACKET_ENCODING_BASE64; e++) {
+            ctx.encode = e == PACKET_ENCODING_BASE64 ? packet_encode_base64 : packet_encode_hex;
+            for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+                bench_packet_binary(&ctx.packet, bench_packet_sizes[s], 0x5A);
+                snprintf(name, sizeof(name), "packet-encode/%s/%s/size=%d", packet_encoding_tostring((packet_encoding_t)e), simd_level_tostring(levels[l]), ctx.packet.size);
+                bench_run(name, bench_fn_packet_encode, &ctx, (uint64_t)ctx.packet.size);
+            }
+        }
+    }
+    packet_encoders_select(NULL);
+    for (int e = PACKET_ENCODING_HEX; e <= PACKET_ENCODING_BASE64; e++) {
+        packet_encoding = (packet_encoding_t)e;
+        for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+            bench_packet_binary(&ctx.packet, bench_packet_sizes[s], 0x5A);
+            snprintf(name, sizeof(name), "convert-json/%s/size=%d", packet_encoding_tostring(packet_encoding), ctx.packet.size);
+            bench_run(name, bench_fn_convert_json, &ctx, (uint64_t)ctx.packet.size);
+        }
+    }
+    packet_encoding = PACKET_ENCODING_HEX;
+    bench_envelope_context_t envelope;
+    config_populate_envelope("ts,rssi,ch,seq");
+    for (int s = 0; s < BENCH_PACKET_SIZES_COUNT; s++) {
+        bench_packet_json(&envelope.packet, bench_packet_sizes[s], "icedepth");
+        envelope.packet_convert = false;
+        snprintf(name, sizeof(name), "envelope-build/json/size=%d", envelope.packet.size);
+        bench_run(name, bench_fn_envelope_build, &envelope, (uint64_t)envelope.packet.size);
+        bench_packet_binary(&envelope.packet, bench_packet_sizes[s], 0x5A);
+        envelope.packet_convert = true;
+        snprintf(name, sizeof(name), "envelope-build/hex/size=%d", envelope.packet.size);
+        bench_run(name, bench_fn_envelope_build, &envelope, (uint64_t)envelope.packet.size);
+    }
+    envelope_op_count = 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the former truncating uint8 EMA, kept for comparison
+static void bench_ema_update(uint8_t value, uint8_t *value_ema, uint32_t *value_cnt) {
+    if ((*value_cnt)++ == 0)
+        *value_ema = value;
+    else
+        *value_ema = (uint8_t)((51 * (uint16_t)value + (256 - 51) * (uint16_t)(*value_ema)) / 256);
+}
+
+static uint64_t bench_fn_ema_update(void *context __attribute__((unused)), const uint64_t iterations) {
+    uint8_t ema = 0;
+    uint32_t count = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_ema_update((uint8_t)(160 + (i & 0x1F)), &ema, &count);
+        bench_clobber(&ema);
+    }
+    return ema;
+}
+
+static uint64_t bench_fn_stats_rssi_update(void *context, const uint64_t iterations) {
+    stats_rssi_t *stats = (stats_rssi_t *)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        stats_rssi_update(stats, -(int32_t)(160 + (i & 0x1F)) * 128);
+        bench_clobber(stats);
+    }
+    return stats->count;
+}
+
+static uint64_t bench_fn_stats_rssi_display(void *context, const uint64_t iterations) {
+    const stats_rssi_t *stats = (const stats_rssi_t *)context;
+    int64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        total += stats_rssi_quantile(stats, 100) + stats_rssi_quantile(stats, 500) + stats_rssi_quantile(stats, 900) + stats_rssi_min(stats) + stats_rssi_max(stats);
+    return (uint64_t)total;
+}
+
+static int bench_compare_int32(const void *a, const void *b) {
+    const int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// the averages must settle on a constant exactly (the uint8 EMA settles below, and in whole dB), quantiles must match a
+// sort of the window, and the noise floor must stay near the quiet level under bursts
+static int bench_stats_rssi_check(void) {
+    static stats_rssi_t stats;
+    int failures = 0;
+    for (int32_t start = -120; start <= -80; start += 40) { // the floor only settles quickly downwards
+        stats_rssi_reset(&stats);
+        stats_rssi_update(&stats, start * STATS_Q8_ONE);
+        for (int i = 0; i < 100; i++)
+            stats_rssi_update(&stats, -(195 * STATS_Q8_ONE) / 2);
+        if (stats_rssi_ema(&stats) != -(195 * STATS_Q8_ONE) / 2 || (start > -97 && stats_rssi_floor(&stats) != -(195 * STATS_Q8_ONE) / 2)) {
+            printf("bench: stats-rssi: settle check failed (start=%" PRId32 ", ema=%" PRId32 ", floor=%" PRId32 ")\n", start, stats_rssi_ema(&stats), stats_rssi_floor(&stats));
+            failures++;
+        }
+    }
+    static const uint32_t permilles[] = { 0, 100, 500, 900, 1000 };
+    int32_t window[STATS_RSSI_WINDOW];
+    for (int round = 0; round < 8; round++) {
+        stats_rssi_reset(&stats);
+        const int samples = round == 0 ? 7 : (int)(100 + (bench_random() % 2000));
+        for (int i = 0; i < samples; i++) {
+            const int32_t value = -(int32_t)(bench_random() % (round < 4 ? 40 : 400)) * 128 - (80 * STATS_Q8_ONE);
+            stats_rssi_update(&stats, value);
+            window[i % STATS_RSSI_WINDOW] = stats_rssi_bin_q8(stats_rssi_bin(value));
+        }
+        const int count = samples < STATS_RSSI_WINDOW ? samples : STATS_RSSI_WINDOW;
+        qsort(window, (size_t)count, sizeof(window[0]), bench_compare_int32);
+        for (int q = 0; q < (int)(sizeof(permilles) / sizeof(permilles[0])); q++) {
+            const uint32_t rank = (((uint32_t)count * permilles[q]) + 999) / 1000;
+            const int32_t exact = window[rank > 0 ? rank - 1 : 0], reported = stats_rssi_quantile(&stats, permilles[q]);
+            if (exact != reported) {
+                printf("bench: stats-rssi: quantile check failed (round=%d, permille=%" PRIu32 ", exact=%" PRId32 ", reported=%" PRId32 ")\n", round, permilles[q], exact, reported);
+                failures++;
+            }
+        }
+    }
+    stats_rssi_reset(&stats);
+    for (int i = 0; i < 1000; i++)
+        stats_rssi_update(&stats, (i % 5 == 0 ? -60 : -110) * STATS_Q8_ONE - (int32_t)(bench_random() % 256));
+    if (stats_rssi_floor(&stats) < -111 * STATS_Q8_ONE || stats_rssi_floor(&stats) > -108 * STATS_Q8_ONE) {
+        printf("bench: stats-rssi: noise floor check failed (floor=%" PRId32 ")\n", stats_rssi_floor(&stats));
+        failures++;
+    }
+    return failures;
+}
+
+static uint64_t bench_fn_update_config_bits(void *context, const uint64_t iterations) {
+    const bool changing = *(const bool *)context;
+    uint8_t config[2] = { 0x62, 0x17 };
+    for (uint64_t i = 0; i < iterations; i++) {
+        __update_config_bits("packet-rate", &config[0], 0, 3, (uint16_t)(changing ? (i & 0x07) : 0x02));
+        bench_clobber(config);
+    }
+    return config[0];
+}
+
+static void bench_suite_stats(void) {
+    bench_run("ema-update", bench_fn_ema_update, NULL, 1);
+    static stats_rssi_t stats;
+    const int failures = bench_stats_rssi_check();
+    printf("bench: stats-rssi: %d failures\n", failures);
+    bench_failures += failures;
+    stats_rssi_reset(&stats);
+    bench_run("stats-rssi-update", bench_fn_stats_rssi_update, &stats, 1);
+    bench_run("stats-rssi-quantiles", bench_fn_stats_rssi_display, &stats, 0);
+    bool changing = false;
+    bench_run("update-config-bits/unchanged", bench_fn_update_config_bits, &changing, 0);
+    changing = true;
+    bench_run("update-config-bits/changed", bench_fn_update_config_bits, &changing, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_METRICS_RENDER_MAX (32 * 1024)
+
+typedef struct {
+    int counter, counter_bytes, histogram_size, histogram_latency;
+    char render[BENCH_METRICS_RENDER_MAX];
+} bench_metrics_context_t;
+
+static uint64_t bench_fn_metrics_counter(void *context, const uint64_t iterations) {
+    const bench_metrics_context_t *ctx = (const bench_metrics_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++)
+        metrics_counter_add(ctx->counter, 1);
+    return metrics_counter_value(ctx->counter);
+}
+
+static uint64_t bench_fn_metrics_histogram(void *context, const uint64_t iterations) {
+    const bench_metrics_context_t *ctx = (const bench_metrics_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++)
+        metrics_histogram_observe(ctx->histogram_size, (int64_t)(i & 0xFF));
+    return iterations;
+}
+
+// what the gateway records per packet: received, bytes, size, process time and published
+static uint64_t bench_fn_metrics_packet(void *context, const uint64_t iterations) {
+    const bench_metrics_context_t *ctx = (const bench_metrics_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        metrics_counter_add(ctx->counter, 1);
+        metrics_counter_add(ctx->counter_bytes, (metrics_value_t)(i & 0xFF));
+        metrics_histogram_observe(ctx->histogram_size, (int64_t)(i & 0xFF));
+        metrics_histogram_observe(ctx->histogram_latency, (int64_t)(i & 0x3F));
+        metrics_counter_add(ctx->counter, 1);
+    }
+    return iterations;
+}
+
+static uint64_t bench_fn_metrics_render(void *context, const uint64_t iterations) {
+    bench_metrics_context_t *ctx = (bench_metrics_context_t *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        total += metrics_render(ctx->render, sizeof(ctx->render));
+    return total;
+}
+
+static void bench_suite_metrics(void) {
+    static const int64_t bounds_size[] = { 8, 16, 32, 64, 96, 128, 160, 192, 224, 240 };
+    static const int64_t bounds_latency[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000, 10000 };
+    static const char *const labels[] = { "broker=\"primary\"", "broker=\"failover\"", "broker=\"fanout\"" };
+    static bench_metrics_context_t ctx;
+    ctx.counter = metrics_counter_register("bench_packets_total", NULL, "Packets.");
+    ctx.counter_bytes = metrics_counter_register("bench_bytes_total", NULL, "Bytes.");
+    ctx.histogram_size = metrics_histogram_register("bench_size_bytes", NULL, "Sizes.", bounds_size, (int)(sizeof(bounds_size) / sizeof(bounds_size[0])), 1);
+    ctx.histogram_latency = metrics_histogram_register("bench_latency_seconds", NULL, "Latencies.", bounds_latency, (int)(sizeof(bounds_latency) / sizeof(bounds_latency[0])), 1000000);
+    for (int i = 0; i < (int)(sizeof(labels) / sizeof(labels[0])); i++) {
+        metrics_counter_register("bench_published_total", labels[i], "Published.");
+        metrics_histogram_register("bench_publish_seconds", labels[i], "Publish latencies.", bounds_latency, (int)(sizeof(bounds_latency) / sizeof(bounds_latency[0])), 1000000);
+    }
+    bench_run("metrics/counter-add", bench_fn_metrics_counter, &ctx, 0);
+    bench_run("metrics/histogram-observe/buckets=10", bench_fn_metrics_histogram, &ctx, 0);
+    bench_run("metrics/packet", bench_fn_metrics_packet, &ctx, 0);
+    char name[BENCH_NAME_MAX];
+    snprintf(name, sizeof(name), "metrics/render/size=%zu", metrics_render(ctx.render, sizeof(ctx.render)));
+    bench_run(name, bench_fn_metrics_render, &ctx, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the document must be valid JSON and carry, in total and per route, the counters that were fed in, and one that does
+// not fit must not be written at all (an empty string, nothing past the buffer); those that fit are compared past the
+// time and uptime, which may tick between renders
+static int bench_health_document_check(const char *name, const char *document, const size_t length, const char *const expected[], const int expected_count) {
+    int failures = 0;
+    if (length == 0 || strlen(document) != length || !json_validate((const uint8_t *)document, (int)length)) {
+        printf("bench: health: %s: document is not valid JSON (length=%zu): %s\n", name, length, document);
+        failures++;
+    }
+    for (int i = 0; i < expected_count; i++)
+        if (strstr(document, expected[i]) == NULL) {
+            printf("bench: health: %s: document does not contain '%s': %s\n", name, expected[i], document);
+            failures++;
+        }
+    for (size_t size = 0; length > 0 && size <= length + 1; size = size < 8 ? size + 1 : (size < length - 8 ? size + (length / 16) + 1 : size + 1)) {
+        char *buffer = malloc(size > 0 ? size : 1);
+        if (buffer == NULL)
+            continue;
+        memset(buffer, 'x', size > 0 ? size : 1);
+        const size_t rendered = health_render(buffer, size);
+        const char *counters = rendered > 0 ? strstr(buffer, ",\"packets\"") : NULL, *counters_expected = strstr(document, ",\"packets\"");
+        if (size <= length ? (rendered != 0 || (size > 0 && buffer[0] != '\0')) : (rendered != length || counters == NULL || counters_expected == NULL || strcmp(counters, counters_expected) != 0)) {
+            printf("bench: health: %s: buffer of %zu bytes for a document of %zu rendered %zu bytes\n", name, size, length, rendered);
+            failures++;
+        }
+        free(buffer);
+    }
+    return failures;
+}
+
+static int bench_health_check(void) {
+    static char document[HEALTH_DOCUMENT_MAX];
+    int failures = 0;
+    size_t length;
+
+    // default route only, with a topic to be escaped
+    topic_routes_reset();
+    topic_route_default.topic = "e22900t22/\"quoted\"\\\x01";
+    health_begin();
+    for (int i = 0; i < 10; i++) {
+        health_received(20 + i);
+        if (i < 2)
+            health_dropped(HEALTH_DROP_NOT_JSON, NULL);
+        else {
+            health_routed(&topic_route_default, 20 + i);
+            if (i == 9)
+                health_dropped(HEALTH_DROP_SINK_FAILED, &topic_route_default);
+            else
+                health_published(&topic_route_default);
+        }
+    }
+    length = health_render(document, sizeof(document));
+    const char *const expected_default[] = {
+        "\"packets\":10,\"bytes\":245,\"published\":7,\"drops\":{\"not-json\":2,\"no-route\":0,\"topic-field\":0,\"too-large\":0,\"sink-failed\":1,\"rate-limited\":0}",
+        "\"routes\":[{\"route\":\"default\",\"topic\":\"e22900t22/\\\"quoted\\\"\\\\\\u0001\",\"packets\":8,\"bytes\":204,\"published\":7,\"drops\":{\"topic-field\":0,\"too-large\":0,\"sink-failed\":1,\"rate-limited\":0}",
+    };
+    failures += bench_health_document_check("default", document, length, expected_default, (int)(sizeof(expected_default) / sizeof(expected_default[0])));
+
+    // several routes, route i taking i+1 packets of 100 bytes, each published but for one too large on route 2
+    bench_routes_setup(4, DATA_TYPE_JSON);
+    health_begin();
+    for (int r = 0; r < 4; r++)
+        for (int i = 0; i <= r; i++) {
+            health_received(100);
+            health_routed(&topic_routes[r], 100);
+            if (r == 2 && i == 0)
+                health_dropped(HEALTH_DROP_TOO_LARGE, &topic_routes[r]);
+            else
+                health_published(&topic_routes[r]);
+        }
+    health_received(50);
+    health_dropped(HEALTH_DROP_NO_ROUTE, NULL);
+    health_received(50);
+    health_dropped(HEALTH_DROP_RATE_LIMITED, NULL);
+    length = health_render(document, sizeof(document));
+    const char *const expected_routes[] = {
+        "\"packets\":12,\"bytes\":1100,\"published\":9,\"drops\":{\"not-json\":0,\"no-route\":1,\"topic-field\":0,\"too-large\":1,\"sink-failed\":0,\"rate-limited\":1}",
+        "{\"route\":0,\"topic\":\"e22900t22/route0\",\"packets\":1,\"bytes\":100,\"published\":1,\"drops\":{\"topic-field\":0,\"too-large\":0,\"sink-failed\":0,\"rate-limited\":0}",
+        "{\"route\":1,\"topic\":\"e22900t22/route1\",\"packets\":2,\"bytes\":200,\"published\":2,",
+        "{\"route\":2,\"topic\":\"e22900t22/route2\",\"packets\":3,\"bytes\":300,\"published\":2,\"drops\":{\"topic-field\":0,\"too-large\":1,",
+        "{\"route\":3,\"topic\":\"e22900t22/route3\",\"packets\":4,\"bytes\":400,\"published\":4,",
+    };
+    failures += bench_health_document_check("routes", document, length, expected_routes, (int)(sizeof(expected_routes) / sizeof(expected_routes[0])));
+    if (strstr(document, "\"route\":\"default\"") != NULL || strstr(document, "\"route\":4") != NULL) {
+        printf("bench: health: routes: document has routes other than those configured: %s\n", document);
+        failures++;
+    }
+
+    topic_routes_reset();
+    return failures;
+}
+
+static uint64_t bench_fn_health_render(void *context, const uint64_t iterations) {
+    char *document = (char *)context;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        total += health_render(document, HEALTH_DOCUMENT_MAX);
+    return total;
+}
+
+static void bench_suite_health(void) {
+    static char document[HEALTH_DOCUMENT_MAX];
+    const int failures = bench_health_check();
+    printf("bench: health: default and 4 routes, %d failures\n", failures);
+    bench_failures += failures;
+    char name[BENCH_NAME_MAX];
+    bench_routes_setup(HEALTH_ROUTES_MAX, DATA_TYPE_JSON);
+    health_begin();
+    snprintf(name, sizeof(name), "health/render/routes=%d/size=%zu", HEALTH_ROUTES_MAX, health_render(document, sizeof(document)));
+    bench_run(name, bench_fn_health_render, document, 0);
+    topic_routes_reset();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_LATENCY_SAMPLES 100000
+
+static uint64_t bench_fn_latency_record(void *context __attribute__((unused)), const uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++)
+        latency_record(LATENCY_STAGE_FRAME, 1000, 1000 + (i & 0xFFFFF));
+    return iterations;
+}
+
+// what the gateway records per packet: each stage, and the total
+static uint64_t bench_fn_latency_packet(void *context __attribute__((unused)), const uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        const uint64_t first_us = 1000 + i, frame_us = first_us + 100000 + (i & 0xFFF), classified_us = frame_us + (i & 0x3F), published_us = classified_us + (i & 0x3FF), acked_us = published_us + (i & 0xFFF);
+        latency_record(LATENCY_STAGE_FRAME, first_us, frame_us);
+        latency_record(LATENCY_STAGE_CLASSIFY, frame_us, classified_us);
+        latency_record(LATENCY_STAGE_QUEUE, classified_us, published_us);
+        latency_record(LATENCY_STAGE_ACK, published_us, acked_us);
+        latency_record(LATENCY_STAGE_TOTAL, first_us, acked_us);
+    }
+    return iterations;
+}
+
+static int bench_compare_uint64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// quantiles must be at or above the exact ones (as the highest value of their bucket), by no more than the 1/32 resolution
+static int bench_latency_check(void) {
+    static uint64_t samples[BENCH_LATENCY_SAMPLES];
+    static uint32_t counts[LATENCY_BUCKETS];
+    static const uint32_t permilles[] = { 1, 500, 900, 990, 999, 1000 };
+    int failures = 0;
+    for (uint64_t value = 0; value < ((uint64_t)1 << 33); value = value < 1024 ? value + 1 : value + (value >> 7))
+        if (latency_bucket_value(latency_bucket(value)) < (value > UINT32_MAX ? UINT32_MAX : value) || (latency_bucket(value) > 0 && latency_bucket_value(latency_bucket(value) - 1) >= value)) {
+            printf("bench: latency: bucket check failed (value=%" PRIu64 ", bucket=%d)\n", value, latency_bucket(value));
+            failures++;
+        }
+    for (int round = 0; round < 4; round++) {
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < BENCH_LATENCY_SAMPLES; i++) {
+            const uint32_t r = bench_random();
+            samples[i] = round == 0 ? (r % 1000) : round == 1 ? 100000 + (r % 50000) : round == 2 ? ((uint64_t)1 << (r % 30)) + (r >> 24) : (r % 100 == 0 ? 2000000 + r % 1000000 : 150 + r % 50);
+            counts[latency_bucket(samples[i])]++;
+        }
+        qsort(samples, BENCH_LATENCY_SAMPLES, sizeof(samples[0]), bench_compare_uint64);
+        for (int q = 0; q < (int)(sizeof(permilles) / sizeof(permilles[0])); q++) {
+            const uint64_t exact = samples[(((uint64_t)BENCH_LATENCY_SAMPLES * permilles[q]) + 999) / 1000 - 1], reported = latency_quantile(counts, BENCH_LATENCY_SAMPLES, permilles[q]);
+            if (reported < exact || reported > exact + (exact / LATENCY_SUB_COUNT)) {
+                printf("bench: latency: quantile check failed (round=%d, permille=%" PRIu32 ", exact=%" PRIu64 ", reported=%" PRIu64 ")\n", round, permilles[q], exact, reported);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static void bench_suite_latency(void) {
+    const int failures = bench_latency_check();
+    printf("bench: latency: %d samples, 4 distributions, %d failures\n", BENCH_LATENCY_SAMPLES, failures);
+    bench_failures += failures;
+    bench_run("latency/record", bench_fn_latency_record, NULL, 0);
+    bench_run("latency/packet", bench_fn_latency_packet, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// frames of 40 bytes, 300us apart but for one gap of 3ms, with 'between_us' between frames, read as serial_read records them
+static void bench_serial_gap_frames(const int frames, const uint64_t between_us, uint64_t *now_us) {
+    for (int frame = 0; frame < frames; frame++) {
+        uint64_t first_us = *now_us;
+        for (int i = 1; i < 40; i++) {
+            const uint64_t gap_us = i == 20 ? 3000 : 300;
+            if (gap_us >= serial_gap.gap_us) { // split, as serial_read would
+                __serial_gap_frame(first_us, *now_us, true);
+                first_us = (*now_us += gap_us);
+                continue;
+            }
+            __serial_gap_record(serial_gap.intra, &serial_gap.intra_count, gap_us);
+            *now_us += gap_us;
+        }
+        __serial_gap_frame(first_us, *now_us, true);
+        *now_us += between_us;
+    }
+}
+
+static int bench_serial_gap_check(void) {
+    int failures = 0;
+    uint64_t now_us = 1000000;
+    serial_gap_begin(2000, true); // below the 3ms gap, so it must adapt past it, but stay below the 60ms between frames
+    bench_serial_gap_frames(500, 60000, &now_us);
+    if (serial_gap.gap_us <= 3000 || serial_gap.gap_us >= 60000) {
+        printf("bench: serial-gap: adaptive check failed (gap=%" PRIu32 "us)\n", serial_gap.gap_us);
+        failures++;
+    }
+    serial_gap_begin(2000, true); // closely spaced, 8ms between frames: once past the 3ms gap, that must not be taken as within frames
+    bench_serial_gap_frames(500, 8000, &now_us);
+    if (serial_gap.gap_us <= 3000 || serial_gap.gap_us >= 8000) {
+        printf("bench: serial-gap: closely spaced check failed (gap=%" PRIu32 "us)\n", serial_gap.gap_us);
+        failures++;
+    }
+    serial_gap_begin(2000, false);
+    bench_serial_gap_frames(500, 60000, &now_us);
+    if (serial_gap.gap_us != 2000) {
+        printf("bench: serial-gap: fixed check failed (gap=%" PRIu32 "us)\n", serial_gap.gap_us);
+        failures++;
+    }
+    static const struct {
+        int rate;
+        uint8_t packet_size, packet_rate;
+        uint32_t expected_us;
+    } rates[] = {
+        { 9600, 0, 2, (4 * 1041) + 5000 },                   // defaults, 240 byte sub-packets, so UART bound
+        { 115200, 0, 7, (4 * 86) + 5000 },                   //
+        { 9600, 3, 2, ((48 * 8 * 1000000) / 2400) * 5 / 4 }, // 32 byte sub-packets at 2.4kbps
+        { 9600, 3, 7, (4 * 1041) + 5000 },                   // 32 byte sub-packets at 62.5kbps, less than the UART bound
+    };
+    for (int i = 0; i < (int)(sizeof(rates) / sizeof(rates[0])); i++) {
+        _e22900txx_config.packet_size = rates[i].packet_size;
+        _e22900txx_config.packet_rate = rates[i].packet_rate;
+        const uint32_t gap_us = device_frame_gap_us(rates[i].rate);
+        if (gap_us != rates[i].expected_us) {
+            printf("bench: serial-gap: rate check failed (rate=%d, packet-size=%d, packet-rate=%d, gap=%" PRIu32 "us, expected=%" PRIu32 "us)\n", rates[i].rate, rates[i].packet_size, rates[i].packet_rate, gap_us, rates[i].expected_us);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static uint64_t bench_fn_serial_gap_record(void *context __attribute__((unused)), const uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++)
+        __serial_gap_record(serial_gap.intra, &serial_gap.intra_count, 300 + (i & 0xFF));
+    return iterations;
+}
+
+static void bench_suite_serial_gap(void) {
+    const int failures = bench_serial_gap_check();
+    printf("bench: serial-gap: 1500 frames, 4 rates, %d failures\n", failures);
+    bench_failures += failures;
+    bench_run("serial-gap/record", bench_fn_serial_gap_record, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_CAPTURE_FRAMES 1000
+
+static uint64_t bench_fn_capture_write(void *context, const uint64_t iterations) {
+    const bench_packet_t *packet = (const bench_packet_t *)context;
+    uint64_t written = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        written += capture_write(packet->data, packet->size, 0x80, true, E22900T22_MODULE_USB, time_monotonic_us());
+    return written;
+}
+
+// as fast as possible, rewinding at the end of the capture rather than reopening it
+static uint64_t bench_fn_capture_replay(void *context __attribute__((unused)), const uint64_t iterations) {
+    static capture_frame_t frame;
+    uint64_t bytes = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (!capture_replay_pending) {
+            fseek(capture_replay_file, (long)sizeof(capture_pcap_header_t), SEEK_SET);
+            __capture_replay_fetch();
+        }
+        bytes += (uint64_t)capture_replay_read(&frame);
+    }
+    return bytes;
+}
+
+// frames written with varied sizes, RSSI, modules and intervals must replay identically, and at speed 0 without waiting
+static int bench_capture_check(const char *path) {
+    static uint8_t sizes[BENCH_CAPTURE_FRAMES], rssis[BENCH_CAPTURE_FRAMES], modules[BENCH_CAPTURE_FRAMES];
+    static uint8_t data[BENCH_CAPTURE_FRAMES][E22900T22_PACKET_MAXSIZE];
+    int failures = 0;
+    if (!capture_begin(path))
+        return 1;
+    const uint64_t base_us = capture_base_monotonic_us;
+    for (int i = 0; i < BENCH_CAPTURE_FRAMES; i++) {
+        sizes[i] = (uint8_t)(1 + bench_random() % (E22900T22_PACKET_MAXSIZE - 1));
+        rssis[i] = (uint8_t)bench_random();
+        modules[i] = (uint8_t)(i % 2);
+        for (int j = 0; j < sizes[i]; j++)
+            data[i][j] = (uint8_t)bench_random();
+        if (!capture_write(data[i], sizes[i], rssis[i], i % 3 != 0, modules[i], base_us + ((uint64_t)i * 150000)))
+            failures++;
+    }
+    capture_end();
+    if (!capture_replay_begin(path, 0))
+        return failures + 1;
+    capture_frame_t frame;
+    int count = 0, size;
+    while ((size = capture_replay_read(&frame)) >= 0) {
+        if (size == 0 || count >= BENCH_CAPTURE_FRAMES || frame.size != sizes[count] || memcmp(frame.data, data[count], (size_t)size) != 0 || frame.module != modules[count] || frame.rssi_valid != (count % 3 != 0) ||
+            (frame.rssi_valid && frame.rssi != rssis[count])) {
+            printf("bench: capture: frame check failed (frame=%d, size=%d)\n", count, size);
+            failures++;
+        }
+        if (size > 0)
+            count++;
+    }
+    if (count != BENCH_CAPTURE_FRAMES) {
+        printf("bench: capture: replayed %d of %d frames\n", count, BENCH_CAPTURE_FRAMES);
+        failures++;
+    }
+    capture_replay_end();
+    return failures;
+}
+
+static void bench_suite_capture(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/e22900t22bench-%d.pcap", (int)getpid());
+    const int failures = bench_capture_check(path);
+    printf("bench: capture: %d frames, %d failures\n", BENCH_CAPTURE_FRAMES, failures);
+    bench_failures += failures;
+    bench_packet_t packet;
+    bench_packet_json(&packet, 128, "icedepth");
+    if (capture_begin(path)) {
+        bench_run("capture/write/size=128", bench_fn_capture_write, &packet, (uint64_t)packet.size);
+        capture_end();
+    }
+    if (capture_frames > 0 && capture_replay_begin(path, 0)) {
+        bench_run("capture/replay/size=128", bench_fn_capture_replay, NULL, (uint64_t)packet.size);
+        capture_replay_end();
+    }
+    unlink(path);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t bench_fn_trace_record(void *context __attribute__((unused)), const uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++)
+        TRACE_EVENT(TRACE_ROUTE, TRACE_ROUTE_OKAY, i & 0xFF, i, 0);
+    return iterations;
+}
+
+// the clock read alone, which is most of a record and depends on the kernel's clock source
+static uint64_t bench_fn_trace_clock(void *context __attribute__((unused)), const uint64_t iterations) {
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        total += __trace_clock_ns(CLOCK_MONOTONIC);
+    return total;
+}
+
+// after wrapping the ring, a dump must load as exactly the latest TRACE_RING_SIZE events, oldest first
+static int bench_trace_check(const char *path) {
+    int failures = 0;
+    const uint32_t start = trace_next, recorded = (TRACE_RING_SIZE * 2) + 123;
+    for (uint32_t i = 0; i < recorded; i++)
+        TRACE_EVENT(TRACE_PACKET, i & 0xFF, 0, i, i * 7);
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    if (!trace_dump(0))
+        return 1;
+    trace_header_t header;
+    uint32_t count = 0;
+    trace_event_t *events = trace_load(path, &header, &count);
+    if (events == NULL)
+        return 1;
+    if (count != TRACE_RING_SIZE || header.next != start + recorded) {
+        printf("bench: trace: loaded %" PRIu32 " events (next=%" PRIu32 "), expected %d\n", count, header.next, TRACE_RING_SIZE);
+        failures++;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t expected = recorded - TRACE_RING_SIZE + i;
+        if (events[i].type != TRACE_PACKET || events[i].c != expected || events[i].d != expected * 7 || events[i].seq != start + expected + 1 || (i > 0 && events[i].time_ns < events[i - 1].time_ns)) {
+            printf("bench: trace: event check failed (index=%" PRIu32 ", c=%" PRIu32 ", expected=%" PRIu32 ")\n", i, events[i].c, expected);
+            failures++;
+            break;
+        }
+    }
+    free(events);
+    return failures;
+}
+
+static void bench_suite_trace(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/e22900t22bench-%d.trace", (int)getpid());
+    const int failures = bench_trace_check(path);
+    char clocksource[32] = "unknown";
+    FILE *file = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (file != NULL) {
+        if (fgets(clocksource, sizeof(clocksource), file) != NULL)
+            clocksource[strcspn(clocksource, "\n")] = '\0';
+        fclose(file);
+    }
+    printf("bench: trace: %d events, clocksource=%s, %d failures\n", TRACE_RING_SIZE, clocksource, failures);
+    bench_failures += failures;
+    unlink(path);
+    bench_run("trace/record", bench_fn_trace_record, NULL, 0);
+    bench_run("trace/clock", bench_fn_trace_clock, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_CONFIG_KEYS 1024
+
+typedef struct {
+    char keys[BENCH_CONFIG_KEYS][48];
+    int key_count;
+} bench_config_context_t;
+
+static uint64_t bench_fn_config_get(void *context, const uint64_t iterations) {
+    const bench_config_context_t *ctx = (const bench_config_context_t *)context;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        found += config_get_string(ctx->keys[i % (uint64_t)ctx->key_count], NULL) != NULL;
+    return found;
+}
+
+// as the former store, a scan of the entries in order
+static uint64_t bench_fn_config_get_linear(void *context, const uint64_t iterations) {
+    const bench_config_context_t *ctx = (const bench_config_context_t *)context;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const char *key = ctx->keys[i % (uint64_t)ctx->key_count];
+        for (size_t j = 0; j < config_store.count; j++)
+            if (strcmp(config_store.entries[j].key, key) == 0) {
+                found++;
+                break;
+            }
+    }
+    return found;
+}
+
+// a file of routes (three keys each) and a later duplicate must load with every value as written, the duplicate
+// replacing the first, and the route indices found in order
+static int bench_config_check(const char *path, const int routes, uint64_t *load_us) {
+    int failures = 0;
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 1;
+    fprintf(file, "data-type=json\nmqtt-server=mqtt://first\n");
+    for (int i = 0; i < routes; i++)
+        fprintf(file, "topic-route.%d.key=type\ntopic-route.%d.value=route%d\ntopic-route.%d.topic=e22900t22/route%d\n", i, i, i, i, i);
+    fprintf(file, "mqtt-server=mqtt://second\n");
+    fclose(file);
+    config_store_free(&config_store);
+    const uint64_t start_ns = bench_now_ns();
+    if (!__config_load_file(path))
+        return failures + 1;
+    *load_us = (bench_now_ns() - start_ns) / 1000;
+    if (config_store.count != (size_t)(routes * 3) + 2 || strcmp(config_get_string("mqtt-server", ""), "mqtt://second") != 0 || config_get_string("topic-route.0.sink", NULL) != NULL) {
+        printf("bench: config: entries=%zu (expected %d) or duplicate check failed\n", config_store.count, (routes * 3) + 2);
+        failures++;
+    }
+    char expected[48];
+    for (int i = 0; i < routes; i++) {
+        snprintf(expected, sizeof(expected), "e22900t22/route%d", i);
+        const char *topic = config_get_indexed("topic-route", i, "topic", "");
+        if (strcmp(topic, expected) != 0 || strcmp(config_get_indexed("topic-route", i, "key", ""), "type") != 0) {
+            printf("bench: config: route %d check failed (topic='%s')\n", i, topic);
+            failures++;
+            break;
+        }
+    }
+    int index_count;
+    int *indices = config_get_indices("topic-route.", ".topic", &index_count);
+    for (int i = 0; i < index_count && index_count == routes; i++)
+        if (indices[i] != i) {
+            index_count = -1;
+            break;
+        }
+    if (index_count != routes) {
+        printf("bench: config: indices check failed (count=%d)\n", index_count);
+        failures++;
+    }
+    free(indices);
+    return failures;
+}
+
+static void bench_suite_config(void) {
+    static const int route_counts[] = { 16, 1000, 10000 };
+    static bench_config_context_t ctx;
+    char path[64], name[BENCH_NAME_MAX];
+    snprintf(path, sizeof(path), "/tmp/e22900t22bench-%d.cfg", (int)getpid());
+    for (int r = 0; r < (int)(sizeof(route_counts) / sizeof(route_counts[0])); r++) {
+        const int routes = route_counts[r];
+        uint64_t load_us = 0;
+        const int failures = bench_config_check(path, routes, &load_us);
+        printf("bench: config: %zu entries, loaded in %" PRIu64 "us (slots=%zu, arena=%zu bytes), %d failures\n", config_store.count, load_us, config_store.slot_count, config_store.arena_bytes, failures);
+        bench_failures += failures;
+        ctx.key_count = 0;
+        for (int i = 0; i < BENCH_CONFIG_KEYS; i++)
+            snprintf(ctx.keys[ctx.key_count++], sizeof(ctx.keys[0]), "topic-route.%d.%s", (int)(bench_random() % (uint32_t)routes), i % 2 ? "topic" : "value");
+        snprintf(name, sizeof(name), "config/get/entries=%zu", config_store.count);
+        bench_run(name, bench_fn_config_get, &ctx, 0);
+        snprintf(name, sizeof(name), "config/get-linear/entries=%zu", config_store.count);
+        bench_run(name, bench_fn_config_get_linear, &ctx, 0);
+    }
+    unlink(path);
+    config_store_free(&config_store);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_ADMISSION_SOURCES 10000
+#define BENCH_ADMISSION_KEYS    (BENCH_ADMISSION_SOURCES * 2)
+#define BENCH_ADMISSION_PACKETS 1024
+
+typedef struct {
+    char keys[BENCH_ADMISSION_KEYS][12];
+    int key_lengths[BENCH_ADMISSION_KEYS];
+    int key_count;
+    uint32_t order[BENCH_ADMISSION_PACKETS];
+    bench_packet_t packets[BENCH_ADMISSION_PACKETS];
+} bench_admission_context_t;
+
+static uint64_t bench_fn_admission_lookup(void *context, const uint64_t iterations) {
+    const bench_admission_context_t *ctx = (const bench_admission_context_t *)context;
+    uint64_t tokens = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const uint32_t key = ctx->order[i % BENCH_ADMISSION_PACKETS] % (uint32_t)ctx->key_count;
+        tokens += admission_table_lookup(&admission_table, ctx->keys[key], ctx->key_lengths[key], ADMISSION_TOKEN, i)->tokens;
+    }
+    return tokens;
+}
+
+// in key order over twice the capacity, so every lookup misses and evicts the least recently used
+static uint64_t bench_fn_admission_evict(void *context, const uint64_t iterations) {
+    const bench_admission_context_t *ctx = (const bench_admission_context_t *)context;
+    uint64_t tokens = 0;
+    static uint32_t next = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const uint32_t key = next++ % (uint32_t)ctx->key_count;
+        tokens += admission_table_lookup(&admission_table, ctx->keys[key], ctx->key_lengths[key], ADMISSION_TOKEN, i)->tokens;
+    }
+    return tokens;
+}
+
+static uint64_t bench_fn_admission_check(void *context, const uint64_t iterations) {
+    const bench_admission_context_t *ctx = (const bench_admission_context_t *)context;
+    uint64_t admitted = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const bench_packet_t *packet = &ctx->packets[i % BENCH_ADMISSION_PACKETS];
+        admitted += admission_check(packet->data, packet->size, i * 1000) == ADMISSION_ADMIT;
+    }
+    return admitted;
+}
+
+// every source must be found from its home slot, and the least recently used list must hold each once
+static int bench_admission_consistent(void) {
+    int failures = 0, listed = 0;
+    for (int32_t i = 0; i < admission_table.count; i++) {
+        const admission_source_t *source = &admission_table.sources[i];
+        if (admission_table_find(&admission_table, source->key, source->key_length) != source)
+            failures++;
+    }
+    for (int32_t i = admission_table.lru_oldest; i >= 0 && listed <= admission_table.count; i = admission_table.sources[i].lru_next)
+        listed++;
+    return failures + (listed != admission_table.count);
+}
+
+static int bench_admission_check(const bench_admission_context_t *ctx) {
+    int failures = 0;
+    // a bucket of 5 at 60/min: the burst, then one a second, and never more than the burst however long it waits
+    admission_source_t source = { .tokens = 5 * ADMISSION_TOKEN, .refilled_us = 0 };
+    int taken = 0;
+    for (int i = 0; i < 10; i++)
+        taken += admission_bucket_take(&source, 60, 5, 0);
+    const bool early = admission_bucket_take(&source, 60, 5, 999000), second = admission_bucket_take(&source, 60, 5, 1000000);
+    int later = 0;
+    for (int i = 0; i < 10; i++)
+        later += admission_bucket_take(&source, 60, 5, 3600000000ULL);
+    if (taken != 5 || early || !second || later != 5) {
+        printf("bench: admission: bucket check failed (burst=%d, early=%d, second=%d, later=%d)\n", taken, early, second, later);
+        failures++;
+    }
+    // in a table of 4, the least recently used is evicted: of a b c d, with a used again, e evicts b
+    if (!admission_table_begin(&admission_table, 4))
+        return failures + 1;
+    static const char *const names[] = { "a", "b", "c", "d", "a", "e" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        admission_table_lookup(&admission_table, names[i], 1, ADMISSION_TOKEN, 0);
+    if (admission_table.evictions != 1 || admission_table_find(&admission_table, "b", 1) != NULL || admission_table_find(&admission_table, "a", 1) == NULL || admission_table_find(&admission_table, "e", 1) == NULL) {
+        printf("bench: admission: eviction check failed (evictions=%" PRIu64 ")\n", admission_table.evictions);
+        failures++;
+    }
+    admission_table_end(&admission_table);
+    // random use of twice as many keys as sources, so that evictions shift entries back through long probe sequences
+    if (!admission_table_begin(&admission_table, BENCH_ADMISSION_SOURCES))
+        return failures + 1;
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < BENCH_ADMISSION_SOURCES; i++) {
+            const uint32_t key = bench_random() % (uint32_t)ctx->key_count;
+            admission_table_lookup(&admission_table, ctx->keys[key], ctx->key_lengths[key], ADMISSION_TOKEN, 0);
+        }
+        if (bench_admission_consistent() != 0) {
+            printf("bench: admission: table check failed (round=%d, count=%" PRId32 ", evictions=%" PRIu64 ")\n", round, admission_table.count, admission_table.evictions);
+            failures++;
+            break;
+        }
+    }
+    admission_table_end(&admission_table);
+    // sampling passes the first over the rate and then 1 in 10
+    admission_config.key = topic_template_compile("{json:id}");
+    admission_config.rate = 60;
+    admission_config.burst = 1;
+    admission_config.sample = 10;
+    admission_config.action = ADMISSION_ACTION_SAMPLE;
+    if (admission_config.key == NULL || !admission_table_begin(&admission_table, 16))
+        return failures + 1;
+    static const uint8_t packet[] = "{\"id\":\"node-1\"}";
+    int admitted = 0;
+    for (int i = 0; i < 101; i++)
+        admitted += admission_check(packet, (int)sizeof(packet) - 1, 0) == ADMISSION_ADMIT;
+    if (admitted != 11 || admission_unkeyed != 0) {
+        printf("bench: admission: sample check failed (admitted=%d of 101, expected 11)\n", admitted);
+        failures++;
+    }
+    admission_end();
+    return failures;
+}
+
+static void bench_suite_admission(void) {
+    static bench_admission_context_t ctx;
+    char name[BENCH_NAME_MAX];
+    ctx.key_count = BENCH_ADMISSION_KEYS;
+    for (int i = 0; i < ctx.key_count; i++)
+        ctx.key_lengths[i] = snprintf(ctx.keys[i], sizeof(ctx.keys[0]), "node-%d", i);
+    const int failures = bench_admission_check(&ctx);
+    printf("bench: admission: bucket, eviction, %d sources over %d keys, sampling, %d failures\n", BENCH_ADMISSION_SOURCES, BENCH_ADMISSION_KEYS, failures);
+    bench_failures += failures;
+
+    for (int i = 0; i < BENCH_ADMISSION_PACKETS; i++)
+        ctx.order[i] = bench_random() % BENCH_ADMISSION_SOURCES;
+    ctx.key_count = BENCH_ADMISSION_SOURCES;
+    if (!admission_table_begin(&admission_table, BENCH_ADMISSION_SOURCES))
+        return;
+    for (int i = 0; i < ctx.key_count; i++)
+        admission_table_lookup(&admission_table, ctx.keys[i], ctx.key_lengths[i], ADMISSION_TOKEN, 0);
+    snprintf(name, sizeof(name), "admission/lookup-hit/sources=%d", BENCH_ADMISSION_SOURCES);
+    bench_run(name, bench_fn_admission_lookup, &ctx, 0);
+    ctx.key_count = BENCH_ADMISSION_KEYS;
+    snprintf(name, sizeof(name), "admission/lookup-evict/sources=%d", BENCH_ADMISSION_SOURCES);
+    bench_run(name, bench_fn_admission_evict, &ctx, 0);
+    admission_table_end(&admission_table);
+
+    admission_config.key = topic_template_compile("{json:id}");
+    admission_config.rate = 60;
+    admission_config.burst = 10;
+    admission_config.action = ADMISSION_ACTION_DROP;
+    if (admission_config.key == NULL || !admission_table_begin(&admission_table, BENCH_ADMISSION_SOURCES))
+        return;
+    for (int i = 0; i < BENCH_ADMISSION_SOURCES; i++)
+        admission_table_lookup(&admission_table, ctx.keys[i], ctx.key_lengths[i], (uint64_t)admission_config.burst * ADMISSION_TOKEN, 0);
+    for (int i = 0; i < BENCH_ADMISSION_PACKETS; i++)
+        ctx.packets[i].size = snprintf((char *)ctx.packets[i].data, sizeof(ctx.packets[i].data), "{\"id\":\"node-%" PRIu32 "\",\"seq\":%d}", ctx.order[i], i);
+    snprintf(name, sizeof(name), "admission/check/sources=%d", BENCH_ADMISSION_SOURCES);
+    bench_run(name, bench_fn_admission_check, &ctx, 0);
+    printf("bench: admission: sources=%" PRId32 ", slots=%" PRIu32 ", %zu bytes\n", admission_table.count, admission_table.slot_mask + 1,
+           ((size_t)admission_table.capacity * sizeof(admission_source_t)) + ((size_t)(admission_table.slot_mask + 1) * sizeof(int32_t)));
+    admission_end();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_TDMA_NODES 1024
+#define BENCH_TDMA_PAGES 4
+
+typedef struct {
+    tdma_scheduler_t scheduler;
+    uint32_t hashes[BENCH_TDMA_NODES];
+    uint8_t pages[BENCH_TDMA_PAGES][E22900T22_PACKET_MAXSIZE];
+    int lengths[BENCH_TDMA_PAGES];
+} bench_tdma_context_t;
+
+static uint64_t bench_fn_tdma_heard(void *context, const uint64_t iterations) {
+    bench_tdma_context_t *ctx = (bench_tdma_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++)
+        tdma_heard(&ctx->scheduler, ctx->hashes[i % BENCH_TDMA_NODES]);
+    return ctx->scheduler.heard;
+}
+
+// a frame hearing every node once, then its schedule and beacon
+static uint64_t bench_fn_tdma_frame(void *context, const uint64_t iterations) {
+    bench_tdma_context_t *ctx = (bench_tdma_context_t *)context;
+    uint64_t pages = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (int n = 0; n < BENCH_TDMA_NODES; n++)
+            tdma_heard(&ctx->scheduler, ctx->hashes[n]);
+        tdma_schedule(&ctx->scheduler);
+        pages += (uint64_t)tdma_beacon_build(&ctx->scheduler, ctx->pages, ctx->lengths, BENCH_TDMA_PAGES, E22900T22_PACKET_MAXSIZE, 0);
+    }
+    return pages;
+}
+
+// every slot owned by the node holding it, and each node found by its hash
+static int bench_tdma_consistent(const tdma_scheduler_t *scheduler) {
+    int failures = 0;
+    uint32_t held = 0, owned = 0;
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        const tdma_node_state_t *node = &scheduler->nodes[i];
+        for (int j = 0; j < node->slot_count; j++)
+            failures += scheduler->owners[node->slots[j]] != (int32_t)i || node->slots[j] >= scheduler->slot_count;
+        held += node->slot_count;
+        uint32_t slot = node->hash & scheduler->index_mask;
+        while (scheduler->index[slot] >= 0 && scheduler->nodes[scheduler->index[slot]].hash != node->hash)
+            slot = (slot + 1) & scheduler->index_mask;
+        failures += scheduler->index[slot] != (int32_t)i;
+    }
+    for (uint32_t slot = 0; slot < scheduler->slots_max; slot++)
+        owned += scheduler->owners[slot] >= 0;
+    return failures + (held != owned);
+}
+
+// the slots each node learned from the beacons are those the scheduler holds for it
+static int bench_tdma_agree(const tdma_scheduler_t *scheduler, const tdma_node_t *nodes, const uint32_t node_count) {
+    int failures = 0;
+    for (uint32_t n = 0; n < node_count; n++) {
+        const tdma_node_state_t *state = NULL;
+        for (uint32_t i = 0; i < scheduler->count && state == NULL; i++)
+            if (scheduler->nodes[i].hash == nodes[n].hash)
+                state = &scheduler->nodes[i];
+        const uint8_t slot_count = state != NULL ? state->slot_count : 0;
+        failures += nodes[n].slot_count != slot_count;
+        for (int j = 0; j < nodes[n].slot_count && j < slot_count; j++) {
+            bool found = false;
+            for (int k = 0; k < slot_count; k++)
+                found |= state->slots[k] == nodes[n].slots[j];
+            failures += !found;
+        }
+    }
+    return failures;
+}
+
+// nodes heard for 'frames' (every tenth three times a frame), the beacons parsed by each, then checked
+static int bench_tdma_frames(bench_tdma_context_t *ctx, tdma_node_t *nodes, const uint32_t heard_count, const uint32_t node_count, const int frames, uint32_t *now_ms) {
+    int failures = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        for (uint32_t n = 0; n < heard_count; n++)
+            for (int k = 0; k < (n % 10 == 0 ? 3 : 1); k++)
+                tdma_heard(&ctx->scheduler, nodes[n].hash);
+        tdma_schedule(&ctx->scheduler);
+        const int page_count = tdma_beacon_build(&ctx->scheduler, ctx->pages, ctx->lengths, BENCH_TDMA_PAGES, E22900T22_PACKET_MAXSIZE, 0);
+        for (uint32_t n = 0; n < node_count; n++)
+            for (int k = 0; k < page_count; k++)
+                failures += !tdma_node_beacon(&nodes[n], ctx->pages[k], ctx->lengths[k], *now_ms);
+        failures += bench_tdma_consistent(&ctx->scheduler);
+        *now_ms += tdma_scheduler_frame_ms(&ctx->scheduler);
+    }
+    return failures;
+}
+
+static int bench_tdma_check(bench_tdma_context_t *ctx) {
+    int failures = 0;
+
+    // 120 nodes in 160 slots, the busy given more; 60 more, so the extra slots are taken back for first slots; then
+    // only 60 heard, so the rest expire
+    static tdma_node_t nodes[180];
+    for (uint32_t n = 0; n < 180; n++) {
+        char key[12];
+        tdma_node_begin(&nodes[n], (const uint8_t *)key, snprintf(key, sizeof(key), "node-%" PRIu32, n));
+    }
+    if (!tdma_scheduler_begin(&ctx->scheduler, 256, 100, 4, 160, 60))
+        return 1;
+    uint32_t now_ms = 0;
+    failures += bench_tdma_frames(ctx, nodes, 120, 180, 30, &now_ms);
+    const int agree_grow = bench_tdma_agree(&ctx->scheduler, nodes, 180);
+    const uint32_t slots_grow = ctx->scheduler.slot_count;
+    failures += bench_tdma_frames(ctx, nodes, 180, 180, 30, &now_ms);
+    const int agree_full = bench_tdma_agree(&ctx->scheduler, nodes, 180);
+    uint32_t slotted = 0, extra = 0;
+    for (uint32_t i = 0; i < ctx->scheduler.count; i++) {
+        slotted += ctx->scheduler.nodes[i].slot_count > 0;
+        extra += ctx->scheduler.nodes[i].slot_count > 1;
+    }
+    failures += bench_tdma_frames(ctx, nodes, 60, 180, 30, &now_ms);
+    const int agree_expire = bench_tdma_agree(&ctx->scheduler, nodes, 180);
+    if (agree_grow + agree_full + agree_expire > 0 || slots_grow <= 120 || slotted != 160 || extra != 0 || ctx->scheduler.count != 60 || ctx->scheduler.expired != 120) {
+        printf("bench: tdma: schedule check failed (disagree=%d/%d/%d, slots=%" PRIu32 ", slotted=%" PRIu32 ", extra=%" PRIu32 ", count=%" PRIu32 ", expired=%" PRIu64 ")\n", agree_grow, agree_full,
+               agree_expire, slots_grow, slotted, extra, ctx->scheduler.count, ctx->scheduler.expired);
+        failures++;
+    }
+
+    // the header as built is parsed back, and a node with slots contends only with more queued than they carry
+    tdma_beacon_t beacon = { .sequence = 0 };
+    if (tdma_beacon_parse(ctx->pages[0], ctx->lengths[0], &beacon) != ctx->lengths[0] || beacon.slot_ms != 100 || beacon.slot_count != ctx->scheduler.slot_count || beacon.contention_count != ctx->scheduler.contention ||
+        beacon.sequence != (uint8_t)ctx->scheduler.frames) {
+        printf("bench: tdma: beacon check failed (length=%d)\n", ctx->lengths[0]);
+        failures++;
+    }
+    tdma_node_t *node = &nodes[1];
+    uint32_t at_ms = 0;
+    const uint32_t end_ms = node->start_ms + tdma_frame_ms(&node->beacon);
+    const bool slot = tdma_node_transmit_ms(node, node->start_ms, 1, 0, &at_ms) && at_ms == node->start_ms + node->slots[0] * 100u;
+    const bool late = tdma_node_transmit_ms(node, end_ms - node->beacon.contention_count * 100u, 1, 0, &at_ms);
+    const bool contend = tdma_node_transmit_ms(node, end_ms - node->beacon.contention_count * 100u, 2, 0, &at_ms), again = tdma_node_transmit_ms(node, end_ms - 100u, 2, 0, &at_ms);
+    if (node->slot_count != 1 || !slot || late || !contend || again) {
+        printf("bench: tdma: transmit check failed (slots=%d, slot=%d, late=%d, contend=%d, again=%d)\n", node->slot_count, slot, late, contend, again);
+        failures++;
+    }
+    tdma_scheduler_end(&ctx->scheduler);
+    return failures;
+}
+
+static void bench_suite_tdma(void) {
+    static bench_tdma_context_t ctx;
+    char name[BENCH_NAME_MAX];
+    const int failures = bench_tdma_check(&ctx);
+    printf("bench: tdma: assignment, reclaim, expiry, beacon, transmit, %d failures\n", failures);
+    bench_failures += failures;
+
+    for (int i = 0; i < BENCH_TDMA_NODES; i++) {
+        char key[12];
+        ctx.hashes[i] = tdma_key_hash((const uint8_t *)key, snprintf(key, sizeof(key), "node-%d", i));
+    }
+    if (!tdma_scheduler_begin(&ctx.scheduler, BENCH_TDMA_NODES, 100, TDMA_CONTENTION_DEFAULT, TDMA_SLOTS_DEFAULT, TDMA_EXPIRE_DEFAULT))
+        return;
+    snprintf(name, sizeof(name), "tdma/heard/nodes=%d", BENCH_TDMA_NODES);
+    bench_run(name, bench_fn_tdma_heard, &ctx, 0);
+    snprintf(name, sizeof(name), "tdma/frame/nodes=%d", BENCH_TDMA_NODES);
+    bench_run(name, bench_fn_tdma_frame, &ctx, 0);
+    printf("bench: tdma: nodes=%" PRIu32 ", slots=%" PRIu16 ", contention=%" PRIu16 ", %zu bytes\n", ctx.scheduler.count, ctx.scheduler.slot_count, ctx.scheduler.contention,
+           ((size_t)ctx.scheduler.capacity * sizeof(tdma_node_state_t)) + ((size_t)(ctx.scheduler.index_mask + 1) * sizeof(int32_t)) + ((size_t)ctx.scheduler.slots_max * sizeof(int32_t)));
+    tdma_scheduler_end(&ctx.scheduler);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_DEDUP_GATEWAYS 4
+#define BENCH_DEDUP_PACKETS  256
+
+typedef struct {
+    dedup_table_t table;
+    char topics[BENCH_DEDUP_GATEWAYS][DEDUP_TOPIC_MAX];
+    uint8_t payloads[BENCH_DEDUP_PACKETS][BENCH_DEDUP_GATEWAYS][192];
+    int lengths[BENCH_DEDUP_PACKETS][BENCH_DEDUP_GATEWAYS];
+    uint64_t now_us, copies;
+} bench_dedup_context_t;
+
+static struct {
+    uint32_t count;
+    char topic[DEDUP_TOPIC_MAX];
+    uint8_t payload[DEDUP_PAYLOAD_MAX];
+    int length;
+} bench_dedup_published;
+
+static void bench_dedup_publish(const char *topic, const uint8_t *payload, const int length) {
+    bench_dedup_published.count++;
+    snprintf(bench_dedup_published.topic, sizeof(bench_dedup_published.topic), "%s", topic);
+    memcpy(bench_dedup_published.payload, payload, (size_t)length);
+    bench_dedup_published.length = length;
+}
+
+// a packet's copy from each gateway, with the time moved on so that as many are held as in use
+static uint64_t bench_fn_dedup_message(void *context, const uint64_t iterations) {
+    bench_dedup_context_t *ctx = (bench_dedup_context_t *)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        const uint64_t packet = ctx->copies / BENCH_DEDUP_GATEWAYS, gateway = ctx->copies++ % BENCH_DEDUP_GATEWAYS;
+        dedup_message(&ctx->table, ctx->topics[gateway], ctx->payloads[packet % BENCH_DEDUP_PACKETS][gateway], ctx->lengths[packet % BENCH_DEDUP_PACKETS][gateway], ctx->now_us);
+        ctx->now_us += 1000;
+    }
+    return ctx->table.copies;
+}
+
+// each held entry is found by probing from its hash, and the index holds no others
+static int bench_dedup_consistent(const dedup_table_t *table) {
+    int failures = 0;
+    uint32_t indexed = 0;
+    for (uint32_t offset = 0; offset < table->count; offset++) {
+        const uint32_t position = (table->head + offset) % table->capacity;
+        uint32_t slot = (uint32_t)table->entries[position].hash & table->index_mask;
+        while (table->index[slot] >= 0 && table->index[slot] != (int32_t)position)
+            slot = (slot + 1) & table->index_mask;
+        failures += table->index[slot] != (int32_t)position;
+    }
+    for (uint32_t slot = 0; slot <= table->index_mask; slot++)
+        indexed += table->index[slot] >= 0;
+    return failures + (indexed != table->count);
+}
+
+static int bench_dedup_envelope(char *buffer, const size_t size, const int64_t ts, const int rssi, const int n) {
+    return snprintf(buffer, size, "{\"ts\":%" PRId64 ",\"rssi\":%d,\"ch\":23,\"seq\":5,\"data\":{\"n\":%d,\"t\":[21.5,60]}}", ts, rssi, n);
+}
+
+static int bench_dedup_check(void) {
+    int failures = 0;
+    static const char *const keys[3] = { "data", "rssi", "ts" };
+    char output[DEDUP_TOPIC_MAX], payload[DEDUP_PAYLOAD_MAX];
+    const char *gateway;
+    int gateway_length;
+
+    // the gateway's level replaced, and those without it or already the output's skipped
+    if (dedup_topic_parse("e22900t22/gw1/sensors", 1, "dedup", output, (int)sizeof(output), &gateway, &gateway_length) != 23 || strcmp(output, "e22900t22/dedup/sensors") != 0 || gateway_length != 3 ||
+        strncmp(gateway, "gw1", 3) != 0 || dedup_topic_parse("e22900t22/gw1", 1, "dedup", output, (int)sizeof(output), &gateway, &gateway_length) != 15 || strcmp(output, "e22900t22/dedup") != 0 ||
+        dedup_topic_parse("e22900t22/dedup/sensors", 1, "dedup", output, (int)sizeof(output), &gateway, &gateway_length) != -1 ||
+        dedup_topic_parse("e22900t22", 1, "dedup", output, (int)sizeof(output), &gateway, &gateway_length) != -1 ||
+        dedup_topic_parse("e22900t22//x", 1, "dedup", output, (int)sizeof(output), &gateway, &gateway_length) != -1 ||
+        dedup_topic_parse("e22900t22/gw1/sensors", 1, "dedup", output, 16, &gateway, &gateway_length) != -1) {
+        printf("bench: dedup: topic check failed\n");
+        failures++;
+    }
+
+    // the members by key, whole and undecoded, the first of each, and only at the top level
+    static const char object[] = "{\"ts\":12,\"x\":{\"rssi\":1},\"data\":{\"a\":[1,\"}\"]},\"rssi\":-87.5,\"data\":2}";
+    json_span_t values[3];
+    const int found = json_object_values((const uint8_t *)object, (int)strlen(object), keys, 3, values), found_missing = json_object_values((const uint8_t *)"{\"data\":\"s\"}", 12, keys, 3, values);
+    if (found != 3 || found_missing != 1 || values[0].length != 3 || values[0].type != JSON_TYPE_STRING || values[1].text != NULL || json_object_values((const uint8_t *)"[1]", 3, keys, 3, values) != -1 ||
+        json_object_values((const uint8_t *)object, (int)strlen(object), keys, 3, values) != 3 || values[0].length != 13 || memcmp(values[0].text, "{\"a\":[1,\"}\"]}", 13) != 0 || values[0].type != JSON_TYPE_OBJECT ||
+        values[1].length != 5 || values[1].type != JSON_TYPE_NUMBER || values[2].length != 2) {
+        printf("bench: dedup: values check failed (found=%d/%d)\n", found, found_missing);
+        failures++;
+    }
+
+    // three copies: the strongest two tie, so the earlier ts is published, once, when the window closes; a copy after
+    // is dropped, until the key has been held for a second window
+    dedup_table_t table;
+    if (!dedup_begin(&table, 16, 500, 1, "dedup", keys, bench_dedup_publish))
+        return failures + 1;
+    memset(&bench_dedup_published, 0, sizeof(bench_dedup_published));
+    dedup_result_t results[6];
+    int length = bench_dedup_envelope(payload, sizeof(payload), 1000, -90, 1);
+    results[0] = dedup_message(&table, "e22900t22/gw0/sensors", (const uint8_t *)payload, length, 1000000);
+    length = bench_dedup_envelope(payload, sizeof(payload), 1002, -80, 1);
+    results[1] = dedup_message(&table, "e22900t22/gw1/sensors", (const uint8_t *)payload, length, 1010000);
+    char best[DEDUP_PAYLOAD_MAX];
+    const int best_length = bench_dedup_envelope(best, sizeof(best), 1001, -80, 1);
+    results[2] = dedup_message(&table, "e22900t22/gw2/sensors", (const uint8_t *)best, best_length, 1020000);
+    dedup_poll(&table, 1499999);
+    const uint32_t published_early = bench_dedup_published.count, wait_ms = dedup_wait_ms(&table, 1499999, 1000);
+    dedup_poll(&table, 1500000);
+    results[3] = dedup_message(&table, "e22900t22/gw3/sensors", (const uint8_t *)payload, length, 1600000);
+    dedup_poll(&table, 2000000);
+    const uint32_t held = table.count;
+    results[4] = dedup_message(&table, "e22900t22/gw3/sensors", (const uint8_t *)payload, length, 2000001);
+    length = bench_dedup_envelope(payload, sizeof(payload), 1003, -80, 2);
+    results[5] = dedup_message(&table, "e22900t22/gw0/other", (const uint8_t *)payload, length, 2000002);
+    if (results[0] != DEDUP_FIRST || results[1] != DEDUP_DUPLICATE || results[2] != DEDUP_DUPLICATE || published_early != 0 || wait_ms != 1 || results[3] != DEDUP_LATE || held != 0 ||
+        results[4] != DEDUP_FIRST || results[5] != DEDUP_FIRST || table.late != 1 || table.gateways[2].best != 1 || table.gateways[0].first != 2 || table.gateways[3].late != 1) {
+        printf("bench: dedup: window check failed (results=%d/%d/%d/%d/%d/%d, wait=%" PRIu32 "ms, held=%" PRIu32 ")\n", results[0], results[1], results[2], results[3], results[4], results[5], wait_ms, held);
+        failures++;
+    }
+    if (bench_dedup_published.count != 1 || bench_dedup_published.length != best_length || memcmp(bench_dedup_published.payload, best, (size_t)best_length) != 0 ||
+        strcmp(bench_dedup_published.topic, "e22900t22/dedup/sensors") != 0) {
+        printf("bench: dedup: best check failed (published=%" PRIu32 ")\n", bench_dedup_published.count);
+        failures++;
+    }
+    dedup_flush(&table);
+    dedup_end(&table);
+
+    // with the ring full, the oldest is published early; then copies of many packets, at random, keep the index whole
+    if (!dedup_begin(&table, 2, 500, 1, "dedup", keys, bench_dedup_publish))
+        return failures + 1;
+    memset(&bench_dedup_published, 0, sizeof(bench_dedup_published));
+    for (int n = 0; n < 3; n++) {
+        length = bench_dedup_envelope(payload, sizeof(payload), n, -80, n);
+        dedup_message(&table, "e22900t22/gw0/sensors", (const uint8_t *)payload, length, 1000000 + (uint64_t)n);
+    }
+    if (bench_dedup_published.count != 1 || table.early != 1 || table.count != 2 || bench_dedup_consistent(&table) != 0) {
+        printf("bench: dedup: full check failed (published=%" PRIu32 ", early=%" PRIu64 ")\n", bench_dedup_published.count, table.early);
+        failures++;
+    }
+    dedup_end(&table);
+    if (!dedup_begin(&table, 8, 200, 1, "dedup", keys, bench_dedup_publish))
+        return failures + 1;
+    uint32_t state = 0x12345678, inconsistent = 0;
+    uint64_t now_us = 1000000;
+    for (int i = 0; i < 100000; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        char topic[32];
+        snprintf(topic, sizeof(topic), "e22900t22/gw%" PRIu32 "/sensors", state % 3);
+        length = bench_dedup_envelope(payload, sizeof(payload), 0, -70 - (int)(state % 20), (int)((state >> 8) % 24));
+        dedup_message(&table, topic, (const uint8_t *)payload, length, now_us);
+        now_us += (state >> 16) % 40000;
+        inconsistent += bench_dedup_consistent(&table) != 0;
+    }
+    if (inconsistent != 0 || table.copies != 100000 || table.packets + table.duplicates + table.late + (table.count - table.published) != table.copies) {
+        printf("bench: dedup: stress check failed (inconsistent=%" PRIu32 ", packets=%" PRIu64 ", duplicates=%" PRIu64 ", late=%" PRIu64 ")\n", inconsistent, table.packets, table.duplicates, table.late);
+        failures++;
+    }
+    dedup_end(&table);
+    return failures;
+}
+
+static void bench_suite_dedup(void) {
+    static bench_dedup_context_t ctx;
+    static const char *const keys[3] = { "data", "rssi", "ts" };
+    char name[BENCH_NAME_MAX];
+    const int failures = bench_dedup_check();
+    printf("bench: dedup: topic, values, window, best, late, full, stress, %d failures\n", failures);
+    bench_failures += failures;
+
+    for (int g = 0; g < BENCH_DEDUP_GATEWAYS; g++)
+        snprintf(ctx.topics[g], sizeof(ctx.topics[g]), "e22900t22/gw%d/sensors", g);
+    for (int n = 0; n < BENCH_DEDUP_PACKETS; n++)
+        for (int g = 0; g < BENCH_DEDUP_GATEWAYS; g++)
+            ctx.lengths[n][g] = bench_dedup_envelope((char *)ctx.payloads[n][g], sizeof(ctx.payloads[n][g]), 1000 + n, -70 - (g * 5), n);
+    if (!dedup_begin(&ctx.table, DEDUP_ENTRIES_DEFAULT, DEDUP_WINDOW_DEFAULT, 1, "dedup", keys, bench_dedup_publish))
+        return;
+    ctx.now_us = 1000000;
+    snprintf(name, sizeof(name), "dedup/message/gateways=%d", BENCH_DEDUP_GATEWAYS);
+    bench_run(name, bench_fn_dedup_message, &ctx, 0);
+    printf("bench: dedup: packets=%" PRIu64 ", duplicates=%" PRIu64 ", late=%" PRIu64 ", early=%" PRIu64 ", %zu bytes\n", ctx.table.packets, ctx.table.duplicates, ctx.table.late, ctx.table.early,
+           ((size_t)ctx.table.capacity * sizeof(dedup_entry_t)) + ((size_t)(ctx.table.index_mask + 1) * sizeof(int32_t)));
+    dedup_end(&ctx.table);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    sink_t *sink;
+    bench_packet_t packet;
+    int receiver_fd;
+} bench_sink_context_t;
+
+// the receiver is drained after every send, so socket sinks are measured as a loopback send and receive
+static uint64_t bench_fn_sink(void *context, const uint64_t iterations) {
+    const bench_sink_context_t *ctx = (const bench_sink_context_t *)context;
+    uint64_t sent = 0;
+    uint8_t buffer[SINK_RECORD_MAX];
+    for (uint64_t i = 0; i < iterations; i++) {
+        sent += ctx->sink->send("e22900t22/bench", ctx->packet.data, ctx->packet.size);
+        if (ctx->receiver_fd >= 0)
+            while (recv(ctx->receiver_fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+                ;
+    }
+    return sent;
+}
+
+static bool bench_sink_fake_okay(const char *topic __attribute__((unused)), const uint8_t *data __attribute__((unused)), const int length __attribute__((unused))) {
+    return true;
+}
+static bool bench_sink_fake_fail(const char *topic __attribute__((unused)), const uint8_t *data __attribute__((unused)), const int length __attribute__((unused))) {
+    return false;
+}
+
+// a packet is sent if any sink sends it, with each failure counted by its sink; and file lines are JSON, however
+// awkward the topic
+// a datagram receiver bound for the socket sinks, or -1; for udp, on an ephemeral loopback port, given as the address
+static int bench_sink_receiver_unix(const char *path) {
+    struct sockaddr_un addr_un;
+    memset(&addr_un, 0, sizeof(addr_un));
+    addr_un.sun_family = AF_UNIX;
+    strcpy(addr_un.sun_path, path);
+    unlink(path);
+    const int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd >= 0 && bind(fd, (const struct sockaddr *)&addr_un, sizeof(addr_un)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int bench_sink_receiver_udp(char *address, const size_t size) {
+    struct sockaddr_in addr_in;
+    socklen_t addr_in_length = sizeof(addr_in);
+    memset(&addr_in, 0, sizeof(addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd >= 0 && (bind(fd, (const struct sockaddr *)&addr_in, sizeof(addr_in)) != 0 || getsockname(fd, (struct sockaddr *)&addr_in, &addr_in_length) != 0)) {
+        close(fd);
+        return -1;
+    }
+    snprintf(address, size, "127.0.0.1:%d", (int)ntohs(addr_in.sin_port));
+    return fd;
+}
+
+// each datagram must be the record the file sink writes: valid JSON, with the topic escaped and the data as sent
+static int bench_sink_socket_check(sink_t *sink, const sink_config_t *config, const int receiver_fd) {
+    static const struct {
+        const char *topic, *data, *expected;
+    } records[] = {
+        { "e22900t22/\"quoted\"", "{\"a\":1}", ",\"topic\":\"e22900t22/\\\"quoted\\\"\",\"data\":{\"a\":1}}\n" },
+        { "e22900t22/binary", "\x01\xff", ",\"topic\":\"e22900t22/binary\",\"data\":[\"01ff\"]}\n" },
+    };
+    int failures = 0;
+    char record[SINK_RECORD_MAX];
+    if (receiver_fd < 0 || !sink->begin(config))
+        return 1;
+    for (int i = 0; i < (int)(sizeof(records) / sizeof(records[0])); i++) {
+        const bool sent = sink->send(records[i].topic, (const uint8_t *)records[i].data, (int)strlen(records[i].data));
+        const ssize_t length = sent ? recv(receiver_fd, record, sizeof(record) - 1, MSG_DONTWAIT) : -1;
+        record[length > 0 ? length : 0] = '\0';
+        const size_t expected_length = strlen(records[i].expected);
+        if (length <= 0 || !json_validate((const uint8_t *)record, (int)length - 1) || strncmp(record, "{\"ts\":", 6) != 0 || (size_t)length < expected_length ||
+            strcmp(record + (size_t)length - expected_length, records[i].expected) != 0) {
+            printf("bench: sink: %s record check failed (sent=%d): %s\n", sink->name, sent, record);
+            failures++;
+        }
+    }
+    sink->end();
+    return failures;
+}
+
+// a rotation that cannot open the file again (a directory stands in its place) must not leave the sink dead: once
+// the path is clear, the next flush opens it and writes
+static int bench_sink_file_reopen_check(const char *path_file) {
+    const sink_config_t config = { .file_path = path_file, .file_rotate_size = 1, .file_rotate_count = 0 };
+    unlink(path_file);
+    if (!sink_file.begin(&config))
+        return 1;
+    const bool first = sink_file.send("e22900t22/first", (const uint8_t *)"{}", 2) && __sink_file_flush();
+    unlink(path_file);
+    mkdir(path_file, 0755);
+    const bool lost = sink_file.send("e22900t22/lost", (const uint8_t *)"{}", 2) && __sink_file_flush(); // rotates, and cannot open
+    const bool dead = __sink_file_fd < 0;
+    rmdir(path_file);
+    const bool reopened = sink_file.send("e22900t22/reopened", (const uint8_t *)"{}", 2) && __sink_file_flush();
+    sink_file.end();
+    FILE *file = fopen(path_file, "r");
+    char line[512] = "";
+    const bool read = file != NULL && fgets(line, sizeof(line), file) != NULL && strstr(line, "\"e22900t22/reopened\"") != NULL && fgets(line, sizeof(line), file) == NULL;
+    if (file != NULL)
+        fclose(file);
+    unlink(path_file);
+    if (!first || lost || !dead || !reopened || !read) {
+        printf("bench: sink: file reopen check failed (first=%d, lost=%d, dead=%d, reopened=%d, read=%d)\n", first, lost, dead, reopened, read);
+        return 1;
+    }
+    return 0;
+}
+
+static int bench_sink_check(const char *path_file, const char *path_unix) {
+    int failures = 0;
+    static sink_t okay = { .name = "okay", .send = bench_sink_fake_okay }, fail = { .name = "fail", .send = bench_sink_fake_fail };
+    sink_register(&okay);
+    sink_register(&fail);
+    sink_begin(&(sink_config_t) { 0 });
+    const bool both = sink_send(3, "t", (const uint8_t *)"{}", 2), failing = sink_send(2, "t", (const uint8_t *)"{}", 2), none = sink_send(0, "t", (const uint8_t *)"{}", 2);
+    if (!both || failing || none || okay.sent != 1 || fail.failed != 2) {
+        printf("bench: sink: partial failure check failed (both=%d, failing=%d, none=%d, sent=%" PRIu32 ", failed=%" PRIu32 ")\n", both, failing, none, okay.sent, fail.failed);
+        failures++;
+    }
+    sink_end();
+
+    const sink_config_t config = { .file_path = path_file, .file_rotate_size = SINK_FILE_ROTATE_SIZE_DEFAULT, .file_rotate_count = 0 };
+    static const char *const topics[] = { "e22900t22/plain", "e22900t22/\"quoted\"", "e22900t22/back\\slash", "e22900t22/control\x01\t" };
+    static const char *const escaped[] = { "\"e22900t22/plain\"", "\"e22900t22/\\\"quoted\\\"\"", "\"e22900t22/back\\\\slash\"", "\"e22900t22/control\\u0001\\u0009\"" };
+    const int topic_count = (int)(sizeof(topics) / sizeof(topics[0]));
+    if (!sink_file.begin(&config))
+        return failures + 1;
+    for (int i = 0; i < topic_count; i++) {
+        failures += !sink_file.send(topics[i], (const uint8_t *)"{\"a\":1}", 7);
+        failures += !sink_file.send(topics[i], (const uint8_t *)"\x01\xff", 2);
+    }
+    sink_file.end();
+    FILE *file = fopen(path_file, "r");
+    char line[512];
+    int lines = 0, invalid = 0;
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        const int length = (int)strcspn(line, "\n");
+        invalid += !json_validate((const uint8_t *)line, length) || lines / 2 >= topic_count || strstr(line, escaped[lines / 2]) == NULL;
+        lines++;
+    }
+    if (file != NULL)
+        fclose(file);
+    unlink(path_file);
+    if (lines != topic_count * 2 || invalid != 0) {
+        printf("bench: sink: file check failed (lines=%d, invalid=%d)\n", lines, invalid);
+        failures++;
+    }
+    failures += bench_sink_file_reopen_check(path_file);
+
+    char address_udp[64];
+    int receiver_fd = bench_sink_receiver_unix(path_unix);
+    failures += bench_sink_socket_check(&sink_unix, &(sink_config_t) { .unix_path = path_unix }, receiver_fd);
+    if (receiver_fd >= 0)
+        close(receiver_fd);
+    unlink(path_unix);
+    receiver_fd = bench_sink_receiver_udp(address_udp, sizeof(address_udp));
+    failures += bench_sink_socket_check(&sink_udp, &(sink_config_t) { .udp_address = address_udp }, receiver_fd);
+    if (receiver_fd >= 0)
+        close(receiver_fd);
+    return failures;
+}
+
+static void bench_suite_sink(void) {
+    char name[BENCH_NAME_MAX], path_unix[64], path_file[64], address_udp[64];
+    snprintf(path_unix, sizeof(path_unix), "/tmp/e22900t22bench-%d.sock", (int)getpid());
+    snprintf(path_file, sizeof(path_file), "/tmp/e22900t22bench-%d.ndjson", (int)getpid());
+    const int failures = bench_sink_check(path_file, path_unix);
+    printf("bench: sink: partial failure, file escaping, file reopen, socket records, %d failures\n", failures);
+    bench_failures += failures;
+    bench_sink_context_t ctx;
+    bench_packet_json(&ctx.packet, 128, "icedepth");
+
+    if ((ctx.receiver_fd = bench_sink_receiver_unix(path_unix)) >= 0) {
+        const sink_config_t config = { .unix_path = path_unix };
+        if ((ctx.sink = &sink_unix)->begin(&config)) {
+            snprintf(name, sizeof(name), "sink/unix/size=%d", ctx.packet.size);
+            bench_run(name, bench_fn_sink, &ctx, (uint64_t)ctx.packet.size);
+            ctx.sink->end();
+        }
+    }
+    if (ctx.receiver_fd >= 0)
+        close(ctx.receiver_fd);
+    unlink(path_unix);
+
+    if ((ctx.receiver_fd = bench_sink_receiver_udp(address_udp, sizeof(address_udp))) >= 0) {
+        const sink_config_t config = { .udp_address = address_udp };
+        if ((ctx.sink = &sink_udp)->begin(&config)) {
+            snprintf(name, sizeof(name), "sink/udp/size=%d", ctx.packet.size);
+            bench_run(name, bench_fn_sink, &ctx, (uint64_t)ctx.packet.size);
+            ctx.sink->end();
+        }
+    }
+    if (ctx.receiver_fd >= 0)
+        close(ctx.receiver_fd);
+
+    ctx.receiver_fd = -1;
+    const sink_config_t config = { .file_path = path_file, .file_rotate_size = SINK_FILE_ROTATE_SIZE_DEFAULT, .file_rotate_count = 0 };
+    if ((ctx.sink = &sink_file)->begin(&config)) {
+        snprintf(name, sizeof(name), "sink/file/size=%d", ctx.packet.size);
+        bench_run(name, bench_fn_sink, &ctx, (uint64_t)ctx.packet.size);
+        ctx.sink->end();
+    }
+    unlink(path_file);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// clang-format off
+const struct option bench_options [] = {
+    {"output",                required_argument, 0, 0},
+    {"filter",                required_argument, 0, 0},
+    {"time",                  required_argument, 0, 0},
+    {"label",                 required_argument, 0, 0},
+    {0, 0, 0, 0}
+};
+// clang-format on
+
+int main(int argc, char *argv[]) {
+
+    setbuf(stdout, NULL);
+
+    const char *output = NULL, *label = NULL;
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, argv, "", bench_options, &option_index)) != -1) {
+        if (c != 0)
+            return EXIT_FAILURE;
+        const char *name = bench_options[option_index].name;
+        if (strcmp(name, "output") == 0)
+            output = optarg;
+        else if (strcmp(name, "filter") == 0)
+            bench_filter = optarg;
+        else if (strcmp(name, "time") == 0)
+            bench_time_ms = (uint32_t)atoi(optarg);
+        else if (strcmp(name, "label") == 0)
+            label = optarg;
+    }
+
+    printf("bench: time=%" PRIu32 "ms, filter=%s, cycles=%s, simd=%s\n", bench_time_ms, bench_filter ? bench_filter : "none", BENCH_CYCLES_SOURCE, simd_level_tostring(simd_level_parse(NULL)));
+
+    json_scanner_select(NULL);
+    packet_encoders_select(NULL);
+    bench_suite_route();
+    bench_suite_reload();
+    bench_suite_topic();
+    bench_suite_filter();
+    bench_suite_json();
+    bench_suite_json_validate();
+    bench_suite_schema();
+    bench_suite_packet();
+    bench_suite_stats();
+    bench_suite_metrics();
+    bench_suite_health();
+    bench_suite_latency();
+    bench_suite_serial_gap();
+    bench_suite_capture();
+    bench_suite_trace();
+    bench_suite_config();
+    bench_suite_admission();
+    bench_suite_tdma();
+    bench_suite_dedup();
+    bench_suite_sink();
+
+    if (output && !bench_write_json(output, label))
+        return EXIT_FAILURE;
+
+    if (bench_failures > 0) {
+        printf("bench: %d check failures\n", bench_failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
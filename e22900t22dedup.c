@@ -0,0 +1,259 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * E22-900T22 gateways to MQTT, deduplicated
+ */
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/util_linux.h"
+#include "include/metrics_linux.h"
+#include "include/latency_linux.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void printf_stdout(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+}
+void printf_stderr(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+#define PRINTF_DEBUG printf_stdout
+#define PRINTF_ERROR printf_stderr
+#define PRINTF_INFO  printf_stdout
+
+#include "include/serial_linux.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define CONFIG_FILE_DEFAULT   "e22900t22dedup.cfg"
+
+#define MQTT_CLIENT_DEFAULT   "e22900t22dedup"
+#define MQTT_SERVER_DEFAULT   "mqtt://localhost"
+
+#define SUBSCRIBE_DEFAULT     "e22900t22/+/#"
+#define KEY_DATA_DEFAULT      "data"
+#define KEY_RSSI_DEFAULT      "rssi"
+#define KEY_TS_DEFAULT        "ts"
+
+#define INTERVAL_STAT_DEFAULT 5 * 60
+
+#define SIMULATE_PACKETS_DEFAULT 10000
+
+#include "include/config_linux.h"
+
+// clang-format off
+const struct option config_options [] = {
+    {"config",                required_argument, 0, 0},
+    {"mqtt-client",           required_argument, 0, 0},
+    {"mqtt-server",           required_argument, 0, 0},
+    {"subscribe",             required_argument, 0, 0},
+    {"gateway-level",         required_argument, 0, 0},
+    {"output-name",           required_argument, 0, 0},
+    {"window",                required_argument, 0, 0},
+    {"entries",               required_argument, 0, 0},
+    {"key-data",              required_argument, 0, 0},
+    {"key-rssi",              required_argument, 0, 0},
+    {"key-ts",                required_argument, 0, 0},
+    {"stats-topic",           required_argument, 0, 0},
+    {"interval-stat",         required_argument, 0, 0},
+    {"simulate",              required_argument, 0, 0},
+    {"simulate-packets",      required_argument, 0, 0},
+    {0, 0, 0, 0}
+};
+// clang-format on
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define MQTT_CONNECT_TIMEOUT 60
+#define MQTT_PUBLISH_QOS     0
+#define MQTT_PUBLISH_RETAIN  false
+
+#include "include/mqtt_linux.h"
+
+void config_populate_mqtt(mqtt_config_t *cfg) {
+    cfg->client = config_get_string("mqtt-client", MQTT_CLIENT_DEFAULT);
+    cfg->server = config_get_string("mqtt-server", MQTT_SERVER_DEFAULT);
+    cfg->server_failover = NULL;
+    cfg->server_fanout = NULL;
+    cfg->queue_size = 0;
+    cfg->use_synchronous = false;
+    cfg->use_inline = true; // the table is only used from the main thread, where messages then arrive
+
+    printf("config: mqtt: client=%s, server=%s\n", cfg->client, cfg->server);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include "include/json_linux.h"
+#include "include/dedup_linux.h"
+
+typedef struct {
+    char *subscribe; // comma separated, split in place
+    int level;
+    const char *name;
+    uint32_t window, entries;
+    const char *keys[3];
+    const char *stats_topic;
+    const char *simulate;
+    uint32_t simulate_packets;
+} dedup_config_t;
+
+bool config_populate_dedup(dedup_config_t *cfg) {
+    static char subscribe[CONFIG_MAX_STRING];
+    snprintf(subscribe, sizeof(subscribe), "%s", config_get_string("subscribe", SUBSCRIBE_DEFAULT));
+    cfg->subscribe = subscribe;
+    cfg->level = config_get_integer("gateway-level", DEDUP_LEVEL_DEFAULT);
+    cfg->name = config_get_string("output-name", DEDUP_NAME_DEFAULT);
+    const int window = config_get_integer("window", DEDUP_WINDOW_DEFAULT), entries = config_get_integer("entries", DEDUP_ENTRIES_DEFAULT);
+    cfg->keys[0] = config_get_string("key-data", KEY_DATA_DEFAULT);
+    cfg->keys[1] = config_get_string("key-rssi", KEY_RSSI_DEFAULT);
+    cfg->keys[2] = config_get_string("key-ts", KEY_TS_DEFAULT);
+    cfg->stats_topic = config_get_string("stats-topic", NULL);
+    cfg->simulate = config_get_string("simulate", NULL);
+    const int simulate_packets = config_get_integer("simulate-packets", SIMULATE_PACKETS_DEFAULT);
+    if (cfg->level < 0 || cfg->level > 16) {
+        fprintf(stderr, "config: dedup: gateway-level %d is not 0 to 16\n", cfg->level);
+        return false;
+    }
+    if (*cfg->name == '\0' || strpbrk(cfg->name, "/+#") != NULL) {
+        fprintf(stderr, "config: dedup: output-name '%s' must be one topic level, without wildcards\n", cfg->name);
+        return false;
+    }
+    if (window <= 0 || window > 60000 || entries <= 0 || entries > DEDUP_ENTRIES_MAX || simulate_packets <= 0 || simulate_packets > 1000000) {
+        fprintf(stderr, "config: dedup: window (1 to 60000 ms), entries (1 to %d) or simulate-packets (1 to 1000000) out of range\n", DEDUP_ENTRIES_MAX);
+        return false;
+    }
+    cfg->window = (uint32_t)window;
+    cfg->entries = (uint32_t)entries;
+    cfg->simulate_packets = (uint32_t)simulate_packets;
+
+    printf("config: dedup: subscribe='%s', gateway-level=%d, output-name='%s', window=%" PRIu32 "ms, entries=%" PRIu32 " (%zu bytes), keys=%s/%s/%s, stats-topic=%s\n", cfg->subscribe, cfg->level, cfg->name, cfg->window, cfg->entries,
+           (size_t)cfg->entries * sizeof(dedup_entry_t), cfg->keys[0], cfg->keys[1], cfg->keys[2], cfg->stats_topic ? cfg->stats_topic : "none");
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+mqtt_config_t mqtt_config;
+dedup_config_t dedup_config;
+time_t interval_stat;
+
+bool config_setup(const int argc, char *argv[]) {
+    if (!config_load(CONFIG_FILE_DEFAULT, argc, argv, config_options))
+        return false;
+    config_populate_mqtt(&mqtt_config);
+    interval_stat = config_get_integer("interval-stat", INTERVAL_STAT_DEFAULT);
+    return config_populate_dedup(&dedup_config);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+dedup_table_t dedup_table;
+
+void dedup_publish(const char *topic, const uint8_t *payload, const int length) {
+    if (!mqtt_send(topic, (const char *)payload, length))
+        fprintf(stderr, "dedup: publish failed (topic='%s', size=%d)\n", topic, length);
+}
+
+void dedup_received(const char *topic, const unsigned char *payload, const int length) {
+    dedup_message(&dedup_table, topic, payload, length, time_monotonic_us());
+}
+
+void dedup_stats_publish(void) {
+    char buffer[DEDUP_PAYLOAD_MAX + (DEDUP_GATEWAYS_MAX * 192)];
+    const size_t length = dedup_stats_render(&dedup_table, buffer, sizeof(buffer));
+    if (length > 0)
+        mqtt_send_retained(dedup_config.stats_topic, buffer, (int)length);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+volatile bool running = true;
+
+void signal_handler(const int sig __attribute__((unused))) {
+    if (running) {
+        printf("stopping\n");
+        running = false;
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    setbuf(stdout, NULL);
+    printf("starting\n");
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    if (!config_setup(argc, argv))
+        return EXIT_FAILURE;
+    json_scanner_select(NULL);
+
+    if (dedup_config.simulate != NULL)
+        return dedup_simulate(dedup_config.simulate, dedup_config.simulate_packets, dedup_config.entries, dedup_config.window) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (!dedup_begin(&dedup_table, dedup_config.entries, dedup_config.window, dedup_config.level, dedup_config.name, dedup_config.keys, dedup_publish)) {
+        fprintf(stderr, "dedup: could not allocate %" PRIu32 " entries\n", dedup_config.entries);
+        return EXIT_FAILURE;
+    }
+    if (!mqtt_begin(&mqtt_config)) {
+        dedup_end(&dedup_table);
+        return EXIT_FAILURE;
+    }
+    for (char *topic = strtok(dedup_config.subscribe, ","); topic != NULL; topic = strtok(NULL, ","))
+        if (!mqtt_subscribe(topic, MQTT_PUBLISH_QOS, dedup_received)) {
+            mqtt_end();
+            dedup_end(&dedup_table);
+            return EXIT_FAILURE;
+        }
+
+    time_t interval_stat_last = 0;
+    while (running) {
+        mqtt_poll(dedup_wait_ms(&dedup_table, time_monotonic_us(), 1000));
+        dedup_poll(&dedup_table, time_monotonic_us());
+        if (running && intervalable(interval_stat, &interval_stat_last)) {
+            dedup_stats_display(&dedup_table, time_monotonic_us());
+            mqtt_stats_display();
+            if (dedup_config.stats_topic != NULL)
+                dedup_stats_publish();
+        }
+    }
+
+    dedup_flush(&dedup_table);
+    mqtt_drain(MQTT_DRAIN_TIMEOUT_DEFAULT);
+    dedup_stats_display(&dedup_table, time_monotonic_us());
+    mqtt_end();
+    dedup_end(&dedup_table);
+
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -19,6 +19,11 @@
 #include <time.h>
 
 #include "include/util_linux.h"
+#include "include/metrics_linux.h"
+#include "include/latency_linux.h"
+#include "include/stats_linux.h"
+#include "include/capture_linux.h"
+#include "include/trace_linux.h"
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -73,6 +78,7 @@ void __sleep_ms(const uint32_t ms) {
 #define MQTT_CLIENT_DEFAULT    "e22900t22tomqtt"
 #define MQTT_SERVER_DEFAULT    "mqtt://localhost"
 #define MQTT_TOPIC_DEFAULT     "e22900t22"
+#define MQTT_LOOP_DEFAULT      "thread"
 
 #define INTERVAL_STAT_DEFAULT  5 * 60
 #define INTERVAL_RSSI_DEFAULT  1 * 60
@@ -86,6 +92,17 @@ const struct option config_options [] = {
     {"config",                required_argument, 0, 0},
     {"mqtt-client",           required_argument, 0, 0},
     {"mqtt-server",           required_argument, 0, 0},
+    {"mqtt-server-failover",  required_argument, 0, 0},
+    {"mqtt-server-fanout",    required_argument, 0, 0},
+    {"mqtt-queue-size",       required_argument, 0, 0},
+    {"mqtt-loop",             required_argument, 0, 0},
+    {"sink",                  required_argument, 0, 0},
+    {"sink-unix",             required_argument, 0, 0},
+    {"sink-udp",              required_argument, 0, 0},
+    {"sink-udp-ttl",          required_argument, 0, 0},
+    {"sink-file",             required_argument, 0, 0},
+    {"sink-file-rotate-size", required_argument, 0, 0},
+    {"sink-file-rotate-count",required_argument, 0, 0},
     {"port",                  required_argument, 0, 0},
     {"rate",                  required_argument, 0, 0},
     {"bits",                  required_argument, 0, 0},
@@ -99,21 +116,60 @@ const struct option config_options [] = {
     {"rssi-channel",          required_argument, 0, 0},
     {"read-timeout-command",  required_argument, 0, 0},
     {"read-timeout-packet",   required_argument, 0, 0},
+    {"serial-gap",            required_argument, 0, 0},
     {"interval-stat",         required_argument, 0, 0},
     {"interval-rssi",         required_argument, 0, 0},
     {"data-type",             required_argument, 0, 0},
+    {"envelope",              required_argument, 0, 0},
+    {"convert-encoding",      required_argument, 0, 0},
+    {"metrics",               required_argument, 0, 0},
+    {"health-topic",          required_argument, 0, 0},
+    {"admission-key",         required_argument, 0, 0},
+    {"admission-rate",        required_argument, 0, 0},
+    {"admission-burst",       required_argument, 0, 0},
+    {"admission-action",      required_argument, 0, 0},
+    {"admission-sample",      required_argument, 0, 0},
+    {"admission-topic",       required_argument, 0, 0},
+    {"admission-sources",     required_argument, 0, 0},
+    {"tdma-key",              required_argument, 0, 0},
+    {"tdma-slot-bytes",       required_argument, 0, 0},
+    {"tdma-guard",            required_argument, 0, 0},
+    {"tdma-contention",       required_argument, 0, 0},
+    {"tdma-slots",            required_argument, 0, 0},
+    {"tdma-beacon-pages",     required_argument, 0, 0},
+    {"tdma-nodes",            required_argument, 0, 0},
+    {"tdma-expire",           required_argument, 0, 0},
+    {"tdma-simulate",         required_argument, 0, 0},
+    {"tdma-simulate-interval",required_argument, 0, 0},
+    {"tdma-simulate-duration",required_argument, 0, 0},
+    {"trace-file",            required_argument, 0, 0},
+    {"capture",               required_argument, 0, 0},
+    {"replay",                required_argument, 0, 0},
+    {"replay-speed",          required_argument, 0, 0},
     {"debug-e22900t22",       required_argument, 0, 0},
     {"debug",                 required_argument, 0, 0},
     {0, 0, 0, 0}
 };
 // clang-format on
 
+// "auto" for the gap from the UART and air rates, adapted to the gaps seen, or a fixed gap in milliseconds
+const char *serial_gap_setting = "auto";
+
 void config_populate_serial(serial_config_t *cfg) {
     cfg->port = config_get_string("port", SERIAL_PORT_DEFAULT);
     cfg->rate = config_get_integer("rate", SERIAL_RATE_DEFAULT);
     cfg->bits = config_get_bits("bits", SERIAL_BITS_DEFAULT);
+    serial_gap_setting = config_get_string("serial-gap", "auto");
+
+    printf("config: serial: port=%s, rate=%d, bits=%s, gap=%s\n", cfg->port, cfg->rate, serial_bits_str(cfg->bits), serial_gap_setting);
+}
 
-    printf("config: serial: port=%s, rate=%d, bits=%s\n", cfg->port, cfg->rate, serial_bits_str(cfg->bits));
+// after the device is connected, as the gap depends on its air rate and sub-packet size
+void serial_gap_setup(const serial_config_t *cfg) {
+    if (strcmp(serial_gap_setting, "auto") == 0)
+        serial_gap_begin(device_frame_gap_us(cfg->rate), true);
+    else
+        serial_gap_begin((uint32_t)atoi(serial_gap_setting) * 1000, false);
 }
 
 void config_populate_e22900t22(e22900t22_config_t *cfg) {
@@ -149,141 +205,360 @@ void config_populate_e22900t22(e22900t22_config_t *cfg) {
 
 #include "include/mqtt_linux.h"
 
+void config_populate_mqtt(mqtt_config_t *cfg) {
+    cfg->client = config_get_string("mqtt-client", MQTT_CLIENT_DEFAULT);
+    cfg->server = config_get_string("mqtt-server", MQTT_SERVER_DEFAULT);
+    cfg->server_failover = config_get_string("mqtt-server-failover", NULL);
+    cfg->server_fanout = config_get_string("mqtt-server-fanout", NULL);
+    cfg->queue_size = config_get_integer("mqtt-queue-size", MQTT_QUEUE_SIZE_DEFAULT);
+    cfg->use_synchronous = false;
+    const char *loop = config_get_string("mqtt-loop", MQTT_LOOP_DEFAULT);
+    if (strcmp(loop, "inline") != 0 && strcmp(loop, "thread") != 0)
+        fprintf(stderr, "config: mqtt: unknown loop '%s', using '%s'\n", loop, MQTT_LOOP_DEFAULT);
+    cfg->use_inline = strcmp(loop, "inline") == 0;
+
+    printf("config: mqtt: client=%s, server=%s, server-failover=%s, server-fanout=%s, queue-size=%d, loop=%s\n", cfg->client, cfg->server, cfg->server_failover ? cfg->server_failover : "none",
+           cfg->server_fanout ? cfg->server_fanout : "none", cfg->queue_size, cfg->use_inline ? "inline" : "thread");
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-typedef enum {
-    DATA_TYPE_JSON = 0,
-    DATA_TYPE_ANY = 1,
-    DATA_TYPE_JSON_CONVERT = 2,
-} data_type_t;
-
-data_type_t data_type_parse(const char *data_type_str) {
-    if (strcmp(data_type_str, "json") == 0)
-        return DATA_TYPE_JSON;
-    else if (strcmp(data_type_str, "json-convert") == 0)
-        return DATA_TYPE_JSON_CONVERT;
-    else if (strcmp(data_type_str, "any") == 0)
-        return DATA_TYPE_ANY;
-    else {
-        fprintf(stderr, "warning: unknown data-type '%s', using default 'json-convert'\n", data_type_str);
-        return DATA_TYPE_JSON_CONVERT;
-    }
+#define SINK_DEFAULT "mqtt"
+
+#include "include/json_linux.h"
+#include "include/sink_linux.h"
+
+bool __sink_mqtt_send(const char *topic, const uint8_t *data, const int length) {
+    return mqtt_send(topic, (const char *)data, length);
 }
-const char *data_type_tostring(const data_type_t data_type) {
-    switch (data_type) {
-    case DATA_TYPE_JSON:
-        return "json";
-    case DATA_TYPE_JSON_CONVERT:
-        return "json-convert";
-    case DATA_TYPE_ANY:
-    default:
-        return "any";
-    }
+
+sink_t sink_mqtt = { .name = "mqtt", .begin = NULL, .send = __sink_mqtt_send, .poll = NULL, .end = NULL };
+
+uint32_t sink_default = 0;
+
+void config_populate_sinks(sink_config_t *cfg) {
+    sink_register(&sink_mqtt);
+    sink_register(&sink_unix);
+    sink_register(&sink_udp);
+    sink_register(&sink_file);
+    cfg->unix_path = config_get_string("sink-unix", NULL);
+    cfg->udp_address = config_get_string("sink-udp", NULL);
+    cfg->udp_ttl = config_get_integer("sink-udp-ttl", SINK_UDP_TTL_DEFAULT);
+    cfg->file_path = config_get_string("sink-file", NULL);
+    cfg->file_rotate_size = config_get_integer("sink-file-rotate-size", SINK_FILE_ROTATE_SIZE_DEFAULT);
+    cfg->file_rotate_count = config_get_integer("sink-file-rotate-count", SINK_FILE_ROTATE_COUNT_DEFAULT);
+    const char *sink_default_str = config_get_string("sink", SINK_DEFAULT);
+    sink_default = sink_parse(sink_default_str);
+
+    printf("config: sinks: default=%s, unix=%s, udp=%s (ttl=%d), file=%s (rotate-size=%d, rotate-count=%d)\n", sink_default_str, cfg->unix_path ? cfg->unix_path : "none", cfg->udp_address ? cfg->udp_address : "none", cfg->udp_ttl,
+           cfg->file_path ? cfg->file_path : "none", cfg->file_rotate_size, cfg->file_rotate_count);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-#define MAX_TOPIC_ROUTES 16
+#include "include/filter_linux.h"
+#include "include/packet_linux.h"
+#include "include/schema_linux.h"
+#include "include/health_linux.h"
+#include "include/admission_linux.h"
+#include "include/tdma_linux.h"
 
-typedef struct {
-    const char *key;
-    const char *value;
-    const char *topic;
-} topic_route_t;
-
-topic_route_t topic_routes[MAX_TOPIC_ROUTES];
-const char *topic_route_default = NULL;
-size_t topic_route_count = 0;
-
-void config_populate_topic_routes(const char *topic_default) {
-    topic_route_default = topic_default;
-    topic_route_count = 0;
-    for (int i = 0; i < MAX_TOPIC_ROUTES; i++) {
-        char key_name[64];
-        snprintf(key_name, sizeof(key_name), "topic-route.%d.key", i);
-        const char *key = config_get_string(key_name, NULL);
-        if (!key)
-            continue;
-        char value_name[64], topic_name[64];
-        snprintf(value_name, sizeof(value_name), "topic-route.%d.value", i);
-        snprintf(topic_name, sizeof(topic_name), "topic-route.%d.topic", i);
-        const char *value = config_get_string(value_name, NULL);
-        const char *topic = config_get_string(topic_name, NULL);
-        if (value && topic) {
-            topic_routes[topic_route_count].key = key;
-            topic_routes[topic_route_count].value = value;
-            topic_routes[topic_route_count].topic = topic;
-            printf("config: topic-route[%d]: key='%s', value='%s', topic='%s'\n", (int)topic_route_count, key, value, topic);
-            topic_route_count++;
-        }
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool capture_rssi_packet = false, capture_rssi_channel = false;
+stats_rssi_t stat_channel_rssi, stat_packet_rssi;
+uint32_t stat_packets_okay = 0, stat_packets_drop = 0;
+time_t interval_stat = 0, interval_stat_last = 0;
+time_t interval_rssi = 0, interval_rssi_last = 0;
+int metric_packets_received, metric_packets_published, metric_packets_dropped[HEALTH_DROP_COUNT], metric_bytes_received, metric_bytes_published;
+int metric_packet_size, metric_packet_rssi, metric_serial_frame, metric_packet_process, metric_config_reloads[2];
+
+static const int64_t metrics_packet_size_bounds[] = { 8, 16, 32, 64, 96, 128, 160, 192, 224, E22900T22_PACKET_MAXSIZE };
+static const int64_t metrics_packet_rssi_bounds[] = { -120, -110, -100, -90, -80, -70, -60, -50, -40 };
+static const int64_t metrics_serial_frame_bounds_us[] = { 1000, 10000, 50000, 100000, 125000, 150000, 200000, 300000, 500000, 1000000, 2000000 };
+static const int64_t metrics_packet_process_bounds_us[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000, 10000 };
+#define METRICS_BOUNDS(bounds) bounds, (int)(sizeof(bounds) / sizeof(bounds[0]))
+
+int64_t metrics_channel_rssi_read(const void *context __attribute__((unused))) {
+    return stats_q8_round(stats_rssi_ema(&stat_channel_rssi));
+}
+
+int64_t metrics_channel_noise_floor_read(const void *context __attribute__((unused))) {
+    return stats_q8_round(stats_rssi_floor(&stat_channel_rssi));
+}
+
+int64_t metrics_start_time = 0;
+int64_t metrics_start_time_read(const void *context __attribute__((unused))) {
+    return metrics_start_time;
+}
+
+void metrics_setup(void) {
+    metrics_start_time = (int64_t)time(NULL);
+    metric_packets_received = metrics_counter_register("e22900t22_packets_received_total", NULL, "Packets read from the device.");
+    metric_packets_published = metrics_counter_register("e22900t22_packets_published_total", NULL, "Packets sent to all of their sinks.");
+    static const char *const dropped_labels[HEALTH_DROP_COUNT] = { "reason=\"not-json\"", "reason=\"no-route\"", "reason=\"topic-field\"", "reason=\"too-large\"", "reason=\"sink-failed\"", "reason=\"rate-limited\"" };
+    for (int reason = 0; reason < HEALTH_DROP_COUNT; reason++)
+        metric_packets_dropped[reason] = metrics_counter_register("e22900t22_packets_dropped_total", dropped_labels[reason], "Packets discarded, or not sent to all of their sinks, by reason.");
+    metric_bytes_received = metrics_counter_register("e22900t22_received_bytes_total", NULL, "Packet bytes read from the device, less RSSI.");
+    metric_bytes_published = metrics_counter_register("e22900t22_published_bytes_total", NULL, "Bytes of published messages, after conversion or envelope.");
+    metric_packet_size = metrics_histogram_register("e22900t22_packet_size_bytes", NULL, "Size of packets read from the device.", METRICS_BOUNDS(metrics_packet_size_bounds), 1);
+    metric_packet_rssi = metrics_histogram_register("e22900t22_packet_rssi_dbm", NULL, "RSSI of packets read from the device, if rssi-packet is on.", METRICS_BOUNDS(metrics_packet_rssi_bounds), 1);
+    metric_serial_frame = metrics_histogram_register("e22900t22_serial_frame_seconds", NULL, "Time from the first byte of a packet to its end, including the idle gap that ends it.", METRICS_BOUNDS(metrics_serial_frame_bounds_us), 1000000);
+    metric_packet_process = metrics_histogram_register("e22900t22_packet_process_seconds", NULL, "Time from a packet being read to it being sent to its sinks.", METRICS_BOUNDS(metrics_packet_process_bounds_us), 1000000);
+    metric_config_reloads[0] = metrics_counter_register("e22900t22_config_reloads_total", "result=\"rejected\"", "Configuration reloads (by SIGHUP), by result.");
+    metric_config_reloads[1] = metrics_counter_register("e22900t22_config_reloads_total", "result=\"applied\"", "Configuration reloads (by SIGHUP), by result.");
+    metrics_gauge_register("e22900t22_start_time_seconds", NULL, "Start time of the gateway since the epoch.", metrics_start_time_read, NULL);
+    if (capture_rssi_channel) {
+        metrics_gauge_register("e22900t22_channel_rssi_dbm", NULL, "Channel RSSI (moving average).", metrics_channel_rssi_read, NULL);
+        metrics_gauge_register("e22900t22_channel_noise_floor_dbm", NULL, "Channel noise floor, as tracked from channel RSSI.", metrics_channel_noise_floor_read, NULL);
     }
-    if (topic_route_count == 0)
-        printf("config: no topic routes configured, using default topic\n");
 }
-bool route_topic_match_json(const uint8_t *packet, const int packet_size, const char *key, const char *value) {
-    char search_pattern[64 + 64 + 64];
-    const int pattern_len = snprintf(search_pattern, sizeof(search_pattern), "\"%s\":\"%s\"", key, value);
-    if (pattern_len >= packet_size)
-        return false;
-    const uint8_t first_char = (uint8_t)search_pattern[0];
-    for (int i = 0; i <= packet_size - pattern_len; i++)
-        if (packet[i] == first_char && memcmp(packet + i, search_pattern, (size_t)pattern_len) == 0)
-            return true;
-    return false;
+
+static inline uint16_t trace_route_index(const topic_route_t *route) {
+    return route == NULL ? TRACE_ROUTE_NONE : route == &topic_route_default ? TRACE_ROUTE_DEFAULT : (uint16_t)(route - topic_routes);
 }
-bool route_topic_match_binary(const uint8_t *packet, const int packet_size, const char *key, const char *value) {
-    const int offset = atoi(key);
-    if (offset < 0 || offset >= packet_size)
+
+static inline void packet_dropped(const health_drop_t reason, const topic_route_t *route, const int size) {
+    TRACE_EVENT(TRACE_ROUTE, reason, trace_route_index(route), size, 0);
+    stat_packets_drop++;
+    metrics_counter_add(metric_packets_dropped[reason], 1);
+    health_dropped(reason, route);
+}
+
+const char *health_topic = NULL;
+char health_buffer[HEALTH_DOCUMENT_MAX];
+
+void health_publish(void) {
+    const size_t length = health_render(health_buffer, sizeof(health_buffer));
+    if (length == 0)
+        fprintf(stderr, "health: document too large (max %d bytes)\n", HEALTH_DOCUMENT_MAX);
+    else
+        mqtt_send_retained(health_topic, health_buffer, (int)length);
+}
+
+const char *capture_path = NULL, *replay_path = NULL;
+bool replaying = false;
+
+// a packet from the device (captured, if capture is on), or from the replay; first_us is the monotonic time of its first
+// byte. Replayed DIP captures have their RSSI converted to the USB scale, as the gateway's is the USB module
+bool packet_read(uint8_t *packet, int *packet_size, uint8_t *packet_rssi, uint64_t *first_us, volatile bool *running) {
+    if (!replaying) {
+        const uint32_t timeout_ms = tdma_enabled() ? tdma_wait_ms(time_monotonic_us(), _e22900txx_config.read_timeout_packet) : _e22900txx_config.read_timeout_packet;
+        if (!device_packet_read_timeout(packet, E22900T22_PACKET_MAXSIZE + 1, packet_size, packet_rssi, timeout_ms))
+            return false;
+        *first_us = latency_timespec_us(&serial_read_first);
+        if (capture_file != NULL)
+            capture_write(packet, *packet_size, *packet_rssi, _e22900txx_config.rssi_packet, E22900T22_MODULE_USB, *first_us);
+        return true;
+    }
+    static capture_frame_t frame;
+    const int size = capture_replay_read(&frame);
+    if (size < 0) {
+        printf("replay: end of capture, stopping\n");
+        *running = false;
         return false;
-    if (strlen(value) != 2)
+    }
+    if (size == 0)
+        return false;
+    if (size > E22900T22_PACKET_MAXSIZE) {
+        fprintf(stderr, "replay: discarding oversized frame (size=%d)\n", size);
         return false;
-    uint8_t expected_value = 0;
-    for (int i = 0; i < 2; i++) {
-        char c = value[i];
-        char digit;
-        if (c >= '0' && c <= '9')
-            digit = c - '0';
-        else if (c >= 'a' && c <= 'f')
-            digit = c - 'a' + 10;
-        else if (c >= 'A' && c <= 'F')
-            digit = c - 'A' + 10;
-        else
-            return false; // Invalid hex character
-        expected_value = (expected_value << 4) | (uint8_t)digit;
     }
-    return packet[offset] == expected_value;
+    memcpy(packet, frame.data, (size_t)size);
+    *packet_size = size;
+    *packet_rssi = frame.module == E22900T22_MODULE_DIP ? (uint8_t)(2 * (256 - (int)frame.rssi) > 255 ? 255 : 2 * (256 - (int)frame.rssi)) : frame.rssi;
+    *first_us = frame.time_us;
+    return true;
 }
-const char *route_topic_select(const uint8_t *packet, const int packet_size, const data_type_t data_type) {
-    if (topic_route_count == 0)
-        return topic_route_default;
-    for (size_t i = 0; i < topic_route_count; i++) {
-        bool match = false;
-        if (data_type == DATA_TYPE_JSON)
-            match = route_topic_match_json(packet, packet_size, topic_routes[i].key, topic_routes[i].value);
-        else
-            match = route_topic_match_binary(packet, packet_size, topic_routes[i].key, topic_routes[i].value);
-        if (match)
-            return topic_routes[i].topic;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+serial_config_t serial_config;
+e22900t22_config_t e22900t22_config;
+mqtt_config_t mqtt_config;
+sink_config_t sink_config;
+data_type_t data_type;
+
+bool config_setup(int argc, char *argv[]) {
+
+    if (!config_load(CONFIG_FILE_DEFAULT, argc, argv, config_options))
+        return false;
+
+    config_populate_serial(&serial_config);
+    config_populate_e22900t22(&e22900t22_config);
+    config_populate_mqtt(&mqtt_config);
+    config_populate_sinks(&sink_config);
+    if (!config_populate_topic_routes(MQTT_TOPIC_DEFAULT, sink_default) || !config_populate_schemas())
+        return false;
+
+    capture_rssi_packet = config_get_bool("rssi-packet", E22900T22_CONFIG_RSSI_PACKET_DEFAULT);
+    capture_rssi_channel = config_get_bool("rssi-channel", E22900T22_CONFIG_RSSI_CHANNEL_DEFAULT);
+    interval_stat = config_get_integer("interval-stat", INTERVAL_STAT_DEFAULT);
+    interval_rssi = config_get_integer("interval-rssi", INTERVAL_RSSI_DEFAULT);
+
+    data_type = data_type_parse(config_get_string("data-type", DATA_TYPE_TYPE_DEFAULT));
+    if (!config_populate_envelope(config_get_string("envelope", NULL)))
+        return false;
+    if (!config_populate_convert(config_get_string("convert-encoding", NULL)))
+        return false;
+
+    health_topic = config_get_string("health-topic", NULL);
+    printf("config: health: topic=%s\n", health_topic ? health_topic : "none");
+    if (!config_populate_admission())
+        return false;
+    if (!config_populate_tdma())
+        return false;
+
+    trace_begin(config_get_string("trace-file", TRACE_PATH_DEFAULT));
+
+    capture_path = config_get_string("capture", NULL);
+    replay_path = config_get_string("replay", NULL);
+    capture_replay_speed = (uint32_t)config_get_integer("replay-speed", 1);
+    printf("config: capture: capture=%s, replay=%s, replay-speed=%" PRIu32 "\n", capture_path ? capture_path : "none", replay_path ? replay_path : "none", capture_replay_speed);
+
+    debug_e22900t22 = config_get_integer("debug-e22900t22", false);
+    debug_readandsend = config_get_bool("debug", false);
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// SIGHUP reloads the configuration from the loop, between packets: the routes and transforms are built anew while the
+// current ones are held aside, then kept, or dropped for the current ones if the new configuration is invalid; the loop
+// is the only reader of them, and holds nothing of them between packets, so the swap needs no locking and the previous
+// routes are freed at once; the serial port is not touched meanwhile (the kernel buffers what arrives), so no packets
+// are lost, other than while the module is written, which happens only if its settings changed
+
+volatile sig_atomic_t config_reload_requested = 0;
+
+// settings that are only read at start, so are reported rather than applied if a reload changes them
+static const char *const config_reload_restart_keys[] = { "port", "rate", "bits", "mqtt-client", "mqtt-server", "mqtt-server-failover", "mqtt-server-fanout", "mqtt-queue-size", "mqtt-loop", "sink-unix", "sink-udp", "sink-udp-ttl", "sink-file",
+                                                          "sink-file-rotate-size", "sink-file-rotate-count", "metrics", "trace-file", "capture", "replay", "replay-speed", "admission-key", "admission-rate", "admission-burst", "admission-action", "admission-sample", "admission-topic", "admission-sources",
+                                                          "tdma-key", "tdma-slot-bytes", "tdma-guard", "tdma-contention", "tdma-slots", "tdma-beacon-pages", "tdma-nodes", "tdma-expire" };
+
+typedef struct {
+    topic_routes_table_t routes;
+    schema_t schemas[SCHEMAS_MAX];
+    int schema_count;
+    envelope_op_t envelope_ops[ENVELOPE_FIELDS_MAX];
+    int envelope_op_count;
+    packet_encoding_t packet_encoding;
+    data_type_t data_type;
+    uint32_t sink_default;
+    const char *health_topic;
+} config_transforms_t;
+
+config_transforms_t config_transforms_previous;
+
+// moves the routes into the holder, leaving none in use, and copies the rest
+static void __config_transforms_hold(config_transforms_t *held) {
+    memset(&held->routes, 0, sizeof(held->routes));
+    topic_routes_swap(&held->routes);
+    memcpy(held->schemas, schemas, sizeof(schemas));
+    held->schema_count = schema_count;
+    memcpy(held->envelope_ops, envelope_ops, sizeof(envelope_ops));
+    held->envelope_op_count = envelope_op_count;
+    held->packet_encoding = packet_encoding;
+    held->data_type = data_type;
+    held->sink_default = sink_default;
+    held->health_topic = health_topic;
+}
+
+// puts back those held, freeing the routes built since
+static void __config_transforms_restore(config_transforms_t *held) {
+    topic_routes_swap(&held->routes);
+    topic_routes_table_free(&held->routes);
+    memcpy(schemas, held->schemas, sizeof(schemas));
+    schema_count = held->schema_count;
+    memcpy(envelope_ops, held->envelope_ops, sizeof(envelope_ops));
+    envelope_op_count = held->envelope_op_count;
+    packet_encoding = held->packet_encoding;
+    data_type = held->data_type;
+    sink_default = held->sink_default;
+    health_topic = held->health_topic;
+}
+
+static bool __config_reload_rejected(const uint64_t start_us, const char *reason) {
+    fprintf(stderr, "config: reload: %s, keeping the current configuration\n", reason);
+    TRACE_EVENT(TRACE_RELOAD, 0, 0, (uint32_t)topic_route_count, (uint32_t)(time_monotonic_us() - start_us));
+    metrics_counter_add(metric_config_reloads[0], 1);
+    return false;
+}
+
+bool config_reload_apply(void) {
+    const uint64_t start_us = time_monotonic_us();
+    printf("config: reload\n");
+
+    if (!config_reload())
+        return __config_reload_rejected(start_us, "could not read configuration");
+
+    __config_transforms_hold(&config_transforms_previous);
+    sink_default = sink_parse(config_get_string("sink", SINK_DEFAULT));
+    const bool routes_valid = config_populate_topic_routes(MQTT_TOPIC_DEFAULT, sink_default);
+    const bool schemas_valid = config_populate_schemas();
+    data_type = data_type_parse(config_get_string("data-type", DATA_TYPE_TYPE_DEFAULT));
+    if (!routes_valid || !schemas_valid || !config_populate_envelope(config_get_string("envelope", NULL)) || !config_populate_convert(config_get_string("convert-encoding", NULL))) {
+        __config_transforms_restore(&config_transforms_previous);
+        config_reload_rollback();
+        return __config_reload_rejected(start_us, "invalid configuration");
     }
-    return NULL;
+    topic_routes_table_free(&config_transforms_previous.routes);
+    health_routes_reset();
+    health_topic = config_get_string("health-topic", NULL);
+
+    interval_stat = config_get_integer("interval-stat", INTERVAL_STAT_DEFAULT);
+    interval_rssi = config_get_integer("interval-rssi", INTERVAL_RSSI_DEFAULT);
+    debug_e22900t22 = config_get_integer("debug-e22900t22", false);
+    debug_readandsend = config_get_bool("debug", false);
+
+    // the module is only written if its settings changed, and not at all when replaying, as there is no device
+    const bool gap_changed = config_reload_changed("serial-gap");
+    serial_gap_setting = config_get_string("serial-gap", "auto");
+    e22900t22_config_t config_device;
+    config_populate_e22900t22(&config_device);
+    bool written = false;
+    if (replaying) {
+        if (device_config_differs(&e22900t22_config, &config_device))
+            fprintf(stderr, "config: reload: device settings changed, not applied when replaying\n");
+    } else if (device_reconfigure(&config_device, &written)) {
+        e22900t22_config = config_device;
+        capture_rssi_packet = config_device.rssi_packet;
+        capture_rssi_channel = config_device.rssi_channel;
+        if (written || gap_changed)
+            serial_gap_setup(&serial_config);
+    } else
+        fprintf(stderr, "config: reload: device settings could not be applied\n");
+
+    for (size_t i = 0; i < sizeof(config_reload_restart_keys) / sizeof(config_reload_restart_keys[0]); i++)
+        if (config_reload_changed(config_reload_restart_keys[i]))
+            fprintf(stderr, "config: reload: '%s' changed, which needs a restart\n", config_reload_restart_keys[i]);
+    config_reload_commit();
+
+    const uint64_t duration_us = time_monotonic_us() - start_us;
+    TRACE_EVENT(TRACE_RELOAD, 1, written, (uint32_t)topic_route_count, (uint32_t)duration_us);
+    metrics_counter_add(metric_config_reloads[1], 1);
+    printf("config: reload: applied in %" PRIu64 "us (routes=%zu, schemas=%d, data-type=%s, module=%s)\n", duration_us, topic_route_count, schema_count, data_type_tostring(data_type), written ? "written" : "unchanged");
+    return true;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-bool capture_rssi_packet = false, capture_rssi_channel = false;
-uint32_t stat_channel_rssi_cnt = 0, stat_packet_rssi_cnt = 0;
-uint8_t stat_channel_rssi_ema, stat_packet_rssi_ema;
-uint32_t stat_packets_okay = 0, stat_packets_drop = 0;
-time_t interval_stat = 0, interval_stat_last = 0;
-time_t interval_rssi = 0, interval_rssi_last = 0;
-#define PACKET_BUFFER_MAX ((E22900T22_PACKET_MAXSIZE * 2) + 4) // has +1 for RSSI; adds 2 for '["' <HEX> '"]'
+#define PACKET_BUFFER_MAX (E22900T22_PACKET_MAXSIZE + 1)                             // has +1 for RSSI
+#define PUBLISH_BUFFER_MAX (((E22900T22_PACKET_MAXSIZE * 2) + 4) + ENVELOPE_OVERHEAD_MAX) // '["' <HEX> '"]' is the largest conversion
+uint32_t envelope_seq = 0;
+volatile sig_atomic_t latency_display_requested = 0; // by SIGUSR1 (which also dumps the trace), shown from the loop
 
-void read_and_send(volatile bool *running, const data_type_t data_type) {
+void read_and_send(volatile bool *running) {
 
-    uint8_t packet_buffer[PACKET_BUFFER_MAX];
+    uint8_t packet_buffer[PACKET_BUFFER_MAX], publish_buffer[PUBLISH_BUFFER_MAX], decode_buffer[SCHEMA_OUTPUT_MAX];
+    char topic_buffer[TOPIC_LENGTH_MAX];
     int packet_size;
 
     printf("read-and-publish (stat=%" PRIu32 "s, rssi=%" PRIu32 "s [packets=%c, channel=%c], data-type=%s)\n", (uint32_t)interval_stat, (uint32_t)interval_rssi, capture_rssi_packet ? 'y' : 'n', capture_rssi_channel ? 'y' : 'n',
@@ -293,67 +568,103 @@ void read_and_send(volatile bool *running, const data_type_t data_type) {
 
         uint8_t packet_rssi = 0, channel_rssi = 0;
 
-        if (device_packet_read(packet_buffer, E22900T22_PACKET_MAXSIZE + 1, &packet_size, &packet_rssi) && *running) {
-            bool deliver = false;
-            switch (data_type) {
-            case DATA_TYPE_JSON:
-                if (!(deliver = is_reasonable_json(packet_buffer, packet_size))) {
-                    fprintf(stderr, "read-and-publish: discarding non-json packet (size=%d)\n", packet_size);
-                    stat_packets_drop++;
+        uint64_t first_us = 0;
+        admission_result_t admission = ADMISSION_ADMIT;
+        if (packet_read(packet_buffer, &packet_size, &packet_rssi, &first_us, running) && *running) {
+            const uint64_t read_us = time_monotonic_us();
+            TRACE_EVENT(TRACE_PACKET, packet_rssi, 0, packet_size, trace_bytes(packet_buffer, packet_size));
+            latency_current = (latency_stamp_t) { .first_us = first_us, .frame_us = read_us };
+            latency_record(LATENCY_STAGE_FRAME, first_us, read_us);
+            metrics_histogram_observe(metric_serial_frame, (int64_t)(read_us - first_us));
+            metrics_counter_add(metric_packets_received, 1);
+            health_received(packet_size);
+            if (tdma_enabled())
+                tdma_heard_packet(packet_buffer, packet_size);
+            metrics_counter_add(metric_bytes_received, (metrics_value_t)packet_size);
+            metrics_histogram_observe(metric_packet_size, packet_size);
+            if (_e22900txx_config.rssi_packet)
+                metrics_histogram_observe(metric_packet_rssi, get_rssi_dbm(packet_rssi));
+            const bool packet_json = json_validate(packet_buffer, packet_size);
+            const uint8_t *publish = packet_buffer;
+            int publish_size = packet_size;
+            const topic_route_t *route = NULL;
+            const char *topic = NULL;
+            if (data_type == DATA_TYPE_JSON && !packet_json) {
+                fprintf(stderr, "read-and-publish: discarding non-json packet (size=%d)\n", packet_size);
+                packet_dropped(HEALTH_DROP_NOT_JSON, NULL, packet_size);
+            } else if ((route = route_topic_select(packet_buffer, packet_size, data_type, envelope_op_count == 0 && data_type == DATA_TYPE_JSON_CONVERT && !packet_json)) == NULL) {
+                fprintf(stderr, "read-and-publish: no topic route match, discarding packet (size=%d)\n", packet_size);
+                packet_dropped(HEALTH_DROP_NO_ROUTE, NULL, packet_size);
+            } else if (admission_enabled() && (admission = admission_check(packet_buffer, packet_size, read_us)) == ADMISSION_DROP) {
+                packet_dropped(HEALTH_DROP_RATE_LIMITED, route, packet_size); // not logged, as the source may be flooding
+            } else if ((topic = admission == ADMISSION_DIVERT ? admission_topic_render(packet_buffer, packet_size, topic_buffer, TOPIC_LENGTH_MAX)
+                                                               : route_topic_render(route, packet_buffer, packet_size, topic_buffer, TOPIC_LENGTH_MAX)) == NULL) {
+                fprintf(stderr, "read-and-publish: topic template field missing, discarding packet (size=%d)\n", packet_size);
+                packet_dropped(HEALTH_DROP_TOPIC_FIELD, route, packet_size);
+            } else {
+                // a schema decodes non-JSON packets wherever they would otherwise be converted to hex or base64
+                const schema_t *schema = (!packet_json && (data_type == DATA_TYPE_JSON_CONVERT || envelope_op_count > 0)) ? schema_select(packet_buffer, packet_size) : NULL;
+                if (schema != NULL) {
+                    publish_size = schema_decode(schema, packet_buffer, decode_buffer);
+                    publish = decode_buffer;
                 }
-                break;
-            case DATA_TYPE_JSON_CONVERT:
-                if (!is_reasonable_json(packet_buffer, packet_size)) {
-                    const int json_size = 4 + (packet_size * 2);
-                    if (json_size >= PACKET_BUFFER_MAX) {
-                        fprintf(stderr, "read-and-publish: packet too large for conversion (size=%d)\n", packet_size);
-                        deliver = false;
-                        stat_packets_drop++;
-                        break;
-                    }
-                    const int data_offset = PACKET_BUFFER_MAX - packet_size;
-                    memmove(packet_buffer + data_offset, packet_buffer, (size_t)packet_size);
-                    packet_buffer[0] = '[';
-                    packet_buffer[1] = '"';
-                    for (int i = 0; i < packet_size; i++) {
-                        const uint8_t byte = packet_buffer[data_offset + i];
-                        packet_buffer[2 + (i * 2)] = (uint8_t)"0123456789abcdef"[byte >> 4];
-                        packet_buffer[2 + (i * 2) + 1] = (uint8_t)"0123456789abcdef"[byte & 0x0f];
-                    }
-                    packet_buffer[2 + (packet_size * 2)] = '"';
-                    packet_buffer[2 + (packet_size * 2) + 1] = ']';
-                    packet_size = json_size;
+                if (envelope_op_count > 0) {
+                    struct timespec ts;
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    const envelope_values_t values = {
+                        .ts = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000,
+                        .rssi = get_rssi_dbm(packet_rssi),
+                        .rssi_valid = _e22900txx_config.rssi_packet,
+                        .channel = _e22900txx_config.channel,
+                        .seq = envelope_seq++,
+                    };
+                    publish_size = packet_envelope_build(publish_buffer, PUBLISH_BUFFER_MAX, publish, publish_size, !packet_json && schema == NULL, &values);
+                    publish = publish_buffer;
+                } else if (schema == NULL && data_type == DATA_TYPE_JSON_CONVERT && !packet_json) {
+                    publish_size = packet_convert_json(publish_buffer, PUBLISH_BUFFER_MAX, packet_buffer, packet_size);
+                    publish = publish_buffer;
                 }
-                deliver = true;
-                break;
-            case DATA_TYPE_ANY:
-            default:
-                deliver = true;
-                break;
-            }
-            if (deliver) {
-                const char *topic = route_topic_select(packet_buffer, packet_size, data_type);
-                if (topic) {
+                if (publish_size < 0) {
+                    fprintf(stderr, "read-and-publish: packet too large for %s (size=%d)\n", envelope_op_count > 0 ? "envelope" : "conversion", packet_size);
+                    packet_dropped(HEALTH_DROP_TOO_LARGE, route, packet_size);
+                } else {
                     if (capture_rssi_packet)
-                        ema_update(packet_rssi, &stat_packet_rssi_ema, &stat_packet_rssi_cnt);
-                    if (mqtt_send(topic, (const char *)packet_buffer, packet_size))
+                        stats_rssi_update(&stat_packet_rssi, get_rssi_dbm_q8(packet_rssi));
+                    latency_current.classified_us = time_monotonic_us();
+                    latency_record(LATENCY_STAGE_CLASSIFY, read_us, latency_current.classified_us);
+                    if (sink_send(route->sinks, topic, publish, publish_size)) {
+                        TRACE_EVENT(TRACE_ROUTE, TRACE_ROUTE_OKAY, trace_route_index(route), packet_size, 0);
                         stat_packets_okay++;
-                    else {
-                        fprintf(stderr, "read-and-publish: mqtt send failed, discarding packet (size=%d)\n", packet_size);
-                        stat_packets_drop++;
+                        health_published(route);
+                        metrics_counter_add(metric_packets_published, 1);
+                        metrics_counter_add(metric_bytes_published, (metrics_value_t)publish_size);
+                        metrics_histogram_observe(metric_packet_process, (int64_t)(time_monotonic_us() - read_us));
+                    } else {
+                        fprintf(stderr, "read-and-publish: every sink failed, discarding packet (size=%d)\n", publish_size);
+                        packet_dropped(HEALTH_DROP_SINK_FAILED, route, packet_size);
                     }
-                } else {
-                    fprintf(stderr, "read-and-publish: no topic route match, discarding packet (size=%d)\n", packet_size);
-                    stat_packets_drop++;
                 }
             }
-            if (debug_readandsend)
-                device_packet_display(packet_buffer, packet_size, packet_rssi);
+            if (route != NULL)
+                health_routed(route, packet_size);
+            if (debug_readandsend) {
+                if (publish_size < 0)
+                    device_packet_display(packet_buffer, packet_size, packet_rssi);
+                else
+                    device_packet_display(publish, publish_size, packet_rssi);
+            }
         }
 
-        if (*running && capture_rssi_channel && intervalable(interval_rssi, &interval_rssi_last)) {
+        if (replaying) {
+            mqtt_poll(0); // otherwise, within the serial port's wait
+            metrics_poll();
+        }
+        tdma_poll(time_monotonic_us(), !replaying);
+        sink_poll();
+
+        if (*running && capture_rssi_channel && !replaying && intervalable(interval_rssi, &interval_rssi_last)) {
             if (device_channel_rssi_read(&channel_rssi) && *running)
-                ema_update(channel_rssi, &stat_channel_rssi_ema, &stat_channel_rssi_cnt);
+                stats_rssi_update(&stat_channel_rssi, get_rssi_dbm_q8(channel_rssi));
         }
 
         time_t period_stat;
@@ -363,44 +674,43 @@ void read_and_send(volatile bool *running, const data_type_t data_type) {
                    rate_drop % 100);
             stat_packets_okay = stat_packets_drop = 0;
             if (capture_rssi_channel)
-                printf(", channel-rssi=%d dBm (%" PRIu32 ")", get_rssi_dbm(stat_channel_rssi_ema), stat_channel_rssi_cnt);
+                stats_rssi_display("channel-rssi", &stat_channel_rssi, true);
             if (capture_rssi_packet)
-                printf(", packet-rssi=%d dbm (%" PRIu32 ")", get_rssi_dbm(stat_packet_rssi_ema), stat_packet_rssi_cnt);
+                stats_rssi_display("packet-rssi", &stat_packet_rssi, false);
             printf("\n");
+            mqtt_stats_display();
+            sink_stats_display();
+            admission_stats_display();
+            tdma_stats_display();
+            latency_display(true);
+            if (debug_readandsend && !replaying)
+                serial_gap_display();
+            if (health_topic != NULL)
+                health_publish();
+        }
+        if (latency_display_requested) {
+            latency_display_requested = 0;
+            latency_display(false);
+            printf("trace: dumped to '%s'\n", trace_path);
+        }
+        if (config_reload_requested) {
+            config_reload_requested = 0;
+            config_reload_apply();
         }
     }
 }
 
-// -----------------------------------------------------------------------------------------------------------------------------------------
-// -----------------------------------------------------------------------------------------------------------------------------------------
-
-serial_config_t serial_config;
-e22900t22_config_t e22900t22_config;
-const char *mqtt_client, *mqtt_server;
-data_type_t data_type;
-
-bool config_setup(int argc, char *argv[]) {
-
-    if (!config_load(CONFIG_FILE_DEFAULT, argc, argv, config_options))
-        return false;
-
-    config_populate_serial(&serial_config);
-    config_populate_e22900t22(&e22900t22_config);
-    config_populate_topic_routes(MQTT_TOPIC_DEFAULT);
-    mqtt_client = config_get_string("mqtt-client", MQTT_CLIENT_DEFAULT);
-    mqtt_server = config_get_string("mqtt-server", MQTT_SERVER_DEFAULT);
-
-    capture_rssi_packet = config_get_bool("rssi-packet", E22900T22_CONFIG_RSSI_PACKET_DEFAULT);
-    capture_rssi_channel = config_get_bool("rssi-channel", E22900T22_CONFIG_RSSI_CHANNEL_DEFAULT);
-    interval_stat = config_get_integer("interval-stat", INTERVAL_STAT_DEFAULT);
-    interval_rssi = config_get_integer("interval-rssi", INTERVAL_RSSI_DEFAULT);
-
-    data_type = data_type_parse(config_get_string("data-type", DATA_TYPE_TYPE_DEFAULT));
-
-    debug_e22900t22 = config_get_integer("debug-e22900t22", false);
-    debug_readandsend = config_get_bool("debug", false);
-
-    return true;
+// the serial port's wait also serves the metrics endpoint, and the mqtt clients when inline, so that neither waits for
+// a packet (or the read timeout) to be answered
+int read_and_send_poll_add(fd_set *rdset, fd_set *wrset, int nfds, uint32_t *timeout_ms) {
+    if (mqtt_config.use_inline)
+        nfds = mqtt_poll_add(rdset, wrset, nfds, timeout_ms);
+    return metrics_poll_add(rdset, wrset, nfds, timeout_ms);
+}
+void read_and_send_poll_service(const fd_set *rdset, const fd_set *wrset) {
+    if (mqtt_config.use_inline)
+        mqtt_poll_service(rdset, wrset);
+    metrics_poll_service(rdset, wrset);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -415,6 +725,17 @@ void signal_handler(const int sig __attribute__((unused))) {
     }
 }
 
+void signal_handler_display(const int sig __attribute__((unused))) {
+    latency_display_requested = 1;
+    TRACE_EVENT(TRACE_SIGNAL, SIGUSR1, 0, 0, 0);
+    trace_dump(SIGUSR1);
+}
+
+void signal_handler_reload(const int sig __attribute__((unused))) {
+    config_reload_requested = 1;
+    TRACE_EVENT(TRACE_SIGNAL, SIGHUP, 0, 0, 0);
+}
+
 int main(int argc, char *argv[]) {
 
     setbuf(stdout, NULL);
@@ -422,33 +743,84 @@ int main(int argc, char *argv[]) {
 
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, signal_handler_display);
+    signal(SIGHUP, signal_handler_reload);
 
     if (!config_setup(argc, argv))
         return EXIT_FAILURE;
 
-    if (!serial_begin(&serial_config) || !serial_connect()) {
-        fprintf(stderr, "device: failed to connect (port=%s, rate=%d, bits=%s)\n", serial_config.port, serial_config.rate, serial_bits_str(serial_config.bits));
-        return EXIT_FAILURE;
+    if (tdma_config.simulate != NULL) {
+        // no device: its settings are only for the air time
+        device_connect(E22900T22_MODULE_USB, &e22900t22_config);
+        return tdma_simulate() ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    if (!device_connect(E22900T22_MODULE_USB, &e22900t22_config)) {
-        serial_end();
-        return EXIT_FAILURE;
+
+    if ((replaying = (replay_path != NULL))) {
+        // no device: the capture's RSSI setting stands in for the device's, and the channel is not read
+        if (!capture_replay_begin(replay_path, capture_replay_speed))
+            return EXIT_FAILURE;
+        e22900t22_config.rssi_packet = capture_replay_next.rssi_valid;
+        capture_rssi_packet = e22900t22_config.rssi_packet;
+        capture_rssi_channel = false;
+        device_connect(E22900T22_MODULE_USB, &e22900t22_config);
+    } else {
+        if (!serial_begin(&serial_config) || !serial_connect()) {
+            fprintf(stderr, "device: failed to connect (port=%s, rate=%d, bits=%s)\n", serial_config.port, serial_config.rate, serial_bits_str(serial_config.bits));
+            return EXIT_FAILURE;
+        }
+        if (!device_connect(E22900T22_MODULE_USB, &e22900t22_config)) {
+            serial_end();
+            return EXIT_FAILURE;
+        }
+        printf("device: connected (port=%s, rate=%d, bits=%s)\n", serial_config.port, serial_config.rate, serial_bits_str(serial_config.bits));
+        serial_gap_setup(&serial_config);
+        if (!(device_mode_config() && device_info_read() && device_config_read_and_update() && device_mode_transfer())) {
+            device_disconnect();
+            serial_end();
+            return EXIT_FAILURE;
+        }
+        if (capture_path != NULL && !capture_begin(capture_path)) {
+            device_disconnect();
+            serial_end();
+            return EXIT_FAILURE;
+        }
     }
-    printf("device: connected (port=%s, rate=%d, bits=%s)\n", serial_config.port, serial_config.rate, serial_bits_str(serial_config.bits));
-    if (!(device_mode_config() && device_info_read() && device_config_read_and_update() && device_mode_transfer())) {
+
+    if (!tdma_begin(serial_config.rate) || !mqtt_begin(&mqtt_config)) {
+        tdma_end();
+        capture_end();
+        capture_replay_end();
         device_disconnect();
         serial_end();
         return EXIT_FAILURE;
     }
 
-    if (!mqtt_begin(mqtt_server, mqtt_client, false)) {
+    sink_begin(&sink_config);
+    health_begin();
+    metrics_setup();
+    if (!metrics_begin(config_get_string("metrics", NULL))) {
+        sink_end();
+        tdma_end();
+        capture_end();
+        capture_replay_end();
         device_disconnect();
         serial_end();
+        mqtt_end();
         return EXIT_FAILURE;
     }
-
-    read_and_send(&running, data_type);
-
+    if (mqtt_config.use_inline || metrics_listening())
+        serial_poll_hook = (serial_poll_hook_t) { .add = read_and_send_poll_add, .service = read_and_send_poll_service };
+
+    read_and_send(&running);
+    if (replaying)
+        mqtt_drain(MQTT_DRAIN_TIMEOUT_DEFAULT);
+
+    metrics_end();
+    admission_end();
+    tdma_end();
+    sink_end();
+    capture_end();
+    capture_replay_end();
     device_disconnect();
     serial_end();
     mqtt_end();
@@ -1,13 +1,24 @@
 #!/bin/bash
 
-# Hex JSON decoder for mosquitto messages using packed json
+# Hex (or base64, with -b, for convert-encoding=base64) JSON decoder for mosquitto messages using packed json
 # Usage: ./decode.sh '["6e6f745f76616c69645f6a736f6e"]'
+#        ./decode.sh -b '["bm90X3ZhbGlkX2pzb24="]'
 # Or pipe: echo '["6e6f745f76616c69645f6a736f6e"]' | ./decode.sh
 
+encoding=hex
+if [ "$1" = "-b" ]; then
+    encoding=base64
+    shift
+fi
+
 decode_hex() {
     local input="$1"
     local hex_string=$(echo "$input" | sed 's/^\["//' | sed 's/"\]$//')
-    echo "$hex_string" | xxd -r -p
+    if [ "$encoding" = "base64" ]; then
+        echo "$hex_string" | base64 -d
+    else
+        echo "$hex_string" | xxd -r -p
+    fi
 }
 
 if [ $# -gt 0 ]; then
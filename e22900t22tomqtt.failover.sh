@@ -0,0 +1,114 @@
+#!/bin/bash
+
+# Failover check against two local mosquitto brokers: replays a capture of numbered JSON packets through the gateway
+# with mqtt-server and mqtt-server-failover set, kills the primary broker part way through, and checks that publishing
+# resumes on the failover broker and that no more packets are lost than the primary's queue holds (those sent within
+# the 10 second holdoff wait there, unsent, as the primary is gone)
+# Usage: ./e22900t22tomqtt.failover.sh [packets] [rate/s] [kill-after-s]
+# Needs mosquitto and mosquitto_sub, and the gateway built (make tomqtt)
+
+PACKETS=${1:-600}
+RATE=${2:-20}
+KILL_AFTER=${3:-10}
+QUEUE=${QUEUE:-256}
+PORT_PRIMARY=${PORT_PRIMARY:-18831}
+PORT_FAILOVER=${PORT_FAILOVER:-18832}
+GATEWAY=${GATEWAY:-./e22900t22tomqtt}
+
+for command in mosquitto mosquitto_sub "$GATEWAY"; do
+    if ! command -v "$command" >/dev/null; then
+        echo "failover: '$command' not found" >&2
+        exit 1
+    fi
+done
+if [ $((RATE * 10)) -ge "$QUEUE" ]; then
+    echo "failover: $RATE packets/s over the 10s holdoff would fill the queue ($QUEUE), lower the rate" >&2
+    exit 1
+fi
+
+dir=$(mktemp -d)
+pids=()
+cleanup() {
+    kill "${pids[@]}" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+le16() {
+    printf '\\x%02x\\x%02x' $(($1 & 255)) $((($1 >> 8) & 255))
+}
+le32() {
+    printf '\\x%02x\\x%02x\\x%02x\\x%02x' $(($1 & 255)) $((($1 >> 8) & 255)) $((($1 >> 16) & 255)) $((($1 >> 24) & 255))
+}
+
+# pcap with the LINKTYPE_USER0 link type, each record a frame header (version 1, no rssi, usb) and {"seq":N}
+{
+    printf "%b" "$(le32 $((0xa1b2c3d4)))$(le16 2)$(le16 4)$(le32 0)$(le32 0)$(le32 65535)$(le32 147)"
+    interval_us=$((1000000 / RATE))
+    for ((seq = 0; seq < PACKETS; seq++)); do
+        payload="{\"seq\":$seq}"
+        length=$((4 + ${#payload}))
+        at_us=$((seq * interval_us))
+        printf "%b" "$(le32 $((1000 + at_us / 1000000)))$(le32 $((at_us % 1000000)))$(le32 $length)$(le32 $length)\\x01\\x00\\x00\\x00"
+        printf "%s" "$payload"
+    done
+} >"$dir/packets.pcap"
+
+cat >"$dir/gateway.cfg" <<EOF
+mqtt-server=mqtt://127.0.0.1:$PORT_PRIMARY
+mqtt-server-failover=mqtt://127.0.0.1:$PORT_FAILOVER
+mqtt-queue-size=$QUEUE
+data-type=json
+replay=$dir/packets.pcap
+replay-speed=1
+EOF
+
+mosquitto -p "$PORT_PRIMARY" >"$dir/primary.log" 2>&1 &
+pid_primary=$!
+pids+=($pid_primary)
+mosquitto -p "$PORT_FAILOVER" >"$dir/failover.log" 2>&1 &
+pids+=($!)
+sleep 1
+mosquitto_sub -h 127.0.0.1 -p "$PORT_PRIMARY" -t '#' >"$dir/primary.received" 2>/dev/null &
+pids+=($!)
+mosquitto_sub -h 127.0.0.1 -p "$PORT_FAILOVER" -t '#' >"$dir/failover.received" 2>/dev/null &
+pids+=($!)
+sleep 1
+
+echo "failover: replaying $PACKETS packets at $RATE/s, killing the primary after ${KILL_AFTER}s"
+"$GATEWAY" --config="$dir/gateway.cfg" >"$dir/gateway.log" 2>&1 &
+pid_gateway=$!
+sleep "$KILL_AFTER"
+kill -9 "$pid_primary"
+wait "$pid_primary" 2>/dev/null
+wait "$pid_gateway"
+result=$?
+sleep 1
+
+received() {
+    grep -o '"seq":[0-9]*' "$@" | cut -d: -f2 | sort -un
+}
+received_primary=$(received "$dir/primary.received" | wc -l)
+received_failover=$(received "$dir/failover.received" | wc -l)
+received_total=$(received "$dir/primary.received" "$dir/failover.received" | wc -l)
+lost=$((PACKETS - received_total))
+last=$(received "$dir/primary.received" "$dir/failover.received" | tail -1)
+grep "failing over\|failing back" "$dir/gateway.log"
+echo "failover: received primary=$received_primary, failover=$received_failover, total=$received_total of $PACKETS, lost=$lost (queue=$QUEUE), last seq=$last"
+
+failures=0
+if [ "$result" -ne 0 ]; then
+    echo "failover: gateway exited with $result" >&2
+    failures=$((failures + 1))
+fi
+if [ "$received_failover" -eq 0 ] || [ "$last" != $((PACKETS - 1)) ]; then
+    echo "failover: publishing did not resume on the failover broker" >&2
+    failures=$((failures + 1))
+fi
+if [ "$lost" -gt "$QUEUE" ]; then
+    echo "failover: lost $lost packets, more than the queue ($QUEUE)" >&2
+    failures=$((failures + 1))
+fi
+echo "failover: $failures failures"
+[ "$failures" -eq 0 ]
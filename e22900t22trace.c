@@ -0,0 +1,67 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * E22-900T22 trace decoder
+ *
+ * Decodes a flight recorder dump from e22900t22tomqtt (written on SIGUSR1 or a crash to trace-file) into
+ * one line per event, oldest first, with the wall clock time and the interval from the previous event.
+ */
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/trace_linux.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// e.g. 2026-10-18T09:30:01.123456Z
+static const char *trace_time_tostring(char *buffer, const size_t size, const uint64_t realtime_ns) {
+    const time_t seconds = (time_t)(realtime_ns / 1000000000ULL);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    const size_t length = strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buffer + length, size - length, ".%06" PRIu64 "Z", (uint64_t)((realtime_ns % 1000000000ULL) / 1000ULL));
+    return buffer;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace-file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace_header_t header;
+    uint32_t count = 0;
+    trace_event_t *events = trace_load(argv[1], &header, &count);
+    if (events == NULL)
+        return EXIT_FAILURE;
+
+    // events are placed on the wall clock by their distance from the dump, as the monotonic clock has no epoch
+    char time_buffer[64], event_buffer[256];
+    printf("trace: '%s' (pid=%" PRId32 ", reason=%s, dumped=%s, events=%" PRIu32 " of %" PRIu32 " recorded)\n", argv[1], header.pid, header.reason == 0 ? "none" : strsignal(header.reason),
+           trace_time_tostring(time_buffer, sizeof(time_buffer), header.realtime_ns), count, header.next);
+    for (uint32_t i = 0; i < count; i++) {
+        const trace_event_t *event = &events[i];
+        const uint64_t before_ns = header.monotonic_ns > event->time_ns ? header.monotonic_ns - event->time_ns : 0;
+        const uint64_t interval_us = i > 0 && event->time_ns > events[i - 1].time_ns ? (event->time_ns - events[i - 1].time_ns) / 1000 : 0;
+        trace_event_format(event_buffer, sizeof(event_buffer), event);
+        printf("%s +%" PRIu64 ".%06" PRIu64 " #%" PRIu32 " %s\n", trace_time_tostring(time_buffer, sizeof(time_buffer), header.realtime_ns - before_ns), interval_us / 1000000, interval_us % 1000000, event->seq - 1, event_buffer);
+    }
+
+    free(events);
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
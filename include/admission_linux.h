@@ -0,0 +1,407 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// per source admission: the source is a key rendered from the packet by a topic template (e.g. '{json:id}' or
+// '{hex:0-3}'), and each source has a token bucket of 'admission-burst' packets refilled at 'admission-rate' packets
+// per minute; a packet over the rate is dropped, passed 1 in 'admission-sample' (the rest dropped), or diverted to the
+// 'admission-topic' (itself a template), and packets without the key are admitted. The sources are held in a fixed
+// table of 'admission-sources' entries with a linear probed index of twice as many slots (deletion by backward shift,
+// so without tombstones) and a least recently used list, the oldest of which is evicted for a new source when it is full.
+// Tokens are in millionths of a packet, so that slow rates refill without floating point. Only the main thread uses it.
+
+#define ADMISSION_SOURCES_DEFAULT 4096
+#define ADMISSION_SOURCES_MAX     (1 << 20)
+#define ADMISSION_RATE_DEFAULT    60 // per minute
+#define ADMISSION_BURST_DEFAULT   10
+#define ADMISSION_SAMPLE_DEFAULT  10
+#define ADMISSION_KEY_MAX         40
+#define ADMISSION_TOKEN           1000000
+#define ADMISSION_DISPLAY_TOP     5
+
+typedef enum {
+    ADMISSION_ACTION_DROP = 0,
+    ADMISSION_ACTION_SAMPLE = 1,
+    ADMISSION_ACTION_DIVERT = 2,
+} admission_action_t;
+
+typedef enum {
+    ADMISSION_ADMIT = 0,
+    ADMISSION_DROP = 1,
+    ADMISSION_DIVERT = 2,
+} admission_result_t;
+
+const char *admission_action_tostring(const admission_action_t action) {
+    switch (action) {
+    case ADMISSION_ACTION_DROP:
+        return "drop";
+    case ADMISSION_ACTION_SAMPLE:
+        return "sample";
+    case ADMISSION_ACTION_DIVERT:
+        return "divert";
+    default:
+        return "unknown";
+    }
+}
+
+typedef enum {
+    ADMISSION_COUNT_ADMITTED = 0,
+    ADMISSION_COUNT_LIMITED = 1, // over the rate, and then one of
+    ADMISSION_COUNT_DROPPED = 2,
+    ADMISSION_COUNT_SAMPLED = 3,
+    ADMISSION_COUNT_DIVERTED = 4,
+    ADMISSION_COUNT_TYPES = 5,
+} admission_count_t;
+
+typedef struct {
+    uint32_t counts[ADMISSION_COUNT_TYPES];
+} admission_counters_t;
+
+typedef struct {
+    uint64_t hash; // of the key
+    uint64_t tokens, refilled_us;
+    int32_t lru_prev, lru_next; // towards the least and most recently used
+    admission_counters_t total, interval;
+    uint8_t key_length;
+    char key[ADMISSION_KEY_MAX];
+} admission_source_t;
+
+typedef struct {
+    admission_source_t *sources;
+    int32_t *slots; // source indices, -1 if empty
+    uint32_t slot_mask;
+    int32_t count, capacity;
+    int32_t lru_oldest, lru_newest;
+    uint64_t evictions;
+} admission_table_t;
+
+typedef struct {
+    topic_template_t *key;
+    uint32_t rate, burst, sample;
+    admission_action_t action;
+    const char *topic;
+    topic_template_t *topic_template;
+} admission_config_t;
+
+admission_config_t admission_config = { .key = NULL, .topic = NULL, .topic_template = NULL };
+admission_table_t admission_table = { .sources = NULL, .slots = NULL };
+admission_counters_t admission_interval;
+uint32_t admission_unkeyed = 0;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t __admission_hash(const char *key, const int length) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (int i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)key[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+bool admission_table_begin(admission_table_t *table, const int capacity) {
+    uint32_t slot_count = 2;
+    while (slot_count < (uint32_t)capacity * 2)
+        slot_count <<= 1;
+    table->sources = (admission_source_t *)calloc((size_t)capacity, sizeof(admission_source_t));
+    table->slots = (int32_t *)malloc(slot_count * sizeof(int32_t));
+    if (table->sources == NULL || table->slots == NULL) {
+        free(table->sources);
+        free(table->slots);
+        table->sources = NULL;
+        table->slots = NULL;
+        return false;
+    }
+    memset(table->slots, 0xFF, slot_count * sizeof(int32_t));
+    table->slot_mask = slot_count - 1;
+    table->capacity = capacity;
+    table->count = 0;
+    table->lru_oldest = table->lru_newest = -1;
+    table->evictions = 0;
+    return true;
+}
+
+void admission_table_end(admission_table_t *table) {
+    free(table->sources);
+    free(table->slots);
+    table->sources = NULL;
+    table->slots = NULL;
+    table->count = table->capacity = 0;
+}
+
+static void __admission_lru_unlink(admission_table_t *table, const int32_t index) {
+    admission_source_t *source = &table->sources[index];
+    if (source->lru_prev >= 0)
+        table->sources[source->lru_prev].lru_next = source->lru_next;
+    else
+        table->lru_oldest = source->lru_next;
+    if (source->lru_next >= 0)
+        table->sources[source->lru_next].lru_prev = source->lru_prev;
+    else
+        table->lru_newest = source->lru_prev;
+}
+
+static void __admission_lru_append(admission_table_t *table, const int32_t index) {
+    admission_source_t *source = &table->sources[index];
+    source->lru_prev = table->lru_newest;
+    source->lru_next = -1;
+    if (table->lru_newest >= 0)
+        table->sources[table->lru_newest].lru_next = index;
+    else
+        table->lru_oldest = index;
+    table->lru_newest = index;
+}
+
+// the entries after the hole that may move back into it (their home is not between the hole and them) do, so that
+// every entry stays reachable from its home without a tombstone
+static void __admission_slot_remove(admission_table_t *table, const int32_t index) {
+    uint32_t hole = (uint32_t)table->sources[index].hash & table->slot_mask;
+    while (table->slots[hole] != index)
+        hole = (hole + 1) & table->slot_mask;
+    for (uint32_t next = (hole + 1) & table->slot_mask; table->slots[next] >= 0; next = (next + 1) & table->slot_mask) {
+        const uint32_t home = (uint32_t)table->sources[table->slots[next]].hash & table->slot_mask;
+        if (((next - home) & table->slot_mask) >= ((next - hole) & table->slot_mask)) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+    table->slots[hole] = -1;
+}
+
+// the index of the source for the key, or -1 with the empty slot that ends its probe sequence
+static inline int32_t __admission_table_find(const admission_table_t *table, const char *key, const int length, const uint64_t hash, uint32_t *slot) {
+    *slot = (uint32_t)hash & table->slot_mask;
+    for (int32_t index; (index = table->slots[*slot]) >= 0; *slot = (*slot + 1) & table->slot_mask) {
+        const admission_source_t *source = &table->sources[index];
+        if (source->hash == hash && source->key_length == length && memcmp(source->key, key, (size_t)length) == 0)
+            return index;
+    }
+    return -1;
+}
+
+admission_source_t *admission_table_find(const admission_table_t *table, const char *key, const int length) {
+    uint32_t slot;
+    const int32_t index = __admission_table_find(table, key, length, __admission_hash(key, length), &slot);
+    return index < 0 ? NULL : &table->sources[index];
+}
+
+// the source for the key, as the most recently used, added (with a full bucket, evicting the least recently used
+// if the table is full) if not present
+admission_source_t *admission_table_lookup(admission_table_t *table, const char *key, const int length, const uint64_t burst_tokens, const uint64_t now_us) {
+    const uint64_t hash = __admission_hash(key, length);
+    uint32_t slot;
+    int32_t index = __admission_table_find(table, key, length, hash, &slot);
+    if (index >= 0) {
+        if (index != table->lru_newest) {
+            __admission_lru_unlink(table, index);
+            __admission_lru_append(table, index);
+        }
+        return &table->sources[index];
+    }
+    if (table->count < table->capacity)
+        index = table->count++;
+    else {
+        index = table->lru_oldest;
+        __admission_lru_unlink(table, index);
+        __admission_slot_remove(table, index);
+        table->evictions++;
+        slot = (uint32_t)hash & table->slot_mask; // the removal may have emptied a slot earlier in the probe sequence
+        while (table->slots[slot] >= 0)
+            slot = (slot + 1) & table->slot_mask;
+    }
+    admission_source_t *source = &table->sources[index];
+    memset(source, 0, sizeof(*source));
+    source->hash = hash;
+    source->key_length = (uint8_t)length;
+    memcpy(source->key, key, (size_t)length);
+    source->tokens = burst_tokens;
+    source->refilled_us = now_us;
+    table->slots[slot] = index;
+    __admission_lru_append(table, index);
+    return source;
+}
+
+// takes a token if there is one, after refilling for the time since the last; the refill is capped before multiplying,
+// so it cannot overflow
+static inline bool admission_bucket_take(admission_source_t *source, const uint32_t rate, const uint32_t burst, const uint64_t now_us) {
+    const uint64_t burst_tokens = (uint64_t)burst * ADMISSION_TOKEN, elapsed_us = now_us > source->refilled_us ? now_us - source->refilled_us : 0;
+    if (elapsed_us >= (burst_tokens * 60) / rate)
+        source->tokens = burst_tokens;
+    else if ((source->tokens += (elapsed_us * rate) / 60) > burst_tokens)
+        source->tokens = burst_tokens;
+    source->refilled_us = now_us;
+    if (source->tokens < ADMISSION_TOKEN)
+        return false;
+    source->tokens -= ADMISSION_TOKEN;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline void __admission_count(admission_source_t *source, const admission_count_t count) {
+    source->total.counts[count]++;
+    source->interval.counts[count]++;
+    admission_interval.counts[count]++;
+}
+
+admission_result_t admission_check(const uint8_t *packet, const int packet_size, const uint64_t now_us) {
+    char key[ADMISSION_KEY_MAX];
+    const int length = topic_template_render(admission_config.key, packet, packet_size, key, sizeof(key));
+    if (length <= 0) {
+        admission_unkeyed++;
+        return ADMISSION_ADMIT;
+    }
+    admission_source_t *source = admission_table_lookup(&admission_table, key, length, (uint64_t)admission_config.burst * ADMISSION_TOKEN, now_us);
+    if (admission_bucket_take(source, admission_config.rate, admission_config.burst, now_us)) {
+        __admission_count(source, ADMISSION_COUNT_ADMITTED);
+        return ADMISSION_ADMIT;
+    }
+    __admission_count(source, ADMISSION_COUNT_LIMITED);
+    switch (admission_config.action) {
+    case ADMISSION_ACTION_SAMPLE:
+        if (source->total.counts[ADMISSION_COUNT_LIMITED] % admission_config.sample == 1 % admission_config.sample) {
+            __admission_count(source, ADMISSION_COUNT_SAMPLED);
+            return ADMISSION_ADMIT;
+        }
+        __admission_count(source, ADMISSION_COUNT_DROPPED);
+        return ADMISSION_DROP;
+    case ADMISSION_ACTION_DIVERT:
+        __admission_count(source, ADMISSION_COUNT_DIVERTED);
+        return ADMISSION_DIVERT;
+    case ADMISSION_ACTION_DROP:
+    default:
+        __admission_count(source, ADMISSION_COUNT_DROPPED);
+        return ADMISSION_DROP;
+    }
+}
+
+// the quarantine topic for a diverted packet, or NULL if a field of its template is missing
+const char *admission_topic_render(const uint8_t *packet, const int packet_size, char *topic, const int topic_size) {
+    if (admission_config.topic_template == NULL)
+        return admission_config.topic;
+    return topic_template_render(admission_config.topic_template, packet, packet_size, topic, topic_size) < 0 ? NULL : topic;
+}
+
+static inline bool admission_enabled(void) {
+    return admission_config.key != NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool config_populate_admission(void) {
+    const char *key = config_get_string("admission-key", NULL);
+    if (key == NULL) {
+        printf("config: admission: off\n");
+        return true;
+    }
+    if ((admission_config.key = topic_template_compile(key)) == NULL) {
+        fprintf(stderr, "config: admission: key '%s' must have an extractor, e.g. '{json:id}' or '{hex:0-1}'\n", key);
+        return false;
+    }
+    const int rate = config_get_integer("admission-rate", ADMISSION_RATE_DEFAULT), burst = config_get_integer("admission-burst", ADMISSION_BURST_DEFAULT),
+              sample = config_get_integer("admission-sample", ADMISSION_SAMPLE_DEFAULT), sources = config_get_integer("admission-sources", ADMISSION_SOURCES_DEFAULT);
+    const char *action = config_get_string("admission-action", "drop");
+    admission_config.rate = (uint32_t)(rate > 0 ? rate : ADMISSION_RATE_DEFAULT);
+    admission_config.burst = (uint32_t)(burst > 0 ? burst : ADMISSION_BURST_DEFAULT);
+    admission_config.sample = (uint32_t)(sample > 0 ? sample : ADMISSION_SAMPLE_DEFAULT);
+    if (strcmp(action, "drop") == 0)
+        admission_config.action = ADMISSION_ACTION_DROP;
+    else if (strcmp(action, "sample") == 0)
+        admission_config.action = ADMISSION_ACTION_SAMPLE;
+    else if (strcmp(action, "divert") == 0)
+        admission_config.action = ADMISSION_ACTION_DIVERT;
+    else {
+        fprintf(stderr, "config: admission: unknown action '%s', expected drop, sample or divert\n", action);
+        return false;
+    }
+    if (admission_config.action == ADMISSION_ACTION_DIVERT) {
+        if ((admission_config.topic = config_get_string("admission-topic", NULL)) == NULL) {
+            fprintf(stderr, "config: admission: action 'divert' requires 'admission-topic'\n");
+            return false;
+        }
+        admission_config.topic_template = topic_template_compile(admission_config.topic);
+        if (admission_config.topic_template == NULL && strchr(admission_config.topic, '{') != NULL)
+            return false;
+    }
+    if (!admission_table_begin(&admission_table, sources > 0 && sources <= ADMISSION_SOURCES_MAX ? sources : ADMISSION_SOURCES_DEFAULT)) {
+        fprintf(stderr, "config: admission: could not allocate the table of %d sources\n", sources);
+        return false;
+    }
+    printf("config: admission: key='%s', rate=%" PRIu32 "/min, burst=%" PRIu32 ", action=%s", key, admission_config.rate, admission_config.burst, admission_action_tostring(admission_config.action));
+    if (admission_config.action == ADMISSION_ACTION_SAMPLE)
+        printf(" (1 in %" PRIu32 ")", admission_config.sample);
+    else if (admission_config.action == ADMISSION_ACTION_DIVERT)
+        printf(" (topic='%s')", admission_config.topic);
+    printf(", sources=%" PRId32 " (slots=%" PRIu32 ")\n", admission_table.capacity, admission_table.slot_mask + 1);
+    return true;
+}
+
+void admission_end(void) {
+    admission_table_end(&admission_table);
+    topic_template_free(admission_config.key);
+    topic_template_free(admission_config.topic_template);
+    admission_config.key = admission_config.topic_template = NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void __admission_counters_display(const admission_counters_t *counters) {
+    printf("admitted=%" PRIu32 ", limited=%" PRIu32 " (dropped=%" PRIu32 ", sampled=%" PRIu32 ", diverted=%" PRIu32 ")", counters->counts[ADMISSION_COUNT_ADMITTED], counters->counts[ADMISSION_COUNT_LIMITED],
+           counters->counts[ADMISSION_COUNT_DROPPED], counters->counts[ADMISSION_COUNT_SAMPLED], counters->counts[ADMISSION_COUNT_DIVERTED]);
+}
+
+static inline uint32_t __admission_interval_limited(const int32_t index) {
+    return admission_table.sources[index].interval.counts[ADMISSION_COUNT_LIMITED];
+}
+
+// the interval's totals, then the sources most limited over it, with their totals since they were added
+void admission_stats_display(void) {
+    if (!admission_enabled())
+        return;
+    printf("admission: sources=%" PRId32 "/%" PRId32 ", evictions=%" PRIu64 ", unkeyed=%" PRIu32 ", ", admission_table.count, admission_table.capacity, admission_table.evictions, admission_unkeyed);
+    __admission_counters_display(&admission_interval);
+    printf("\n");
+    int32_t top[ADMISSION_DISPLAY_TOP];
+    int top_count = 0;
+    for (int32_t i = 0; i < admission_table.count; i++) {
+        if (__admission_interval_limited(i) == 0)
+            continue;
+        if (top_count < ADMISSION_DISPLAY_TOP)
+            top[top_count++] = i;
+        else if (__admission_interval_limited(i) > __admission_interval_limited(top[ADMISSION_DISPLAY_TOP - 1]))
+            top[ADMISSION_DISPLAY_TOP - 1] = i;
+        else
+            continue;
+        for (int j = top_count - 1; j > 0 && __admission_interval_limited(top[j]) > __admission_interval_limited(top[j - 1]); j--) {
+            const int32_t swap = top[j];
+            top[j] = top[j - 1];
+            top[j - 1] = swap;
+        }
+    }
+    for (int i = 0; i < top_count; i++) {
+        const admission_source_t *source = &admission_table.sources[top[i]];
+        printf("admission: source '%.*s': interval ", (int)source->key_length, source->key);
+        __admission_counters_display(&source->interval);
+        printf(", total ");
+        __admission_counters_display(&source->total);
+        printf("\n");
+    }
+    for (int32_t i = 0; i < admission_table.count; i++)
+        memset(&admission_table.sources[i].interval, 0, sizeof(admission_counters_t));
+    memset(&admission_interval, 0, sizeof(admission_interval));
+    admission_unkeyed = 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,210 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// captures are pcap files (so that standard tools can list and slice them) with the LINKTYPE_USER0 link type: each
+// record is a 4 byte frame header (version, flags, raw RSSI and module, as the RSSI scale depends on the module) and
+// the frame as read from the serial port, less its RSSI byte; timestamps are those of the frame's first byte, taken from
+// the monotonic clock and offset to the wall clock at the start of the capture, so that intervals are exact while times
+// still read as dates; fields are in host order, and readers swap them if the magic is swapped, as for pcap
+
+#define CAPTURE_PCAP_MAGIC         0xa1b2c3d4
+#define CAPTURE_PCAP_MAGIC_SWAPPED 0xd4c3b2a1
+#define CAPTURE_PCAP_LINKTYPE      147 // LINKTYPE_USER0
+#define CAPTURE_PCAP_SNAPLEN       65535
+#define CAPTURE_VERSION            1
+#define CAPTURE_FLAG_RSSI          0x01
+#define CAPTURE_FRAME_MAX          256
+#define CAPTURE_REPLAY_SLEEP_MAX   100 // ms, so that the caller's loop keeps polling while waiting for the next frame
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major, version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs, snaplen, network;
+} capture_pcap_header_t;
+
+typedef struct {
+    uint32_t ts_sec, ts_usec, incl_len, orig_len;
+} capture_pcap_record_t;
+
+typedef struct {
+    uint8_t version, flags, rssi, module;
+} capture_frame_header_t;
+
+typedef struct {
+    uint64_t time_us; // as captured (wall clock), or as replayed (monotonic)
+    uint8_t module, rssi;
+    bool rssi_valid;
+    int size;
+    uint8_t data[CAPTURE_FRAME_MAX];
+} capture_frame_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+FILE *capture_file = NULL;
+uint64_t capture_base_realtime_us = 0, capture_base_monotonic_us = 0;
+uint32_t capture_frames = 0;
+
+static uint64_t __capture_clock_us(const clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+bool capture_begin(const char *path) {
+    if ((capture_file = fopen(path, "wb")) == NULL) {
+        fprintf(stderr, "capture: could not open '%s' for writing\n", path);
+        return false;
+    }
+    const capture_pcap_header_t header = { .magic = CAPTURE_PCAP_MAGIC, .version_major = 2, .version_minor = 4, .thiszone = 0, .sigfigs = 0, .snaplen = CAPTURE_PCAP_SNAPLEN, .network = CAPTURE_PCAP_LINKTYPE };
+    if (fwrite(&header, sizeof(header), 1, capture_file) != 1 || fflush(capture_file) != 0) {
+        fprintf(stderr, "capture: could not write header to '%s'\n", path);
+        fclose(capture_file);
+        capture_file = NULL;
+        return false;
+    }
+    capture_base_realtime_us = __capture_clock_us(CLOCK_REALTIME);
+    capture_base_monotonic_us = __capture_clock_us(CLOCK_MONOTONIC);
+    capture_frames = 0;
+    printf("capture: writing to '%s' (pcap, linktype=%d)\n", path, CAPTURE_PCAP_LINKTYPE);
+    return true;
+}
+
+// time_us is the monotonic time of the frame's first byte; flushed per frame, so that a capture survives a crash
+bool capture_write(const uint8_t *data, const int size, const uint8_t rssi, const bool rssi_valid, const uint8_t module, const uint64_t time_us) {
+    if (capture_file == NULL || size < 0 || size > CAPTURE_FRAME_MAX)
+        return false;
+    const uint64_t ts_us = capture_base_realtime_us + (time_us > capture_base_monotonic_us ? time_us - capture_base_monotonic_us : 0);
+    const capture_pcap_record_t record = { .ts_sec = (uint32_t)(ts_us / 1000000), .ts_usec = (uint32_t)(ts_us % 1000000), .incl_len = (uint32_t)(sizeof(capture_frame_header_t) + (size_t)size), .orig_len = (uint32_t)(sizeof(capture_frame_header_t) + (size_t)size) };
+    const capture_frame_header_t frame = { .version = CAPTURE_VERSION, .flags = rssi_valid ? CAPTURE_FLAG_RSSI : 0, .rssi = rssi_valid ? rssi : 0, .module = module };
+    if (fwrite(&record, sizeof(record), 1, capture_file) != 1 || fwrite(&frame, sizeof(frame), 1, capture_file) != 1 || fwrite(data, 1, (size_t)size, capture_file) != (size_t)size || fflush(capture_file) != 0) {
+        fprintf(stderr, "capture: write failed, stopping capture\n");
+        fclose(capture_file);
+        capture_file = NULL;
+        return false;
+    }
+    capture_frames++;
+    return true;
+}
+
+void capture_end(void) {
+    if (capture_file == NULL)
+        return;
+    fclose(capture_file);
+    capture_file = NULL;
+    printf("capture: closed (frames=%" PRIu32 ")\n", capture_frames);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// frames are replayed at their captured intervals divided by the speed, or as fast as possible with a speed of 0; the
+// next frame is read ahead, so that the module and RSSI of the capture are known before the first is replayed
+
+FILE *capture_replay_file = NULL;
+bool capture_replay_swapped = false, capture_replay_pending = false;
+uint32_t capture_replay_speed = 1, capture_replay_frames = 0;
+uint64_t capture_replay_start_us = 0, capture_replay_first_us = 0;
+capture_frame_t capture_replay_next;
+
+static uint32_t __capture_swap32(const uint32_t value) {
+    return capture_replay_swapped ? __builtin_bswap32(value) : value;
+}
+
+static bool __capture_replay_fetch(void) {
+    capture_pcap_record_t record;
+    capture_frame_header_t frame;
+    capture_replay_pending = false;
+    if (fread(&record, sizeof(record), 1, capture_replay_file) != 1)
+        return false;
+    const uint32_t length = __capture_swap32(record.incl_len);
+    if (length < sizeof(frame) || length > sizeof(frame) + CAPTURE_FRAME_MAX || fread(&frame, sizeof(frame), 1, capture_replay_file) != 1 || frame.version != CAPTURE_VERSION) {
+        fprintf(stderr, "capture: replay: invalid frame (number=%" PRIu32 ", length=%" PRIu32 ")\n", capture_replay_frames + 1, length);
+        return false;
+    }
+    capture_replay_next.size = (int)(length - sizeof(frame));
+    if (fread(capture_replay_next.data, 1, (size_t)capture_replay_next.size, capture_replay_file) != (size_t)capture_replay_next.size) {
+        fprintf(stderr, "capture: replay: truncated frame (number=%" PRIu32 ")\n", capture_replay_frames + 1);
+        return false;
+    }
+    capture_replay_next.time_us = ((uint64_t)__capture_swap32(record.ts_sec) * 1000000ULL) + __capture_swap32(record.ts_usec);
+    capture_replay_next.module = frame.module;
+    capture_replay_next.rssi_valid = (frame.flags & CAPTURE_FLAG_RSSI) != 0;
+    capture_replay_next.rssi = frame.rssi;
+    return (capture_replay_pending = true);
+}
+
+bool capture_replay_begin(const char *path, const uint32_t speed) {
+    capture_pcap_header_t header;
+    if ((capture_replay_file = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "capture: replay: could not open '%s'\n", path);
+        return false;
+    }
+    if (fread(&header, sizeof(header), 1, capture_replay_file) != 1 || (header.magic != CAPTURE_PCAP_MAGIC && header.magic != CAPTURE_PCAP_MAGIC_SWAPPED)) {
+        fprintf(stderr, "capture: replay: '%s' is not a pcap file\n", path);
+        fclose(capture_replay_file);
+        capture_replay_file = NULL;
+        return false;
+    }
+    capture_replay_swapped = header.magic == CAPTURE_PCAP_MAGIC_SWAPPED;
+    if (__capture_swap32(header.network) != CAPTURE_PCAP_LINKTYPE) {
+        fprintf(stderr, "capture: replay: '%s' has linktype %" PRIu32 ", not %d\n", path, __capture_swap32(header.network), CAPTURE_PCAP_LINKTYPE);
+        fclose(capture_replay_file);
+        capture_replay_file = NULL;
+        return false;
+    }
+    capture_replay_speed = speed;
+    capture_replay_frames = 0;
+    __capture_replay_fetch();
+    capture_replay_first_us = capture_replay_next.time_us;
+    capture_replay_start_us = __capture_clock_us(CLOCK_MONOTONIC);
+    printf("capture: replaying '%s' (speed=%s%" PRIu32 "%s, module=%s, rssi=%s)\n", path, speed == 0 ? "" : "x", speed, speed == 0 ? " (as fast as possible)" : "", capture_replay_next.module == 0 ? "usb" : "dip",
+           capture_replay_next.rssi_valid ? "yes" : "no");
+    return true;
+}
+
+// returns the frame size, 0 if the next frame is not yet due (having waited up to CAPTURE_REPLAY_SLEEP_MAX), or -1 at the end
+int capture_replay_read(capture_frame_t *frame) {
+    if (capture_replay_file == NULL || !capture_replay_pending)
+        return -1;
+    const uint64_t now_us = __capture_clock_us(CLOCK_MONOTONIC);
+    if (capture_replay_speed > 0) {
+        const uint64_t offset_us = capture_replay_next.time_us > capture_replay_first_us ? capture_replay_next.time_us - capture_replay_first_us : 0;
+        const uint64_t due_us = capture_replay_start_us + (offset_us / capture_replay_speed);
+        if (now_us < due_us) {
+            const uint64_t wait_us = due_us - now_us;
+            usleep((useconds_t)(wait_us < CAPTURE_REPLAY_SLEEP_MAX * 1000 ? wait_us : CAPTURE_REPLAY_SLEEP_MAX * 1000));
+            return 0;
+        }
+    }
+    *frame = capture_replay_next;
+    frame->time_us = now_us;
+    capture_replay_frames++;
+    __capture_replay_fetch();
+    return frame->size;
+}
+
+void capture_replay_end(void) {
+    if (capture_replay_file == NULL)
+        return;
+    const uint64_t elapsed_ms = (__capture_clock_us(CLOCK_MONOTONIC) - capture_replay_start_us) / 1000;
+    fclose(capture_replay_file);
+    capture_replay_file = NULL;
+    printf("capture: replay: finished (frames=%" PRIu32 ", elapsed=%" PRIu64 "ms, rate=%" PRIu64 "/s)\n", capture_replay_frames, elapsed_ms, elapsed_ms > 0 ? ((uint64_t)capture_replay_frames * 1000) / elapsed_ms : 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -4,82 +4,233 @@
 
 #include <ctype.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 #define CONFIG_MAX_STRING 255
 
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the store holds its keys and values in an arena (a list of blocks that strings are bump allocated from, freed only as
+// a whole), its entries in load order (for indexed sections and display), and an open addressing hash table (linear
+// probing, FNV-1a, at most half full) of entry indices, so that there is no limit on entries and a lookup is O(1)
+// however many routes are configured; a value that is set again takes a new string, leaving the old one in the arena
+
+#define CONFIG_ARENA_BLOCK 16384
+#define CONFIG_SLOTS_MIN   64
+
+typedef struct config_arena_block {
+    struct config_arena_block *next;
+    size_t used, size;
+    char data[];
+} config_arena_block_t;
+
 typedef struct {
-    char *key;
-    char *value;
+    const char *key;
+    const char *value;
+    uint32_t hash;
 } config_entry_t;
 
-#define CONFIG_MAX_ENTRIES 32
-config_entry_t config_entries[CONFIG_MAX_ENTRIES];
-int config_entry_count = 0;
+typedef struct {
+    config_arena_block_t *blocks;
+    size_t arena_bytes;
+    config_entry_t *entries;
+    size_t count, capacity;
+    uint32_t *slots; // entry index + 1, or 0 if empty
+    size_t slot_count;
+} config_store_t;
+
+config_store_t config_store;
+
+static const char *__config_arena_strdup(config_store_t *store, const char *string) {
+    const size_t length = strlen(string) + 1;
+    config_arena_block_t *block = store->blocks;
+    if (block == NULL || block->size - block->used < length) {
+        const size_t size = length > CONFIG_ARENA_BLOCK ? length : CONFIG_ARENA_BLOCK;
+        if ((block = (config_arena_block_t *)malloc(sizeof(config_arena_block_t) + size)) == NULL)
+            return NULL;
+        block->used = 0;
+        block->size = size;
+        block->next = store->blocks;
+        store->blocks = block;
+        store->arena_bytes += size;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, string, length);
+    block->used += length;
+    return copy;
+}
+
+void config_store_free(config_store_t *store) {
+    for (config_arena_block_t *block = store->blocks, *next; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(store->entries);
+    free(store->slots);
+    memset(store, 0, sizeof(*store));
+}
+
+static inline uint32_t __config_hash(const char *key) {
+    uint32_t hash = 2166136261U;
+    while (*key)
+        hash = (hash ^ (uint8_t)*key++) * 16777619U;
+    return hash;
+}
+
+static config_entry_t *__config_find(const config_store_t *store, const char *key, const uint32_t hash) {
+    if (store->slot_count == 0)
+        return NULL;
+    for (size_t slot = hash & (store->slot_count - 1);; slot = (slot + 1) & (store->slot_count - 1)) {
+        const uint32_t index = store->slots[slot];
+        if (index == 0)
+            return NULL;
+        config_entry_t *entry = &store->entries[index - 1];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            return entry;
+    }
+}
+
+static bool __config_slots_grow(config_store_t *store) {
+    const size_t slot_count = store->slot_count ? store->slot_count * 2 : CONFIG_SLOTS_MIN;
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL)
+        return false;
+    for (size_t i = 0; i < store->count; i++) {
+        size_t slot = store->entries[i].hash & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint32_t)(i + 1);
+    }
+    free(store->slots);
+    store->slots = slots;
+    store->slot_count = slot_count;
+    return true;
+}
+
+static bool __config_store_set(config_store_t *store, const char *key, const char *value) {
+    const uint32_t hash = __config_hash(key);
+    config_entry_t *entry = __config_find(store, key, hash);
+    if (entry != NULL)
+        return (entry->value = __config_arena_strdup(store, value)) != NULL;
+    if ((store->count + 1) * 2 > store->slot_count && !__config_slots_grow(store))
+        return false;
+    if (store->count == store->capacity) {
+        const size_t capacity = store->capacity ? store->capacity * 2 : CONFIG_SLOTS_MIN / 2;
+        config_entry_t *entries = (config_entry_t *)realloc(store->entries, capacity * sizeof(config_entry_t));
+        if (entries == NULL)
+            return false;
+        store->entries = entries;
+        store->capacity = capacity;
+    }
+    const char *key_copy = __config_arena_strdup(store, key), *value_copy = __config_arena_strdup(store, value);
+    if (key_copy == NULL || value_copy == NULL)
+        return false;
+    store->entries[store->count] = (config_entry_t) { .key = key_copy, .value = value_copy, .hash = hash };
+    size_t slot = hash & (store->slot_count - 1);
+    while (store->slots[slot] != 0)
+        slot = (slot + 1) & (store->slot_count - 1);
+    store->slots[slot] = (uint32_t)(++store->count);
+    return true;
+}
 
 void __config_set_value(const char *key, const char *value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            free(config_entries[i].value);
-            config_entries[i].value = strdup(value);
-            return;
-        }
-    if (config_entry_count < CONFIG_MAX_ENTRIES) {
-        config_entries[config_entry_count].key = strdup(key);
-        config_entries[config_entry_count].value = strdup(value);
-        config_entry_count++;
-    } else
-        fprintf(stderr, "config: too many entries, ignoring %s=%s\n", key, value);
+    if (!__config_store_set(&config_store, key, value))
+        fprintf(stderr, "config: could not allocate, ignoring %s=%s\n", key, value);
+}
+
+static const char *__config_store_get(const config_store_t *store, const char *key) {
+    const config_entry_t *entry = __config_find(store, key, __config_hash(key));
+    return entry != NULL ? entry->value : NULL;
 }
 
 const char *config_get_string(const char *key, const char *default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0)
-            return config_entries[i].value;
-    return default_value;
+    const char *value = __config_store_get(&config_store, key);
+    return value != NULL ? value : default_value;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// indexed sections are keys '<section>.N.<field>', e.g. 'topic-route.3.topic', as arrays of records
+
+static int __config_index_compare(const void *a, const void *b) {
+    const int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// returns the sorted N of all keys '<prefix>N<suffix>' (e.g. 'topic-route.' N '.key'), to be freed by the caller
+int *config_get_indices(const char *prefix, const char *suffix, int *count) {
+    const size_t prefix_length = strlen(prefix);
+    int *indices = (int *)malloc(sizeof(int) * (config_store.count + 1));
+    *count = 0;
+    if (indices == NULL)
+        return NULL;
+    for (size_t i = 0; i < config_store.count; i++) {
+        const char *key = config_store.entries[i].key;
+        if (strncmp(key, prefix, prefix_length) != 0 || !isdigit((unsigned char)key[prefix_length]))
+            continue;
+        char *end;
+        const long index = strtol(key + prefix_length, &end, 10);
+        if (strcmp(end, suffix) == 0 && index <= INT_MAX)
+            indices[(*count)++] = (int)index;
+    }
+    qsort(indices, (size_t)*count, sizeof(int), __config_index_compare);
+    return indices;
+}
+
+// the field of the record N of the section, e.g. ("schema", 2, "fields") for 'schema.2.fields'
+const char *config_get_indexed(const char *section, const int index, const char *field, const char *default_value) {
+    char key[CONFIG_MAX_STRING];
+    snprintf(key, sizeof(key), "%s.%d.%s", section, index, field);
+    return config_get_string(key, default_value);
 }
 
 int config_get_integer(const char *key, const int default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            char *endptr;
-            const long val = strtol(config_entries[i].value, &endptr, 0);
-            if (*endptr == '\0')
-                return (int)val;
-            else {
-                fprintf(stderr, "config: invalid integer value '%s' for key '%s', using default\n", config_entries[i].value, key);
-                return default_value;
-            }
-        }
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    char *endptr;
+    const long val = strtol(value, &endptr, 0);
+    if (*endptr == '\0')
+        return (int)val;
+    fprintf(stderr, "config: invalid integer value '%s' for key '%s', using default\n", value, key);
     return default_value;
 }
 
 bool config_get_bool(const char *key, const bool default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            if (strcasecmp(config_entries[i].value, "true") == 0 || strcmp(config_entries[i].value, "1") == 0)
-                return true;
-            else if (strcasecmp(config_entries[i].value, "false") == 0 || strcmp(config_entries[i].value, "0") == 0)
-                return false;
-            fprintf(stderr, "config: invalid boolean value '%s' for key '%s', using default\n", config_entries[i].value, key);
-        }
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0)
+        return true;
+    else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0)
+        return false;
+    fprintf(stderr, "config: invalid boolean value '%s' for key '%s', using default\n", value, key);
     return default_value;
 }
 
 serial_bits_t config_get_bits(const char *key, const serial_bits_t default_value) {
-    for (int i = 0; i < config_entry_count; i++)
-        if (strcmp(config_entries[i].key, key) == 0) {
-            if (strcmp(config_entries[i].value, "8N1") == 0)
-                return SERIAL_8N1;
-            fprintf(stderr, "config: invalid bits value '%s', using default\n", config_entries[i].value);
-        }
+    const char *value = config_get_string(key, NULL);
+    if (value == NULL)
+        return default_value;
+    if (strcmp(value, "8N1") == 0)
+        return SERIAL_8N1;
+    fprintf(stderr, "config: invalid bits value '%s', using default\n", value);
     return default_value;
 }
 
-void __config_load_file(const char *filename) {
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool __config_load_file(const char *filename) {
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
         fprintf(stderr, "config: could not load '%s'\n", filename);
-        return;
+        return false;
     }
     char line[CONFIG_MAX_STRING];
     while (fgets(line, sizeof(line), file)) {
@@ -102,9 +253,23 @@ void __config_load_file(const char *filename) {
         }
     }
     fclose(file);
+    return true;
 }
 
-bool config_load(const char *config_file, const int argc, char *argv[], const struct option *options_long) {
+// kept for config_reload()
+const char *config_load_file_default = NULL;
+int config_load_argc = 0;
+char **config_load_argv = NULL;
+const struct option *config_load_options = NULL;
+
+static uint64_t __config_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static bool __config_load(const char *config_file, const int argc, char *argv[], const struct option *options_long) {
+    const uint64_t start_us = __config_clock_us();
     int c;
     int option_index = 0;
     optind = 0;
@@ -115,13 +280,14 @@ bool config_load(const char *config_file, const int argc, char *argv[], const st
                 break;
             }
     }
-    __config_load_file(config_file);
+    const bool loaded = __config_load_file(config_file);
     optind = 0;
     while ((c = getopt_long(argc, (char **)argv, "", options_long, &option_index)) != -1) {
         if (c == 0)
             if (strcmp(options_long[option_index].name, "config") != 0)
                 __config_set_value(options_long[option_index].name, optarg);
     }
+    const uint64_t load_us = __config_clock_us() - start_us;
     printf("config: file='%s'", config_file);
     for (int i = 1; options_long[i].name != NULL; i++) {
         const char *value = config_get_string(options_long[i].name, NULL);
@@ -129,8 +295,62 @@ bool config_load(const char *config_file, const int argc, char *argv[], const st
             printf(", %s='%s'", options_long[i].name, value);
     }
     printf("\n");
+    printf("config: entries=%zu (slots=%zu, arena=%zu bytes), loaded in %" PRIu64 "us\n", config_store.count, config_store.slot_count, config_store.arena_bytes, load_us);
+    return loaded;
+}
+
+bool config_load(const char *config_file, const int argc, char *argv[], const struct option *options_long) {
+    config_load_file_default = config_file;
+    config_load_argc = argc;
+    config_load_argv = argv;
+    config_load_options = options_long;
+    __config_load(config_file, argc, argv, options_long);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// a reload reads the file and command line again into a new store, holding the current one until the caller has built
+// its settings from the new one, then either dropping it by config_reload_commit() or putting it back by
+// config_reload_rollback(); the store loaded at start is never freed, as settings that are only read at start (e.g.
+// the serial port, the MQTT server) point into it, so that memory is that of the start store and the current one
+
+config_store_t config_store_previous, config_store_start;
+uint32_t config_reloads = 0;
+
+void config_reload_rollback(void) {
+    config_store_free(&config_store);
+    config_store = config_store_previous;
+    memset(&config_store_previous, 0, sizeof(config_store_previous));
+}
+
+// false if the file could not be read, in which case the current store is already back in place
+bool config_reload(void) {
+    if (config_load_options == NULL)
+        return false;
+    config_store_previous = config_store;
+    memset(&config_store, 0, sizeof(config_store));
+    if (!__config_load(config_load_file_default, config_load_argc, config_load_argv, config_load_options)) {
+        config_reload_rollback();
+        return false;
+    }
     return true;
 }
 
+// whether the value (or presence) of the key differs from before the reload
+bool config_reload_changed(const char *key) {
+    const char *value = config_get_string(key, NULL), *previous = __config_store_get(&config_store_previous, key);
+    return (value == NULL || previous == NULL) ? value != previous : strcmp(value, previous) != 0;
+}
+
+void config_reload_commit(void) {
+    if (config_reloads++ == 0)
+        config_store_start = config_store_previous;
+    else
+        config_store_free(&config_store_previous);
+    memset(&config_store_previous, 0, sizeof(config_store_previous));
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
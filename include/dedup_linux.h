@@ -0,0 +1,549 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// deduplication of the copies of each packet published by overlapping gateways: each gateway publishes under its own
+// name at one level of the topic (e.g. 'e22900t22/<gateway>/...'), and a copy is keyed by the hash of its topic with
+// that level replaced by the output's name, and of its data (the envelope's 'data' member, else the whole payload).
+// The copies of a key that arrive within 'window' of the first are one packet, of which the best (highest 'rssi',
+// then earliest 'ts', else the first) is published to that topic when the window closes; the key is then held for
+// another window, so that later copies are dropped rather than published again. Keys are held in a ring of 'entries'
+// in order of arrival, with a linear probed index, so memory is fixed: if the ring is full, the oldest is published
+// early. Only the main thread uses it.
+
+#define DEDUP_ENTRIES_DEFAULT  4096
+#define DEDUP_ENTRIES_MAX      (1 << 20)
+#define DEDUP_WINDOW_DEFAULT   500 // ms
+#define DEDUP_LEVEL_DEFAULT    1
+#define DEDUP_NAME_DEFAULT     "dedup"
+#define DEDUP_GATEWAYS_MAX     32
+#define DEDUP_GATEWAY_NAME_MAX 32
+#define DEDUP_TOPIC_MAX        128
+#define DEDUP_PAYLOAD_MAX      JSON_SCAN_SIZE_MAX // more than the largest the gateway publishes
+#define DEDUP_RSSI_NONE        INT64_MIN
+#define DEDUP_TS_NONE          INT64_MAX
+#define DEDUP_HASH_SEED        0xCBF29CE484222325ULL
+
+typedef enum {
+    DEDUP_FIRST = 0,
+    DEDUP_DUPLICATE,
+    DEDUP_LATE,    // after the packet was published, so dropped
+    DEDUP_PASSED,  // too large to hold, so published as it is
+    DEDUP_SKIPPED, // the topic has no gateway level, or is the output's
+} dedup_result_t;
+
+typedef struct {
+    uint64_t hash, first_us;
+    int64_t rssi, ts;  // of the best copy: rssi in millionths of a dBm, ts as published (DEDUP_RSSI_NONE, DEDUP_TS_NONE if not)
+    uint32_t gateways; // those that sent a copy, by bit
+    int8_t best;       // the gateway of the best copy, -1 if not known
+    bool published;
+    uint16_t topic_length, payload_length, data_offset, data_length;
+    char topic[DEDUP_TOPIC_MAX];
+    uint8_t payload[DEDUP_PAYLOAD_MAX];
+} dedup_entry_t;
+
+typedef struct {
+    char name[DEDUP_GATEWAY_NAME_MAX];
+    uint64_t received, heard, first, best, only, late; // copies, packets it sent a copy of, and of those, where it was first, best and alone
+    int64_t rssi_sum;                                  // millionths of a dBm
+    uint64_t rssi_count, last_us;
+} dedup_gateway_t;
+
+typedef void (*dedup_publish_t)(const char *topic, const uint8_t *payload, const int length);
+
+typedef struct {
+    uint64_t window_us;
+    int level;
+    const char *name;
+    const char *keys[3]; // data, rssi, ts
+    dedup_publish_t publish;
+    dedup_entry_t *entries; // a ring, oldest first, of which the first 'published' are
+    int32_t *index;         // ring positions by hash (linear probed), -1 if none
+    uint32_t index_mask, capacity, head, count, published;
+    dedup_gateway_t gateways[DEDUP_GATEWAYS_MAX];
+    int gateway_count;
+    uint64_t copies, packets, duplicates, late, early, passed, skipped, unknown;
+} dedup_table_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool dedup_begin(dedup_table_t *table, const uint32_t capacity, const uint32_t window_ms, const int level, const char *name, const char *const keys[3], const dedup_publish_t publish) {
+    uint32_t index_count = 2;
+    while (index_count < capacity * 2)
+        index_count <<= 1;
+    memset(table, 0, sizeof(*table));
+    table->entries = (dedup_entry_t *)malloc(capacity * sizeof(dedup_entry_t));
+    table->index = (int32_t *)malloc(index_count * sizeof(int32_t));
+    if (table->entries == NULL || table->index == NULL) {
+        free(table->entries);
+        free(table->index);
+        table->entries = NULL;
+        table->index = NULL;
+        return false;
+    }
+    memset(table->index, 0xFF, index_count * sizeof(int32_t));
+    table->index_mask = index_count - 1;
+    table->capacity = capacity;
+    table->window_us = (uint64_t)window_ms * 1000;
+    table->level = level;
+    table->name = name;
+    for (int i = 0; i < 3; i++)
+        table->keys[i] = keys[i];
+    table->publish = publish;
+    return true;
+}
+
+void dedup_end(dedup_table_t *table) {
+    free(table->entries);
+    free(table->index);
+    table->entries = NULL;
+    table->index = NULL;
+    table->capacity = table->count = 0;
+}
+
+static inline uint64_t __dedup_hash(uint64_t hash, const uint8_t *data, const int length) {
+    for (int i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+static inline dedup_entry_t *__dedup_entry(const dedup_table_t *table, const uint32_t offset) {
+    return &table->entries[(table->head + offset) % table->capacity];
+}
+
+// the topic with the gateway's level replaced by 'name', giving the gateway; -1 if it has no such level, it is the
+// output's (as when the output is under the topics subscribed to) or the result does not fit
+int dedup_topic_parse(const char *topic, const int level, const char *name, char *output, const int output_size, const char **gateway, int *gateway_length) {
+    const char *start = topic;
+    for (int i = 0; i < level; i++)
+        if ((start = strchr(start, '/')) == NULL)
+            return -1;
+        else
+            start++;
+    const char *end = strchr(start, '/');
+    if (end == NULL)
+        end = start + strlen(start);
+    const int length = (int)(end - start);
+    if (length == 0 || ((int)strlen(name) == length && memcmp(start, name, (size_t)length) == 0))
+        return -1;
+    const int written = snprintf(output, (size_t)output_size, "%.*s%s%s", (int)(start - topic), topic, name, end);
+    if (written < 0 || written >= output_size)
+        return -1;
+    *gateway = start;
+    *gateway_length = length;
+    return written;
+}
+
+static inline char __dedup_name_char(const char c) {
+    return (c == '"' || c == '\\' || (unsigned char)c < 0x20) ? '_' : c; // as names are put in JSON
+}
+
+// the gateway's index, added if new; -1 if there are already DEDUP_GATEWAYS_MAX (names are cut to fit)
+int dedup_gateway_find(dedup_table_t *table, const char *name, const int length) {
+    const int cut = length < DEDUP_GATEWAY_NAME_MAX - 1 ? length : DEDUP_GATEWAY_NAME_MAX - 1;
+    int i, j;
+    for (i = 0; i < table->gateway_count; i++) {
+        const char *known = table->gateways[i].name;
+        for (j = 0; j < cut && known[j] == __dedup_name_char(name[j]); j++)
+            ;
+        if (j == cut && known[j] == '\0')
+            return i;
+    }
+    if (table->gateway_count == DEDUP_GATEWAYS_MAX)
+        return -1;
+    dedup_gateway_t *gateway = &table->gateways[table->gateway_count];
+    memset(gateway, 0, sizeof(*gateway));
+    for (j = 0; j < cut; j++)
+        gateway->name[j] = __dedup_name_char(name[j]);
+    return table->gateway_count++;
+}
+
+static void __dedup_publish(dedup_table_t *table, dedup_entry_t *entry) {
+    entry->published = true;
+    table->publish(entry->topic, entry->payload, entry->payload_length);
+    table->packets++;
+    for (int i = 0; i < table->gateway_count; i++)
+        if (entry->gateways & (1u << i)) {
+            table->gateways[i].heard++;
+            if (entry->gateways == (1u << i))
+                table->gateways[i].only++;
+        }
+    if (entry->best >= 0)
+        table->gateways[entry->best].best++;
+}
+
+// from the index, by moving back those after it that probed past its slot
+static void __dedup_remove_head(dedup_table_t *table) {
+    const dedup_entry_t *entry = &table->entries[table->head];
+    uint32_t hole = (uint32_t)entry->hash & table->index_mask;
+    while (table->index[hole] != (int32_t)table->head)
+        hole = (hole + 1) & table->index_mask;
+    for (uint32_t next = (hole + 1) & table->index_mask; table->index[next] >= 0; next = (next + 1) & table->index_mask) {
+        const uint32_t home = (uint32_t)table->entries[table->index[next]].hash & table->index_mask;
+        if (((next - home) & table->index_mask) >= ((next - hole) & table->index_mask)) {
+            table->index[hole] = table->index[next];
+            hole = next;
+        }
+    }
+    table->index[hole] = -1;
+    table->head = (table->head + 1) % table->capacity;
+    table->count--;
+    table->published--;
+}
+
+// publishes those whose window has closed, and drops those held for a window after
+void dedup_poll(dedup_table_t *table, const uint64_t now_us) {
+    for (dedup_entry_t *entry; table->published < table->count && (entry = __dedup_entry(table, table->published))->first_us + table->window_us <= now_us; table->published++)
+        __dedup_publish(table, entry);
+    while (table->published > 0 && table->entries[table->head].first_us + (table->window_us * 2) <= now_us)
+        __dedup_remove_head(table);
+}
+
+// until the next is to be published or dropped, at most timeout_ms
+uint32_t dedup_wait_ms(const dedup_table_t *table, const uint64_t now_us, const uint32_t timeout_ms) {
+    if (table->count == 0)
+        return timeout_ms;
+    const uint64_t due_us = table->published < table->count ? __dedup_entry(table, table->published)->first_us + table->window_us : table->entries[table->head].first_us + (table->window_us * 2);
+    const uint64_t wait_ms = due_us > now_us ? (due_us - now_us + 999) / 1000 : 0;
+    return wait_ms < timeout_ms ? (uint32_t)wait_ms : timeout_ms;
+}
+
+// publishes all those waiting, e.g. when stopping
+void dedup_flush(dedup_table_t *table) {
+    for (; table->published < table->count; table->published++)
+        __dedup_publish(table, __dedup_entry(table, table->published));
+}
+
+static void __dedup_entry_copy(dedup_entry_t *entry, const int gateway, const uint8_t *payload, const int length, const uint8_t *data, const int64_t rssi, const int64_t ts) {
+    memcpy(entry->payload, payload, (size_t)length);
+    entry->payload_length = (uint16_t)length;
+    entry->data_offset = (uint16_t)(data - payload);
+    entry->rssi = rssi;
+    entry->ts = ts;
+    entry->best = (int8_t)gateway;
+}
+
+// a copy from the gateway (-1 if not known), for the topic as it is to be published
+dedup_result_t dedup_receive(dedup_table_t *table, const int gateway, const char *topic, const int topic_length, const uint8_t *payload, const int length, const uint64_t now_us) {
+    dedup_poll(table, now_us);
+    dedup_gateway_t *source = gateway >= 0 ? &table->gateways[gateway] : NULL;
+    table->copies++;
+    if (source != NULL) {
+        source->received++;
+        source->last_us = now_us;
+    } else
+        table->unknown++;
+    if (length > DEDUP_PAYLOAD_MAX || topic_length >= DEDUP_TOPIC_MAX) {
+        table->publish(topic, payload, length);
+        table->passed++;
+        return DEDUP_PASSED;
+    }
+
+    json_span_t values[3];
+    const uint8_t *data = payload;
+    int data_length = length;
+    int64_t rssi = DEDUP_RSSI_NONE, ts = DEDUP_TS_NONE, number;
+    if (json_object_values(payload, length, table->keys, 3, values) > 0) {
+        if (values[0].text != NULL) {
+            data = values[0].text;
+            data_length = values[0].length;
+        }
+        if (values[1].text != NULL && values[1].type == JSON_TYPE_NUMBER && json_number_parse(values[1].text, values[1].length, &number))
+            rssi = number;
+        if (values[2].text != NULL && values[2].type == JSON_TYPE_NUMBER && json_number_parse(values[2].text, values[2].length, &number))
+            ts = number;
+    }
+    if (source != NULL && rssi != DEDUP_RSSI_NONE) {
+        source->rssi_sum += rssi;
+        source->rssi_count++;
+    }
+
+    const uint64_t hash = __dedup_hash(__dedup_hash(DEDUP_HASH_SEED, (const uint8_t *)topic, topic_length + 1), data, data_length);
+    uint32_t slot = (uint32_t)hash & table->index_mask;
+    for (int32_t position; (position = table->index[slot]) >= 0; slot = (slot + 1) & table->index_mask) {
+        dedup_entry_t *entry = &table->entries[position];
+        if (entry->hash != hash || entry->topic_length != topic_length || entry->data_length != data_length || memcmp(entry->topic, topic, (size_t)topic_length) != 0 ||
+            memcmp(&entry->payload[entry->data_offset], data, (size_t)data_length) != 0)
+            continue;
+        if (entry->published) {
+            table->late++;
+            if (source != NULL)
+                source->late++;
+            return DEDUP_LATE;
+        }
+        table->duplicates++;
+        if (gateway >= 0)
+            entry->gateways |= 1u << gateway;
+        if (rssi > entry->rssi || (rssi == entry->rssi && ts < entry->ts))
+            __dedup_entry_copy(entry, gateway, payload, length, data, rssi, ts);
+        return DEDUP_DUPLICATE;
+    }
+
+    if (table->count == table->capacity) {
+        if (table->published == 0) {
+            __dedup_publish(table, &table->entries[table->head]);
+            table->published++;
+            table->early++;
+        }
+        __dedup_remove_head(table);
+        for (slot = (uint32_t)hash & table->index_mask; table->index[slot] >= 0; slot = (slot + 1) & table->index_mask)
+            ;
+    }
+    const uint32_t position = (table->head + table->count++) % table->capacity;
+    dedup_entry_t *entry = &table->entries[position];
+    entry->hash = hash;
+    entry->first_us = now_us;
+    entry->gateways = gateway >= 0 ? 1u << gateway : 0;
+    entry->published = false;
+    entry->topic_length = (uint16_t)topic_length;
+    memcpy(entry->topic, topic, (size_t)topic_length + 1);
+    entry->data_length = (uint16_t)data_length;
+    __dedup_entry_copy(entry, gateway, payload, length, data, rssi, ts);
+    table->index[slot] = (int32_t)position;
+    if (source != NULL)
+        source->first++;
+    return DEDUP_FIRST;
+}
+
+// a message as received, from the gateway named at the table's level of its topic
+dedup_result_t dedup_message(dedup_table_t *table, const char *topic, const uint8_t *payload, const int length, const uint64_t now_us) {
+    char output[DEDUP_TOPIC_MAX];
+    const char *gateway;
+    int gateway_length;
+    const int output_length = dedup_topic_parse(topic, table->level, table->name, output, (int)sizeof(output), &gateway, &gateway_length);
+    if (output_length < 0) {
+        table->skipped++;
+        return DEDUP_SKIPPED;
+    }
+    return dedup_receive(table, dedup_gateway_find(table, gateway, gateway_length), output, output_length, payload, length, now_us);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the average RSSI in hundredths of a dBm, rounded half away from zero
+static int64_t __dedup_gateway_rssi(const dedup_gateway_t *gateway) {
+    const int64_t average = gateway->rssi_sum / (int64_t)gateway->rssi_count;
+    return average < 0 ? -((-average + 5000) / 10000) : (average + 5000) / 10000;
+}
+
+void dedup_stats_display(const dedup_table_t *table, const uint64_t now_us) {
+    const uint64_t copies_per_packet = table->packets > 0 ? ((table->copies - table->passed - table->late) * 100) / table->packets : 0;
+    printf("dedup: packets=%" PRIu64 ", copies=%" PRIu64 " (%" PRIu64 ".%02" PRIu64 " a packet), duplicates=%" PRIu64 ", late=%" PRIu64 ", early=%" PRIu64 ", passed=%" PRIu64 ", skipped=%" PRIu64 ", unknown=%" PRIu64
+           ", entries=%" PRIu32 "/%" PRIu32 "\n",
+           table->packets, table->copies, copies_per_packet / 100, copies_per_packet % 100, table->duplicates, table->late, table->early, table->passed, table->skipped, table->unknown, table->count, table->capacity);
+    for (int i = 0; i < table->gateway_count; i++) {
+        const dedup_gateway_t *gateway = &table->gateways[i];
+        const uint64_t heard_permille = table->packets > 0 ? (gateway->heard * 1000) / table->packets : 0;
+        printf("dedup: gateway '%s': received=%" PRIu64 ", heard=%" PRIu64 " (%" PRIu64 ".%" PRIu64 "%%), first=%" PRIu64 ", best=%" PRIu64 ", only=%" PRIu64 ", late=%" PRIu64, gateway->name, gateway->received, gateway->heard,
+               heard_permille / 10, heard_permille % 10, gateway->first, gateway->best, gateway->only, gateway->late);
+        if (gateway->rssi_count > 0) {
+            const int64_t rssi = __dedup_gateway_rssi(gateway);
+            printf(", rssi-avg=%s%" PRId64 ".%02" PRId64 " dBm", rssi < 0 ? "-" : "", (rssi < 0 ? -rssi : rssi) / 100, (rssi < 0 ? -rssi : rssi) % 100);
+        }
+        printf(", last=%" PRIu64 "s ago\n", (now_us - gateway->last_us) / 1000000);
+    }
+}
+
+typedef struct {
+    char *buffer;
+    size_t size, used;
+} __dedup_output_t;
+
+static void __dedup_printf(__dedup_output_t *output, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void __dedup_printf(__dedup_output_t *output, const char *format, ...) {
+    if (output->used >= output->size)
+        return;
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(output->buffer + output->used, output->size - output->used, format, args);
+    va_end(args);
+    output->used = length < 0 ? output->size : output->used + (size_t)length;
+}
+
+// e.g. {"time":..,"packets":..,"copies":..,"duplicates":..,"late":..,"early":..,"passed":..,"skipped":..,"gateways":[{"gateway":"..",
+// "received":..,"heard":..,"first":..,"best":..,"only":..,"late":..,"rssi":-87.25}]}, with "rssi":null if none were given;
+// returns the length, or 0 if it does not fit
+size_t dedup_stats_render(const dedup_table_t *table, char *buffer, const size_t size) {
+    __dedup_output_t output = { .buffer = buffer, .size = size, .used = 0 };
+    __dedup_printf(&output, "{\"time\":%" PRId64 ",\"packets\":%" PRIu64 ",\"copies\":%" PRIu64 ",\"duplicates\":%" PRIu64 ",\"late\":%" PRIu64 ",\"early\":%" PRIu64 ",\"passed\":%" PRIu64 ",\"skipped\":%" PRIu64 ",\"gateways\":[",
+                   (int64_t)time(NULL), table->packets, table->copies, table->duplicates, table->late, table->early, table->passed, table->skipped);
+    for (int i = 0; i < table->gateway_count; i++) {
+        const dedup_gateway_t *gateway = &table->gateways[i];
+        __dedup_printf(&output, "%s{\"gateway\":\"%s\",\"received\":%" PRIu64 ",\"heard\":%" PRIu64 ",\"first\":%" PRIu64 ",\"best\":%" PRIu64 ",\"only\":%" PRIu64 ",\"late\":%" PRIu64 ",\"rssi\":", i == 0 ? "" : ",", gateway->name,
+                       gateway->received, gateway->heard, gateway->first, gateway->best, gateway->only, gateway->late);
+        if (gateway->rssi_count > 0) {
+            const int64_t rssi = __dedup_gateway_rssi(gateway);
+            __dedup_printf(&output, "%s%" PRId64 ".%02" PRId64 "}", rssi < 0 ? "-" : "", (rssi < 0 ? -rssi : rssi) / 100, (rssi < 0 ? -rssi : rssi) % 100);
+        } else
+            __dedup_printf(&output, "null}");
+    }
+    __dedup_printf(&output, "]}");
+    return output.used < output.size ? output.used : 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// simulated gateways: each packet, from one of DEDUP_SIMULATE_SENSORS, is heard by each gateway with a probability,
+// at an RSSI that falls with the gateway's number, and reaches the broker after a delay of up to 3/4 of the window
+// (DEDUP_SIMULATE_LATE percent of copies after more than the window); its copies, enveloped as the gateway would, go
+// through the table in order of arrival, and each packet heard must be published once, as its best copy
+
+#define DEDUP_SIMULATE_SENSORS 100
+#define DEDUP_SIMULATE_GAP_MS  100 // between packets, at most
+#define DEDUP_SIMULATE_HEARD   85  // percent, for each gateway
+#define DEDUP_SIMULATE_LATE    1   // percent
+#define DEDUP_SIMULATE_TOPIC   "e22900t22/%s/sensors"
+
+typedef struct {
+    uint64_t arrival_us, ts_ms;
+    uint32_t packet;
+    uint8_t gateway;
+    int8_t rssi;
+} __dedup_copy_t;
+
+static struct {
+    uint32_t *published;
+    int8_t *rssi;
+    uint32_t misrouted;
+} __dedup_simulated;
+
+static inline uint32_t __dedup_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int __dedup_copy_compare(const void *a, const void *b) {
+    const uint64_t x = ((const __dedup_copy_t *)a)->arrival_us, y = ((const __dedup_copy_t *)b)->arrival_us;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void __dedup_simulate_publish(const char *topic, const uint8_t *payload, const int length) {
+    static const char *const keys[2] = { "data", "rssi" }, *const data_keys[1] = { "n" };
+    json_span_t values[2], packet[1];
+    int64_t n, rssi;
+    char expected[DEDUP_TOPIC_MAX];
+    snprintf(expected, sizeof(expected), DEDUP_SIMULATE_TOPIC, DEDUP_NAME_DEFAULT);
+    if (strcmp(topic, expected) != 0 || json_object_values(payload, length, keys, 2, values) != 2 || json_object_values(values[0].text, values[0].length, data_keys, 1, packet) != 1 ||
+        !json_number_parse(packet[0].text, packet[0].length, &n) || !json_number_parse(values[1].text, values[1].length, &rssi)) {
+        __dedup_simulated.misrouted++;
+        return;
+    }
+    __dedup_simulated.published[n / 1000000]++;
+    __dedup_simulated.rssi[n / 1000000] = (int8_t)(rssi / 1000000);
+}
+
+static bool __dedup_simulate_run(const int gateway_count, const uint32_t packets, const uint32_t capacity, const uint32_t window_ms) {
+    static const char *const keys[3] = { "data", "rssi", "ts" };
+    __dedup_copy_t *copies = (__dedup_copy_t *)malloc((size_t)packets * (size_t)gateway_count * sizeof(__dedup_copy_t));
+    __dedup_copy_t *best = (__dedup_copy_t *)calloc(packets, sizeof(__dedup_copy_t));
+    uint64_t *first_us = (uint64_t *)calloc(packets, sizeof(uint64_t));
+    __dedup_simulated.published = (uint32_t *)calloc(packets, sizeof(uint32_t));
+    __dedup_simulated.rssi = (int8_t *)calloc(packets, sizeof(int8_t));
+    __dedup_simulated.misrouted = 0;
+    dedup_table_t table;
+    bool okay = copies != NULL && best != NULL && first_us != NULL && __dedup_simulated.published != NULL && __dedup_simulated.rssi != NULL && dedup_begin(&table, capacity, window_ms, 1, DEDUP_NAME_DEFAULT, keys, __dedup_simulate_publish);
+    if (!okay) {
+        fprintf(stderr, "dedup: simulate: out of memory\n");
+    } else {
+        uint32_t random = 0x2545F491, count = 0, seqs[DEDUP_GATEWAYS_MAX] = { 0 };
+        uint64_t emitted_us = 0;
+        for (uint32_t n = 0; n < packets; n++) {
+            emitted_us += 1000 + __dedup_random(&random) % (DEDUP_SIMULATE_GAP_MS * 1000);
+            for (int g = 0; g < gateway_count; g++) {
+                if (__dedup_random(&random) % 100 >= DEDUP_SIMULATE_HEARD)
+                    continue;
+                uint64_t delay_us = 2000 + __dedup_random(&random) % (window_ms * 750);
+                if (__dedup_random(&random) % 100 < DEDUP_SIMULATE_LATE)
+                    delay_us += window_ms * 1100;
+                copies[count++] = (__dedup_copy_t) {
+                    .arrival_us = emitted_us + delay_us,
+                    .ts_ms = emitted_us / 1000 + 5 + __dedup_random(&random) % 3,
+                    .packet = n,
+                    .gateway = (uint8_t)g,
+                    .rssi = (int8_t)(-70 - (6 * g) - (int)(__dedup_random(&random) % 16)),
+                };
+            }
+        }
+        qsort(copies, count, sizeof(__dedup_copy_t), __dedup_copy_compare);
+        uint32_t heard = 0, late = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const __dedup_copy_t *copy = &copies[i];
+            __dedup_copy_t *chosen = &best[copy->packet];
+            if (first_us[copy->packet] == 0) {
+                first_us[copy->packet] = copy->arrival_us;
+                *chosen = *copy;
+                heard++;
+            } else if (copy->arrival_us >= first_us[copy->packet] + (uint64_t)window_ms * 1000)
+                late++;
+            else if (copy->rssi > chosen->rssi || (copy->rssi == chosen->rssi && copy->ts_ms < chosen->ts_ms))
+                *chosen = *copy;
+            char topic[DEDUP_TOPIC_MAX], gateway[16], payload[DEDUP_PAYLOAD_MAX];
+            snprintf(gateway, sizeof(gateway), "gw%d", copy->gateway);
+            snprintf(topic, sizeof(topic), DEDUP_SIMULATE_TOPIC, gateway);
+            const int length = snprintf(payload, sizeof(payload), "{\"ts\":%" PRIu64 ",\"rssi\":%d,\"ch\":23,\"seq\":%" PRIu32 ",\"data\":{\"id\":\"sensor-%" PRIu32 "\",\"n\":%" PRIu32 ",\"value\":%" PRIu32 "}}", copy->ts_ms,
+                                        copy->rssi, seqs[copy->gateway]++, copy->packet % DEDUP_SIMULATE_SENSORS, copy->packet, (copy->packet * 7919) % 1000);
+            dedup_message(&table, topic, (const uint8_t *)payload, length, copy->arrival_us);
+        }
+        dedup_poll(&table, (count > 0 ? copies[count - 1].arrival_us : 0) + ((uint64_t)window_ms * 2000));
+        uint32_t once = 0, repeated = 0, missed = 0, chosen = 0;
+        for (uint32_t n = 0; n < packets; n++) {
+            if (first_us[n] == 0)
+                continue;
+            once += __dedup_simulated.published[n] == 1;
+            repeated += __dedup_simulated.published[n] > 1;
+            missed += __dedup_simulated.published[n] == 0;
+            chosen += __dedup_simulated.published[n] > 0 && __dedup_simulated.rssi[n] == best[n].rssi;
+        }
+        const uint32_t failures = repeated + missed + (heard - chosen) + __dedup_simulated.misrouted + (late != table.late);
+        printf("dedup: simulate: gateways=%d, packets=%" PRIu32 ", copies=%" PRIu32 ", window=%" PRIu32 "ms, entries=%" PRIu32 "\n", gateway_count, packets, count, window_ms, capacity);
+        printf("dedup: simulate: heard=%" PRIu32 ", published once=%" PRIu32 ", more than once=%" PRIu32 ", missed=%" PRIu32 ", best copy=%" PRIu32 ", late=%" PRIu64 " (expected %" PRIu32 "), misrouted=%" PRIu32 ", failures=%" PRIu32 "\n", heard,
+               once, repeated, missed, chosen, table.late, late, __dedup_simulated.misrouted, failures);
+        if (table.early > 0)
+            printf("dedup: simulate: %" PRIu64 " entries were published early, as the ring was full: size it for 2 windows of packets\n", table.early);
+        dedup_stats_display(&table, count > 0 ? copies[count - 1].arrival_us : 0);
+        printf("dedup: simulate: memory=%zu bytes\n", ((size_t)table.capacity * sizeof(dedup_entry_t)) + ((size_t)(table.index_mask + 1) * sizeof(int32_t)));
+        okay = failures == 0;
+        dedup_end(&table);
+    }
+    free(__dedup_simulated.rssi);
+    free(__dedup_simulated.published);
+    free(first_us);
+    free(best);
+    free(copies);
+    return okay;
+}
+
+// for each number of gateways in the comma separated list
+bool dedup_simulate(const char *gateways, const uint32_t packets, const uint32_t capacity, const uint32_t window_ms) {
+    bool okay = true;
+    for (const char *list = gateways; *list != '\0';) {
+        char *end;
+        const long gateway_count = strtol(list, &end, 10);
+        if (end == list || gateway_count <= 0 || gateway_count > DEDUP_GATEWAYS_MAX || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "dedup: simulate: expected a list of gateway counts, e.g. '2,3,4', not '%s'\n", gateways);
+            return false;
+        }
+        list = *end == ',' ? end + 1 : end;
+        okay = __dedup_simulate_run((int)gateway_count, packets, capacity, window_ms) && okay;
+    }
+    return okay;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -12,6 +12,10 @@
 
 extern void __sleep_ms(const uint32_t ms);
 
+#ifndef TRACE_EVENT
+#define TRACE_EVENT(type, a, b, c, d) // unless the program includes trace_linux.h first
+#endif
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
@@ -186,14 +190,43 @@ static bool device_packet_write(const uint8_t *packet, const int length) {
     return serial_write(packet, length) == length;
 }
 
-static bool device_packet_read(uint8_t *packet, const int max_size, int *packet_size, uint8_t *rssi) {
-    *packet_size = serial_read(packet, max_size, _e22900txx_config.read_timeout_packet);
+static bool device_packet_read_timeout(uint8_t *packet, const int max_size, int *packet_size, uint8_t *rssi, const uint32_t timeout_ms) {
+    *packet_size = serial_read(packet, max_size, timeout_ms);
     if (*packet_size <= 0)
         return false;
     *rssi = _e22900txx_config.rssi_packet ? packet[--*packet_size] : 0;
     return true;
 }
 
+static bool device_packet_read(uint8_t *packet, const int max_size, int *packet_size, uint8_t *rssi) {
+    return device_packet_read_timeout(packet, max_size, packet_size, rssi, _e22900txx_config.read_timeout_packet);
+}
+
+// the idle time that ends a frame on the UART: the module writes each sub-packet out as a burst, so its bytes are a few byte
+// times apart (plus the USB bridge's latency); a transmission longer than the sub-packet size arrives as sub-packets about
+// an air time apart, so with sub-packets smaller than a frame the gap is stretched to join them
+#define E22900T22_FRAME_GAP_BYTES          4
+#define E22900T22_FRAME_GAP_SLACK_US       5000 // USB bridge latency
+#define E22900T22_FRAME_AIR_OVERHEAD_BYTES 16   // preamble and header, approximately, in bytes at the air rate
+
+// the time on the air of a transmission of so many bytes at the configured air rate, approximately
+static uint32_t device_air_time_us(const int bytes) {
+    static const uint32_t air_rates_bps[] = { 2400, 2400, 2400, 4800, 9600, 19200, 38400, 62500 }; // as get_packet_rate
+    return (uint32_t)(((uint64_t)(bytes + E22900T22_FRAME_AIR_OVERHEAD_BYTES) * 8 * 1000000) / air_rates_bps[_e22900txx_config.packet_rate & 0x07]);
+}
+
+static uint32_t device_frame_gap_us(const int uart_rate) {
+    const uint32_t byte_us = (10 * 1000000) / (uint32_t)(uart_rate > 0 ? uart_rate : 9600);
+    uint32_t gap_us = (E22900T22_FRAME_GAP_BYTES * byte_us) + E22900T22_FRAME_GAP_SLACK_US;
+    const uint16_t subpacket_bytes = get_packet_size_bytes(_e22900txx_config.packet_size);
+    if (subpacket_bytes < E22900T22_PACKET_MAXSIZE) {
+        const uint64_t air_us = device_air_time_us(subpacket_bytes);
+        if ((air_us * 5) / 4 > gap_us)
+            gap_us = (uint32_t)((air_us * 5) / 4);
+    }
+    return gap_us;
+}
+
 static void device_packet_display(const uint8_t *packet, const int packet_size, const uint8_t rssi) {
     PRINTF_INFO("device: packet: size=%d", packet_size);
     if (_e22900txx_config.rssi_packet)
@@ -205,12 +238,164 @@ static void device_packet_display(const uint8_t *packet, const int packet_size,
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+// TDMA: the gateway broadcasts a beacon, after which the frame has the assigned slots and then some contention slots,
+// used by nodes without an assignment (so new ones are heard) or with more to send than their slots carry, once a
+// frame each; a beacon lists assignments by a hash of the node's key (what the gateway renders from its packets with
+// 'tdma-key', e.g. its id), in pages sent back to back, over a cycle of frames if they do not all fit, changes first.
+// A node times the frame from a page's arrival, less the delay the gateway estimates (its reading at the UART), plus
+// the air time of the pages after it, with slot N starting N slots later, and keeps its slots until a page gives one
+// to another node, or none lists it for two cycles. All in the node's millisecond clock, which may wrap
+
+#define TDMA_BEACON_MAGIC_0     0xE2
+#define TDMA_BEACON_MAGIC_1     0x7D
+#define TDMA_BEACON_HEADER_SIZE 15
+#define TDMA_BEACON_ENTRY_SIZE  6 // hash (u32le), slot (u16le)
+#define TDMA_BEACON_ENTRIES_MAX ((E22900T22_PACKET_MAXSIZE - TDMA_BEACON_HEADER_SIZE) / TDMA_BEACON_ENTRY_SIZE)
+#define TDMA_NODE_SLOTS_MAX     4
+
+typedef struct {
+    uint8_t sequence, cycle; // sequence: of the frame, and so the same for each of its pages
+    uint16_t slot_ms, slot_count, contention_count, delay_ms, after_ms;
+    uint8_t entry_count;
+} tdma_beacon_t;
+
+typedef struct {
+    uint32_t hash;
+    uint16_t slots[TDMA_NODE_SLOTS_MAX];
+    uint8_t slot_count, unlisted; // frames since one listed it
+    bool synced, listed, contended; // in this frame
+    uint32_t start_ms;              // of this frame
+    tdma_beacon_t beacon;
+} tdma_node_t;
+
+static uint32_t tdma_key_hash(const uint8_t *key, const int length) {
+    uint32_t hash = 0x811c9dc5; // FNV-1a
+    for (int i = 0; i < length; i++)
+        hash = (hash ^ key[i]) * 0x01000193;
+    return hash;
+}
+
+static inline uint16_t __tdma_get_u16(const uint8_t *bytes) {
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static inline uint32_t __tdma_get_u32(const uint8_t *bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// the size of the page, or 0 if it is not one
+static int tdma_beacon_parse(const uint8_t *packet, const int length, tdma_beacon_t *beacon) {
+    if (length < TDMA_BEACON_HEADER_SIZE || packet[0] != TDMA_BEACON_MAGIC_0 || packet[1] != TDMA_BEACON_MAGIC_1)
+        return 0;
+    beacon->sequence = packet[2];
+    beacon->cycle = packet[3];
+    beacon->slot_ms = __tdma_get_u16(&packet[4]);
+    beacon->slot_count = __tdma_get_u16(&packet[6]);
+    beacon->contention_count = __tdma_get_u16(&packet[8]);
+    beacon->delay_ms = __tdma_get_u16(&packet[10]);
+    beacon->after_ms = __tdma_get_u16(&packet[12]);
+    beacon->entry_count = packet[14];
+    const int size = TDMA_BEACON_HEADER_SIZE + beacon->entry_count * TDMA_BEACON_ENTRY_SIZE;
+    return beacon->slot_ms > 0 && length >= size ? size : 0;
+}
+
+static uint32_t tdma_frame_ms(const tdma_beacon_t *beacon) {
+    return ((uint32_t)beacon->slot_count + beacon->contention_count) * beacon->slot_ms;
+}
+
+static void tdma_node_begin(tdma_node_t *node, const uint8_t *key, const int length) {
+    memset(node, 0, sizeof(*node));
+    node->hash = tdma_key_hash(key, length);
+}
+
+static inline void __tdma_node_slot_remove(tdma_node_t *node, const int j) {
+    node->slots[j] = node->slots[--node->slot_count];
+}
+
+static void __tdma_node_page(tdma_node_t *node, const uint8_t *page, const tdma_beacon_t *beacon, const uint32_t now_ms) {
+    if (!node->synced || beacon->sequence != node->beacon.sequence) {
+        if (node->synced && !node->listed && node->unlisted < 255 && ++node->unlisted > 2 * (int)beacon->cycle)
+            node->slot_count = 0;
+        node->listed = node->contended = false;
+    }
+    uint16_t listed[TDMA_NODE_SLOTS_MAX];
+    uint8_t listed_count = 0;
+    for (int i = 0; i < beacon->entry_count; i++) {
+        const uint8_t *entry = &page[TDMA_BEACON_HEADER_SIZE + i * TDMA_BEACON_ENTRY_SIZE];
+        const uint16_t slot = __tdma_get_u16(&entry[4]);
+        if (__tdma_get_u32(entry) == node->hash) {
+            if (listed_count < TDMA_NODE_SLOTS_MAX)
+                listed[listed_count++] = slot;
+        } else
+            for (int j = node->slot_count - 1; j >= 0; j--)
+                if (node->slots[j] == slot)
+                    __tdma_node_slot_remove(node, j);
+    }
+    if (listed_count > 0) {
+        memcpy(node->slots, listed, listed_count * sizeof(uint16_t));
+        node->slot_count = listed_count;
+        node->unlisted = 0;
+        node->listed = true;
+    }
+    for (int j = node->slot_count - 1; j >= 0; j--)
+        if (node->slots[j] >= beacon->slot_count)
+            __tdma_node_slot_remove(node, j);
+    node->beacon = *beacon;
+    node->start_ms = now_ms - beacon->delay_ms + beacon->after_ms;
+    node->synced = true;
+}
+
+// takes the packet if it is a beacon (one or more pages, as read together), received at now_ms: the node's slots are
+// those a page lists for it, else those it had less any listed for another or beyond the frame
+static bool tdma_node_beacon(tdma_node_t *node, const uint8_t *packet, const int length, const uint32_t now_ms) {
+    tdma_beacon_t beacon;
+    int offset = 0, size;
+    while ((size = tdma_beacon_parse(&packet[offset], length - offset, &beacon)) > 0) {
+        __tdma_node_page(node, &packet[offset], &beacon, now_ms);
+        offset += size;
+    }
+    return offset > 0;
+}
+
+// when to send a packet ready at now_ms, of 'queued' waiting: the start of the next of its slots in the frame, else
+// (if it has none, or more queued than they carry) of a contention slot chosen by 'random' from those left, one a frame
+// (so it is taken by asking); false if there is none, to wait for the next beacon
+static bool tdma_node_transmit_ms(tdma_node_t *node, const uint32_t now_ms, const int queued, const uint32_t random, uint32_t *at_ms) {
+    if (!node->synced)
+        return false;
+    const uint32_t slot_ms = node->beacon.slot_ms;
+    bool found = false;
+    for (int j = 0; j < node->slot_count; j++) {
+        const uint32_t slot_start_ms = node->start_ms + node->slots[j] * slot_ms;
+        if ((int32_t)(slot_start_ms - now_ms) >= 0 && (!found || (int32_t)(slot_start_ms - *at_ms) < 0)) {
+            *at_ms = slot_start_ms;
+            found = true;
+        }
+    }
+    if (found)
+        return true;
+    if (node->contended || (node->slot_count > 0 && queued <= node->slot_count))
+        return false;
+    const uint32_t contention_ms = node->start_ms + node->beacon.slot_count * slot_ms;
+    const int32_t late_ms = (int32_t)(now_ms - contention_ms);
+    const uint32_t first = late_ms > 0 ? ((uint32_t)late_ms + slot_ms - 1) / slot_ms : 0;
+    if (first >= node->beacon.contention_count)
+        return false;
+    *at_ms = contention_ms + (first + random % (node->beacon.contention_count - first)) * slot_ms;
+    node->contended = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
 static bool device_cmd_send(const uint8_t *cmd, const int cmd_len) {
 
     if (_e22900txx_config.debug) {
         PRINTF_DEBUG("command: send: (%d bytes): ", cmd_len);
         __print_hex_debug(cmd, cmd_len, 0);
     }
+    TRACE_EVENT(TRACE_COMMAND_SEND, cmd[0], cmd_len >= 3 ? (cmd[1] << 8) | cmd[2] : 0, cmd_len, 0);
 
     return serial_write(cmd, cmd_len) == cmd_len;
 }
@@ -218,6 +403,7 @@ static bool device_cmd_send(const uint8_t *cmd, const int cmd_len) {
 static int device_cmd_recv_response(uint8_t *buffer, const int buffer_length, const uint32_t timeout_ms) {
 
     const int read_len = serial_read(buffer, buffer_length, timeout_ms);
+    TRACE_EVENT(TRACE_COMMAND_RECV, read_len > 0 ? buffer[0] : 0, 0, read_len, 0);
 
     if (_e22900txx_config.debug) {
         if (read_len > 0) {
@@ -416,6 +602,7 @@ static bool device_mode_switch(const device_mode_t mode) {
     if (_e22900txx_module == E22900T22_MODULE_USB)
         result = device_mode_switch_impl_software(mode);
 #endif
+    TRACE_EVENT(TRACE_MODE_SWITCH, mode, result, 0, 0);
     if (!result)
         return false;
     static const char *name = "mode_switch";
@@ -715,7 +902,42 @@ static bool device_config_read_and_update(void) {
     return true;
 }
 
-static void device_packet_read_and_display(volatile bool *is_active) {
+// whether the settings held in the module's registers differ, as against those only used by the host (e.g. timeouts)
+static bool device_config_differs(const e22900t22_config_t *a, const e22900t22_config_t *b) {
+    bool differs = a->address != b->address || a->network != b->network || a->channel != b->channel || a->packet_size != b->packet_size || a->packet_rate != b->packet_rate || a->crypt != b->crypt ||
+                   a->transmit_power != b->transmit_power || a->transmission_method != b->transmission_method || a->relay_enabled != b->relay_enabled || a->listen_before_transmit != b->listen_before_transmit ||
+                   a->rssi_packet != b->rssi_packet || a->rssi_channel != b->rssi_channel;
+#ifdef E22900T22_SUPPORT_MODULE_DIP
+    differs = differs || a->wor_enabled != b->wor_enabled || a->wor_cycle != b->wor_cycle;
+#endif
+    return differs;
+}
+
+// for a connected device, takes the new settings, and only if those in the module's registers changed, switches to
+// config mode to write them (as device_config_read_and_update, so only the registers that differ) and back to transfer
+// mode; *written is set if the module was written
+static bool device_reconfigure(const e22900t22_config_t *config_device, bool *written) {
+    *written = device_config_differs(&_e22900txx_config, config_device);
+    const e22900t22_config_t config_previous = _e22900txx_config;
+    if (!device_config(config_device)) {
+        PRINTF_ERROR("device: failed to set config\n");
+        _e22900txx_config = config_previous;
+        return false;
+    }
+    if (!*written)
+        return true;
+    if (!(device_mode_config() && device_config_read_and_update() && device_mode_transfer())) {
+        PRINTF_ERROR("device: failed to reconfigure module\n");
+        device_mode_transfer();
+        return false;
+    }
+    return true;
+}
+
+// on_packet, if not NULL, is given each packet as read, e.g. to capture it
+typedef void (*device_packet_handler_t)(const uint8_t *packet, const int packet_size, const uint8_t rssi);
+
+static void device_packet_read_and_display(volatile bool *is_active, device_packet_handler_t on_packet) {
 
     PRINTF_DEBUG("device: packet read and display (with periodic channel_rssi)\n");
 
@@ -724,9 +946,11 @@ static void device_packet_read_and_display(volatile bool *is_active) {
     uint8_t rssi;
 
     while (*is_active) {
-        if (device_packet_read(packet_buffer, get_packet_size_bytes(_e22900txx_config.packet_size) + 1, &packet_size, &rssi) && *is_active)
+        if (device_packet_read(packet_buffer, get_packet_size_bytes(_e22900txx_config.packet_size) + 1, &packet_size, &rssi) && *is_active) {
+            if (on_packet != NULL)
+                on_packet(packet_buffer, packet_size, rssi);
             device_packet_display(packet_buffer, packet_size, rssi);
-        else if (*is_active) {
+        } else if (*is_active) {
             if (device_channel_rssi_read(&rssi) && *is_active)
                 device_channel_rssi_display(rssi);
         }
@@ -831,6 +1055,19 @@ static int get_rssi_dbm(const uint8_t rssi) {
     return 0;
 }
 
+// in Q8.8, keeping the half dB steps of the USB module
+static int32_t get_rssi_dbm_q8(const uint8_t rssi) {
+#ifdef E22900T22_SUPPORT_MODULE_DIP
+    if (_e22900txx_module == E22900T22_MODULE_DIP)
+        return -(256 - (int32_t)rssi) * 256;
+#endif
+#ifdef E22900T22_SUPPORT_MODULE_USB
+    if (_e22900txx_module == E22900T22_MODULE_USB)
+        return -(int32_t)rssi * 128;
+#endif
+    return 0;
+}
+
 #pragma GCC diagnostic pop
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
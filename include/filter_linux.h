@@ -0,0 +1,483 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// binary packet filters, e.g. 'u8[0] == 0x5B && u16le[1] & 0x0FFF in 100..200 && len >= 8', are compiled at config load
+// into a small cBPF-like program: an accumulator, loads of the length or a (masked) field, and conditional forward
+// jumps to a final match or no-match; the verifier only accepts forward jumps within the program, so every program
+// terminates within its length; a load beyond the end of the packet ends the program as no-match
+//
+//   filter  := or
+//   or      := and ( '||' and )*
+//   and     := unary ( '&&' unary )*
+//   unary   := '!' unary | '(' or ')' | compare
+//   compare := operand ( '==' | '!=' | '<' | '<=' | '>' | '>=' ) number | operand 'in' number '..' number
+//   operand := 'len' | type '[' offset ']' ( '&' number )?
+//   type    := u8 | i8 | u16le | u16be | i16le | i16be | u32le | u32be | i32le | i32be
+
+#define FILTER_INSNS_MAX  64
+#define FILTER_NODES_MAX  32
+#define FILTER_OFFSET_MAX 1024
+
+typedef enum {
+    FILTER_LD_LEN = 0,
+    FILTER_LD_U8,
+    FILTER_LD_I8,
+    FILTER_LD_U16LE,
+    FILTER_LD_U16BE,
+    FILTER_LD_I16LE,
+    FILTER_LD_I16BE,
+    FILTER_LD_U32LE,
+    FILTER_LD_U32BE,
+    FILTER_LD_I32LE,
+    FILTER_LD_I32BE,
+    FILTER_AND,
+    FILTER_JEQ,
+    FILTER_JGT,
+    FILTER_JGE,
+    FILTER_RET,
+} filter_code_t;
+
+typedef struct {
+    uint8_t code;
+    uint8_t jt, jf; // relative to the next instruction
+    int64_t k;
+} filter_insn_t;
+
+typedef struct {
+    filter_insn_t insns[FILTER_INSNS_MAX];
+    int length;
+} filter_program_t;
+
+static const struct {
+    const char *name;
+    filter_code_t code;
+    int width;
+} __filter_types[] = {
+    { "u8", FILTER_LD_U8, 1 },       { "i8", FILTER_LD_I8, 1 },       { "u16le", FILTER_LD_U16LE, 2 }, { "u16be", FILTER_LD_U16BE, 2 }, { "i16le", FILTER_LD_I16LE, 2 },
+    { "i16be", FILTER_LD_I16BE, 2 }, { "u32le", FILTER_LD_U32LE, 4 }, { "u32be", FILTER_LD_U32BE, 4 }, { "i32le", FILTER_LD_I32LE, 4 }, { "i32be", FILTER_LD_I32BE, 4 },
+};
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+    __FILTER_NODE_COMPARE = 0,
+    __FILTER_NODE_AND,
+    __FILTER_NODE_OR,
+    __FILTER_NODE_NOT,
+} __filter_node_type_t;
+
+typedef enum {
+    __FILTER_CMP_EQ = 0,
+    __FILTER_CMP_NE,
+    __FILTER_CMP_LT,
+    __FILTER_CMP_LE,
+    __FILTER_CMP_GT,
+    __FILTER_CMP_GE,
+    __FILTER_CMP_IN,
+} __filter_cmp_t;
+
+typedef struct {
+    __filter_node_type_t type;
+    int left, right;
+    filter_code_t load;
+    int64_t offset, mask, value, value_high;
+    bool masked;
+    __filter_cmp_t cmp;
+} __filter_node_t;
+
+typedef struct {
+    const char *p;
+    const char *error;
+    __filter_node_t nodes[FILTER_NODES_MAX];
+    int node_count;
+    filter_program_t *program;
+    int label_count;
+    int labels[FILTER_INSNS_MAX * 2];
+    int jt_label[FILTER_INSNS_MAX], jf_label[FILTER_INSNS_MAX];
+} __filter_compiler_t;
+
+#define __FILTER_LABEL_NEXT -1
+
+static void __filter_skip(__filter_compiler_t *c) {
+    while (*c->p == ' ' || *c->p == '\t')
+        c->p++;
+}
+
+static bool __filter_accept(__filter_compiler_t *c, const char *token) {
+    __filter_skip(c);
+    const size_t length = strlen(token);
+    if (strncmp(c->p, token, length) != 0)
+        return false;
+    c->p += length;
+    return true;
+}
+
+static bool __filter_number(__filter_compiler_t *c, int64_t *value) {
+    __filter_skip(c);
+    const bool negative = *c->p == '-';
+    const char *p = c->p + (negative ? 1 : 0);
+    const int base = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) ? 16 : 10;
+    if (base == 16)
+        p += 2;
+    char *end;
+    errno = 0;
+    const unsigned long long magnitude = strtoull(p, &end, base);
+    if (end == p || errno != 0 || magnitude > (unsigned long long)INT64_MAX) {
+        c->error = "invalid number";
+        return false;
+    }
+    *value = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+    c->p = end;
+    return true;
+}
+
+static int __filter_node(__filter_compiler_t *c, const __filter_node_type_t type, const int left, const int right) {
+    if (c->node_count == FILTER_NODES_MAX) {
+        c->error = "expression too complex";
+        return -1;
+    }
+    __filter_node_t *node = &c->nodes[c->node_count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return c->node_count++;
+}
+
+static int __filter_parse_or(__filter_compiler_t *c);
+
+static int __filter_parse_compare(__filter_compiler_t *c) {
+    const int n = __filter_node(c, __FILTER_NODE_COMPARE, -1, -1);
+    if (n < 0)
+        return -1;
+    __filter_node_t *node = &c->nodes[n];
+    __filter_skip(c);
+    if (__filter_accept(c, "len"))
+        node->load = FILTER_LD_LEN;
+    else {
+        int t, width = 0;
+        for (t = (int)(sizeof(__filter_types) / sizeof(__filter_types[0])) - 1; t >= 0; t--)
+            if (strncmp(c->p, __filter_types[t].name, strlen(__filter_types[t].name)) == 0 && c->p[strlen(__filter_types[t].name)] == '[')
+                break;
+        if (t < 0) {
+            c->error = "expected 'len' or a field such as 'u8[0]'";
+            return -1;
+        }
+        c->p += strlen(__filter_types[t].name) + 1;
+        node->load = __filter_types[t].code;
+        width = __filter_types[t].width;
+        if (!__filter_number(c, &node->offset))
+            return -1;
+        if (node->offset < 0 || node->offset + width > FILTER_OFFSET_MAX) {
+            c->error = "field offset out of range";
+            return -1;
+        }
+        if (!__filter_accept(c, "]")) {
+            c->error = "expected ']'";
+            return -1;
+        }
+    }
+    __filter_skip(c);
+    if (c->p[0] == '&' && c->p[1] != '&') {
+        c->p++;
+        node->masked = true;
+        if (!__filter_number(c, &node->mask))
+            return -1;
+    }
+    static const struct {
+        const char *token;
+        __filter_cmp_t cmp;
+    } cmps[] = { { "==", __FILTER_CMP_EQ }, { "!=", __FILTER_CMP_NE }, { "<=", __FILTER_CMP_LE }, { ">=", __FILTER_CMP_GE }, { "<", __FILTER_CMP_LT }, { ">", __FILTER_CMP_GT }, { "in", __FILTER_CMP_IN } };
+    int i;
+    for (i = 0; i < (int)(sizeof(cmps) / sizeof(cmps[0])) && !__filter_accept(c, cmps[i].token); i++)
+        ;
+    if (i == (int)(sizeof(cmps) / sizeof(cmps[0]))) {
+        c->error = "expected a comparison";
+        return -1;
+    }
+    node->cmp = cmps[i].cmp;
+    if (!__filter_number(c, &node->value))
+        return -1;
+    if (node->cmp == __FILTER_CMP_IN && (!__filter_accept(c, "..") || !__filter_number(c, &node->value_high))) {
+        c->error = c->error ? c->error : "expected 'low..high'";
+        return -1;
+    }
+    return n;
+}
+
+static int __filter_parse_unary(__filter_compiler_t *c) {
+    if (__filter_accept(c, "!")) {
+        const int operand = __filter_parse_unary(c);
+        return operand < 0 ? -1 : __filter_node(c, __FILTER_NODE_NOT, operand, -1);
+    }
+    if (__filter_accept(c, "(")) {
+        const int inner = __filter_parse_or(c);
+        if (inner >= 0 && !__filter_accept(c, ")")) {
+            c->error = "expected ')'";
+            return -1;
+        }
+        return inner;
+    }
+    return __filter_parse_compare(c);
+}
+
+static int __filter_parse_and(__filter_compiler_t *c) {
+    int left = __filter_parse_unary(c);
+    while (left >= 0 && __filter_accept(c, "&&")) {
+        const int right = __filter_parse_unary(c);
+        left = right < 0 ? -1 : __filter_node(c, __FILTER_NODE_AND, left, right);
+    }
+    return left;
+}
+
+static int __filter_parse_or(__filter_compiler_t *c) {
+    int left = __filter_parse_and(c);
+    while (left >= 0 && __filter_accept(c, "||")) {
+        const int right = __filter_parse_and(c);
+        left = right < 0 ? -1 : __filter_node(c, __FILTER_NODE_OR, left, right);
+    }
+    return left;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static int __filter_label(__filter_compiler_t *c) {
+    c->labels[c->label_count] = -1;
+    return c->label_count++;
+}
+
+static void __filter_place(__filter_compiler_t *c, const int label) {
+    c->labels[label] = c->program->length;
+}
+
+static bool __filter_emit(__filter_compiler_t *c, const filter_code_t code, const int64_t k, const int jt_label, const int jf_label) {
+    if (c->program->length == FILTER_INSNS_MAX) {
+        c->error = "program too long";
+        return false;
+    }
+    const int pc = c->program->length++;
+    c->program->insns[pc].code = (uint8_t)code;
+    c->program->insns[pc].jt = c->program->insns[pc].jf = 0;
+    c->program->insns[pc].k = k;
+    c->jt_label[pc] = jt_label;
+    c->jf_label[pc] = jf_label;
+    return true;
+}
+
+// emits the condition as jumps to 'on_true' or 'on_false', short-circuiting && and || through intermediate labels
+static bool __filter_generate(__filter_compiler_t *c, const int n, const int on_true, const int on_false) {
+    const __filter_node_t *node = &c->nodes[n];
+    switch (node->type) {
+    case __FILTER_NODE_AND: {
+        const int next = __filter_label(c);
+        if (!__filter_generate(c, node->left, next, on_false))
+            return false;
+        __filter_place(c, next);
+        return __filter_generate(c, node->right, on_true, on_false);
+    }
+    case __FILTER_NODE_OR: {
+        const int next = __filter_label(c);
+        if (!__filter_generate(c, node->left, on_true, next))
+            return false;
+        __filter_place(c, next);
+        return __filter_generate(c, node->right, on_true, on_false);
+    }
+    case __FILTER_NODE_NOT:
+        return __filter_generate(c, node->left, on_false, on_true);
+    case __FILTER_NODE_COMPARE:
+    default:
+        if (!__filter_emit(c, node->load, node->offset, __FILTER_LABEL_NEXT, __FILTER_LABEL_NEXT))
+            return false;
+        if (node->masked && !__filter_emit(c, FILTER_AND, node->mask, __FILTER_LABEL_NEXT, __FILTER_LABEL_NEXT))
+            return false;
+        switch (node->cmp) {
+        case __FILTER_CMP_EQ:
+            return __filter_emit(c, FILTER_JEQ, node->value, on_true, on_false);
+        case __FILTER_CMP_NE:
+            return __filter_emit(c, FILTER_JEQ, node->value, on_false, on_true);
+        case __FILTER_CMP_LT:
+            return __filter_emit(c, FILTER_JGE, node->value, on_false, on_true);
+        case __FILTER_CMP_LE:
+            return __filter_emit(c, FILTER_JGT, node->value, on_false, on_true);
+        case __FILTER_CMP_GT:
+            return __filter_emit(c, FILTER_JGT, node->value, on_true, on_false);
+        case __FILTER_CMP_GE:
+            return __filter_emit(c, FILTER_JGE, node->value, on_true, on_false);
+        case __FILTER_CMP_IN:
+        default:
+            return __filter_emit(c, FILTER_JGE, node->value, __FILTER_LABEL_NEXT, on_false) && __filter_emit(c, FILTER_JGT, node->value_high, on_false, on_true);
+        }
+    }
+}
+
+// checks that the program can only run forward to a return: jumps land inside the program, loads are bounded, and
+// the last instruction returns
+static int __filter_load_width(const uint8_t code) {
+    for (size_t t = 0; t < sizeof(__filter_types) / sizeof(__filter_types[0]); t++)
+        if ((uint8_t)__filter_types[t].code == code)
+            return __filter_types[t].width;
+    return -1;
+}
+
+bool filter_verify(const filter_program_t *program) {
+    if (program->length <= 0 || program->length > FILTER_INSNS_MAX || program->insns[program->length - 1].code != FILTER_RET)
+        return false;
+    for (int pc = 0; pc < program->length; pc++) {
+        const filter_insn_t *insn = &program->insns[pc];
+        switch (insn->code) {
+        case FILTER_JEQ:
+        case FILTER_JGT:
+        case FILTER_JGE:
+            if (pc + 1 + insn->jt >= program->length || pc + 1 + insn->jf >= program->length)
+                return false;
+            break;
+        case FILTER_LD_LEN:
+        case FILTER_AND:
+        case FILTER_RET:
+            break;
+        default: {
+            const int width = __filter_load_width(insn->code);
+            if (width < 0 || insn->k < 0 || insn->k + width > FILTER_OFFSET_MAX)
+                return false;
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+bool filter_compile(const char *expression, filter_program_t *program) {
+    __filter_compiler_t c = { .p = expression, .error = NULL, .node_count = 0, .program = program, .label_count = 0 };
+    program->length = 0;
+    const int root = __filter_parse_or(&c);
+    __filter_skip(&c);
+    if (root >= 0 && *c.p != '\0')
+        c.error = "unexpected trailing input";
+    if (root >= 0 && c.error == NULL) {
+        const int on_true = __filter_label(&c), on_false = __filter_label(&c);
+        if (__filter_generate(&c, root, on_true, on_false)) {
+            __filter_place(&c, on_true);
+            __filter_emit(&c, FILTER_RET, 1, __FILTER_LABEL_NEXT, __FILTER_LABEL_NEXT);
+            __filter_place(&c, on_false);
+            __filter_emit(&c, FILTER_RET, 0, __FILTER_LABEL_NEXT, __FILTER_LABEL_NEXT);
+        }
+    }
+    if (c.error == NULL) {
+        for (int pc = 0; pc < program->length; pc++) {
+            if (c.jt_label[pc] != __FILTER_LABEL_NEXT)
+                program->insns[pc].jt = (uint8_t)(c.labels[c.jt_label[pc]] - (pc + 1));
+            if (c.jf_label[pc] != __FILTER_LABEL_NEXT)
+                program->insns[pc].jf = (uint8_t)(c.labels[c.jf_label[pc]] - (pc + 1));
+        }
+        if (!filter_verify(program))
+            c.error = "program failed verification";
+    }
+    if (c.error != NULL) {
+        fprintf(stderr, "config: filter: %s at offset %d in '%s'\n", c.error, (int)(c.p - expression), expression);
+        program->length = 0;
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// decodes a field of the given load type at p; constant folded for each case of the interpreter
+static inline int64_t __filter_decode(const uint8_t code, const uint8_t *p) {
+    switch (code) {
+    case FILTER_LD_U8:
+        return p[0];
+    case FILTER_LD_I8:
+        return (int8_t)p[0];
+    case FILTER_LD_U16LE:
+        return (uint16_t)(p[0] | (p[1] << 8));
+    case FILTER_LD_U16BE:
+        return (uint16_t)((p[0] << 8) | p[1]);
+    case FILTER_LD_I16LE:
+        return (int16_t)(uint16_t)(p[0] | (p[1] << 8));
+    case FILTER_LD_I16BE:
+        return (int16_t)(uint16_t)((p[0] << 8) | p[1]);
+    case FILTER_LD_U32LE:
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    case FILTER_LD_U32BE:
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    case FILTER_LD_I32LE:
+        return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    case FILTER_LD_I32BE:
+        return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+    default:
+        return 0;
+    }
+}
+
+#define __FILTER_LOAD(code, width) \
+    case code: \
+        if (insn->k + (width) > size) \
+            return false; \
+        a = __filter_decode(code, packet + insn->k); \
+        break;
+
+bool filter_run(const filter_program_t *program, const uint8_t *packet, const int size) {
+    const filter_insn_t *insn = program->insns;
+    int64_t a = 0;
+    for (;; insn++) {
+        switch (insn->code) {
+        case FILTER_LD_LEN:
+            a = size;
+            break;
+            __FILTER_LOAD(FILTER_LD_U8, 1)
+            __FILTER_LOAD(FILTER_LD_I8, 1)
+            __FILTER_LOAD(FILTER_LD_U16LE, 2)
+            __FILTER_LOAD(FILTER_LD_U16BE, 2)
+            __FILTER_LOAD(FILTER_LD_I16LE, 2)
+            __FILTER_LOAD(FILTER_LD_I16BE, 2)
+            __FILTER_LOAD(FILTER_LD_U32LE, 4)
+            __FILTER_LOAD(FILTER_LD_U32BE, 4)
+            __FILTER_LOAD(FILTER_LD_I32LE, 4)
+            __FILTER_LOAD(FILTER_LD_I32BE, 4)
+        case FILTER_AND:
+            a &= insn->k;
+            break;
+        case FILTER_JEQ:
+            insn += (a == insn->k) ? insn->jt : insn->jf;
+            break;
+        case FILTER_JGT:
+            insn += (a > insn->k) ? insn->jt : insn->jf;
+            break;
+        case FILTER_JGE:
+            insn += (a >= insn->k) ? insn->jt : insn->jf;
+            break;
+        case FILTER_RET:
+        default:
+            return insn->k != 0;
+        }
+    }
+}
+
+#undef __FILTER_LOAD
+
+// the filter field types, for other users of packet fields such as topic templates
+
+bool filter_field_lookup(const char *name, const size_t length, filter_code_t *code, int *width) {
+    for (size_t t = 0; t < sizeof(__filter_types) / sizeof(__filter_types[0]); t++)
+        if (strlen(__filter_types[t].name) == length && strncmp(__filter_types[t].name, name, length) == 0) {
+            *code = __filter_types[t].code;
+            *width = __filter_types[t].width;
+            return true;
+        }
+    return false;
+}
+
+static inline bool filter_field_load(const filter_code_t code, const int width, const uint8_t *packet, const int size, const int offset, int64_t *value) {
+    if (offset < 0 || offset + width > size)
+        return false;
+    *value = __filter_decode((uint8_t)code, packet + offset);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,186 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// cumulative packet counters, in total and per route (in a fixed array indexed as topic_routes, with a slot for the
+// default route), with drops by cause; they are never reset, so that a monitor can take rates and compare gateways,
+// other than those per route when the configuration is reloaded (as the indices may then be of other routes),
+// and are rendered as one JSON document for the health topic. Only the main thread updates them.
+
+#define HEALTH_ROUTES_MAX   64
+#define HEALTH_DOCUMENT_MAX 16384
+
+typedef enum {
+    HEALTH_DROP_NOT_JSON = 0,    // data-type=json, and the packet is not
+    HEALTH_DROP_NO_ROUTE = 1,    // no topic route matched
+    HEALTH_DROP_TOPIC_FIELD = 2, // a field of the topic template is missing from the packet
+    HEALTH_DROP_TOO_LARGE = 3,   // the packet does not fit the conversion or envelope
+    HEALTH_DROP_SINK_FAILED = 4, // not sent to all of the route's sinks
+    HEALTH_DROP_RATE_LIMITED = 5, // the source is over its admission rate
+    HEALTH_DROP_COUNT = 6,
+} health_drop_t;
+
+const char *health_drop_tostring(const health_drop_t reason) {
+    switch (reason) {
+    case HEALTH_DROP_NOT_JSON:
+        return "not-json";
+    case HEALTH_DROP_NO_ROUTE:
+        return "no-route";
+    case HEALTH_DROP_TOPIC_FIELD:
+        return "topic-field";
+    case HEALTH_DROP_TOO_LARGE:
+        return "too-large";
+    case HEALTH_DROP_SINK_FAILED:
+        return "sink-failed";
+    case HEALTH_DROP_RATE_LIMITED:
+        return "rate-limited";
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct {
+    uint64_t packets, bytes, published;
+    uint64_t drops[HEALTH_DROP_COUNT];
+    time_t last_seen;
+} health_counters_t;
+
+health_counters_t health_total;
+health_counters_t health_routes[HEALTH_ROUTES_MAX + 1]; // the last is the default route
+time_t health_start = 0;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void health_routes_reset(void) {
+    memset(health_routes, 0, sizeof(health_routes));
+    if (topic_route_count > HEALTH_ROUTES_MAX)
+        fprintf(stderr, "health: only the first %d of %zu topic routes have their own counters\n", HEALTH_ROUTES_MAX, topic_route_count);
+}
+
+void health_begin(void) {
+    memset(&health_total, 0, sizeof(health_total));
+    health_routes_reset();
+    health_start = time(NULL);
+}
+
+// NULL for routes without a slot
+static health_counters_t *__health_route(const topic_route_t *route) {
+    if (route == NULL)
+        return NULL;
+    if (route == &topic_route_default)
+        return &health_routes[HEALTH_ROUTES_MAX];
+    const ptrdiff_t index = route - topic_routes;
+    return (index >= 0 && index < HEALTH_ROUTES_MAX) ? &health_routes[index] : NULL;
+}
+
+static inline void health_received(const int size) {
+    health_total.packets++;
+    health_total.bytes += (uint64_t)size;
+    health_total.last_seen = time(NULL);
+}
+
+static inline void health_routed(const topic_route_t *route, const int size) {
+    health_counters_t *counters = __health_route(route);
+    if (counters != NULL) {
+        counters->packets++;
+        counters->bytes += (uint64_t)size;
+        counters->last_seen = health_total.last_seen;
+    }
+}
+
+static inline void health_published(const topic_route_t *route) {
+    health_counters_t *counters = __health_route(route);
+    health_total.published++;
+    if (counters != NULL)
+        counters->published++;
+}
+
+// route is NULL for drops before one is selected
+static inline void health_dropped(const health_drop_t reason, const topic_route_t *route) {
+    health_counters_t *counters = __health_route(route);
+    health_total.drops[reason]++;
+    if (counters != NULL)
+        counters->drops[reason]++;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    char *buffer;
+    size_t size, used;
+} __health_output_t;
+
+static void __health_printf(__health_output_t *output, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void __health_printf(__health_output_t *output, const char *format, ...) {
+    if (output->used >= output->size)
+        return;
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(output->buffer + output->used, output->size - output->used, format, args);
+    va_end(args);
+    output->used = length < 0 ? output->size : output->used + (size_t)length;
+}
+
+static void __health_put_string(__health_output_t *output, const char *string) {
+    __health_printf(output, "\"");
+    for (const char *p = string; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            __health_printf(output, "\\%c", *p);
+        else if ((unsigned char)*p < 0x20)
+            __health_printf(output, "\\u%04x", (unsigned)(unsigned char)*p);
+        else
+            __health_printf(output, "%c", *p);
+    }
+    __health_printf(output, "\"");
+}
+
+static void __health_put_counters(__health_output_t *output, const health_counters_t *counters, const health_drop_t drop_first) {
+    __health_printf(output, "\"packets\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"published\":%" PRIu64 ",\"drops\":{", counters->packets, counters->bytes, counters->published);
+    for (int reason = (int)drop_first; reason < HEALTH_DROP_COUNT; reason++)
+        __health_printf(output, "%s\"%s\":%" PRIu64, reason == (int)drop_first ? "" : ",", health_drop_tostring((health_drop_t)reason), counters->drops[reason]);
+    __health_printf(output, "},\"last_seen\":%" PRId64, (int64_t)counters->last_seen);
+}
+
+// e.g. {"time":..,"uptime":..,"packets":..,"bytes":..,"published":..,"drops":{"not-json":..,..},"last_seen":..,"routes":[{"route":0,
+// "topic":"..",..}]}, where per route drops are those after selection and the default route is "route":"default";
+// returns the length, or 0 (and an empty string) if it does not fit
+size_t health_render(char *buffer, const size_t size) {
+    __health_output_t output = { .buffer = buffer, .size = size, .used = 0 };
+    const time_t now = time(NULL);
+    __health_printf(&output, "{\"time\":%" PRId64 ",\"uptime\":%" PRId64 ",", (int64_t)now, (int64_t)(now - health_start));
+    __health_put_counters(&output, &health_total, HEALTH_DROP_NOT_JSON);
+    __health_printf(&output, ",\"routes\":[");
+    const size_t route_count = topic_route_count == 0 ? 1 : (topic_route_count < HEALTH_ROUTES_MAX ? topic_route_count : HEALTH_ROUTES_MAX);
+    for (size_t i = 0; i < route_count; i++) {
+        const topic_route_t *route = topic_route_count == 0 ? &topic_route_default : &topic_routes[i];
+        if (route == &topic_route_default)
+            __health_printf(&output, "%s{\"route\":\"default\",\"topic\":", i == 0 ? "" : ",");
+        else
+            __health_printf(&output, "%s{\"route\":%zu,\"topic\":", i == 0 ? "" : ",", i);
+        __health_put_string(&output, route->topic);
+        __health_printf(&output, ",");
+        __health_put_counters(&output, __health_route(route), HEALTH_DROP_TOPIC_FIELD);
+        __health_printf(&output, "}");
+    }
+    __health_printf(&output, "]}");
+    if (output.used >= output.size) {
+        if (size > 0)
+            buffer[0] = '\0';
+        return 0;
+    }
+    return output.used;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
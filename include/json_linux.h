@@ -0,0 +1,786 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <limits.h>
+
+#include "simd_linux.h"
+
+// structural scanner in the style of simdjson stage 1: each 64-byte block is classified into quote, backslash,
+// structural and whitespace bitmaps (by a vector kernel, or the scalar table), escaped quotes are removed, strings
+// are masked with a prefix xor of the quotes, and the positions of structurals, quotes and scalar starts are
+// emitted as indices for the walker to tokenise
+
+#define JSON_SCAN_SIZE_MAX  1024
+#define JSON_DEPTH_MAX      16
+#define JSON_PATH_DEPTH_MAX 8
+
+typedef void (*json_classify_fn_t)(const uint8_t *block, simd_json_masks_t *masks);
+
+#define __JSON_CLASS_QUOTE      0x01
+#define __JSON_CLASS_BACKSLASH  0x02
+#define __JSON_CLASS_STRUCTURAL 0x04
+#define __JSON_CLASS_WHITESPACE 0x08
+
+static const uint8_t __json_class_table[256] = {
+    ['"'] = __JSON_CLASS_QUOTE,      ['\\'] = __JSON_CLASS_BACKSLASH,  ['{'] = __JSON_CLASS_STRUCTURAL,  ['}'] = __JSON_CLASS_STRUCTURAL,  ['['] = __JSON_CLASS_STRUCTURAL,
+    [']'] = __JSON_CLASS_STRUCTURAL, [':'] = __JSON_CLASS_STRUCTURAL, [','] = __JSON_CLASS_STRUCTURAL,  [' '] = __JSON_CLASS_WHITESPACE, ['\t'] = __JSON_CLASS_WHITESPACE,
+    ['\n'] = __JSON_CLASS_WHITESPACE, ['\r'] = __JSON_CLASS_WHITESPACE,
+};
+
+void json_classify_scalar(const uint8_t *block, simd_json_masks_t *masks) {
+    masks->quote = masks->backslash = masks->structural = masks->whitespace = 0;
+    for (int i = 0; i < 64; i++) {
+        const uint64_t c = __json_class_table[block[i]];
+        masks->quote |= (c & 1) << i;
+        masks->backslash |= ((c >> 1) & 1) << i;
+        masks->structural |= ((c >> 2) & 1) << i;
+        masks->whitespace |= ((c >> 3) & 1) << i;
+    }
+}
+
+typedef int (*json_string_span_fn_t)(const uint8_t *data, const int length);
+
+static inline bool __json_string_plain(const uint8_t c) {
+    return (uint8_t)(c - 0x20) < 0x60 && c != '"' && c != '\\';
+}
+
+int json_string_span_scalar(const uint8_t *data, const int length) {
+    int i = 0;
+    while (i < length && __json_string_plain(data[i]))
+        i++;
+    return i;
+}
+
+#if SIMD_X86
+// the kernels stop at the last whole block, so the scalar span takes any rest (or stops at once, if the kernel did)
+int json_string_span_sse2(const uint8_t *data, const int length) {
+    const int span = simd_json_string_span_sse2(data, length);
+    return span + json_string_span_scalar(data + span, length - span);
+}
+int json_string_span_avx2(const uint8_t *data, const int length) {
+    const int span = simd_json_string_span_avx2(data, length);
+    return span + json_string_span_scalar(data + span, length - span);
+}
+#endif
+
+json_classify_fn_t json_classify = json_classify_scalar;
+json_string_span_fn_t json_string_span = json_string_span_scalar;
+simd_level_t json_classify_level = SIMD_LEVEL_SCALAR;
+
+// selects the named kernels ("scalar", "sse2", "avx2"), or the best supported ones if NULL or unknown
+void json_scanner_select(const char *level_name) {
+    simd_level_t level = simd_level_parse(level_name);
+    if (!simd_supports(level))
+        level = simd_level_parse(NULL);
+    json_classify_level = level;
+    switch (level) {
+#if SIMD_X86
+    case SIMD_LEVEL_AVX2:
+        json_classify = simd_json_classify_avx2;
+        json_string_span = json_string_span_avx2;
+        break;
+    case SIMD_LEVEL_SSE2:
+        json_classify = simd_json_classify_sse2;
+        json_string_span = json_string_span_sse2;
+        break;
+#endif
+    case SIMD_LEVEL_SCALAR:
+    default:
+        json_classify = json_classify_scalar;
+        json_string_span = json_string_span_scalar;
+        json_classify_level = SIMD_LEVEL_SCALAR;
+        break;
+    }
+}
+
+static inline uint64_t __json_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// writes the indices of structurals, quotes (both ends of each string) and scalar starts, returning their count, or
+// -1 if the data ends inside a string; indices must have room for size entries
+int json_structurals(const uint8_t *data, const int size, uint32_t *indices) {
+    static const uint64_t even_bits = 0x5555555555555555ULL;
+    uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+    int count = 0;
+    for (int offset = 0; offset < size; offset += 64) {
+        const uint8_t *block = data + offset;
+        uint8_t padded[64];
+        if (size - offset < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, (size_t)(size - offset));
+            block = padded;
+        }
+        simd_json_masks_t masks;
+        json_classify(block, &masks);
+        // a backslash run of odd length escapes the byte following it, where runs carry across blocks
+        const uint64_t backslash = masks.backslash & ~prev_escaped;
+        const uint64_t follows_escape = (backslash << 1) | prev_escaped;
+        const uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+        uint64_t sequences_even;
+        prev_escaped = __builtin_add_overflow(odd_starts, backslash, &sequences_even);
+        const uint64_t escaped = (even_bits ^ (sequences_even << 1)) & follows_escape;
+        const uint64_t quote = masks.quote & ~escaped;
+        // set from each opening quote up to but excluding its closing quote
+        const uint64_t in_string = __json_prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+        const uint64_t scalar = ~(masks.structural | masks.whitespace | quote | in_string);
+        const uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+        prev_scalar = scalar >> 63;
+        uint64_t bits = (masks.structural & ~in_string) | quote | scalar_start;
+        while (bits) {
+            indices[count++] = (uint32_t)offset + (uint32_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    return prev_in_string ? -1 : count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// strict validation to RFC 8259, in one pass with no allocation: a pushdown machine over the grammar with the open
+// containers as a bit stack, strings spanned by the selected kernel up to the next quote, escape, control or non-ASCII
+// byte, and non-ASCII checked as well formed UTF-8 (no overlongs, surrogates or code points above U+10FFFF); escaped
+// surrogates must pair; packets must be an object or array, as the gateway has always required
+
+#define JSON_VALIDATE_DEPTH_MAX 64
+
+// returns the length of the UTF-8 sequence at p, or 0 if it is not well formed
+static inline int __json_utf8_sequence(const uint8_t *p, const uint8_t *end) {
+    const uint8_t c = p[0];
+    const int length = c < 0xC2 ? 0 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+    if (length == 0 || end - p < length)
+        return 0;
+    const uint8_t low = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80, high = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+    if (p[1] < low || p[1] > high)
+        return 0;
+    for (int i = 2; i < length; i++)
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+    return length;
+}
+
+static inline int __json_hex_quad(const uint8_t *p) {
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t c = p[i], lower = (uint8_t)(c | 0x20);
+        const int digit = (c >= '0' && c <= '9') ? c - '0' : (lower >= 'a' && lower <= 'f') ? lower - 'a' + 10 : -1;
+        if (digit < 0)
+            return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+// from the opening quote, returns the byte after the closing quote, or NULL
+static const uint8_t *__json_validate_string(const uint8_t *p, const uint8_t *end) {
+    p++;
+    while (true) {
+        // most strings are short keys and values, so spanned inline before calling the kernel
+        const uint8_t *inline_end = end - p > 16 ? p + 16 : end;
+        while (p < inline_end && __json_string_plain(*p))
+            p++;
+        if (p == inline_end && p < end)
+            p += json_string_span(p, (int)(end - p));
+        if (p == end)
+            return NULL;
+        const uint8_t c = *p;
+        if (c == '"')
+            return p + 1;
+        if (c >= 0x80) {
+            const int length = __json_utf8_sequence(p, end);
+            if (length == 0)
+                return NULL;
+            p += length;
+        } else if (c == '\\') {
+            if (end - p < 2)
+                return NULL;
+            switch (p[1]) {
+            case '"':
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+                p += 2;
+                break;
+            case 'u': {
+                const int unit = end - p >= 6 ? __json_hex_quad(p + 2) : -1;
+                if (unit < 0 || (unit >= 0xDC00 && unit <= 0xDFFF))
+                    return NULL;
+                p += 6;
+                if (unit >= 0xD800 && unit <= 0xDBFF) {
+                    const int low = (end - p >= 6 && p[0] == '\\' && p[1] == 'u') ? __json_hex_quad(p + 2) : -1;
+                    if (low < 0xDC00 || low > 0xDFFF)
+                        return NULL;
+                    p += 6;
+                }
+                break;
+            }
+            default:
+                return NULL;
+            }
+        } else
+            return NULL;
+    }
+}
+
+static inline const uint8_t *__json_validate_digits(const uint8_t *p, const uint8_t *end) {
+    while (p < end && (uint8_t)(*p - '0') < 10)
+        p++;
+    return p;
+}
+
+// from the first byte, returns the byte after the number, or NULL; what follows is checked by the caller
+static const uint8_t *__json_validate_number(const uint8_t *p, const uint8_t *end) {
+    if (*p == '-' && ++p == end)
+        return NULL;
+    if (*p == '0')
+        p++;
+    else if ((uint8_t)(*p - '1') < 9)
+        p = __json_validate_digits(p + 1, end);
+    else
+        return NULL;
+    if (p < end && *p == '.') {
+        const uint8_t *digits = p + 1;
+        if ((p = __json_validate_digits(digits, end)) == digits)
+            return NULL;
+    }
+    if (p < end && (*p | 0x20) == 'e') {
+        const uint8_t *digits = p + 1 < end && (p[1] == '+' || p[1] == '-') ? p + 2 : p + 1;
+        if ((p = __json_validate_digits(digits, end)) == digits)
+            return NULL;
+    }
+    return p;
+}
+
+static inline const uint8_t *__json_validate_whitespace(const uint8_t *p, const uint8_t *end) {
+    while (p < end && (__json_class_table[*p] & __JSON_CLASS_WHITESPACE))
+        p++;
+    return p;
+}
+
+static inline const uint8_t *__json_validate_literal(const uint8_t *p, const uint8_t *end, const char *literal, const int length) {
+    return (end - p >= length && memcmp(p, literal, (size_t)length) == 0) ? p + length : NULL;
+}
+
+typedef enum {
+    __JSON_VALIDATE_VALUE,        // after ':', or ',' in an array
+    __JSON_VALIDATE_ARRAY_FIRST,  // after '['
+    __JSON_VALIDATE_OBJECT_FIRST, // after '{'
+    __JSON_VALIDATE_KEY,          // after ',' in an object
+    __JSON_VALIDATE_AFTER,        // after a value
+} __json_validate_state_t;
+
+bool json_validate(const uint8_t *data, const int size) {
+    const uint8_t *p = data, *const end = data + size;
+    uint64_t objects = 0; // bit per open container, set for objects, innermost lowest
+    int depth = 0;
+    __json_validate_state_t state = __JSON_VALIDATE_VALUE;
+    p = __json_validate_whitespace(p, end);
+    if (p == end || (*p != '{' && *p != '['))
+        return false;
+    while (true) {
+        p = __json_validate_whitespace(p, end);
+        if (p == end)
+            return state == __JSON_VALIDATE_AFTER && depth == 0;
+        const uint8_t c = *p;
+        switch (state) {
+        case __JSON_VALIDATE_OBJECT_FIRST:
+        case __JSON_VALIDATE_KEY:
+            if (c == '}' && state == __JSON_VALIDATE_OBJECT_FIRST) {
+                objects >>= 1;
+                depth--;
+                p++;
+                state = __JSON_VALIDATE_AFTER;
+                break;
+            }
+            if (c != '"' || (p = __json_validate_string(p, end)) == NULL)
+                return false;
+            p = __json_validate_whitespace(p, end);
+            if (p == end || *p++ != ':')
+                return false;
+            state = __JSON_VALIDATE_VALUE;
+            break;
+        case __JSON_VALIDATE_ARRAY_FIRST:
+        case __JSON_VALIDATE_VALUE:
+            switch (c) {
+            case '{':
+            case '[':
+                if (depth == JSON_VALIDATE_DEPTH_MAX)
+                    return false;
+                objects = (objects << 1) | (c == '{');
+                depth++;
+                p++;
+                state = c == '{' ? __JSON_VALIDATE_OBJECT_FIRST : __JSON_VALIDATE_ARRAY_FIRST;
+                continue;
+            case ']':
+                if (state != __JSON_VALIDATE_ARRAY_FIRST)
+                    return false;
+                objects >>= 1;
+                depth--;
+                p++;
+                state = __JSON_VALIDATE_AFTER;
+                continue;
+            case '"':
+                p = __json_validate_string(p, end);
+                break;
+            case 't':
+                p = __json_validate_literal(p, end, "true", 4);
+                break;
+            case 'f':
+                p = __json_validate_literal(p, end, "false", 5);
+                break;
+            case 'n':
+                p = __json_validate_literal(p, end, "null", 4);
+                break;
+            default:
+                p = __json_validate_number(p, end);
+                break;
+            }
+            if (p == NULL)
+                return false;
+            state = __JSON_VALIDATE_AFTER;
+            break;
+        case __JSON_VALIDATE_AFTER:
+        default:
+            if (depth == 0)
+                return false;
+            if (c == ',')
+                state = (objects & 1) ? __JSON_VALIDATE_KEY : __JSON_VALIDATE_VALUE;
+            else if (c == ((objects & 1) ? '}' : ']')) {
+                objects >>= 1;
+                depth--;
+            } else
+                return false;
+            p++;
+            break;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// numbers are compared in fixed point millionths, as the build has no floating point; out of range values saturate
+#define JSON_NUMBER_SCALE_DIGITS 6
+
+bool json_number_parse(const uint8_t *text, const int length, int64_t *value) {
+    int i = 0, scale = JSON_NUMBER_SCALE_DIGITS, digits = 0;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    if (i < length && text[i] == '-') {
+        negative = true;
+        i++;
+    }
+    for (; i < length && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+        if (mantissa < (UINT64_MAX / 10) - 9)
+            mantissa = (mantissa * 10) + (uint64_t)(text[i] - '0');
+        else
+            scale++; // integer digits beyond the precision still count
+    }
+    if (i < length && text[i] == '.')
+        for (i++; i < length && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+            if (mantissa < (UINT64_MAX / 10) - 9) {
+                mantissa = (mantissa * 10) + (uint64_t)(text[i] - '0');
+                scale--;
+            }
+        }
+    if (digits == 0)
+        return false;
+    if (i < length && (text[i] == 'e' || text[i] == 'E')) {
+        bool exponent_negative = false;
+        int exponent = 0;
+        i++;
+        if (i < length && (text[i] == '-' || text[i] == '+'))
+            exponent_negative = text[i++] == '-';
+        if (i == length)
+            return false;
+        for (; i < length && text[i] >= '0' && text[i] <= '9'; i++)
+            if (exponent < 1000)
+                exponent = (exponent * 10) + (text[i] - '0');
+        scale += exponent_negative ? -exponent : exponent;
+    }
+    if (i != length)
+        return false;
+    for (; scale < 0 && mantissa; scale++)
+        mantissa /= 10;
+    for (; scale > 0 && mantissa && mantissa < (uint64_t)INT64_MAX; scale--)
+        mantissa = mantissa > (uint64_t)INT64_MAX / 10 ? (uint64_t)INT64_MAX : mantissa * 10;
+    if (mantissa > (uint64_t)INT64_MAX)
+        mantissa = (uint64_t)INT64_MAX;
+    *value = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+    return true;
+}
+
+// the string as the contents of a JSON string ('"' and '\' escaped, control characters as \u00XX), at most 6 bytes a
+// character; returns the length, or -1 if it does not fit (with a terminator)
+int json_string_escape(char *output, const int size, const char *string) {
+    int used = 0;
+    for (const char *p = string; *p != '\0'; p++) {
+        if (used + 7 > size)
+            return -1;
+        if (*p == '"' || *p == '\\') {
+            output[used++] = '\\';
+            output[used++] = *p;
+        } else if ((unsigned char)*p < 0x20)
+            used += snprintf(output + used, (size_t)(size - used), "\\u%04x", (unsigned)(unsigned char)*p);
+        else
+            output[used++] = *p;
+    }
+    if (used >= size)
+        return -1;
+    output[used] = '\0';
+    return used;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// a path such as 'meta.type', 'readings[0].value' or '$.a.b', compiled into key and array index segments
+
+typedef struct {
+    const char *key;
+    int key_length;
+    int index; // -1 for a key
+} json_path_segment_t;
+
+typedef struct {
+    json_path_segment_t segments[JSON_PATH_DEPTH_MAX];
+    int depth;
+} json_path_t;
+
+typedef enum {
+    JSON_OP_EQ = 0,
+    JSON_OP_NE,
+    JSON_OP_LT,
+    JSON_OP_LE,
+    JSON_OP_GT,
+    JSON_OP_GE,
+    JSON_OP_EXISTS,
+} json_op_t;
+
+typedef enum {
+    JSON_TYPE_STRING = 0,
+    JSON_TYPE_NUMBER,
+    JSON_TYPE_TRUE,
+    JSON_TYPE_FALSE,
+    JSON_TYPE_NULL,
+    JSON_TYPE_OBJECT,
+    JSON_TYPE_ARRAY,
+} json_type_t;
+
+typedef struct {
+    json_path_t path;
+    json_op_t op;
+    json_type_t type;
+    const char *string;
+    int string_length;
+    int64_t number;
+} json_match_t;
+
+bool json_path_compile(const char *expression, json_path_t *path) {
+    const char *p = expression;
+    path->depth = 0;
+    if (p[0] == '$')
+        p += (p[1] == '.') ? 2 : 1;
+    while (*p) {
+        if (path->depth == JSON_PATH_DEPTH_MAX)
+            return false;
+        json_path_segment_t *segment = &path->segments[path->depth];
+        if (*p == '[') {
+            char *end;
+            const long index = strtol(p + 1, &end, 10);
+            if (end == p + 1 || *end != ']' || index < 0 || index > INT_MAX)
+                return false;
+            segment->key = NULL;
+            segment->key_length = 0;
+            segment->index = (int)index;
+            p = end + 1;
+        } else {
+            const size_t length = strcspn(p, ".[");
+            if (length == 0)
+                return false;
+            segment->key = p;
+            segment->key_length = (int)length;
+            segment->index = -1;
+            p += length;
+        }
+        path->depth++;
+        if (*p == '.' && *++p == '\0')
+            return false;
+    }
+    return path->depth > 0;
+}
+
+bool json_match_compile(const char *path, const char *op, const char *value, json_match_t *match) {
+    static const char *ops[] = { "eq", "ne", "lt", "le", "gt", "ge", "exists" };
+    if (!json_path_compile(path, &match->path))
+        return false;
+    match->op = JSON_OP_EQ;
+    if (op != NULL) {
+        int i;
+        for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])) && strcmp(ops[i], op) != 0; i++)
+            ;
+        if (i == (int)(sizeof(ops) / sizeof(ops[0])))
+            return false;
+        match->op = (json_op_t)i;
+    }
+    match->string = NULL;
+    match->string_length = 0;
+    match->number = 0;
+    if (match->op == JSON_OP_EXISTS)
+        return true;
+    if (value == NULL)
+        return false;
+    const int length = (int)strlen(value);
+    if (length >= 2 && value[0] == '"' && value[length - 1] == '"') {
+        match->type = JSON_TYPE_STRING;
+        match->string = value + 1;
+        match->string_length = length - 2;
+    } else if (strcmp(value, "true") == 0)
+        match->type = JSON_TYPE_TRUE;
+    else if (strcmp(value, "false") == 0)
+        match->type = JSON_TYPE_FALSE;
+    else if (strcmp(value, "null") == 0)
+        match->type = JSON_TYPE_NULL;
+    else if (json_number_parse((const uint8_t *)value, length, &match->number))
+        match->type = JSON_TYPE_NUMBER;
+    else {
+        match->type = JSON_TYPE_STRING;
+        match->string = value;
+        match->string_length = length;
+    }
+    if (match->op != JSON_OP_EQ && match->op != JSON_OP_NE && match->type != JSON_TYPE_NUMBER)
+        return false; // ordering is only for numbers
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    const uint8_t *key;
+    int key_length;
+    int index;
+    bool array;
+} __json_frame_t;
+
+static bool __json_value_compare(const json_match_t *match, const json_type_t type, const uint8_t *text, const int length) {
+    if (match->op == JSON_OP_EXISTS)
+        return true;
+    bool equal;
+    if (match->type == JSON_TYPE_NUMBER) {
+        int64_t number;
+        if (type != JSON_TYPE_NUMBER || !json_number_parse(text, length, &number))
+            return match->op == JSON_OP_NE;
+        switch (match->op) {
+        case JSON_OP_LT:
+            return number < match->number;
+        case JSON_OP_LE:
+            return number <= match->number;
+        case JSON_OP_GT:
+            return number > match->number;
+        case JSON_OP_GE:
+            return number >= match->number;
+        case JSON_OP_EQ:
+        case JSON_OP_NE:
+        case JSON_OP_EXISTS:
+        default:
+            equal = number == match->number;
+            break;
+        }
+    } else if (match->type == JSON_TYPE_STRING)
+        equal = type == JSON_TYPE_STRING && length == match->string_length && memcmp(text, match->string, (size_t)length) == 0;
+    else
+        equal = type == match->type;
+    return match->op == JSON_OP_NE ? !equal : equal;
+}
+
+static inline bool __json_path_at(const json_path_t *path, const __json_frame_t *frames, const int depth) {
+    if (path->depth != depth)
+        return false;
+    for (int i = depth - 1; i >= 0; i--) {
+        const json_path_segment_t *segment = &path->segments[i];
+        if (segment->index >= 0 ? (!frames[i].array || frames[i].index != segment->index) : (frames[i].array || frames[i].key_length != segment->key_length || memcmp(frames[i].key, segment->key, (size_t)segment->key_length) != 0))
+            return false;
+    }
+    return true;
+}
+
+// tokenises the packet and returns the index of the first (lowest) of the matches that holds, or -1, giving the value
+// that it held on if wanted; strings and keys are compared as their raw (still escaped) bytes, and malformed input
+// stops the walk without error
+int json_match_value(const uint8_t *data, const int size, const json_match_t *matches, const int match_count, const uint8_t **value, int *value_length, json_type_t *value_type) {
+    uint32_t indices[JSON_SCAN_SIZE_MAX];
+    if (match_count <= 0 || size > JSON_SCAN_SIZE_MAX)
+        return -1;
+    const int count = json_structurals(data, size, indices);
+    __json_frame_t frames[JSON_DEPTH_MAX];
+    int depth = 0, limit = match_count;
+    bool expect_key = false;
+    for (int k = 0; k < count && limit > 0; k++) {
+        const uint32_t i = indices[k];
+        const uint8_t *text = data + i;
+        int length = 1;
+        json_type_t type;
+        switch (data[i]) {
+        case '{':
+        case '[':
+            type = data[i] == '{' ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0)
+                return limit < match_count ? limit : -1;
+            depth--;
+            expect_key = false;
+            continue;
+        case ',':
+            if (depth > 0 && frames[depth - 1].array)
+                frames[depth - 1].index++;
+            else
+                expect_key = depth > 0;
+            continue;
+        case ':':
+            expect_key = false;
+            continue;
+        case '"':
+            if (k + 1 >= count)
+                return limit < match_count ? limit : -1;
+            text = data + i + 1;
+            length = (int)(indices[++k] - i - 1);
+            if (expect_key && depth > 0) {
+                frames[depth - 1].key = text;
+                frames[depth - 1].key_length = length;
+                continue;
+            }
+            type = JSON_TYPE_STRING;
+            break;
+        default:
+            while (i + (uint32_t)length < (uint32_t)size && !__json_class_table[data[i + (uint32_t)length]])
+                length++;
+            type = data[i] == 't' ? JSON_TYPE_TRUE : data[i] == 'f' ? JSON_TYPE_FALSE : data[i] == 'n' ? JSON_TYPE_NULL : JSON_TYPE_NUMBER;
+            break;
+        }
+        if (depth > 0)
+            for (int m = 0; m < limit; m++)
+                if (__json_path_at(&matches[m].path, frames, depth) && __json_value_compare(&matches[m], type, text, length)) {
+                    limit = m;
+                    if (value != NULL) {
+                        *value = text;
+                        *value_length = length;
+                        *value_type = type;
+                    }
+                    break;
+                }
+        if (type == JSON_TYPE_OBJECT || type == JSON_TYPE_ARRAY) {
+            if (depth == JSON_DEPTH_MAX)
+                break;
+            frames[depth].key = NULL;
+            frames[depth].key_length = -1;
+            frames[depth].index = 0;
+            frames[depth].array = type == JSON_TYPE_ARRAY;
+            depth++;
+            expect_key = type == JSON_TYPE_OBJECT;
+        }
+    }
+    return limit < match_count ? limit : -1;
+}
+int json_match_first(const uint8_t *data, const int size, const json_match_t *matches, const int match_count) {
+    return json_match_value(data, size, matches, match_count, NULL, NULL, NULL);
+}
+
+typedef struct {
+    const uint8_t *text; // NULL if absent
+    int length;
+    json_type_t type;
+} json_span_t;
+
+// the raw values (strings with their quotes, objects and arrays whole) of the members of a top level object named by
+// 'keys', compared as raw bytes, the first of each; returns how many were found, or -1 if the data is not an object
+int json_object_values(const uint8_t *data, const int size, const char *const *keys, const int key_count, json_span_t *values) {
+    uint32_t indices[JSON_SCAN_SIZE_MAX];
+    for (int m = 0; m < key_count; m++)
+        values[m].text = NULL;
+    if (size <= 0 || size > JSON_SCAN_SIZE_MAX)
+        return -1;
+    const int count = json_structurals(data, size, indices);
+    if (count < 2 || data[indices[0]] != '{')
+        return -1;
+    int depth = 0, member = -1, found = 0;
+    bool expect_key = false, in_value = false;
+    uint32_t start = 0;
+    for (int k = 0; k < count; k++) {
+        const uint32_t i = indices[k];
+        if (depth == 1 && in_value && (data[i] == ',' || data[i] == '}')) {
+            if (member >= 0 && values[member].text == NULL) {
+                uint32_t end = i;
+                while (end > start && (data[end - 1] == ' ' || data[end - 1] == '\t' || data[end - 1] == '\r' || data[end - 1] == '\n'))
+                    end--;
+                const uint8_t c = data[start];
+                values[member].text = data + start;
+                values[member].length = (int)(end - start);
+                values[member].type = c == '{' ? JSON_TYPE_OBJECT : c == '[' ? JSON_TYPE_ARRAY : c == '"' ? JSON_TYPE_STRING : c == 't' ? JSON_TYPE_TRUE : c == 'f' ? JSON_TYPE_FALSE : c == 'n' ? JSON_TYPE_NULL : JSON_TYPE_NUMBER;
+                found++;
+            }
+            in_value = false;
+            member = -1;
+        }
+        switch (data[i]) {
+        case '{':
+        case '[':
+            if (depth == 1 && !in_value) {
+                in_value = true;
+                start = i;
+            }
+            expect_key = ++depth == 1;
+            break;
+        case '}':
+        case ']':
+            if (--depth <= 0)
+                return found;
+            break;
+        case ',':
+            expect_key = depth == 1;
+            break;
+        case ':':
+            break;
+        case '"':
+            if (k + 1 >= count)
+                return found;
+            if (depth == 1 && expect_key) {
+                const int length = (int)(indices[k + 1] - i - 1);
+                for (member = key_count - 1; member >= 0; member--)
+                    if ((int)strlen(keys[member]) == length && memcmp(keys[member], data + i + 1, (size_t)length) == 0)
+                        break;
+                expect_key = false;
+            } else if (depth == 1 && !in_value) {
+                in_value = true;
+                start = i;
+            }
+            k++;
+            break;
+        default:
+            if (depth == 1 && !in_value) {
+                in_value = true;
+                start = i;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,115 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// per-stage packet latencies, in log-linear (HDR style) histograms of microseconds: values below 2^LATENCY_SUB_BITS have
+// a bucket each, and above that each power of two is split into 2^LATENCY_SUB_BITS linear buckets, so that a quantile is
+// reported within 1/32 (about 3%) of the recorded value from 1us to over an hour. Stages are recorded from the main, mqtt
+// publisher and mosquitto threads with relaxed increments; reports read the counts, and take the interval as the difference
+// from the previous report, so that recording never has to be paused or reset.
+
+#define LATENCY_SUB_BITS       5
+#define LATENCY_SUB_COUNT      (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAGNITUDE_BITS 32 // values are clamped to 2^32-1 us, about 71 minutes
+#define LATENCY_BUCKETS        (LATENCY_SUB_COUNT + ((LATENCY_MAGNITUDE_BITS - LATENCY_SUB_BITS) * LATENCY_SUB_COUNT))
+
+typedef enum {
+    LATENCY_STAGE_FRAME = 0,    // first byte on the serial port to the frame being complete, after the idle gap
+    LATENCY_STAGE_CLASSIFY = 1, // frame complete to being handed to the sinks: validated, routed, decoded and converted
+    LATENCY_STAGE_QUEUE = 2,    // handed to the sinks to being handed to mosquitto_publish, i.e. the broker queue
+    LATENCY_STAGE_ACK = 3,      // handed to mosquitto_publish to the broker acknowledgement (at QoS 0, the socket write)
+    LATENCY_STAGE_TOTAL = 4,    // first byte to the broker acknowledgement
+    LATENCY_STAGE_COUNT = 5,
+} latency_stage_t;
+
+typedef struct {
+    const char *name;
+    uint32_t counts[LATENCY_BUCKETS];
+    uint32_t reported[LATENCY_BUCKETS]; // the counts at the previous interval report
+} latency_histogram_t;
+
+// the stamps of the packet being handled by the main thread, which the mqtt sink carries through its queue
+typedef struct {
+    uint64_t first_us, frame_us, classified_us; // 0 if not stamped
+} latency_stamp_t;
+
+latency_histogram_t latency_histograms[LATENCY_STAGE_COUNT] = {
+    [LATENCY_STAGE_FRAME] = { .name = "frame" }, [LATENCY_STAGE_CLASSIFY] = { .name = "classify" }, [LATENCY_STAGE_QUEUE] = { .name = "queue" }, [LATENCY_STAGE_ACK] = { .name = "ack" }, [LATENCY_STAGE_TOTAL] = { .name = "total" },
+};
+latency_stamp_t latency_current = { 0 };
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline int latency_bucket(const uint64_t value_us) {
+    const uint32_t value = value_us > UINT32_MAX ? UINT32_MAX : (uint32_t)value_us;
+    if (value < LATENCY_SUB_COUNT)
+        return (int)value;
+    const int shift = (31 - __builtin_clz(value)) - LATENCY_SUB_BITS;
+    return LATENCY_SUB_COUNT + (shift * LATENCY_SUB_COUNT) + (int)((value >> shift) - LATENCY_SUB_COUNT);
+}
+
+// the highest value that falls in the bucket, as HdrHistogram reports quantiles
+static uint64_t latency_bucket_value(const int bucket) {
+    if (bucket < LATENCY_SUB_COUNT)
+        return (uint64_t)bucket;
+    const int shift = (bucket / LATENCY_SUB_COUNT) - 1;
+    return ((((uint64_t)LATENCY_SUB_COUNT + (uint64_t)(bucket % LATENCY_SUB_COUNT)) + 1) << shift) - 1;
+}
+
+static inline void latency_record(const latency_stage_t stage, const uint64_t from_us, const uint64_t to_us) {
+    if (from_us == 0)
+        return;
+    __atomic_fetch_add(&latency_histograms[stage].counts[latency_bucket(to_us > from_us ? to_us - from_us : 0)], 1, __ATOMIC_RELAXED);
+}
+
+uint64_t latency_timespec_us(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000ULL + (uint64_t)ts->tv_nsec / 1000ULL;
+}
+
+// the value at or below which permille/1000 of the counts fall
+uint64_t latency_quantile(const uint32_t *counts, const uint64_t total, const uint32_t permille) {
+    const uint64_t rank = total == 0 ? 0 : ((total * permille) + 999) / 1000;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        if ((seen += counts[bucket]) >= (rank > 0 ? rank : 1))
+            return latency_bucket_value(bucket);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// over the interval since the previous interval report, or since start; stages without counts are not shown
+void latency_display(const bool interval) {
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        latency_histogram_t *histogram = &latency_histograms[stage];
+        uint32_t counts[LATENCY_BUCKETS];
+        uint64_t total = 0;
+        int highest = 0;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            const uint32_t count = __atomic_load_n(&histogram->counts[bucket], __ATOMIC_RELAXED);
+            counts[bucket] = interval ? count - histogram->reported[bucket] : count;
+            if (interval)
+                histogram->reported[bucket] = count;
+            if (counts[bucket] > 0) {
+                total += counts[bucket];
+                highest = bucket;
+            }
+        }
+        if (total > 0)
+            printf("latency: %s[%s]: count=%" PRIu64 ", p50=%" PRIu64 "us, p90=%" PRIu64 "us, p99=%" PRIu64 "us, p999=%" PRIu64 "us, max=%" PRIu64 "us\n", histogram->name, interval ? "interval" : "start", total,
+                   latency_quantile(counts, total, 500), latency_quantile(counts, total, 900), latency_quantile(counts, total, 990), latency_quantile(counts, total, 999), latency_bucket_value(highest));
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,460 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// metrics are registered at startup (before any threads start) and recorded into a per-thread shard, so that the
+// hot path is a plain load and store to a cache line no other thread writes; a scrape sums the shards with relaxed
+// loads. Values are the native word, so that updates and reads are single instructions on 32 bit targets too,
+// where counters wrap as a reset would. Threads beyond the shards share the last one with atomic adds.
+
+#define METRICS_COUNTERS_MAX   64
+#define METRICS_GAUGES_MAX     16
+#define METRICS_HISTOGRAMS_MAX 12
+#define METRICS_BUCKETS_MAX    16
+#define METRICS_SHARDS_MAX     8
+
+typedef unsigned long metrics_value_t;
+
+typedef struct {
+    metrics_value_t counters[METRICS_COUNTERS_MAX];
+    metrics_value_t buckets[METRICS_HISTOGRAMS_MAX][METRICS_BUCKETS_MAX + 1]; // the last is +Inf
+    metrics_value_t sums[METRICS_HISTOGRAMS_MAX];
+    bool shared;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+typedef struct {
+    const char *name, *labels, *help; // labels are rendered as is, e.g. broker="primary", or NULL
+} metrics_info_t;
+
+typedef struct {
+    metrics_info_t info;
+    int64_t (*read)(const void *context);
+    const void *context;
+} metrics_gauge_t;
+
+typedef struct {
+    metrics_info_t info;
+    const int64_t *bounds; // ascending upper bounds, in the recorded unit
+    int bound_count;
+    int64_t scale; // recorded units per exposed unit, e.g. 1000000 for microseconds exposed as seconds
+} metrics_histogram_t;
+
+metrics_info_t metrics_counters[METRICS_COUNTERS_MAX];
+int metrics_counter_count = 0;
+metrics_gauge_t metrics_gauges[METRICS_GAUGES_MAX];
+int metrics_gauge_count = 0;
+metrics_histogram_t metrics_histograms[METRICS_HISTOGRAMS_MAX];
+int metrics_histogram_count = 0;
+
+metrics_shard_t metrics_shards[METRICS_SHARDS_MAX];
+int metrics_shard_count = 0;
+__thread metrics_shard_t *__metrics_shard = NULL;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the id, or -1 (which records nothing) if full
+int metrics_counter_register(const char *name, const char *labels, const char *help) {
+    if (metrics_counter_count >= METRICS_COUNTERS_MAX) {
+        fprintf(stderr, "metrics: too many counters, ignoring '%s'\n", name);
+        return -1;
+    }
+    metrics_counters[metrics_counter_count] = (metrics_info_t) { .name = name, .labels = labels, .help = help };
+    return metrics_counter_count++;
+}
+
+int metrics_gauge_register(const char *name, const char *labels, const char *help, int64_t (*read)(const void *context), const void *context) {
+    if (metrics_gauge_count >= METRICS_GAUGES_MAX) {
+        fprintf(stderr, "metrics: too many gauges, ignoring '%s'\n", name);
+        return -1;
+    }
+    metrics_gauges[metrics_gauge_count] = (metrics_gauge_t) { .info = { .name = name, .labels = labels, .help = help }, .read = read, .context = context };
+    return metrics_gauge_count++;
+}
+
+int metrics_histogram_register(const char *name, const char *labels, const char *help, const int64_t *bounds, const int bound_count, const int64_t scale) {
+    if (metrics_histogram_count >= METRICS_HISTOGRAMS_MAX || bound_count > METRICS_BUCKETS_MAX) {
+        fprintf(stderr, "metrics: too many histograms or buckets, ignoring '%s'\n", name);
+        return -1;
+    }
+    metrics_histograms[metrics_histogram_count] = (metrics_histogram_t) { .info = { .name = name, .labels = labels, .help = help }, .bounds = bounds, .bound_count = bound_count, .scale = scale };
+    return metrics_histogram_count++;
+}
+
+static metrics_shard_t *__metrics_shard_claim(void) {
+    const int index = __atomic_fetch_add(&metrics_shard_count, 1, __ATOMIC_RELAXED);
+    __metrics_shard = &metrics_shards[index < METRICS_SHARDS_MAX - 1 ? index : METRICS_SHARDS_MAX - 1];
+    if (index >= METRICS_SHARDS_MAX - 1)
+        __atomic_store_n(&__metrics_shard->shared, true, __ATOMIC_RELAXED);
+    return __metrics_shard;
+}
+
+static inline void __metrics_add(metrics_shard_t *shard, metrics_value_t *value, const metrics_value_t amount) {
+    if (__builtin_expect(__atomic_load_n(&shard->shared, __ATOMIC_RELAXED), 0))
+        __atomic_fetch_add(value, amount, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_counter_add(const int id, const metrics_value_t amount) {
+    if (id < 0)
+        return;
+    metrics_shard_t *shard = __builtin_expect(__metrics_shard != NULL, 1) ? __metrics_shard : __metrics_shard_claim();
+    __metrics_add(shard, &shard->counters[id], amount);
+}
+
+static inline void metrics_histogram_observe(const int id, const int64_t value) {
+    if (id < 0)
+        return;
+    metrics_shard_t *shard = __builtin_expect(__metrics_shard != NULL, 1) ? __metrics_shard : __metrics_shard_claim();
+    const metrics_histogram_t *histogram = &metrics_histograms[id];
+    int bucket = 0;
+    while (bucket < histogram->bound_count && value > histogram->bounds[bucket])
+        bucket++;
+    __metrics_add(shard, &shard->buckets[id][bucket], 1);
+    __metrics_add(shard, &shard->sums[id], (metrics_value_t)value);
+}
+
+// sums a value over the shards, given its offset within a shard
+static metrics_value_t __metrics_sum(const size_t offset) {
+    metrics_value_t total = 0;
+    for (int i = 0; i < METRICS_SHARDS_MAX; i++)
+        total += __atomic_load_n((const metrics_value_t *)(const void *)((const char *)&metrics_shards[i] + offset), __ATOMIC_RELAXED);
+    return total;
+}
+
+metrics_value_t metrics_counter_value(const int id) {
+    return id < 0 ? 0 : __metrics_sum(offsetof(metrics_shard_t, counters) + ((size_t)id * sizeof(metrics_value_t)));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// rendered in the Prometheus text format (0.0.4), which OpenMetrics scrapers also accept
+
+typedef struct {
+    char *buffer;
+    size_t size, used;
+} __metrics_output_t;
+
+static void __metrics_printf(__metrics_output_t *output, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void __metrics_printf(__metrics_output_t *output, const char *format, ...) {
+    if (output->used >= output->size)
+        return;
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(output->buffer + output->used, output->size - output->used, format, args);
+    va_end(args);
+    output->used = length < 0 ? output->size : output->used + (size_t)length;
+}
+
+// a fixed point value as a decimal, e.g. 1500 at scale 1000000 is 0.0015
+static void __metrics_put_scaled(char *buffer, const size_t size, const int64_t value, const int64_t scale) {
+    const uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    const uint64_t whole = scale > 1 ? magnitude / (uint64_t)scale : magnitude;
+    uint64_t fraction = scale > 1 ? magnitude % (uint64_t)scale : 0;
+    char digits[24];
+    int length = 0;
+    for (int64_t s = scale; s > 1; s /= 10) {
+        digits[length++] = (char)('0' + (fraction * 10) / (uint64_t)scale);
+        fraction = (fraction * 10) % (uint64_t)scale;
+    }
+    while (length > 0 && digits[length - 1] == '0')
+        length--;
+    digits[length] = '\0';
+    snprintf(buffer, size, "%s%" PRIu64 "%s%s", value < 0 ? "-" : "", whole, length > 0 ? "." : "", digits);
+}
+
+static void __metrics_render_labels(__metrics_output_t *output, const char *name, const char *suffix, const metrics_info_t *info) {
+    __metrics_printf(output, "%s%s%s%s%s ", name, suffix, info->labels ? "{" : "", info->labels ? info->labels : "", info->labels ? "}" : "");
+}
+
+static const metrics_info_t *__metrics_counter_info(const int id) {
+    return &metrics_counters[id];
+}
+
+static void __metrics_counter_render(__metrics_output_t *output, const int id) {
+    __metrics_render_labels(output, metrics_counters[id].name, "", &metrics_counters[id]);
+    __metrics_printf(output, "%lu\n", metrics_counter_value(id));
+}
+
+static const metrics_info_t *__metrics_gauge_info(const int id) {
+    return &metrics_gauges[id].info;
+}
+
+static void __metrics_gauge_render(__metrics_output_t *output, const int id) {
+    const metrics_gauge_t *gauge = &metrics_gauges[id];
+    __metrics_render_labels(output, gauge->info.name, "", &gauge->info);
+    __metrics_printf(output, "%" PRId64 "\n", gauge->read(gauge->context));
+}
+
+static const metrics_info_t *__metrics_histogram_info(const int id) {
+    return &metrics_histograms[id].info;
+}
+
+static void __metrics_histogram_render(__metrics_output_t *output, const int id) {
+    const metrics_histogram_t *histogram = &metrics_histograms[id];
+    const char *labels = histogram->info.labels ? histogram->info.labels : "", *separator = histogram->info.labels ? "," : "";
+    char bound[48];
+    metrics_value_t cumulative = 0;
+    for (int b = 0; b <= histogram->bound_count; b++) {
+        cumulative += __metrics_sum(offsetof(metrics_shard_t, buckets) + ((((size_t)id * (METRICS_BUCKETS_MAX + 1)) + (size_t)b) * sizeof(metrics_value_t)));
+        if (b < histogram->bound_count)
+            __metrics_put_scaled(bound, sizeof(bound), histogram->bounds[b], histogram->scale);
+        else
+            snprintf(bound, sizeof(bound), "+Inf");
+        __metrics_printf(output, "%s_bucket{%s%sle=\"%s\"} %lu\n", histogram->info.name, labels, separator, bound, cumulative);
+    }
+    // the sum wraps with the word, and is signed for histograms of negative values such as RSSI
+    __metrics_put_scaled(bound, sizeof(bound), (int64_t)(long)__metrics_sum(offsetof(metrics_shard_t, sums) + ((size_t)id * sizeof(metrics_value_t))), histogram->scale);
+    __metrics_render_labels(output, histogram->info.name, "_sum", &histogram->info);
+    __metrics_printf(output, "%s\n", bound);
+    __metrics_render_labels(output, histogram->info.name, "_count", &histogram->info);
+    __metrics_printf(output, "%lu\n", cumulative);
+}
+
+// metrics sharing a name (with different labels) form one family under one HELP and TYPE, wherever they registered
+static void __metrics_render_families(__metrics_output_t *output, const int count, const char *type, const metrics_info_t *(*info)(const int id), void (*render)(__metrics_output_t *output, const int id)) {
+    for (int i = 0; i < count; i++) {
+        int first = 0;
+        while (strcmp(info(first)->name, info(i)->name) != 0)
+            first++;
+        if (first != i)
+            continue;
+        __metrics_printf(output, "# HELP %s %s\n# TYPE %s %s\n", info(i)->name, info(i)->help, info(i)->name, type);
+        for (int j = i; j < count; j++)
+            if (strcmp(info(j)->name, info(i)->name) == 0)
+                render(output, j);
+    }
+}
+
+// returns the length, which is at least size if the output was truncated
+size_t metrics_render(char *buffer, const size_t size) {
+    __metrics_output_t output = { .buffer = buffer, .size = size, .used = 0 };
+    __metrics_render_families(&output, metrics_counter_count, "counter", __metrics_counter_info, __metrics_counter_render);
+    __metrics_render_families(&output, metrics_gauge_count, "gauge", __metrics_gauge_info, __metrics_gauge_render);
+    __metrics_render_families(&output, metrics_histogram_count, "histogram", __metrics_histogram_info, __metrics_histogram_render);
+    return output.used;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// a minimal HTTP/1.0 server for GET /metrics, polled from the caller's loop: the listener and clients are
+// non-blocking, each client sends one request and gets one response and a close, and stalled clients are dropped
+
+#define METRICS_CLIENTS_MAX       4
+#define METRICS_REQUEST_MAX       1024
+#define METRICS_RESPONSE_MAX      (32 * 1024)
+#define METRICS_CLIENT_TIMEOUT_MS 5000
+
+typedef struct {
+    int fd;
+    uint64_t accepted_us;
+    char request[METRICS_REQUEST_MAX];
+    size_t request_used;
+    char *response;
+    size_t response_size, response_sent;
+} __metrics_client_t;
+
+int __metrics_listen_fd = -1;
+__metrics_client_t __metrics_clients[METRICS_CLIENTS_MAX];
+char __metrics_responses[METRICS_CLIENTS_MAX][METRICS_RESPONSE_MAX];
+uint32_t metrics_scrapes = 0;
+
+// address is "port", "host:port" or "[ipv6]:port"; an empty or NULL address leaves the server off
+bool metrics_begin(const char *address) {
+    for (int i = 0; i < METRICS_CLIENTS_MAX; i++)
+        __metrics_clients[i].fd = -1;
+    if (!address || !*address)
+        return true;
+    char host[128];
+    const char *port = strrchr(address, ':');
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - address), address);
+        port++;
+        if (host[0] == '[' && strlen(host) > 2 && host[strlen(host) - 1] == ']') {
+            memmove(host, host + 1, strlen(host) - 2);
+            host[strlen(host) - 2] = '\0';
+        }
+    } else {
+        host[0] = '\0';
+        port = address;
+    }
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int error;
+    if ((error = getaddrinfo(*host ? host : NULL, port, &hints, &result)) != 0) {
+        fprintf(stderr, "metrics: error resolving '%s': %s\n", address, gai_strerror(error));
+        return false;
+    }
+    if ((__metrics_listen_fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol)) < 0) {
+        fprintf(stderr, "metrics: error creating socket: %s\n", strerror(errno));
+        freeaddrinfo(result);
+        return false;
+    }
+    const int reuse = 1;
+    setsockopt(__metrics_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(__metrics_listen_fd, result->ai_addr, result->ai_addrlen) < 0 || listen(__metrics_listen_fd, METRICS_CLIENTS_MAX) < 0) {
+        fprintf(stderr, "metrics: error listening on '%s': %s\n", address, strerror(errno));
+        freeaddrinfo(result);
+        close(__metrics_listen_fd);
+        __metrics_listen_fd = -1;
+        return false;
+    }
+    freeaddrinfo(result);
+    printf("metrics: listening on '%s' (/metrics)\n", address);
+    return true;
+}
+
+static void __metrics_client_close(__metrics_client_t *client) {
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void __metrics_client_respond(__metrics_client_t *client, char *response) {
+    static const char *const not_found = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+    static const char *const not_allowed = "HTTP/1.0 405 Method Not Allowed\r\nContent-Type: text/plain\r\nContent-Length: 19\r\nAllow: GET\r\nConnection: close\r\n\r\nmethod not allowed\n";
+    const char *line_end = strpbrk(client->request, "\r\n");
+    const size_t line_length = line_end ? (size_t)(line_end - client->request) : client->request_used;
+    const bool get = strncmp(client->request, "GET ", 4) == 0;
+    const bool path = get && line_length >= 12 && strncmp(client->request + 4, "/metrics", 8) == 0 && (client->request[12] == ' ' || client->request[12] == '?');
+    client->response = response;
+    client->response_sent = 0;
+    if (!get)
+        client->response_size = (size_t)snprintf(response, METRICS_RESPONSE_MAX, "%s", not_allowed);
+    else if (!path)
+        client->response_size = (size_t)snprintf(response, METRICS_RESPONSE_MAX, "%s", not_found);
+    else {
+        // the body is rendered after room for the header, which is then written in front of it
+        static const size_t header_max = 128;
+        size_t body_size = metrics_render(response + header_max, METRICS_RESPONSE_MAX - header_max);
+        if (body_size >= METRICS_RESPONSE_MAX - header_max) {
+            fprintf(stderr, "metrics: response truncated (%zu bytes)\n", body_size);
+            body_size = METRICS_RESPONSE_MAX - header_max - 1;
+        }
+        char header[128];
+        const size_t header_size = (size_t)snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_size);
+        client->response = response + header_max - header_size;
+        memcpy(client->response, header, header_size);
+        client->response_size = header_size + body_size;
+        metrics_scrapes++;
+    }
+}
+
+void metrics_poll(void) {
+    if (__metrics_listen_fd < 0)
+        return;
+    const uint64_t now_us = time_monotonic_us();
+    for (int i = 0; i < METRICS_CLIENTS_MAX; i++) {
+        __metrics_client_t *client = &__metrics_clients[i];
+        if (client->fd < 0) {
+            const int fd = accept(__metrics_listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            client->fd = fd;
+            client->accepted_us = now_us;
+            client->request_used = 0;
+            client->response = NULL;
+        }
+        if (client->response == NULL) {
+            const ssize_t length = recv(client->fd, client->request + client->request_used, sizeof(client->request) - 1 - client->request_used, MSG_DONTWAIT);
+            if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                __metrics_client_close(client);
+                continue;
+            }
+            if (length > 0)
+                client->request_used += (size_t)length;
+            client->request[client->request_used] = '\0';
+            if (strstr(client->request, "\r\n\r\n") != NULL || strstr(client->request, "\n\n") != NULL || client->request_used == sizeof(client->request) - 1)
+                __metrics_client_respond(client, __metrics_responses[i]);
+        }
+        if (client->response != NULL) {
+            const ssize_t sent = send(client->fd, client->response + client->response_sent, client->response_size - client->response_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                __metrics_client_close(client);
+                continue;
+            }
+            if (sent > 0)
+                client->response_sent += (size_t)sent;
+            if (client->response_sent == client->response_size) {
+                __metrics_client_close(client);
+                continue;
+            }
+        }
+        if (now_us - client->accepted_us > (uint64_t)METRICS_CLIENT_TIMEOUT_MS * 1000)
+            __metrics_client_close(client);
+    }
+}
+
+// for a caller's wait (e.g. serial_poll_hook): the listener and the clients, waited on for their request or for room
+// for their response, with the wait shortened to the first client's timeout
+int metrics_poll_add(fd_set *rdset, fd_set *wrset, int nfds, uint32_t *timeout_ms) {
+    if (__metrics_listen_fd < 0)
+        return nfds;
+    FD_SET(__metrics_listen_fd, rdset);
+    if (__metrics_listen_fd >= nfds)
+        nfds = __metrics_listen_fd + 1;
+    const uint64_t now_us = time_monotonic_us();
+    for (int i = 0; i < METRICS_CLIENTS_MAX; i++) {
+        const __metrics_client_t *client = &__metrics_clients[i];
+        if (client->fd < 0)
+            continue;
+        FD_SET(client->fd, client->response == NULL ? rdset : wrset);
+        if (client->fd >= nfds)
+            nfds = client->fd + 1;
+        const uint64_t timeout_us = client->accepted_us + (uint64_t)METRICS_CLIENT_TIMEOUT_MS * 1000;
+        const uint64_t remaining_ms = timeout_us > now_us ? (timeout_us - now_us + 999) / 1000 : 0;
+        if (remaining_ms < *timeout_ms)
+            *timeout_ms = (uint32_t)remaining_ms;
+    }
+    return nfds;
+}
+
+// polls if the listener or a client is ready, or a client may have timed out
+void metrics_poll_service(const fd_set *rdset, const fd_set *wrset) {
+    if (__metrics_listen_fd < 0)
+        return;
+    bool ready = FD_ISSET(__metrics_listen_fd, rdset);
+    const uint64_t now_us = time_monotonic_us();
+    for (int i = 0; i < METRICS_CLIENTS_MAX && !ready; i++) {
+        const __metrics_client_t *client = &__metrics_clients[i];
+        if (client->fd >= 0)
+            ready = FD_ISSET(client->fd, rdset) || FD_ISSET(client->fd, wrset) || now_us - client->accepted_us > (uint64_t)METRICS_CLIENT_TIMEOUT_MS * 1000;
+    }
+    if (ready)
+        metrics_poll();
+}
+
+bool metrics_listening(void) {
+    return __metrics_listen_fd >= 0;
+}
+
+void metrics_end(void) {
+    for (int i = 0; i < METRICS_CLIENTS_MAX; i++)
+        if (__metrics_clients[i].fd >= 0)
+            __metrics_client_close(&__metrics_clients[i]);
+    if (__metrics_listen_fd >= 0)
+        close(__metrics_listen_fd);
+    __metrics_listen_fd = -1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
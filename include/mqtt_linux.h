@@ -3,37 +3,347 @@
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
 #include <mosquitto.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-struct mosquitto *mosq = NULL;
+#define MQTT_BROKERS_MAX        3
+#define MQTT_QUEUE_SIZE_DEFAULT 64
+#define MQTT_QUEUE_TOPIC_MAX    128
+#ifndef MQTT_QUEUE_PAYLOAD_MAX
+#define MQTT_QUEUE_PAYLOAD_MAX 1024
+#endif
+#define MQTT_FAILOVER_HOLDOFF 10 // seconds the primary must be unhealthy before failing over
+#define MQTT_PENDING_MAX      32 // publishes awaiting acknowledgement for latency, the oldest are overwritten
+#define MQTT_DRAIN_TIMEOUT_DEFAULT 5000 // ms
+#define MQTT_INLINE_MISC_MS        1000 // keepalive and reconnect checks, when inline
+#define MQTT_RECONNECT_DELAY_MIN   1    // seconds, doubling to the max, as given to mosquitto for its own loop
+#define MQTT_RECONNECT_DELAY_MAX   30
+#define MQTT_SUBSCRIPTIONS_MAX     8
+
+typedef enum {
+    MQTT_BROKER_PRIMARY = 0,
+    MQTT_BROKER_FAILOVER = 1,
+    MQTT_BROKER_FANOUT = 2,
+} mqtt_broker_role_t;
+
+const char *mqtt_broker_role_str(const mqtt_broker_role_t role) {
+    switch (role) {
+    case MQTT_BROKER_PRIMARY:
+        return "primary";
+    case MQTT_BROKER_FAILOVER:
+        return "failover";
+    case MQTT_BROKER_FANOUT:
+        return "fanout";
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct {
+    const char *client;
+    const char *server;
+    const char *server_failover; // optional, receives messages while the primary is unhealthy
+    const char *server_fanout;   // optional, receives a copy of every message
+    int queue_size;
+    bool use_synchronous;
+    bool use_inline; // no threads: the caller drives the clients from its own loop, see mqtt_poll_add
+} mqtt_config_t;
+
+typedef struct {
+    char topic[MQTT_QUEUE_TOPIC_MAX];
+    char payload[MQTT_QUEUE_PAYLOAD_MAX];
+    int length;
+    uint64_t enqueued_us;
+    latency_stamp_t stamp;
+} mqtt_message_t;
+
+// the acknowledgement can arrive (on the mosquitto thread) before mosquitto_publish has returned the mid, in which case
+// it is held with only acked_us set until the publisher adds the rest
+typedef struct {
+    int mid; // 0 if free
+    uint64_t first_us, published_us, acked_us;
+} mqtt_pending_t;
+
+typedef struct {
+    uint32_t published, dropped, failed;
+    uint32_t connects, disconnects;
+    uint32_t latency_cnt;
+    uint64_t latency_sum_us, latency_max_us;
+} mqtt_broker_stats_t;
+
+typedef struct {
+    mqtt_broker_role_t role;
+    const char *server;
+    struct mosquitto *mosq;
+    bool connected, stopping, thread_started;
+    time_t unhealthy_since;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    mqtt_message_t *queue;
+    int queue_size, queue_head, queue_tail, queue_count;
+    mqtt_broker_stats_t stats;
+    mqtt_pending_t pending[MQTT_PENDING_MAX];
+    int pending_next;
+    char metric_labels[24];
+    int metric_published, metric_dropped, metric_failed, metric_latency;
+    uint64_t reconnect_us; // when inline
+    uint32_t reconnect_delay_s;
+} mqtt_broker_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+mqtt_broker_t mqtt_brokers[MQTT_BROKERS_MAX];
+int mqtt_broker_count = 0;
+mqtt_broker_t *mqtt_broker_active = NULL;
 void (*mqtt_message_callback)(const char *, const unsigned char *, const int) = NULL;
+struct {
+    const char *topic;
+    int qos;
+} mqtt_subscriptions[MQTT_SUBSCRIPTIONS_MAX];
+int mqtt_subscription_count = 0;
 bool mqtt_synchronous = false;
-bool mqtt_connected = false;
+bool mqtt_inline = false;
+uint64_t mqtt_inline_misc_us = 0;
+struct rusage mqtt_stats_usage;
 
-bool mqtt_send(const char *topic, const char *message, const int length) {
-    if (!mosq)
-        return false;
-    const int result = mosquitto_publish(mosq, NULL, topic, length, message, MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN);
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void __mqtt_broker_latency_record(mqtt_broker_t *broker, const uint64_t latency_us) {
+    metrics_counter_add(broker->metric_published, 1);
+    metrics_histogram_observe(broker->metric_latency, (int64_t)latency_us);
+    broker->stats.latency_cnt++;
+    broker->stats.latency_sum_us += latency_us;
+    if (latency_us > broker->stats.latency_max_us)
+        broker->stats.latency_max_us = latency_us;
+}
+
+static bool __mqtt_broker_publish(mqtt_broker_t *broker, int *mid, const char *topic, const char *message, const int length) {
+    const int result = mosquitto_publish(broker->mosq, mid, topic, length, message, MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN);
+    TRACE_EVENT(TRACE_PUBLISH, broker->role, result, *mid, length);
     if (result != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mqtt: publish error: %s\n", mosquitto_strerror(result));
+        fprintf(stderr, "mqtt: publish error (%s): %s\n", mqtt_broker_role_str(broker->role), mosquitto_strerror(result));
+        return false;
+    }
+    return true;
+}
+
+static void __mqtt_pending_record(const mqtt_pending_t *pending) {
+    latency_record(LATENCY_STAGE_ACK, pending->published_us, pending->acked_us);
+    latency_record(LATENCY_STAGE_TOTAL, pending->first_us, pending->acked_us);
+}
+
+static mqtt_pending_t *__mqtt_pending_find(mqtt_broker_t *broker, const int mid, const bool acked) {
+    for (int i = 0; i < MQTT_PENDING_MAX; i++)
+        if (broker->pending[i].mid == mid && (broker->pending[i].acked_us != 0) == acked)
+            return &broker->pending[i];
+    return NULL;
+}
+
+static mqtt_pending_t *__mqtt_pending_claim(mqtt_broker_t *broker, const int mid) {
+    mqtt_pending_t *pending = &broker->pending[broker->pending_next];
+    broker->pending_next = (broker->pending_next + 1) % MQTT_PENDING_MAX;
+    *pending = (mqtt_pending_t) { .mid = mid };
+    return pending;
+}
+
+// with the broker locked
+static void __mqtt_pending_published(mqtt_broker_t *broker, const int mid, const uint64_t first_us, const uint64_t published_us) {
+    mqtt_pending_t *pending = __mqtt_pending_find(broker, mid, true);
+    if (pending == NULL)
+        pending = __mqtt_pending_claim(broker, mid);
+    pending->first_us = first_us;
+    pending->published_us = published_us;
+    if (pending->acked_us != 0) {
+        __mqtt_pending_record(pending);
+        pending->mid = 0;
+    }
+}
+
+void mqtt_publish_callback(struct mosquitto *m __attribute__((unused)), void *o, int mid) {
+    mqtt_broker_t *broker = (mqtt_broker_t *)o;
+    const uint64_t acked_us = time_monotonic_us();
+    TRACE_EVENT(TRACE_ACK, broker->role, 0, mid, 0);
+    pthread_mutex_lock(&broker->lock);
+    mqtt_pending_t *pending = __mqtt_pending_find(broker, mid, false);
+    if (pending != NULL) {
+        pending->acked_us = acked_us;
+        __mqtt_pending_record(pending);
+        pending->mid = 0;
+    } else
+        __mqtt_pending_claim(broker, mid)->acked_us = acked_us;
+    pthread_mutex_unlock(&broker->lock);
+}
+
+static void *__mqtt_broker_thread(void *arg) {
+    mqtt_broker_t *broker = (mqtt_broker_t *)arg;
+    pthread_mutex_lock(&broker->lock);
+    while (!broker->stopping) {
+        if (broker->queue_count == 0 || !broker->connected) {
+            pthread_cond_wait(&broker->cond, &broker->lock);
+            continue;
+        }
+        const mqtt_message_t *message = &broker->queue[broker->queue_tail];
+        pthread_mutex_unlock(&broker->lock);
+        const uint64_t published_us = time_monotonic_us();
+        latency_record(LATENCY_STAGE_QUEUE, message->stamp.classified_us, published_us);
+        int mid = 0;
+        const bool result = __mqtt_broker_publish(broker, &mid, message->topic, message->payload, message->length);
+        const uint64_t latency_us = time_monotonic_us() - message->enqueued_us, first_us = message->stamp.first_us;
+        pthread_mutex_lock(&broker->lock);
+        broker->queue_tail = (broker->queue_tail + 1) % broker->queue_size;
+        broker->queue_count--;
+        if (result) {
+            broker->stats.published++;
+            __mqtt_broker_latency_record(broker, latency_us);
+            __mqtt_pending_published(broker, mid, first_us, published_us);
+        } else {
+            broker->stats.failed++;
+            metrics_counter_add(broker->metric_failed, 1);
+        }
+    }
+    pthread_mutex_unlock(&broker->lock);
+    return NULL;
+}
+
+static bool __mqtt_broker_enqueue(mqtt_broker_t *broker, const char *topic, const char *message, const int length) {
+    const size_t topic_length = strlen(topic);
+    if (topic_length >= MQTT_QUEUE_TOPIC_MAX || length < 0 || length > MQTT_QUEUE_PAYLOAD_MAX) {
+        fprintf(stderr, "mqtt: message too large for queue (%s): topic=%zu, payload=%d\n", mqtt_broker_role_str(broker->role), topic_length, length);
+        pthread_mutex_lock(&broker->lock);
+        broker->stats.failed++;
+        metrics_counter_add(broker->metric_failed, 1);
+        pthread_mutex_unlock(&broker->lock);
         return false;
     }
+    pthread_mutex_lock(&broker->lock);
+    if (broker->queue_count == broker->queue_size) {
+        broker->stats.dropped++;
+        metrics_counter_add(broker->metric_dropped, 1);
+        pthread_mutex_unlock(&broker->lock);
+        return false;
+    }
+    mqtt_message_t *slot = &broker->queue[broker->queue_head];
+    memcpy(slot->topic, topic, topic_length + 1);
+    memcpy(slot->payload, message, (size_t)length);
+    slot->length = length;
+    slot->enqueued_us = time_monotonic_us();
+    slot->stamp = latency_current;
+    broker->queue_head = (broker->queue_head + 1) % broker->queue_size;
+    broker->queue_count++;
+    pthread_cond_signal(&broker->cond);
+    pthread_mutex_unlock(&broker->lock);
     return true;
 }
 
-void mqtt_message_callback_wrapper(struct mosquitto *m, void *o __attribute__((unused)), const struct mosquitto_message *message) {
-    if (m != mosq)
+static bool __mqtt_broker_send(mqtt_broker_t *broker, const char *topic, const char *message, const int length) {
+    if (!mqtt_synchronous)
+        return __mqtt_broker_enqueue(broker, topic, message, length);
+    const uint64_t started_us = time_monotonic_us();
+    latency_record(LATENCY_STAGE_QUEUE, latency_current.classified_us, started_us);
+    int mid = 0;
+    const bool result = __mqtt_broker_publish(broker, &mid, topic, message, length);
+    if (result) {
+        broker->stats.published++;
+        __mqtt_broker_latency_record(broker, time_monotonic_us() - started_us);
+        pthread_mutex_lock(&broker->lock);
+        __mqtt_pending_published(broker, mid, latency_current.first_us, started_us);
+        pthread_mutex_unlock(&broker->lock);
+    } else {
+        broker->stats.failed++;
+        metrics_counter_add(broker->metric_failed, 1);
+    }
+    return result;
+}
+
+static bool __mqtt_broker_healthy(mqtt_broker_t *broker) {
+    return __atomic_load_n(&broker->connected, __ATOMIC_RELAXED) && __atomic_load_n(&broker->queue_count, __ATOMIC_RELAXED) < broker->queue_size;
+}
+
+static mqtt_broker_t *__mqtt_broker_find(const mqtt_broker_role_t role) {
+    for (int i = 0; i < mqtt_broker_count; i++)
+        if (mqtt_brokers[i].role == role)
+            return &mqtt_brokers[i];
+    return NULL;
+}
+
+static mqtt_broker_t *__mqtt_broker_select(void) {
+    mqtt_broker_t *primary = &mqtt_brokers[0], *failover = __mqtt_broker_find(MQTT_BROKER_FAILOVER);
+    if (!failover)
+        return primary;
+    if (__mqtt_broker_healthy(primary)) {
+        primary->unhealthy_since = 0;
+        if (mqtt_broker_active != primary) {
+            printf("mqtt: primary broker healthy, failing back (server='%s')\n", primary->server);
+            mqtt_broker_active = primary;
+        }
+    } else {
+        const time_t now = time(NULL);
+        if (primary->unhealthy_since == 0)
+            primary->unhealthy_since = now;
+        if (mqtt_broker_active == primary && (now - primary->unhealthy_since) >= MQTT_FAILOVER_HOLDOFF) {
+            printf("mqtt: primary broker unhealthy for %" PRIu32 "s, failing over (server='%s')\n", (uint32_t)(now - primary->unhealthy_since), failover->server);
+            mqtt_broker_active = failover;
+        }
+    }
+    return mqtt_broker_active;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool mqtt_send(const char *topic, const char *message, const int length) {
+    if (mqtt_broker_count == 0)
+        return false;
+    const bool result = __mqtt_broker_send(__mqtt_broker_select(), topic, message, length);
+    for (int i = 0; i < mqtt_broker_count; i++)
+        if (mqtt_brokers[i].role == MQTT_BROKER_FANOUT)
+            __mqtt_broker_send(&mqtt_brokers[i], topic, message, length);
+    return result;
+}
+
+// retained status (e.g. health) documents, which are published directly rather than queued, as they can be larger than
+// a queue slot and should not displace packets; to the active broker and any fanout
+bool mqtt_send_retained(const char *topic, const char *message, const int length) {
+    if (mqtt_broker_count == 0)
+        return false;
+    const mqtt_broker_t *active = __mqtt_broker_select();
+    bool result = false;
+    for (int i = 0; i < mqtt_broker_count; i++) {
+        mqtt_broker_t *broker = &mqtt_brokers[i];
+        if (broker != active && broker->role != MQTT_BROKER_FANOUT)
+            continue;
+        int mid = 0;
+        const int published = mosquitto_publish(broker->mosq, &mid, topic, length, message, MQTT_PUBLISH_QOS, true);
+        TRACE_EVENT(TRACE_PUBLISH, broker->role, published, mid, length);
+        if (published != MOSQ_ERR_SUCCESS) {
+            fprintf(stderr, "mqtt: publish error (%s, retained): %s\n", mqtt_broker_role_str(broker->role), mosquitto_strerror(published));
+            continue;
+        }
+        pthread_mutex_lock(&broker->lock);
+        __mqtt_pending_published(broker, mid, 0, 0); // takes the acknowledgement, without latency
+        pthread_mutex_unlock(&broker->lock);
+        if (broker->role != MQTT_BROKER_FANOUT)
+            result = true;
+    }
+    return result;
+}
+
+void mqtt_message_callback_wrapper(struct mosquitto *m __attribute__((unused)), void *o, const struct mosquitto_message *message) {
+    const mqtt_broker_t *broker = (const mqtt_broker_t *)o;
+    if (broker->role != MQTT_BROKER_PRIMARY)
         return;
     if (mqtt_message_callback)
         mqtt_message_callback((const char *)message->topic, message->payload, message->payloadlen);
 }
-bool mqtt_subscribe(const char *topic, const int qos, void (*callback)(const char *, const unsigned char *, const int)) {
-    if (!mosq)
-        return false;
-    mqtt_message_callback = callback;
-    const int result = mosquitto_subscribe(mosq, NULL, topic, qos);
+static bool __mqtt_subscribe(mqtt_broker_t *broker, const char *topic, const int qos) {
+    const int result = mosquitto_subscribe(broker->mosq, NULL, topic, qos);
     if (result != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mqtt: subscribe error: %s\n", mosquitto_strerror(result));
         return false;
@@ -41,10 +351,36 @@ bool mqtt_subscribe(const char *topic, const int qos, void (*callback)(const cha
     printf("mqtt: subscribed to topic '%s' (qos=%d)\n", topic, qos);
     return true;
 }
+// subscriptions are on the primary, kept (the topic is not copied) to be made again whenever it connects, as the
+// session is clean; until it first connects they wait for that
+bool mqtt_subscribe(const char *topic, const int qos, void (*callback)(const char *, const unsigned char *, const int)) {
+    if (mqtt_broker_count == 0)
+        return false;
+    mqtt_broker_t *broker = &mqtt_brokers[0];
+    pthread_mutex_lock(&broker->lock);
+    const bool added = mqtt_subscription_count < MQTT_SUBSCRIPTIONS_MAX, connected = broker->connected;
+    if (added) {
+        mqtt_subscriptions[mqtt_subscription_count].topic = topic;
+        mqtt_subscriptions[mqtt_subscription_count++].qos = qos;
+        mqtt_message_callback = callback;
+    }
+    pthread_mutex_unlock(&broker->lock);
+    if (!added) {
+        fprintf(stderr, "mqtt: subscribe error: more than %d subscriptions\n", MQTT_SUBSCRIPTIONS_MAX);
+        return false;
+    }
+    return connected ? __mqtt_subscribe(broker, topic, qos) : true;
+}
 bool mqtt_unsubscribe(const char *topic) {
-    if (!mosq)
+    if (mqtt_broker_count == 0)
         return false;
-    const int result = mosquitto_unsubscribe(mosq, NULL, topic);
+    mqtt_broker_t *broker = &mqtt_brokers[0];
+    pthread_mutex_lock(&broker->lock);
+    for (int i = 0; i < mqtt_subscription_count; i++)
+        if (strcmp(mqtt_subscriptions[i].topic, topic) == 0)
+            mqtt_subscriptions[i--] = mqtt_subscriptions[--mqtt_subscription_count];
+    pthread_mutex_unlock(&broker->lock);
+    const int result = mosquitto_unsubscribe(broker->mosq, NULL, topic);
     if (result != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mqtt: unsubscribe error: %s\n", mosquitto_strerror(result));
         return false;
@@ -74,33 +410,178 @@ bool mqtt_parse(const char *string, char *host, const int length, int *port, boo
     return true;
 }
 
-void mqtt_connect_callback(struct mosquitto *m, void *o __attribute__((unused)), int r) {
-    if (m != mosq)
-        return;
+void mqtt_connect_callback(struct mosquitto *m __attribute__((unused)), void *o, int r) {
+    mqtt_broker_t *broker = (mqtt_broker_t *)o;
     if (r != 0) {
-        fprintf(stderr, "mqtt: connect failed: %s\n", mosquitto_connack_string(r));
+        fprintf(stderr, "mqtt: connect failed (%s): %s\n", mqtt_broker_role_str(broker->role), mosquitto_connack_string(r));
         return;
     }
-    mqtt_connected = true;
-    printf("mqtt: connected\n");
+    pthread_mutex_lock(&broker->lock);
+    broker->connected = true;
+    broker->stats.connects++;
+    broker->reconnect_us = 0;
+    broker->reconnect_delay_s = MQTT_RECONNECT_DELAY_MIN;
+    pthread_cond_signal(&broker->cond);
+    const int subscription_count = broker->role == MQTT_BROKER_PRIMARY ? mqtt_subscription_count : 0;
+    pthread_mutex_unlock(&broker->lock);
+    printf("mqtt: connected (%s)\n", mqtt_broker_role_str(broker->role));
+    for (int i = 0; i < subscription_count; i++)
+        __mqtt_subscribe(broker, mqtt_subscriptions[i].topic, mqtt_subscriptions[i].qos);
 }
 
-void mqtt_disconnect_callback(struct mosquitto *m, void *o __attribute__((unused)), int rc) {
-    if (m != mosq)
-        return;
-    mqtt_connected = false;
+void mqtt_disconnect_callback(struct mosquitto *m __attribute__((unused)), void *o, int rc) {
+    mqtt_broker_t *broker = (mqtt_broker_t *)o;
+    pthread_mutex_lock(&broker->lock);
+    broker->connected = false;
+    broker->stats.disconnects++;
+    pthread_mutex_unlock(&broker->lock);
     if (rc != 0)
-        fprintf(stderr, "mqtt: disconnected unexpectedly (rc=%d)\n", rc);
+        fprintf(stderr, "mqtt: disconnected unexpectedly (%s, rc=%d)\n", mqtt_broker_role_str(broker->role), rc);
     else
-        printf("mqtt: disconnected\n");
+        printf("mqtt: disconnected (%s)\n", mqtt_broker_role_str(broker->role));
 }
 
 void mqtt_loop(const int timeout_ms) {
-    if (mosq)
-        mosquitto_loop(mosq, timeout_ms, 1);
+    for (int i = 0; i < mqtt_broker_count; i++)
+        mosquitto_loop(mqtt_brokers[i].mosq, timeout_ms, 1);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// inline, the clients have no network or publisher threads: publishes are written from the caller (mosquitto writes at
+// once when it has no thread, leaving any remainder for when the socket is writable), and the caller waits on the
+// sockets with its own descriptors, through mqtt_poll_add and mqtt_poll_service, or mqtt_poll if it has none; every
+// MQTT_INLINE_MISC_MS the keepalive is run, and a broker that has lost its connection is reconnected with backoff, which
+// mosquitto's own loop would otherwise do
+
+int mqtt_poll_add(fd_set *rdset, fd_set *wrset, int nfds, uint32_t *timeout_ms) {
+    for (int i = 0; i < mqtt_broker_count; i++) {
+        mqtt_broker_t *broker = &mqtt_brokers[i];
+        const int sock = mosquitto_socket(broker->mosq);
+        if (sock < 0)
+            continue;
+        FD_SET(sock, rdset);
+        if (mosquitto_want_write(broker->mosq))
+            FD_SET(sock, wrset);
+        if (sock >= nfds)
+            nfds = sock + 1;
+    }
+    const uint64_t now_us = time_monotonic_us();
+    const uint64_t misc_ms = mqtt_inline_misc_us > now_us ? (mqtt_inline_misc_us - now_us + 999) / 1000 : 0;
+    if (misc_ms < *timeout_ms)
+        *timeout_ms = (uint32_t)misc_ms;
+    return nfds;
+}
+
+static void __mqtt_broker_reconnect(mqtt_broker_t *broker, const uint64_t now_us) {
+    if (broker->reconnect_us == 0) {
+        broker->reconnect_delay_s = broker->reconnect_delay_s ? broker->reconnect_delay_s : MQTT_RECONNECT_DELAY_MIN;
+        broker->reconnect_us = now_us + (uint64_t)broker->reconnect_delay_s * 1000000;
+        return;
+    }
+    if (now_us < broker->reconnect_us)
+        return;
+    const int result = mosquitto_reconnect_async(broker->mosq);
+    if (result != MOSQ_ERR_SUCCESS)
+        fprintf(stderr, "mqtt: reconnect error (%s), will retry in %" PRIu32 "s: %s\n", mqtt_broker_role_str(broker->role), broker->reconnect_delay_s, mosquitto_strerror(result));
+    broker->reconnect_us = now_us + (uint64_t)broker->reconnect_delay_s * 1000000;
+    broker->reconnect_delay_s = broker->reconnect_delay_s * 2 < MQTT_RECONNECT_DELAY_MAX ? broker->reconnect_delay_s * 2 : MQTT_RECONNECT_DELAY_MAX;
+}
+
+void mqtt_poll_service(const fd_set *rdset, const fd_set *wrset) {
+    for (int i = 0; i < mqtt_broker_count; i++) {
+        mqtt_broker_t *broker = &mqtt_brokers[i];
+        const int sock = mosquitto_socket(broker->mosq);
+        if (sock < 0)
+            continue;
+        if (FD_ISSET(sock, rdset))
+            mosquitto_loop_read(broker->mosq, 1);
+        if (FD_ISSET(sock, wrset) && mosquitto_socket(broker->mosq) == sock) // unless the read lost the connection
+            mosquitto_loop_write(broker->mosq, 1);
+    }
+    const uint64_t now_us = time_monotonic_us();
+    if (now_us < mqtt_inline_misc_us)
+        return;
+    mqtt_inline_misc_us = now_us + MQTT_INLINE_MISC_MS * 1000;
+    for (int i = 0; i < mqtt_broker_count; i++) {
+        mqtt_broker_t *broker = &mqtt_brokers[i];
+        if (mosquitto_socket(broker->mosq) >= 0)
+            mosquitto_loop_misc(broker->mosq);
+        else
+            __mqtt_broker_reconnect(broker, now_us);
+    }
+}
+
+void mqtt_poll(const uint32_t timeout_ms) {
+    if (!mqtt_inline)
+        return;
+    fd_set rdset, wrset;
+    FD_ZERO(&rdset);
+    FD_ZERO(&wrset);
+    uint32_t wait_ms = timeout_ms;
+    const int nfds = mqtt_poll_add(&rdset, &wrset, 0, &wait_ms);
+    struct timeval tv = { .tv_sec = (time_t)wait_ms / 1000, .tv_usec = (suseconds_t)(wait_ms % 1000) * 1000 };
+    const int result = select(nfds, &rdset, &wrset, NULL, &tv);
+    if (result < 0)
+        return;
+    if (result == 0) {
+        FD_ZERO(&rdset);
+        FD_ZERO(&wrset);
+    }
+    mqtt_poll_service(&rdset, &wrset);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void __mqtt_broker_end(mqtt_broker_t *broker) {
+    if (broker->thread_started) {
+        pthread_mutex_lock(&broker->lock);
+        broker->stopping = true;
+        pthread_cond_signal(&broker->cond);
+        pthread_mutex_unlock(&broker->lock);
+        pthread_join(broker->thread, NULL);
+        broker->thread_started = false;
+    }
+    if (broker->mosq) {
+        if (!mqtt_synchronous)
+            mosquitto_loop_stop(broker->mosq, true);
+        mosquitto_disconnect(broker->mosq);
+        mosquitto_destroy(broker->mosq);
+        broker->mosq = NULL;
+    }
+    free(broker->queue);
+    broker->queue = NULL;
+    pthread_cond_destroy(&broker->cond);
+    pthread_mutex_destroy(&broker->lock);
+}
+
+static const int64_t __mqtt_latency_bounds_us[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000 };
+
+static int64_t __mqtt_broker_queue_depth(const void *context) {
+    const mqtt_broker_t *broker = (const mqtt_broker_t *)context;
+    return __atomic_load_n(&broker->queue_count, __ATOMIC_RELAXED);
+}
+
+static int64_t __mqtt_broker_connected(const void *context) {
+    const mqtt_broker_t *broker = (const mqtt_broker_t *)context;
+    return __atomic_load_n(&broker->connected, __ATOMIC_RELAXED);
+}
+
+// registered before the broker's threads start, which record into them
+static void __mqtt_broker_metrics_register(mqtt_broker_t *broker) {
+    snprintf(broker->metric_labels, sizeof(broker->metric_labels), "broker=\"%s\"", mqtt_broker_role_str(broker->role));
+    broker->metric_published = metrics_counter_register("e22900t22_mqtt_published_total", broker->metric_labels, "Messages published to the broker.");
+    broker->metric_dropped = metrics_counter_register("e22900t22_mqtt_dropped_total", broker->metric_labels, "Messages dropped as the broker queue was full.");
+    broker->metric_failed = metrics_counter_register("e22900t22_mqtt_failed_total", broker->metric_labels, "Messages that failed to publish or did not fit the queue.");
+    broker->metric_latency = metrics_histogram_register("e22900t22_mqtt_publish_seconds", broker->metric_labels, "Time from enqueue (or the call, if synchronous) to publish.", __mqtt_latency_bounds_us,
+                                                        (int)(sizeof(__mqtt_latency_bounds_us) / sizeof(__mqtt_latency_bounds_us[0])), 1000000);
+    metrics_gauge_register("e22900t22_mqtt_queue_depth", broker->metric_labels, "Messages waiting in the broker queue.", __mqtt_broker_queue_depth, broker);
+    metrics_gauge_register("e22900t22_mqtt_connected", broker->metric_labels, "Whether the broker is connected.", __mqtt_broker_connected, broker);
 }
 
-bool mqtt_begin(const char *server, const char *client, const bool use_synchronous) {
+static bool __mqtt_broker_begin(mqtt_broker_t *broker, const mqtt_broker_role_t role, const char *server, const char *client_id, const int queue_size) {
     char host[CONFIG_MAX_STRING];
     int port;
     bool ssl;
@@ -108,50 +589,132 @@ bool mqtt_begin(const char *server, const char *client, const bool use_synchrono
         fprintf(stderr, "mqtt: error parsing details in '%s'\n", server);
         return false;
     }
-    printf("mqtt: connecting (host='%s', port=%d, ssl=%s, client='%s')\n", host, port, ssl ? "true" : "false", client);
-    char client_id[24];
-    sprintf(client_id, "%s-%06X", client ? client : "mqtt-linux", rand() & 0xFFFFFF);
-    mosquitto_lib_init();
-    mosq = mosquitto_new(client_id, true, NULL);
-    if (!mosq) {
+    printf("mqtt: connecting (role=%s, host='%s', port=%d, ssl=%s, client='%s', queue=%d)\n", mqtt_broker_role_str(role), host, port, ssl ? "true" : "false", client_id, queue_size);
+    memset(broker, 0, sizeof(*broker));
+    broker->role = role;
+    broker->server = server;
+    pthread_mutex_init(&broker->lock, NULL);
+    pthread_cond_init(&broker->cond, NULL);
+    broker->queue_size = queue_size > 0 ? queue_size : MQTT_QUEUE_SIZE_DEFAULT;
+    __mqtt_broker_metrics_register(broker);
+    if (!mqtt_synchronous && (broker->queue = (mqtt_message_t *)calloc((size_t)broker->queue_size, sizeof(mqtt_message_t))) == NULL) {
+        fprintf(stderr, "mqtt: error allocating queue (%s)\n", mqtt_broker_role_str(role));
+        __mqtt_broker_end(broker);
+        return false;
+    }
+    broker->mosq = mosquitto_new(client_id, true, broker);
+    if (!broker->mosq) {
         fprintf(stderr, "mqtt: error creating client instance\n");
+        __mqtt_broker_end(broker);
         return false;
     }
     if (ssl)
-        mosquitto_tls_insecure_set(mosq, true);       // Skip certificate validation
-    mosquitto_reconnect_delay_set(mosq, 1, 30, true); // 1s initial, 30s max, exponential backoff
-    mosquitto_connect_callback_set(mosq, mqtt_connect_callback);
-    mosquitto_disconnect_callback_set(mosq, mqtt_disconnect_callback);
-    mosquitto_message_callback_set(mosq, mqtt_message_callback_wrapper);
+        mosquitto_tls_insecure_set(broker->mosq, true);       // Skip certificate validation
+    mosquitto_reconnect_delay_set(broker->mosq, 1, 30, true); // 1s initial, 30s max, exponential backoff
+    mosquitto_connect_callback_set(broker->mosq, mqtt_connect_callback);
+    mosquitto_disconnect_callback_set(broker->mosq, mqtt_disconnect_callback);
+    mosquitto_message_callback_set(broker->mosq, mqtt_message_callback_wrapper);
+    mosquitto_publish_callback_set(broker->mosq, mqtt_publish_callback);
     int result;
-    if ((result = mosquitto_connect(mosq, host, port, MQTT_CONNECT_TIMEOUT)) != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mqtt: error connecting to broker: %s\n", mosquitto_strerror(result));
-        mosquitto_destroy(mosq);
-        mosq = NULL;
-        return false;
-    }
-    mqtt_synchronous = use_synchronous;
-    if (!mqtt_synchronous && (result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mqtt: error starting loop: %s\n", mosquitto_strerror(result));
-        mosquitto_disconnect(mosq);
-        mosquitto_destroy(mosq);
-        mosq = NULL;
-        return false;
+    // none need be reachable at startup, the primary included, so that the failover can take over from a primary that
+    // is down at launch: each connects (and reconnects) in the background, and is used once it has
+    if ((result = mosquitto_connect_async(broker->mosq, host, port, MQTT_CONNECT_TIMEOUT)) != MOSQ_ERR_SUCCESS)
+        fprintf(stderr, "mqtt: error connecting to broker (%s), will retry: %s\n", mqtt_broker_role_str(role), mosquitto_strerror(result));
+    if (!mqtt_synchronous) {
+        if ((result = mosquitto_loop_start(broker->mosq)) != MOSQ_ERR_SUCCESS) {
+            fprintf(stderr, "mqtt: error starting loop: %s\n", mosquitto_strerror(result));
+            __mqtt_broker_end(broker);
+            return false;
+        }
+        if (pthread_create(&broker->thread, NULL, __mqtt_broker_thread, broker) != 0) {
+            fprintf(stderr, "mqtt: error starting publisher thread (%s)\n", mqtt_broker_role_str(role));
+            __mqtt_broker_end(broker);
+            return false;
+        }
+        broker->thread_started = true;
     }
+    return true;
+}
 
+bool mqtt_begin(const mqtt_config_t *config) {
+    char client_id[24];
+    snprintf(client_id, sizeof(client_id), "%s-%06X", config->client ? config->client : "mqtt-linux", rand() & 0xFFFFFF);
+    mosquitto_lib_init();
+    mqtt_synchronous = config->use_synchronous || config->use_inline; // inline is synchronous, with the loop driven by the caller
+    mqtt_inline = config->use_inline;
+    mqtt_inline_misc_us = 0;
+    getrusage(RUSAGE_SELF, &mqtt_stats_usage);
+    mqtt_broker_count = 0;
+    if (!__mqtt_broker_begin(&mqtt_brokers[mqtt_broker_count], MQTT_BROKER_PRIMARY, config->server, client_id, config->queue_size))
+        return false;
+    mqtt_broker_active = &mqtt_brokers[mqtt_broker_count++];
+    if (config->server_failover && *config->server_failover)
+        if (__mqtt_broker_begin(&mqtt_brokers[mqtt_broker_count], MQTT_BROKER_FAILOVER, config->server_failover, client_id, config->queue_size))
+            mqtt_broker_count++;
+    if (config->server_fanout && *config->server_fanout)
+        if (__mqtt_broker_begin(&mqtt_brokers[mqtt_broker_count], MQTT_BROKER_FANOUT, config->server_fanout, client_id, config->queue_size))
+            mqtt_broker_count++;
     return true;
 }
 
-void mqtt_end(void) {
-    if (mosq) {
-        if (!mqtt_synchronous)
-            mosquitto_loop_stop(mosq, true);
-        mosquitto_disconnect(mosq);
-        mosquitto_destroy(mosq);
-        mosq = NULL;
+// waits for the queues of connected brokers to empty, e.g. so that the end of a replay is published before stopping;
+// inline, for what mosquitto holds unwritten
+bool mqtt_drain(const uint32_t timeout_ms) {
+    for (uint32_t waited_ms = 0;; waited_ms += 10) {
+        int queued = 0;
+        for (int i = 0; i < mqtt_broker_count; i++)
+            if (mqtt_inline)
+                queued += mqtt_brokers[i].connected && mosquitto_want_write(mqtt_brokers[i].mosq);
+            else if (__atomic_load_n(&mqtt_brokers[i].connected, __ATOMIC_RELAXED))
+                queued += __atomic_load_n(&mqtt_brokers[i].queue_count, __ATOMIC_RELAXED);
+        if (queued == 0)
+            return true;
+        if (waited_ms >= timeout_ms) {
+            fprintf(stderr, "mqtt: drain: %d messages still queued after %" PRIu32 "ms\n", queued, timeout_ms);
+            return false;
+        }
+        if (mqtt_inline)
+            mqtt_poll(10);
+        else
+            usleep(10 * 1000);
     }
+}
+
+void mqtt_end(void) {
+    for (int i = 0; i < mqtt_broker_count; i++)
+        __mqtt_broker_end(&mqtt_brokers[i]);
+    mqtt_broker_count = 0;
+    mqtt_broker_active = NULL;
+    mqtt_subscription_count = 0;
     mosquitto_lib_cleanup();
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
+
+const char *mqtt_loop_str(void) {
+    return mqtt_inline ? "inline" : (mqtt_synchronous ? "synchronous" : "thread");
+}
+
+void mqtt_stats_display(void) {
+    for (int i = 0; i < mqtt_broker_count; i++) {
+        mqtt_broker_t *broker = &mqtt_brokers[i];
+        pthread_mutex_lock(&broker->lock);
+        const mqtt_broker_stats_t stats = broker->stats;
+        const bool connected = broker->connected;
+        const int queue_count = broker->queue_count;
+        memset(&broker->stats, 0, sizeof(broker->stats));
+        pthread_mutex_unlock(&broker->lock);
+        printf("mqtt: broker[%s]: %s%s, published=%" PRIu32 ", dropped=%" PRIu32 ", failed=%" PRIu32 ", connects=%" PRIu32 ", disconnects=%" PRIu32 ", queue=%d/%d, latency-avg=%" PRIu64 "us, latency-max=%" PRIu64 "us\n",
+               mqtt_broker_role_str(broker->role), connected ? "connected" : "disconnected", broker == mqtt_broker_active ? " (active)" : "", stats.published, stats.dropped, stats.failed, stats.connects, stats.disconnects, queue_count,
+               mqtt_synchronous ? 0 : broker->queue_size, stats.latency_cnt ? stats.latency_sum_us / stats.latency_cnt : 0, stats.latency_max_us);
+    }
+    // of the process, for comparing the loops: the threads' handoffs are voluntary switches
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("mqtt: loop=%s, context-switches: voluntary=%ld, involuntary=%ld\n", mqtt_loop_str(), usage.ru_nvcsw - mqtt_stats_usage.ru_nvcsw, usage.ru_nivcsw - mqtt_stats_usage.ru_nivcsw);
+    mqtt_stats_usage = usage;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,1024 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+    DATA_TYPE_JSON = 0,
+    DATA_TYPE_ANY = 1,
+    DATA_TYPE_JSON_CONVERT = 2,
+} data_type_t;
+
+data_type_t data_type_parse(const char *data_type_str) {
+    if (strcmp(data_type_str, "json") == 0)
+        return DATA_TYPE_JSON;
+    else if (strcmp(data_type_str, "json-convert") == 0)
+        return DATA_TYPE_JSON_CONVERT;
+    else if (strcmp(data_type_str, "any") == 0)
+        return DATA_TYPE_ANY;
+    else {
+        fprintf(stderr, "warning: unknown data-type '%s', using default 'json-convert'\n", data_type_str);
+        return DATA_TYPE_JSON_CONVERT;
+    }
+}
+const char *data_type_tostring(const data_type_t data_type) {
+    switch (data_type) {
+    case DATA_TYPE_JSON:
+        return "json";
+    case DATA_TYPE_JSON_CONVERT:
+        return "json-convert";
+    case DATA_TYPE_ANY:
+    default:
+        return "any";
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// a topic with '{...}' extractors, e.g. 'e22900t22/{byte:0}/{hex:1-4}' or 'sensors/{json:id}', is compiled into a
+// list of literal and extractor ops so that one route can stand for many topics; extractors are {byte:N} (decimal),
+// {hex:A-B} (bytes A to B inclusive as lowercase hex, or {hex:N}), any filter field such as {u16le:N} or {i8:N}
+// (decimal), and {json:path} (a scalar value, with any character not valid in a topic level replaced by '_'); a
+// packet without the field has no topic
+
+#define TOPIC_LENGTH_MAX        128 // as the mqtt queue
+#define TOPIC_TEMPLATE_OPS_MAX  16
+#define TOPIC_TEMPLATE_JSON_MAX 4
+
+typedef enum {
+    TOPIC_OP_LITERAL = 0,
+    TOPIC_OP_HEX,
+    TOPIC_OP_FIELD,
+    TOPIC_OP_JSON,
+} topic_op_type_t;
+
+typedef struct {
+    topic_op_type_t type;
+    const char *literal;
+    int length; // literal length, or hex byte count
+    int offset;
+    filter_code_t load;
+    int width;
+    int match; // index into the template matches
+} topic_op_t;
+
+typedef struct {
+    topic_op_t ops[TOPIC_TEMPLATE_OPS_MAX];
+    int op_count;
+    json_match_t matches[TOPIC_TEMPLATE_JSON_MAX];
+    int match_count;
+    char *paths; // copy of the topic holding the NUL terminated json paths
+} topic_template_t;
+
+// two digits per division, from a table of "00" to "99", and 32 bit divisions where the value allows
+static inline uint8_t *__packet_put_uint(uint8_t *output, uint64_t value) {
+    static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869"
+                                "70717273747576777879808182838485868788899091929394959697989900";
+    uint8_t digits[20];
+    int count = 20;
+    for (; value > UINT32_MAX; value /= 100) {
+        const unsigned pair = (unsigned)(value % 100) * 2;
+        digits[--count] = (uint8_t)pairs[pair + 1];
+        digits[--count] = (uint8_t)pairs[pair];
+    }
+    uint32_t small = (uint32_t)value;
+    for (; small >= 100; small /= 100) {
+        const unsigned pair = (small % 100) * 2;
+        digits[--count] = (uint8_t)pairs[pair + 1];
+        digits[--count] = (uint8_t)pairs[pair];
+    }
+    if (small >= 10) {
+        digits[--count] = (uint8_t)pairs[(small * 2) + 1];
+        digits[--count] = (uint8_t)pairs[small * 2];
+    } else
+        digits[--count] = (uint8_t)('0' + small);
+    memcpy(output, digits + count, (size_t)(20 - count));
+    return output + (20 - count);
+}
+static bool __topic_template_number(const char **p, int *value) {
+    char *end;
+    const long number = strtol(*p, &end, 10);
+    if (end == *p || number < 0 || number >= FILTER_OFFSET_MAX)
+        return false;
+    *value = (int)number;
+    *p = end;
+    return true;
+}
+
+// returns a template, or NULL (with an error for a malformed one) if the topic has no extractors
+topic_template_t *topic_template_compile(const char *topic) {
+    if (strchr(topic, '{') == NULL)
+        return NULL;
+    topic_template_t *topic_template = (topic_template_t *)calloc(1, sizeof(topic_template_t));
+    if (topic_template == NULL || (topic_template->paths = strdup(topic)) == NULL) {
+        fprintf(stderr, "config: topic: could not allocate topic_template for '%s'\n", topic);
+        free(topic_template);
+        return NULL;
+    }
+    const char *p = topic, *error = NULL;
+    while (*p && error == NULL) {
+        if (topic_template->op_count == TOPIC_TEMPLATE_OPS_MAX) {
+            error = "too many parts";
+            break;
+        }
+        topic_op_t *op = &topic_template->ops[topic_template->op_count++];
+        if (*p != '{') {
+            op->type = TOPIC_OP_LITERAL;
+            op->literal = p;
+            op->length = (int)strcspn(p, "{");
+            p += op->length;
+            continue;
+        }
+        const char *name = ++p, *close = strchr(p, '}');
+        const size_t name_length = strcspn(p, ":}");
+        if (close == NULL || name[name_length] != ':') {
+            error = "expected '{type:argument}'";
+            break;
+        }
+        p = name + name_length + 1;
+        if (name_length == 4 && strncmp(name, "json", 4) == 0) {
+            char *path = topic_template->paths + (p - topic);
+            path[close - p] = '\0';
+            if (topic_template->match_count == TOPIC_TEMPLATE_JSON_MAX || !json_match_compile(path, "exists", NULL, &topic_template->matches[topic_template->match_count])) {
+                error = "invalid json path";
+                break;
+            }
+            op->type = TOPIC_OP_JSON;
+            op->match = topic_template->match_count++;
+            p = close;
+        } else if (name_length == 3 && strncmp(name, "hex", 3) == 0) {
+            int last;
+            op->type = TOPIC_OP_HEX;
+            if (!__topic_template_number(&p, &op->offset)) {
+                error = "invalid offset";
+                break;
+            }
+            last = op->offset;
+            if (*p == '-' && (++p, !__topic_template_number(&p, &last) || last < op->offset)) {
+                error = "invalid range";
+                break;
+            }
+            op->length = last - op->offset + 1;
+        } else {
+            op->type = TOPIC_OP_FIELD;
+            if (!(name_length == 4 && strncmp(name, "byte", 4) == 0 ? filter_field_lookup("u8", 2, &op->load, &op->width) : filter_field_lookup(name, name_length, &op->load, &op->width))) {
+                error = "unknown type";
+                break;
+            }
+            if (!__topic_template_number(&p, &op->offset)) {
+                error = "invalid offset";
+                break;
+            }
+        }
+        if (p != close) {
+            error = "expected '}'";
+            break;
+        }
+        p++;
+    }
+    if (error != NULL) {
+        fprintf(stderr, "config: topic: %s at offset %d in '%s'\n", error, (int)(p - topic), topic);
+        free(topic_template->paths);
+        free(topic_template);
+        return NULL;
+    }
+    return topic_template;
+}
+
+void topic_template_free(topic_template_t *topic_template) {
+    if (topic_template != NULL)
+        free(topic_template->paths);
+    free(topic_template);
+}
+
+// renders the topic for the packet, returning its length or -1 if a field is missing or it will not fit
+int topic_template_render(const topic_template_t *topic_template, const uint8_t *packet, const int packet_size, char *topic, const int topic_size) {
+    uint8_t *p = (uint8_t *)topic, *const end = (uint8_t *)topic + topic_size - 1;
+    for (int i = 0; i < topic_template->op_count; i++) {
+        const topic_op_t *op = &topic_template->ops[i];
+        switch (op->type) {
+        case TOPIC_OP_LITERAL:
+            if (op->length > end - p)
+                return -1;
+            memcpy(p, op->literal, (size_t)op->length);
+            p += op->length;
+            break;
+        case TOPIC_OP_HEX:
+            if (op->offset + op->length > packet_size || op->length * 2 > end - p)
+                return -1;
+            for (int j = op->offset; j < op->offset + op->length; j++) {
+                *p++ = (uint8_t)"0123456789abcdef"[packet[j] >> 4];
+                *p++ = (uint8_t)"0123456789abcdef"[packet[j] & 0x0f];
+            }
+            break;
+        case TOPIC_OP_FIELD: {
+            int64_t value;
+            if (!filter_field_load(op->load, op->width, packet, packet_size, op->offset, &value) || end - p < 11)
+                return -1;
+            if (value < 0)
+                *p++ = '-';
+            p = __packet_put_uint(p, (uint64_t)(value < 0 ? -value : value));
+            break;
+        }
+        case TOPIC_OP_JSON:
+        default: {
+            const uint8_t *value;
+            int length;
+            json_type_t type;
+            if (json_match_value(packet, packet_size, &topic_template->matches[op->match], 1, &value, &length, &type) < 0 || type == JSON_TYPE_OBJECT || type == JSON_TYPE_ARRAY || length > end - p)
+                return -1;
+            for (int j = 0; j < length; j++)
+                *p++ = (value[j] > ' ' && value[j] < 0x7f && value[j] != '/' && value[j] != '+' && value[j] != '#' && value[j] != '\\') ? value[j] : '_';
+            break;
+        }
+        }
+    }
+    *p = '\0';
+    return (int)(p - (uint8_t *)topic);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// routes are compiled when added: binary routes into a table per distinct offset indexed by byte value, giving the
+// first route for each (offset, byte), and JSON routes into their '"key":"value"' search pattern; once all routes are
+// added, topic_routes_compile() builds the JSON patterns into an Aho-Corasick automaton so that each packet is scanned
+// once regardless of the number of routes; path routes ('topic-route.N.path' with an optional 'op' and typed 'value')
+// are evaluated by the structural scanner in json_linux.h, only for packets where no lower numbered literal route has
+// matched; filter routes ('topic-route.N.filter') are compiled by filter_linux.h into verified programs that are run in
+// order against binary packets, only while no lower numbered binary route has matched; selection is first-match in
+// configuration order, as the lowest index wins
+
+typedef struct {
+    const char *key;
+    const char *value;
+    const char *topic;
+    uint32_t sinks;
+    char *pattern; // literal JSON routes
+    int pattern_length;
+    int32_t match;  // path routes, as the index into topic_route_matches, else -1
+    int32_t filter; // filter routes, as the index into topic_route_filters, else -1
+    topic_template_t *topic_template; // topics with extractors, else NULL
+} topic_route_t;
+
+typedef struct {
+    int offset;
+    int32_t route[256];
+} topic_route_offset_t;
+
+topic_route_t *topic_routes = NULL;
+topic_route_t topic_route_default;
+size_t topic_route_count = 0, topic_route_capacity = 0, topic_route_literal_count = 0;
+topic_route_offset_t *topic_route_offsets = NULL;
+size_t topic_route_offset_count = 0;
+json_match_t *topic_route_matches = NULL;
+int32_t *topic_route_match_routes = NULL;
+size_t topic_route_match_count = 0, topic_route_match_capacity = 0;
+filter_program_t *topic_route_filters = NULL;
+int32_t *topic_route_filter_routes = NULL;
+size_t topic_route_filter_count = 0, topic_route_filter_capacity = 0;
+
+// the automaton is a full DFA over byte classes (the distinct bytes used in the patterns, plus one for all others),
+// where each state also holds the lowest route index of all patterns ending there, including through failure links
+typedef struct {
+    uint16_t classes[256];
+    int class_count;
+    int32_t *next;
+    int32_t *match;
+    int state_count;
+} topic_route_automaton_t;
+
+topic_route_automaton_t topic_route_automaton = { .next = NULL, .match = NULL };
+
+static void __route_automaton_clear(void) {
+    free(topic_route_automaton.next);
+    free(topic_route_automaton.match);
+    topic_route_automaton.next = topic_route_automaton.match = NULL;
+    topic_route_automaton.state_count = 0;
+}
+
+void topic_routes_reset(void) {
+    for (size_t i = 0; i < topic_route_count; i++) {
+        free(topic_routes[i].pattern);
+        topic_template_free(topic_routes[i].topic_template);
+    }
+    free(topic_routes);
+    free(topic_route_offsets);
+    free(topic_route_matches);
+    free(topic_route_match_routes);
+    free(topic_route_filters);
+    free(topic_route_filter_routes);
+    __route_automaton_clear();
+    topic_routes = NULL;
+    topic_route_offsets = NULL;
+    topic_route_matches = NULL;
+    topic_route_match_routes = NULL;
+    topic_route_filters = NULL;
+    topic_route_filter_routes = NULL;
+    topic_route_count = topic_route_capacity = topic_route_literal_count = topic_route_offset_count = topic_route_match_count = topic_route_match_capacity = 0;
+    topic_route_filter_count = topic_route_filter_capacity = 0;
+}
+
+// the routes as a whole, so that a new set can be built in place while the current one is held aside, then either
+// kept (and the held set freed) or dropped (and the held set swapped back); a swap is a copy of the pointers and
+// counts, so costs the same for any number of routes
+typedef struct {
+    topic_route_t *routes;
+    topic_route_t route_default;
+    size_t count, capacity, literal_count;
+    topic_route_offset_t *offsets;
+    size_t offset_count;
+    json_match_t *matches;
+    int32_t *match_routes;
+    size_t match_count, match_capacity;
+    filter_program_t *filters;
+    int32_t *filter_routes;
+    size_t filter_count, filter_capacity;
+    topic_route_automaton_t automaton;
+} topic_routes_table_t;
+
+#define __TOPIC_ROUTES_SWAP(type, a, b) \
+    do {                                \
+        type __swap = a;                \
+        a = b;                          \
+        b = __swap;                     \
+    } while (0)
+
+// exchanges the routes in use with those of the table, e.g. with an empty table to hold the current routes aside
+void topic_routes_swap(topic_routes_table_t *table) {
+    __TOPIC_ROUTES_SWAP(topic_route_t *, topic_routes, table->routes);
+    __TOPIC_ROUTES_SWAP(topic_route_t, topic_route_default, table->route_default);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_count, table->count);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_capacity, table->capacity);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_literal_count, table->literal_count);
+    __TOPIC_ROUTES_SWAP(topic_route_offset_t *, topic_route_offsets, table->offsets);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_offset_count, table->offset_count);
+    __TOPIC_ROUTES_SWAP(json_match_t *, topic_route_matches, table->matches);
+    __TOPIC_ROUTES_SWAP(int32_t *, topic_route_match_routes, table->match_routes);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_match_count, table->match_count);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_match_capacity, table->match_capacity);
+    __TOPIC_ROUTES_SWAP(filter_program_t *, topic_route_filters, table->filters);
+    __TOPIC_ROUTES_SWAP(int32_t *, topic_route_filter_routes, table->filter_routes);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_filter_count, table->filter_count);
+    __TOPIC_ROUTES_SWAP(size_t, topic_route_filter_capacity, table->filter_capacity);
+    __TOPIC_ROUTES_SWAP(topic_route_automaton_t, topic_route_automaton, table->automaton);
+}
+
+// frees the routes held in the table, leaving it empty
+void topic_routes_table_free(topic_routes_table_t *table) {
+    topic_routes_swap(table);
+    topic_routes_reset();
+    topic_template_free(topic_route_default.topic_template);
+    memset(&topic_route_default, 0, sizeof(topic_route_default));
+    topic_routes_swap(table);
+}
+
+static bool __route_parse_byte(const char *value, uint8_t *byte) {
+    if (strlen(value) != 2)
+        return false;
+    uint8_t expected_value = 0;
+    for (int i = 0; i < 2; i++) {
+        const char c = value[i];
+        char digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false; // Invalid hex character
+        expected_value = (uint8_t)((expected_value << 4) | (uint8_t)digit);
+    }
+    *byte = expected_value;
+    return true;
+}
+
+static bool __route_index_binary(const int route, const char *key, const char *value) {
+    const int offset = atoi(key);
+    uint8_t byte;
+    if (offset < 0 || !__route_parse_byte(value, &byte))
+        return true; // can never match
+    size_t i;
+    for (i = 0; i < topic_route_offset_count && topic_route_offsets[i].offset < offset; i++)
+        ;
+    if (i == topic_route_offset_count || topic_route_offsets[i].offset != offset) {
+        topic_route_offset_t *offsets = (topic_route_offset_t *)realloc(topic_route_offsets, (topic_route_offset_count + 1) * sizeof(topic_route_offset_t));
+        if (offsets == NULL)
+            return false;
+        topic_route_offsets = offsets;
+        memmove(&topic_route_offsets[i + 1], &topic_route_offsets[i], (topic_route_offset_count - i) * sizeof(topic_route_offset_t));
+        topic_route_offsets[i].offset = offset;
+        for (int b = 0; b < 256; b++)
+            topic_route_offsets[i].route[b] = -1;
+        topic_route_offset_count++;
+    }
+    if (topic_route_offsets[i].route[byte] < 0)
+        topic_route_offsets[i].route[byte] = route;
+    return true;
+}
+
+static topic_route_t *__route_append(const char *key, const char *value, const char *topic, const uint32_t sink_mask) {
+    if (topic_route_count == topic_route_capacity) {
+        const size_t capacity = topic_route_capacity ? topic_route_capacity * 2 : 16;
+        topic_route_t *routes = (topic_route_t *)realloc(topic_routes, capacity * sizeof(topic_route_t));
+        if (routes == NULL) {
+            fprintf(stderr, "config: topic-route: could not allocate %zu routes\n", capacity);
+            return NULL;
+        }
+        topic_routes = routes;
+        topic_route_capacity = capacity;
+    }
+    topic_template_t *topic_template = topic_template_compile(topic);
+    if (topic_template == NULL && strchr(topic, '{') != NULL)
+        return NULL;
+    __route_automaton_clear(); // until recompiled, selection falls back to the per route scan
+    topic_route_t *route = &topic_routes[topic_route_count];
+    route->key = key;
+    route->value = value;
+    route->topic = topic;
+    route->sinks = sink_mask;
+    route->pattern = NULL;
+    route->pattern_length = 0;
+    route->match = -1;
+    route->filter = -1;
+    route->topic_template = topic_template;
+    return route;
+}
+
+bool topic_route_add(const char *key, const char *value, const char *topic, const uint32_t sink_mask) {
+    topic_route_t *route = __route_append(key, value, topic, sink_mask);
+    if (route == NULL)
+        return false;
+    route->pattern_length = (int)(strlen(key) + strlen(value) + 5);
+    if ((route->pattern = (char *)malloc((size_t)route->pattern_length + 1)) == NULL || !__route_index_binary((int)topic_route_count, key, value)) {
+        fprintf(stderr, "config: topic-route: could not allocate route\n");
+        free(route->pattern);
+        topic_template_free(route->topic_template);
+        return false;
+    }
+    snprintf(route->pattern, (size_t)route->pattern_length + 1, "\"%s\":\"%s\"", key, value);
+    topic_route_literal_count++;
+    topic_route_count++;
+    return true;
+}
+
+// path routes only apply to JSON, so are not indexed for binary
+bool topic_route_add_path(const char *path, const char *op, const char *value, const char *topic, const uint32_t sink_mask) {
+    json_match_t match;
+    if (!json_match_compile(path, op, value, &match)) {
+        fprintf(stderr, "config: topic-route: invalid path route (path='%s', op='%s', value='%s')\n", path, op ? op : "eq", value ? value : "");
+        return false;
+    }
+    if (topic_route_match_count == topic_route_match_capacity) {
+        const size_t capacity = topic_route_match_capacity ? topic_route_match_capacity * 2 : 8;
+        json_match_t *matches = (json_match_t *)realloc(topic_route_matches, capacity * sizeof(json_match_t));
+        if (matches != NULL)
+            topic_route_matches = matches;
+        int32_t *match_routes = (int32_t *)realloc(topic_route_match_routes, capacity * sizeof(int32_t));
+        if (match_routes != NULL)
+            topic_route_match_routes = match_routes;
+        if (matches == NULL || match_routes == NULL) {
+            fprintf(stderr, "config: topic-route: could not allocate %zu path routes\n", capacity);
+            return false;
+        }
+        topic_route_match_capacity = capacity;
+    }
+    topic_route_t *route = __route_append(path, value, topic, sink_mask);
+    if (route == NULL)
+        return false;
+    route->match = (int32_t)topic_route_match_count;
+    topic_route_matches[topic_route_match_count] = match;
+    topic_route_match_routes[topic_route_match_count++] = (int32_t)topic_route_count++;
+    return true;
+}
+
+// filter routes only apply to binary, so are not part of the JSON automaton
+bool topic_route_add_filter(const char *expression, const char *topic, const uint32_t sink_mask) {
+    filter_program_t program;
+    if (!filter_compile(expression, &program))
+        return false;
+    if (topic_route_filter_count == topic_route_filter_capacity) {
+        const size_t capacity = topic_route_filter_capacity ? topic_route_filter_capacity * 2 : 8;
+        filter_program_t *filters = (filter_program_t *)realloc(topic_route_filters, capacity * sizeof(filter_program_t));
+        if (filters != NULL)
+            topic_route_filters = filters;
+        int32_t *filter_routes = (int32_t *)realloc(topic_route_filter_routes, capacity * sizeof(int32_t));
+        if (filter_routes != NULL)
+            topic_route_filter_routes = filter_routes;
+        if (filters == NULL || filter_routes == NULL) {
+            fprintf(stderr, "config: topic-route: could not allocate %zu filter routes\n", capacity);
+            return false;
+        }
+        topic_route_filter_capacity = capacity;
+    }
+    topic_route_t *route = __route_append(expression, NULL, topic, sink_mask);
+    if (route == NULL)
+        return false;
+    route->filter = (int32_t)topic_route_filter_count;
+    topic_route_filters[topic_route_filter_count] = program;
+    topic_route_filter_routes[topic_route_filter_count++] = (int32_t)topic_route_count++;
+    return true;
+}
+
+bool topic_routes_compile(void) {
+    topic_route_automaton_t *ac = &topic_route_automaton;
+    __route_automaton_clear();
+    if (topic_route_literal_count == 0)
+        return true;
+    memset(ac->classes, 0, sizeof(ac->classes));
+    ac->class_count = 1;
+    size_t states_max = 1;
+    for (size_t i = 0; i < topic_route_count; i++) {
+        for (int j = 0; j < topic_routes[i].pattern_length; j++) {
+            const uint8_t c = (uint8_t)topic_routes[i].pattern[j];
+            if (ac->classes[c] == 0)
+                ac->classes[c] = (uint16_t)ac->class_count++;
+        }
+        states_max += (size_t)topic_routes[i].pattern_length;
+    }
+    const size_t class_count = (size_t)ac->class_count;
+    int32_t *fail = (int32_t *)malloc(states_max * sizeof(int32_t)), *queue = (int32_t *)malloc(states_max * sizeof(int32_t));
+    ac->next = (int32_t *)malloc(states_max * class_count * sizeof(int32_t));
+    ac->match = (int32_t *)malloc(states_max * sizeof(int32_t));
+    if (fail == NULL || queue == NULL || ac->next == NULL || ac->match == NULL) {
+        fprintf(stderr, "config: topic-routes: could not allocate automaton (states=%zu, classes=%zu)\n", states_max, class_count);
+        free(fail);
+        free(queue);
+        free(ac->next);
+        free(ac->match);
+        ac->next = ac->match = NULL;
+        return false;
+    }
+    memset(ac->next, 0xFF, states_max * class_count * sizeof(int32_t));
+    ac->match[0] = -1;
+    int32_t states = 1;
+    for (size_t i = 0; i < topic_route_count; i++) {
+        if (topic_routes[i].pattern == NULL)
+            continue;
+        int32_t state = 0;
+        for (int j = 0; j < topic_routes[i].pattern_length; j++) {
+            int32_t *next = &ac->next[(size_t)state * class_count + ac->classes[(uint8_t)topic_routes[i].pattern[j]]];
+            if (*next < 0) {
+                ac->match[states] = -1;
+                *next = states++;
+            }
+            state = *next;
+        }
+        if (ac->match[state] < 0)
+            ac->match[state] = (int32_t)i;
+    }
+    // breadth first, so that failure states are complete before they are used; missing transitions are filled
+    // from the failure state, making the trie a DFA, and matches are inherited along the failure links
+    int32_t head = 0, tail = 0;
+    for (size_t c = 0; c < class_count; c++) {
+        if (ac->next[c] < 0)
+            ac->next[c] = 0;
+        else {
+            fail[ac->next[c]] = 0;
+            queue[tail++] = ac->next[c];
+        }
+    }
+    while (head < tail) {
+        const int32_t state = queue[head++];
+        const int32_t inherited = ac->match[fail[state]];
+        if (inherited >= 0 && (ac->match[state] < 0 || inherited < ac->match[state]))
+            ac->match[state] = inherited;
+        for (size_t c = 0; c < class_count; c++) {
+            int32_t *next = &ac->next[(size_t)state * class_count + c];
+            const int32_t next_fail = ac->next[(size_t)fail[state] * class_count + c];
+            if (*next < 0)
+                *next = next_fail;
+            else {
+                fail[*next] = next_fail;
+                queue[tail++] = *next;
+            }
+        }
+    }
+    // transitions are stored as the target row offset shifted left one, with the low bit set if the target has a match
+    for (int32_t state = 0; state < states; state++)
+        for (size_t c = 0; c < class_count; c++) {
+            int32_t *next = &ac->next[(size_t)state * class_count + c];
+            *next = (int32_t)(((uint32_t)*next * (uint32_t)class_count) << 1) | (ac->match[*next] >= 0 ? 1 : 0);
+        }
+    free(fail);
+    free(queue);
+    ac->state_count = states;
+    return true;
+}
+
+// returns false if any route is invalid (each is reported, the valid ones still added), so that a reload can be refused
+bool config_populate_topic_routes(const char *topic_default, const uint32_t sinks_default) {
+    topic_route_default.topic = topic_default;
+    topic_route_default.sinks = sinks_default;
+    topic_template_free(topic_route_default.topic_template);
+    topic_route_default.topic_template = topic_template_compile(topic_default);
+    topic_routes_reset();
+    bool valid = true;
+    int index_count;
+    int *indices = config_get_indices("topic-route.", ".topic", &index_count);
+    for (int i = 0; i < index_count; i++) {
+        const char *key = config_get_indexed("topic-route", indices[i], "key", NULL);
+        const char *path = config_get_indexed("topic-route", indices[i], "path", NULL);
+        const char *filter = config_get_indexed("topic-route", indices[i], "filter", NULL);
+        const char *op = config_get_indexed("topic-route", indices[i], "op", NULL);
+        const char *value = config_get_indexed("topic-route", indices[i], "value", NULL);
+        const char *topic = config_get_indexed("topic-route", indices[i], "topic", NULL);
+        const char *sink = config_get_indexed("topic-route", indices[i], "sink", NULL);
+        const uint32_t sink_mask = sink ? sink_parse(sink) : sinks_default;
+        bool added;
+        if (path) {
+            if ((added = topic_route_add_path(path, op, value, topic, sink_mask)))
+                printf("config: topic-route[%d]: path='%s', op='%s', value='%s', topic='%s', sink='%s'\n", (int)topic_route_count - 1, path, op ? op : "eq", value ? value : "", topic, sink ? sink : "default");
+        } else if (filter) {
+            if ((added = topic_route_add_filter(filter, topic, sink_mask)))
+                printf("config: topic-route[%d]: filter='%s' (%d insns), topic='%s', sink='%s'\n", (int)topic_route_count - 1, filter, topic_route_filters[topic_route_filter_count - 1].length, topic,
+                       sink ? sink : "default");
+        } else if ((added = key && value && topic_route_add(key, value, topic, sink_mask)))
+            printf("config: topic-route[%d]: key='%s', value='%s', topic='%s', sink='%s'\n", (int)topic_route_count - 1, key, value, topic, sink ? sink : "default");
+        if (!added) {
+            fprintf(stderr, "config: topic-route.%d: invalid route (topic='%s')\n", indices[i], topic);
+            valid = false;
+        }
+    }
+    free(indices);
+    topic_routes_compile();
+    if (topic_route_match_count > 0) {
+        json_scanner_select(NULL);
+        printf("config: topic-routes: json path scanner '%s'\n", simd_level_tostring(json_classify_level));
+    }
+    if (topic_route_count == 0)
+        printf("config: no topic routes configured, using default topic\n");
+    else
+        printf("config: topic-routes: %zu routes (%zu path, %zu filter), %zu binary offsets, %d json states\n", topic_route_count, topic_route_match_count, topic_route_filter_count, topic_route_offset_count,
+               topic_route_automaton.state_count);
+    return valid;
+}
+
+static inline bool __route_match_json(const uint8_t *packet, const int packet_size, const topic_route_t *route) {
+    const int pattern_len = route->pattern_length;
+    if (route->pattern == NULL || pattern_len >= packet_size)
+        return false;
+    for (int i = 0; i <= packet_size - pattern_len; i++)
+        if (packet[i] == '"' && memcmp(packet + i, route->pattern, (size_t)pattern_len) == 0)
+            return true;
+    return false;
+}
+// the per route scan, kept for comparison in the benchmarks
+static inline const topic_route_t *__route_select_json_linear(const uint8_t *packet, const int packet_size) {
+    for (size_t i = 0; i < topic_route_count; i++)
+        if (__route_match_json(packet, packet_size, &topic_routes[i]))
+            return &topic_routes[i];
+    return NULL;
+}
+static inline const topic_route_t *__route_select_json_literal(const uint8_t *packet, const int packet_size) {
+    const topic_route_automaton_t *ac = &topic_route_automaton;
+    if (topic_route_literal_count == 0)
+        return NULL;
+    if (ac->next == NULL)
+        return __route_select_json_linear(packet, packet_size);
+    uint32_t next = 0;
+    int32_t selected = -1;
+    for (int i = 0; i < packet_size; i++) {
+        next = (uint32_t)ac->next[(next >> 1) + ac->classes[packet[i]]];
+        if (next & 1) {
+            const int32_t route = ac->match[(next >> 1) / (uint32_t)ac->class_count];
+            if (selected < 0 || route < selected)
+                if ((selected = route) == 0)
+                    break;
+        }
+    }
+    return selected < 0 ? NULL : &topic_routes[selected];
+}
+static inline const topic_route_t *__route_select_json(const uint8_t *packet, const int packet_size) {
+    const topic_route_t *literal = __route_select_json_literal(packet, packet_size);
+    if (topic_route_match_count == 0)
+        return literal;
+    const int32_t limit = literal ? (int32_t)(literal - topic_routes) : (int32_t)topic_route_count;
+    int count = 0;
+    while (count < (int)topic_route_match_count && topic_route_match_routes[count] < limit)
+        count++;
+    const int match = json_match_first(packet, packet_size, topic_route_matches, count);
+    return match < 0 ? literal : &topic_routes[topic_route_match_routes[match]];
+}
+// the byte at the offset of the '["' <HEX> '"]' text that json-convert publishes for the packet
+static inline uint8_t __route_hex_view_byte(const uint8_t *packet, const int packet_size, const int offset) {
+    const int i = offset - 2;
+    if (i < 0)
+        return offset == 0 ? '[' : '"';
+    else if (i < packet_size * 2)
+        return (uint8_t)"0123456789abcdef"[(i & 1) ? (packet[i >> 1] & 0x0f) : (packet[i >> 1] >> 4)];
+    return i == packet_size * 2 ? '"' : ']';
+}
+static inline const topic_route_t *__route_select_binary(const uint8_t *packet, const int packet_size, const bool hex_view) {
+    int32_t selected = -1;
+    if (hex_view) {
+        for (size_t i = 0; i < topic_route_offset_count && topic_route_offsets[i].offset < 4 + (packet_size * 2); i++) {
+            const int32_t route = topic_route_offsets[i].route[__route_hex_view_byte(packet, packet_size, topic_route_offsets[i].offset)];
+            if (route >= 0 && (selected < 0 || route < selected))
+                selected = route;
+        }
+    } else {
+        for (size_t i = 0; i < topic_route_offset_count && topic_route_offsets[i].offset < packet_size; i++) {
+            const int32_t route = topic_route_offsets[i].route[packet[topic_route_offsets[i].offset]];
+            if (route >= 0 && (selected < 0 || route < selected))
+                selected = route;
+        }
+    }
+    for (size_t i = 0; i < topic_route_filter_count && (selected < 0 || topic_route_filter_routes[i] < selected); i++)
+        if (filter_run(&topic_route_filters[i], packet, packet_size))
+            return &topic_routes[topic_route_filter_routes[i]];
+    return selected < 0 ? NULL : &topic_routes[selected];
+}
+// selection is on the raw packet: 'hex_view' is for json-convert without an envelope, where key/value binary routes
+// have always addressed the converted '["' <HEX> '"]' text, so their offsets are mapped onto that text, while filter
+// routes see the packet bytes
+const topic_route_t *route_topic_select(const uint8_t *packet, const int packet_size, const data_type_t data_type, const bool hex_view) {
+    if (topic_route_count == 0)
+        return &topic_route_default;
+    return data_type == DATA_TYPE_JSON ? __route_select_json(packet, packet_size) : __route_select_binary(packet, packet_size, hex_view);
+}
+// the route topic, rendered into the buffer if it is a template, or NULL if the packet lacks a template field
+const char *route_topic_render(const topic_route_t *route, const uint8_t *packet, const int packet_size, char *topic, const int topic_size) {
+    if (route->topic_template == NULL)
+        return route->topic;
+    return topic_template_render(route->topic_template, packet, packet_size, topic, topic_size) < 0 ? NULL : topic;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// json-convert wraps a packet as '["' <DATA> '"]', with the data as lowercase hex or as base64 (RFC 4648, padded),
+// which is a third smaller; the scalar encoders are table driven, hex a byte pair at a time and base64 three bytes to
+// a 24 bit word at a time, and the vector kernels in simd_linux.c encode whole blocks with the scalar encoders taking
+// the rest; encoders are selected at runtime as for the JSON scanner
+
+typedef enum {
+    PACKET_ENCODING_HEX = 0,
+    PACKET_ENCODING_BASE64 = 1,
+} packet_encoding_t;
+
+packet_encoding_t packet_encoding_parse(const char *encoding) {
+    return (encoding != NULL && strcmp(encoding, "base64") == 0) ? PACKET_ENCODING_BASE64 : PACKET_ENCODING_HEX;
+}
+
+const char *packet_encoding_tostring(const packet_encoding_t encoding) {
+    return encoding == PACKET_ENCODING_BASE64 ? "base64" : "hex";
+}
+
+static inline int packet_encoded_size(const packet_encoding_t encoding, const int length) {
+    return encoding == PACKET_ENCODING_BASE64 ? ((length + 2) / 3) * 4 : length * 2;
+}
+
+static const char __packet_hex_pairs[] = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+                                   "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+                                   "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+                                   "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char __packet_base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+uint8_t *packet_encode_hex_scalar(uint8_t *output, const uint8_t *data, const int length) {
+    int i = 0;
+    for (; i + 4 <= length; i += 4, output += 8) {
+        memcpy(output + 0, &__packet_hex_pairs[data[i + 0] * 2], 2);
+        memcpy(output + 2, &__packet_hex_pairs[data[i + 1] * 2], 2);
+        memcpy(output + 4, &__packet_hex_pairs[data[i + 2] * 2], 2);
+        memcpy(output + 6, &__packet_hex_pairs[data[i + 3] * 2], 2);
+    }
+    for (; i < length; i++, output += 2)
+        memcpy(output, &__packet_hex_pairs[data[i] * 2], 2);
+    return output;
+}
+
+uint8_t *packet_encode_base64_scalar(uint8_t *output, const uint8_t *data, const int length) {
+    int i = 0;
+    for (; i + 3 <= length; i += 3, output += 4) {
+        const uint32_t word = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        output[0] = (uint8_t)__packet_base64_alphabet[word >> 18];
+        output[1] = (uint8_t)__packet_base64_alphabet[(word >> 12) & 0x3F];
+        output[2] = (uint8_t)__packet_base64_alphabet[(word >> 6) & 0x3F];
+        output[3] = (uint8_t)__packet_base64_alphabet[word & 0x3F];
+    }
+    if (i < length) {
+        const uint32_t word = ((uint32_t)data[i] << 16) | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0);
+        output[0] = (uint8_t)__packet_base64_alphabet[word >> 18];
+        output[1] = (uint8_t)__packet_base64_alphabet[(word >> 12) & 0x3F];
+        output[2] = i + 1 < length ? (uint8_t)__packet_base64_alphabet[(word >> 6) & 0x3F] : '=';
+        output[3] = '=';
+        output += 4;
+    }
+    return output;
+}
+
+#if SIMD_X86
+uint8_t *packet_encode_hex_sse2(uint8_t *output, const uint8_t *data, const int length) {
+    const int encoded = simd_hex_encode_sse2(data, length, output);
+    return packet_encode_hex_scalar(output + (encoded * 2), data + encoded, length - encoded);
+}
+uint8_t *packet_encode_hex_avx2(uint8_t *output, const uint8_t *data, const int length) {
+    const int encoded = simd_hex_encode_avx2(data, length, output);
+    return packet_encode_hex_scalar(output + (encoded * 2), data + encoded, length - encoded);
+}
+uint8_t *packet_encode_base64_avx2(uint8_t *output, const uint8_t *data, const int length) {
+    const int encoded = simd_base64_encode_avx2(data, length, output);
+    return packet_encode_base64_scalar(output + ((encoded / 3) * 4), data + encoded, length - encoded);
+}
+#endif
+
+typedef uint8_t *(*packet_encode_fn_t)(uint8_t *output, const uint8_t *data, const int length);
+
+packet_encoding_t packet_encoding = PACKET_ENCODING_HEX;
+packet_encode_fn_t packet_encode_hex = packet_encode_hex_scalar, packet_encode_base64 = packet_encode_base64_scalar;
+simd_level_t packet_encode_level = SIMD_LEVEL_SCALAR;
+
+// selects the named kernels ("scalar", "sse2", "avx2"), or the best supported ones if NULL or unknown; base64 has no
+// SSE2 kernel, as it needs a byte shuffle
+void packet_encoders_select(const char *level_name) {
+    simd_level_t level = simd_level_parse(level_name);
+    if (!simd_supports(level))
+        level = simd_level_parse(NULL);
+    packet_encode_level = level;
+    switch (level) {
+#if SIMD_X86
+    case SIMD_LEVEL_AVX2:
+        packet_encode_hex = packet_encode_hex_avx2;
+        packet_encode_base64 = packet_encode_base64_avx2;
+        break;
+    case SIMD_LEVEL_SSE2:
+        packet_encode_hex = packet_encode_hex_sse2;
+        packet_encode_base64 = packet_encode_base64_scalar;
+        break;
+#endif
+    case SIMD_LEVEL_SCALAR:
+    default:
+        packet_encode_hex = packet_encode_hex_scalar;
+        packet_encode_base64 = packet_encode_base64_scalar;
+        packet_encode_level = SIMD_LEVEL_SCALAR;
+        break;
+    }
+}
+
+// writes '["' <DATA> '"]' for the bytes in the selected encoding, returning the end of the output
+static inline uint8_t *__packet_put_json_encoded(uint8_t *output, const uint8_t *data, const int length) {
+    *output++ = '[';
+    *output++ = '"';
+    output = (packet_encoding == PACKET_ENCODING_BASE64 ? packet_encode_base64 : packet_encode_hex)(output, data, length);
+    *output++ = '"';
+    *output++ = ']';
+    return output;
+}
+
+// writes the packet as '["' <DATA> '"]' into the output, returning the size or -1 if it will not fit
+int packet_convert_json(uint8_t *output, const int output_size, const uint8_t *packet, const int packet_size) {
+    const int json_size = 4 + packet_encoded_size(packet_encoding, packet_size);
+    if (json_size > output_size)
+        return -1;
+    __packet_put_json_encoded(output, packet, packet_size);
+    return json_size;
+}
+
+bool config_populate_convert(const char *encoding) {
+    if (encoding != NULL && strcmp(encoding, "hex") != 0 && strcmp(encoding, "base64") != 0) {
+        fprintf(stderr, "config: convert-encoding: unknown encoding '%s' (expected hex or base64)\n", encoding);
+        return false;
+    }
+    packet_encoding = packet_encoding_parse(encoding);
+    packet_encoders_select(NULL);
+    printf("config: convert-encoding: %s (encoder '%s')\n", packet_encoding_tostring(packet_encoding), simd_level_tostring(packet_encode_level));
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the envelope format (e.g. "ts,rssi,ch,seq" or "ts:time,data:payload") is compiled into a list of fields with
+// their literal '{"key":' / ',"key":' prefixes, so that building is a single pass of copies and integer formatting
+
+#define ENVELOPE_FIELDS_MAX   8
+#define ENVELOPE_KEY_MAX      16
+#define ENVELOPE_PREFIX_MAX   (ENVELOPE_KEY_MAX + 4)
+#define ENVELOPE_OVERHEAD_MAX ((ENVELOPE_FIELDS_MAX * (ENVELOPE_PREFIX_MAX + 20)) + 1)
+
+typedef enum {
+    ENVELOPE_FIELD_TS = 0,
+    ENVELOPE_FIELD_RSSI = 1,
+    ENVELOPE_FIELD_CHANNEL = 2,
+    ENVELOPE_FIELD_SEQ = 3,
+    ENVELOPE_FIELD_DATA = 4,
+} envelope_field_t;
+
+typedef struct {
+    envelope_field_t field;
+    char prefix[ENVELOPE_PREFIX_MAX];
+    int prefix_length;
+} envelope_op_t;
+
+typedef struct {
+    uint64_t ts; // milliseconds since the epoch
+    int rssi;    // dBm
+    bool rssi_valid;
+    uint8_t channel;
+    uint32_t seq;
+} envelope_values_t;
+
+envelope_op_t envelope_ops[ENVELOPE_FIELDS_MAX];
+int envelope_op_count = 0;
+
+static bool __envelope_op_add(const envelope_field_t field, const char *key, const size_t key_length) {
+    if (envelope_op_count >= ENVELOPE_FIELDS_MAX || key_length == 0 || key_length > ENVELOPE_KEY_MAX)
+        return false;
+    envelope_op_t *op = &envelope_ops[envelope_op_count];
+    op->field = field;
+    op->prefix_length = snprintf(op->prefix, sizeof(op->prefix), "%c\"%.*s\":", envelope_op_count == 0 ? '{' : ',', (int)key_length, key);
+    envelope_op_count++;
+    return true;
+}
+
+bool config_populate_envelope(const char *format) {
+    static const struct {
+        const char *name;
+        envelope_field_t field;
+    } fields[] = {
+        { "ts", ENVELOPE_FIELD_TS }, { "rssi", ENVELOPE_FIELD_RSSI }, { "ch", ENVELOPE_FIELD_CHANNEL }, { "channel", ENVELOPE_FIELD_CHANNEL }, { "seq", ENVELOPE_FIELD_SEQ }, { "data", ENVELOPE_FIELD_DATA },
+    };
+    envelope_op_count = 0;
+    if (!format || !*format)
+        return true;
+    bool have_data = false;
+    const char *p = format;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        const size_t length = end ? (size_t)(end - p) : strlen(p);
+        const char *rename = memchr(p, ':', length);
+        const size_t name_length = rename ? (size_t)(rename - p) : length;
+        const char *key = rename ? rename + 1 : p;
+        const size_t key_length = rename ? length - name_length - 1 : length;
+        int i;
+        for (i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++)
+            if (strlen(fields[i].name) == name_length && strncmp(fields[i].name, p, name_length) == 0)
+                break;
+        if (i == (int)(sizeof(fields) / sizeof(fields[0])) || !__envelope_op_add(fields[i].field, key, key_length)) {
+            fprintf(stderr, "config: invalid envelope field '%.*s'\n", (int)length, p);
+            envelope_op_count = 0;
+            return false;
+        }
+        have_data |= fields[i].field == ENVELOPE_FIELD_DATA;
+        p += length;
+        if (*p == ',')
+            p++;
+    }
+    if (!have_data)
+        __envelope_op_add(ENVELOPE_FIELD_DATA, "data", 4);
+    printf("config: envelope: ");
+    for (int i = 0; i < envelope_op_count; i++)
+        printf("%.*s", envelope_ops[i].prefix_length, envelope_ops[i].prefix);
+    printf("...}\n");
+    return true;
+}
+
+// builds the envelope around the packet (copied as is if JSON, else as '["' <DATA> '"]') directly into the output,
+// returning the size or -1 if it will not fit
+int packet_envelope_build(uint8_t *output, const int output_size, const uint8_t *packet, const int packet_size, const bool packet_convert, const envelope_values_t *values) {
+    if (ENVELOPE_OVERHEAD_MAX + (packet_convert ? 4 + packet_encoded_size(packet_encoding, packet_size) : packet_size) > output_size)
+        return -1;
+    uint8_t *p = output;
+    for (int i = 0; i < envelope_op_count; i++) {
+        const envelope_op_t *op = &envelope_ops[i];
+        memcpy(p, op->prefix, (size_t)op->prefix_length);
+        p += op->prefix_length;
+        switch (op->field) {
+        case ENVELOPE_FIELD_TS:
+            p = __packet_put_uint(p, values->ts);
+            break;
+        case ENVELOPE_FIELD_RSSI:
+            if (!values->rssi_valid) {
+                memcpy(p, "null", 4);
+                p += 4;
+                break;
+            }
+            if (values->rssi < 0)
+                *p++ = '-';
+            p = __packet_put_uint(p, (uint64_t)(values->rssi < 0 ? -values->rssi : values->rssi));
+            break;
+        case ENVELOPE_FIELD_CHANNEL:
+            p = __packet_put_uint(p, values->channel);
+            break;
+        case ENVELOPE_FIELD_SEQ:
+            p = __packet_put_uint(p, values->seq);
+            break;
+        case ENVELOPE_FIELD_DATA:
+        default:
+            if (packet_convert)
+                p = __packet_put_json_encoded(p, packet, packet_size);
+            else {
+                memcpy(p, packet, (size_t)packet_size);
+                p += packet_size;
+            }
+            break;
+        }
+    }
+    *p++ = '}';
+    return (int)(p - output);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
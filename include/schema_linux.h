@@ -0,0 +1,292 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// binary payload schemas decode the packets selected by a discriminator byte into named JSON fields, e.g.
+//
+//   schema.1.discriminator=A5 (the byte at offset 0, or 'A5@2' at offset 2; with none, the schema takes any packet)
+//   schema.1.fields=id:u16le@1, temp:i16be@3*0.01, battery:u8@5*0.02+2, alarm:bits@6.0, mode:bits@6.1-3, pressure:float16@7
+//
+// publishes '{"id":1001,"temp":21.5,...}' in place of the '["<hex>"]' conversion; field types are the filter field
+// types, float16 (or float16be) and bits@offset.low-high (from the little-endian bytes at the offset); the optional
+// scale and bias are applied in fixed point (millionths), so values have up to six decimal places, and float16 is
+// converted without floating point; each schema is compiled into a flat table of field ops with their '{"name":'
+// prefixes, checked at load against the largest output and the bytes it needs, so that decoding is one pass with no
+// per field checks
+
+#define SCHEMAS_MAX       16
+#define SCHEMA_FIELDS_MAX 24
+#define SCHEMA_NAME_MAX   24
+#define SCHEMA_PREFIX_MAX (SCHEMA_NAME_MAX + 4)
+#define SCHEMA_VALUE_MAX  28                                    // sign, 19 integer digits, point and 6 decimals
+#define SCHEMA_OUTPUT_MAX ((E22900T22_PACKET_MAXSIZE * 2) + 4) // as the json-convert output
+#define SCHEMA_UNIT       1000000
+
+typedef enum {
+    SCHEMA_FIELD_INTEGER = 0,
+    SCHEMA_FIELD_BITS,
+    SCHEMA_FIELD_FLOAT16LE,
+    SCHEMA_FIELD_FLOAT16BE,
+} schema_field_type_t;
+
+typedef struct {
+    schema_field_type_t type;
+    filter_code_t load;
+    int offset;
+    int bit_low;
+    uint32_t bit_mask;
+    bool scaled;
+    int64_t scale, bias; // millionths
+    char prefix[SCHEMA_PREFIX_MAX + 1]; // with the terminator, which is not copied
+    int prefix_length;
+} schema_field_t;
+
+typedef struct {
+    int discriminator_offset; // -1 for any packet
+    uint8_t discriminator;
+    int size_min; // bytes needed by the fields
+    schema_field_t fields[SCHEMA_FIELDS_MAX];
+    int field_count;
+} schema_t;
+
+schema_t schemas[SCHEMAS_MAX];
+int schema_count = 0;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static bool __schema_parse_fixed(const char **p, int64_t *value) {
+    const char *start = *p + (**p == '+' ? 1 : 0);
+    const size_t sign = start[0] == '-' ? 1 : 0, length = sign + strspn(start + sign, "0123456789.");
+    if (!json_number_parse((const uint8_t *)start, (int)length, value))
+        return false;
+    *p = start + length;
+    return true;
+}
+
+// name:type@offset[.low-high][*scale][+bias|-bias]
+static bool __schema_field_compile(schema_t *schema, const char *text, const size_t length) {
+    const char *end = text + length, *colon = memchr(text, ':', length), *at = memchr(text, '@', length);
+    if (schema->field_count == SCHEMA_FIELDS_MAX || colon == NULL || at == NULL || at < colon || colon == text || colon - text > SCHEMA_NAME_MAX)
+        return false;
+    schema_field_t *field = &schema->fields[schema->field_count];
+    memset(field, 0, sizeof(*field));
+    for (const char *c = text; c < colon; c++)
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-')
+            return false;
+    const char *type = colon + 1;
+    const size_t type_length = (size_t)(at - type);
+    int width = 2;
+    if (type_length == 7 && strncmp(type, "float16", 7) == 0)
+        field->type = SCHEMA_FIELD_FLOAT16LE;
+    else if (type_length == 9 && strncmp(type, "float16be", 9) == 0)
+        field->type = SCHEMA_FIELD_FLOAT16BE;
+    else if (type_length == 4 && strncmp(type, "bits", 4) == 0)
+        field->type = SCHEMA_FIELD_BITS;
+    else if (filter_field_lookup(type, type_length, &field->load, &width))
+        field->type = SCHEMA_FIELD_INTEGER;
+    else
+        return false;
+    const bool float16 = field->type == SCHEMA_FIELD_FLOAT16LE || field->type == SCHEMA_FIELD_FLOAT16BE;
+    char *number_end;
+    const long offset = strtol(at + 1, &number_end, 10);
+    if (number_end == at + 1 || offset < 0 || offset >= E22900T22_PACKET_MAXSIZE)
+        return false;
+    field->offset = (int)offset;
+    const char *p = number_end;
+    if (field->type == SCHEMA_FIELD_BITS) {
+        if (*p != '.')
+            return false;
+        const long low = strtol(p + 1, &number_end, 10);
+        long high = low;
+        if (number_end == p + 1)
+            return false;
+        p = number_end;
+        if (*p == '-') {
+            high = strtol(p + 1, &number_end, 10);
+            if (number_end == p + 1)
+                return false;
+            p = number_end;
+        }
+        if (low < 0 || high < low || high > 31)
+            return false;
+        width = high < 8 ? 1 : high < 16 ? 2 : 4;
+        field->load = width == 1 ? FILTER_LD_U8 : width == 2 ? FILTER_LD_U16LE : FILTER_LD_U32LE;
+        field->bit_low = (int)low;
+        field->bit_mask = (uint32_t)((1ULL << (high - low + 1)) - 1);
+    }
+    field->scale = SCHEMA_UNIT;
+    if (*p == '*') {
+        p++;
+        if (!__schema_parse_fixed(&p, &field->scale))
+            return false;
+        field->scaled = true;
+    }
+    if (*p == '+' || *p == '-') {
+        if (!__schema_parse_fixed(&p, &field->bias))
+            return false;
+        field->scaled = true;
+    }
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    if (p != end)
+        return false;
+    // the largest raw value (in millionths for float16) times the scale, plus the bias, must stay within int64
+    const int64_t raw_max = float16 ? 65504LL * SCHEMA_UNIT : field->type == SCHEMA_FIELD_BITS ? (int64_t)field->bit_mask : width == 1 ? 0xFF : width == 2 ? 0xFFFF : (int64_t)UINT32_MAX;
+    if (field->scale > (INT64_MAX / 4) / raw_max || field->scale < -(INT64_MAX / 4) / raw_max || field->bias > INT64_MAX / 4 || field->bias < -(INT64_MAX / 4))
+        return false;
+    field->scaled |= float16;
+    field->prefix_length = snprintf(field->prefix, sizeof(field->prefix), "%c\"%.*s\":", schema->field_count == 0 ? '{' : ',', (int)(colon - text), text);
+    if (field->offset + width > schema->size_min)
+        schema->size_min = field->offset + width;
+    schema->field_count++;
+    return true;
+}
+
+bool schema_compile(schema_t *schema, const char *discriminator, const char *fields) {
+    memset(schema, 0, sizeof(*schema));
+    schema->discriminator_offset = -1;
+    if (discriminator != NULL) {
+        char *end;
+        const unsigned long byte = strtoul(discriminator, &end, 16);
+        long offset = 0;
+        if (*end == '@') {
+            const char *digits = end + 1;
+            offset = strtol(digits, &end, 10);
+            if (end == digits)
+                offset = -1; // no offset after the '@'
+        }
+        if (end == discriminator || byte > 0xFF || *end != '\0' || offset < 0 || offset >= E22900T22_PACKET_MAXSIZE) {
+            fprintf(stderr, "config: schema: invalid discriminator '%s'\n", discriminator);
+            return false;
+        }
+        schema->discriminator = (uint8_t)byte;
+        schema->discriminator_offset = (int)offset;
+        schema->size_min = (int)offset + 1;
+    }
+    int output_max = 1;
+    const char *p = fields;
+    while (*p) {
+        while (isspace((unsigned char)*p))
+            p++;
+        const size_t length = strcspn(p, ",");
+        if (!__schema_field_compile(schema, p, length)) {
+            fprintf(stderr, "config: schema: invalid field '%.*s'\n", (int)length, p);
+            return false;
+        }
+        output_max += schema->fields[schema->field_count - 1].prefix_length + SCHEMA_VALUE_MAX;
+        p += length;
+        if (*p == ',')
+            p++;
+    }
+    if (schema->field_count == 0 || output_max > SCHEMA_OUTPUT_MAX) {
+        fprintf(stderr, "config: schema: %s\n", schema->field_count == 0 ? "no fields" : "too many fields for the output");
+        return false;
+    }
+    return true;
+}
+
+// returns false if any schema is invalid (each is reported, the valid ones still added), so that a reload can be refused
+bool config_populate_schemas(void) {
+    schema_count = 0;
+    bool valid = true;
+    int index_count;
+    int *indices = config_get_indices("schema.", ".fields", &index_count);
+    for (int i = 0; i < index_count; i++) {
+        const char *discriminator = config_get_indexed("schema", indices[i], "discriminator", NULL);
+        const char *fields = config_get_indexed("schema", indices[i], "fields", NULL);
+        if (schema_count == SCHEMAS_MAX) {
+            fprintf(stderr, "config: schema.%d: too many schemas (at most %d)\n", indices[i], SCHEMAS_MAX);
+            valid = false;
+        } else if (schema_compile(&schemas[schema_count], discriminator, fields)) {
+            printf("config: schema[%d]: discriminator='%s', fields=%d, size>=%d\n", schema_count, discriminator ? discriminator : "any", schemas[schema_count].field_count, schemas[schema_count].size_min);
+            schema_count++;
+        } else {
+            fprintf(stderr, "config: schema.%d: invalid schema\n", indices[i]);
+            valid = false;
+        }
+    }
+    free(indices);
+    return valid;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the first schema, in configuration order, for the packet, if it has the bytes for all of its fields
+const schema_t *schema_select(const uint8_t *packet, const int packet_size) {
+    for (int i = 0; i < schema_count; i++)
+        if (packet_size >= schemas[i].size_min && (schemas[i].discriminator_offset < 0 || packet[schemas[i].discriminator_offset] == schemas[i].discriminator))
+            return &schemas[i];
+    return NULL;
+}
+
+// IEEE 754 half precision as millionths, rounded to nearest
+static inline int64_t __schema_float16(const uint16_t half) {
+    const int exponent = (half >> 10) & 0x1F;
+    const int shift = (exponent ? exponent : 1) - 25; // value is mantissa * 2^(exponent - 25)
+    int64_t value = (int64_t)((half & 0x3FF) | (exponent ? 0x400 : 0)) * SCHEMA_UNIT;
+    value = shift >= 0 ? value << shift : (value + ((int64_t)1 << (-shift - 1))) >> -shift;
+    return (half & 0x8000) ? -value : value;
+}
+
+static inline uint8_t *__schema_put_fixed(uint8_t *output, const int64_t value) {
+    if (value < 0)
+        *output++ = '-';
+    const uint64_t magnitude = (uint64_t)(value < 0 ? -value : value);
+    output = __packet_put_uint(output, magnitude / SCHEMA_UNIT);
+    uint32_t fraction = (uint32_t)(magnitude % SCHEMA_UNIT);
+    if (fraction) {
+        int digits = 6;
+        for (; fraction % 10 == 0; digits--)
+            fraction /= 10;
+        *output++ = '.';
+        for (int d = digits - 1; d >= 0; d--, fraction /= 10)
+            output[d] = (uint8_t)('0' + (fraction % 10));
+        output += digits;
+    }
+    return output;
+}
+
+// decodes the packet, which must have been selected for the schema, returning the size of the JSON object
+int schema_decode(const schema_t *schema, const uint8_t *packet, uint8_t *output) {
+    uint8_t *p = output;
+    for (int i = 0; i < schema->field_count; i++) {
+        const schema_field_t *field = &schema->fields[i];
+        memcpy(p, field->prefix, SCHEMA_PREFIX_MAX); // whole, as the value allowance covers the rest
+        p += field->prefix_length;
+        int64_t value;
+        switch (field->type) {
+        case SCHEMA_FIELD_FLOAT16LE:
+        case SCHEMA_FIELD_FLOAT16BE: {
+            const uint16_t half = field->type == SCHEMA_FIELD_FLOAT16LE ? (uint16_t)(packet[field->offset] | (packet[field->offset + 1] << 8)) : (uint16_t)((packet[field->offset] << 8) | packet[field->offset + 1]);
+            if ((half & 0x7C00) == 0x7C00) { // infinity or nan
+                memcpy(p, "null", 4);
+                p += 4;
+                continue;
+            }
+            p = __schema_put_fixed(p, ((__schema_float16(half) * field->scale) / SCHEMA_UNIT) + field->bias);
+            continue;
+        }
+        case SCHEMA_FIELD_BITS:
+            value = (int64_t)(((uint32_t)__filter_decode((uint8_t)field->load, packet + field->offset) >> field->bit_low) & field->bit_mask);
+            break;
+        case SCHEMA_FIELD_INTEGER:
+        default:
+            value = __filter_decode((uint8_t)field->load, packet + field->offset);
+            break;
+        }
+        if (field->scaled)
+            p = __schema_put_fixed(p, (value * field->scale) + field->bias);
+        else {
+            if (value < 0)
+                *p++ = '-';
+            p = __packet_put_uint(p, (uint64_t)(value < 0 ? -value : value));
+        }
+    }
+    *p++ = '}';
+    return (int)(p - output);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -3,21 +3,40 @@
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
 #include <errno.h>
+#include <inttypes.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
+#include <sys/select.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+#ifndef TRACE_EVENT
+#define TRACE_EVENT(type, a, b, c, d) // unless the program includes trace_linux.h first
+#endif
+
 #define SERIAL_CONNECT_CHECK_PERIOD 5
 #define SERIAL_CONNECT_CHECK_PRINT  30
 
+// a frame ends after an idle gap, which starts as given (e.g. from the UART and air rates, by the device) and, when
+// adaptive, follows the gaps seen between bytes within frames: SERIAL_GAP_MARGIN times their 99.9th percentile, never
+// below the starting gap's floor nor above the 1st percentile of those between frames; gaps within and between frames are kept in log2 histograms of microseconds, halved as
+// they fill so that they follow the link rather than its history
+#define SERIAL_GAP_DEFAULT_US   100000 // until serial_gap_begin
+#define SERIAL_GAP_MIN_US       2000
+#define SERIAL_GAP_MAX_US       500000
+#define SERIAL_GAP_BUCKETS      24 // bucket b holds gaps below 2^(b+1) us, so up to about 16s, the last holding any longer
+#define SERIAL_GAP_MARGIN       3
+#define SERIAL_GAP_ADAPT_FRAMES 32
+#define SERIAL_GAP_DECAY        4096
+
 typedef enum {
     SERIAL_8N1 = 0,
 } serial_bits_t;
@@ -43,6 +62,18 @@ typedef struct {
 const serial_config_t *_serial_cfg;
 
 int serial_fd = -1;
+struct timespec serial_read_first; // when the last read saw its first byte
+
+typedef struct {
+    uint32_t gap_us, floor_us;
+    bool adaptive;
+    uint32_t frames, adaptations;
+    uint64_t last_us; // the last byte of the previous frame, 0 if none
+    uint32_t intra[SERIAL_GAP_BUCKETS], inter[SERIAL_GAP_BUCKETS];
+    uint32_t intra_count, inter_count;
+} serial_gap_t;
+
+serial_gap_t serial_gap = { .gap_us = SERIAL_GAP_DEFAULT_US, .floor_us = SERIAL_GAP_DEFAULT_US };
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -164,46 +195,214 @@ int serial_write(const uint8_t *buffer, const int length) {
     if (serial_fd < 0)
         return -1;
     usleep(50 * 1000); // yuck
-    return (int)write(serial_fd, buffer, (size_t)length);
+    const int result = (int)write(serial_fd, buffer, (size_t)length);
+    TRACE_EVENT(TRACE_SERIAL_WRITE, 0, 0, result, trace_bytes(buffer, length));
+    return result;
 }
 
 bool serial_write_all(const uint8_t *buffer, const int length) {
     return serial_write(buffer, length) == length;
 }
 
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t __serial_timespec_us(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000ULL + (uint64_t)ts->tv_nsec / 1000ULL;
+}
+
+static inline int serial_gap_bucket(const uint64_t gap_us) {
+    const int bucket = gap_us < 2 ? 0 : (63 - __builtin_clzll(gap_us));
+    return bucket < SERIAL_GAP_BUCKETS ? bucket : SERIAL_GAP_BUCKETS - 1;
+}
+
+static inline void __serial_gap_record(uint32_t *histogram, uint32_t *count, const uint64_t gap_us) {
+    histogram[serial_gap_bucket(gap_us)]++;
+    if (++*count >= SERIAL_GAP_DECAY) {
+        *count = 0;
+        for (int bucket = 0; bucket < SERIAL_GAP_BUCKETS; bucket++)
+            *count += (histogram[bucket] /= 2);
+    }
+}
+
+// the upper bound of the bucket at or below which permille/1000 of the gaps fall, or 0 if there are none
+static uint64_t serial_gap_quantile(const uint32_t *histogram, const uint32_t permille) {
+    uint64_t total = 0, seen = 0;
+    for (int bucket = 0; bucket < SERIAL_GAP_BUCKETS; bucket++)
+        total += histogram[bucket];
+    if (total == 0)
+        return 0;
+    const uint64_t rank = ((total * permille) + 999) / 1000;
+    for (int bucket = 0; bucket < SERIAL_GAP_BUCKETS; bucket++)
+        if ((seen += histogram[bucket]) >= (rank > 0 ? rank : 1))
+            return ((uint64_t)2 << bucket) - 1;
+    return 0;
+}
+
+void serial_gap_begin(const uint32_t gap_us, const bool adaptive) {
+    const uint32_t bounded_us = gap_us < SERIAL_GAP_MIN_US ? SERIAL_GAP_MIN_US : gap_us > SERIAL_GAP_MAX_US ? SERIAL_GAP_MAX_US : gap_us;
+    memset(&serial_gap, 0, sizeof(serial_gap));
+    serial_gap.gap_us = serial_gap.floor_us = bounded_us;
+    serial_gap.adaptive = adaptive;
+    PRINTF_INFO("serial: frame gap: %" PRIu32 "us (%s)\n", bounded_us, adaptive ? "adaptive" : "fixed");
+}
+
+// the highest gap that is still below the shortest gaps between frames, as the bucket below that of their 1st
+// percentile, or 0 until there are any
+static inline uint64_t __serial_gap_inter_cap(void) {
+    return serial_gap_quantile(serial_gap.inter, 10) / 2;
+}
+
+// not until a gap between frames has been seen, so that the first frames cannot raise it past them before the cap
+static void __serial_gap_adapt(void) {
+    const uint64_t intra_us = serial_gap_quantile(serial_gap.intra, 999), cap_us = __serial_gap_inter_cap();
+    if (intra_us == 0 || cap_us == 0)
+        return;
+    const uint64_t target_us = intra_us * SERIAL_GAP_MARGIN > cap_us ? cap_us : intra_us * SERIAL_GAP_MARGIN;
+    const uint32_t bounded_us = target_us < serial_gap.floor_us ? serial_gap.floor_us : target_us > SERIAL_GAP_MAX_US ? SERIAL_GAP_MAX_US : (uint32_t)target_us;
+    const uint32_t gap_us = (serial_gap.gap_us + bounded_us) / 2; // halfway, as the buckets are coarse
+    if (gap_us != serial_gap.gap_us) {
+        PRINTF_DEBUG("serial: frame gap: %" PRIu32 "us -> %" PRIu32 "us (intra p999 < %" PRIu64 "us)\n", serial_gap.gap_us, gap_us, intra_us + 1);
+        serial_gap.gap_us = gap_us;
+        serial_gap.adaptations++;
+    }
+}
+
+// of each frame, the gap from the previous frame (the bytes' gaps are recorded as they are read); a read that filled
+// its buffer is continued by the next, so that is not a gap between frames. A gap of less than twice the threshold is
+// taken as a frame that was split, and counted within frames instead, as otherwise a threshold below the gaps within
+// frames would only ever see the smaller of them; but not above the cap from the gaps between frames, as the window
+// grows with the threshold, and would otherwise take in closely spaced frames and raise the threshold past them
+static void __serial_gap_frame(const uint64_t first_us, const uint64_t last_us, const bool complete) {
+    if (serial_gap.last_us > 0 && first_us > serial_gap.last_us) {
+        const uint64_t gap_us = first_us - serial_gap.last_us, cap_us = __serial_gap_inter_cap();
+        if (gap_us < (uint64_t)serial_gap.gap_us * 2 && (cap_us == 0 || gap_us <= cap_us))
+            __serial_gap_record(serial_gap.intra, &serial_gap.intra_count, gap_us);
+        else
+            __serial_gap_record(serial_gap.inter, &serial_gap.inter_count, gap_us);
+    }
+    serial_gap.last_us = complete ? last_us : 0;
+    if (serial_gap.adaptive && (++serial_gap.frames <= SERIAL_GAP_ADAPT_FRAMES || serial_gap.frames % SERIAL_GAP_ADAPT_FRAMES == 0)) // each frame at first
+        __serial_gap_adapt();
+}
+
+static void __serial_gap_histogram_display(const char *name, const uint32_t *histogram) {
+    PRINTF_INFO("serial: frame gap: %s:", name);
+    for (int bucket = 0; bucket < SERIAL_GAP_BUCKETS; bucket++)
+        if (histogram[bucket] > 0)
+            PRINTF_INFO(" <%" PRIu64 "us=%" PRIu32, (uint64_t)2 << bucket, histogram[bucket]);
+    PRINTF_INFO("\n");
+}
+
+void serial_gap_display(void) {
+    PRINTF_INFO("serial: frame gap: %" PRIu32 "us (%s, floor=%" PRIu32 "us, adaptations=%" PRIu32 ", intra-p999<%" PRIu64 "us, inter-p1<%" PRIu64 "us)\n", serial_gap.gap_us, serial_gap.adaptive ? "adaptive" : "fixed", serial_gap.floor_us,
+                serial_gap.adaptations, serial_gap_quantile(serial_gap.intra, 999) + 1, serial_gap_quantile(serial_gap.inter, 10) + 1);
+    __serial_gap_histogram_display("intra", serial_gap.intra);
+    __serial_gap_histogram_display("inter", serial_gap.inter);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// other descriptors (e.g. the mqtt client's sockets) waited on with the serial port for its first byte, so that a single
+// thread can drive both: add puts them into the sets, returning the new nfds, and may shorten the wait (for their timers);
+// service is then called with the ready sets, or empty sets on a timeout; not used within a frame, as the gap must hold
+#define SERIAL_WAIT_STEP_MAX_MS 1000
+
+typedef struct {
+    int (*add)(fd_set *rdset, fd_set *wrset, int nfds, uint32_t *timeout_ms);
+    void (*service)(const fd_set *rdset, const fd_set *wrset);
+} serial_poll_hook_t;
+
+serial_poll_hook_t serial_poll_hook = { .add = NULL, .service = NULL };
+
+static int __serial_wait_first(const uint32_t timeout_ms) {
+    fd_set rdset, wrset;
+    struct timeval tv;
+    if (serial_poll_hook.add == NULL) {
+        FD_ZERO(&rdset);
+        FD_SET(serial_fd, &rdset);
+        tv.tv_sec = (time_t)timeout_ms / 1000;
+        tv.tv_usec = (time_t)(timeout_ms % 1000) * 1000;
+        return select(serial_fd + 1, &rdset, NULL, NULL, &tv);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_us = __serial_timespec_us(&ts);
+    const uint64_t until_us = now_us + (uint64_t)timeout_ms * 1000;
+    for (;;) {
+        FD_ZERO(&rdset);
+        FD_ZERO(&wrset);
+        FD_SET(serial_fd, &rdset);
+        const uint64_t remaining_ms = until_us > now_us ? (until_us - now_us + 999) / 1000 : 0;
+        uint32_t wait_ms = remaining_ms < SERIAL_WAIT_STEP_MAX_MS ? (uint32_t)remaining_ms : SERIAL_WAIT_STEP_MAX_MS;
+        const int nfds = serial_poll_hook.add(&rdset, &wrset, serial_fd + 1, &wait_ms);
+        tv.tv_sec = (time_t)wait_ms / 1000;
+        tv.tv_usec = (time_t)(wait_ms % 1000) * 1000;
+        const int result = select(nfds, &rdset, &wrset, NULL, &tv);
+        if (result < 0)
+            return result;
+        if (result == 0) {
+            FD_ZERO(&rdset);
+            FD_ZERO(&wrset);
+        }
+        serial_poll_hook.service(&rdset, &wrset);
+        if (FD_ISSET(serial_fd, &rdset))
+            return 1;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if ((now_us = __serial_timespec_us(&ts)) >= until_us)
+            return 0;
+    }
+}
+
 int serial_read(uint8_t *buffer, const int length, const uint32_t timeout_ms) {
     if (serial_fd < 0)
         return -1;
     usleep(50 * 1000); // yuck
     fd_set rdset;
     struct timeval tv;
-    FD_ZERO(&rdset);
-    FD_SET(serial_fd, &rdset);
-    tv.tv_sec = (time_t)timeout_ms / 1000;
-    tv.tv_usec = (time_t)(timeout_ms % 1000) * 1000;
-    const int select_result = select(serial_fd + 1, &rdset, NULL, NULL, &tv);
-    if (select_result <= 0)
+    TRACE_EVENT(TRACE_SERIAL_READ_BEGIN, 0, 0, timeout_ms, length);
+    const int select_result = __serial_wait_first(timeout_ms);
+    if (select_result <= 0) {
+        TRACE_EVENT(TRACE_SERIAL_READ_END, 0, 0, select_result, 0);
         return select_result; // timeout or error
+    }
+    clock_gettime(CLOCK_MONOTONIC, &serial_read_first);
+    const uint32_t gap_us = serial_gap.gap_us;
+    const uint64_t first_us = __serial_timespec_us(&serial_read_first);
+    uint64_t byte_us = first_us;
+    struct timespec ts;
     int bytes_read = 0;
     uint8_t byte;
     bool buffer_complete = false;
     while (bytes_read < length) {
         FD_ZERO(&rdset);
         FD_SET(serial_fd, &rdset);
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000;
-        if (select(serial_fd + 1, &rdset, NULL, NULL, &tv) <= 0) {
+        tv.tv_sec = (time_t)(gap_us / 1000000);
+        tv.tv_usec = (suseconds_t)(gap_us % 1000000);
+        int gap_result;
+        while ((gap_result = select(serial_fd + 1, &rdset, NULL, NULL, &tv)) < 0 && errno == EINTR)
+            ; // a signal (e.g. SIGUSR1) must not end the packet early; linux leaves the remaining time in tv
+        if (gap_result <= 0) {
             buffer_complete = true;
             break;
         }
         if (read(serial_fd, &byte, 1) != 1)
             break;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        const uint64_t now_us = __serial_timespec_us(&ts);
+        if (bytes_read > 0)
+            __serial_gap_record(serial_gap.intra, &serial_gap.intra_count, now_us - byte_us);
+        byte_us = now_us;
         buffer[bytes_read++] = byte;
     }
+    __serial_gap_frame(first_us, byte_us, buffer_complete);
     if (!buffer_complete && bytes_read > length) {
         PRINTF_ERROR("device: buffer_read: buffer too large (max %d bytes, read %d bytes)\n", length, bytes_read);
+        TRACE_EVENT(TRACE_SERIAL_READ_END, 0, 0, -1, trace_bytes(buffer, bytes_read));
         return -1;
     }
+    TRACE_EVENT(TRACE_SERIAL_READ_END, buffer_complete, 0, bytes_read, trace_bytes(buffer, bytes_read));
     return bytes_read;
 }
 
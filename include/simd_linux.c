@@ -0,0 +1,160 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * Vector kernels, built separately from the -mno-sse main build; see simd_linux.h
+ */
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "simd_linux.h"
+
+#if SIMD_X86
+
+#include <immintrin.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+__attribute__((target("sse2"))) static inline uint16_t __simd_mask_sse2(const __m128i v, const char c) {
+    return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+__attribute__((target("sse2"))) void simd_json_classify_sse2(const uint8_t *block, simd_json_masks_t *masks) {
+    masks->quote = masks->backslash = masks->structural = masks->whitespace = 0;
+    for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(block + (i * 16)));
+        const unsigned shift = (unsigned)(i * 16);
+        masks->quote |= (uint64_t)__simd_mask_sse2(v, '"') << shift;
+        masks->backslash |= (uint64_t)__simd_mask_sse2(v, '\\') << shift;
+        masks->structural |= (uint64_t)(uint16_t)(__simd_mask_sse2(v, '{') | __simd_mask_sse2(v, '}') | __simd_mask_sse2(v, '[') | __simd_mask_sse2(v, ']') | __simd_mask_sse2(v, ':') | __simd_mask_sse2(v, ','))
+                              << shift;
+        masks->whitespace |= (uint64_t)(uint16_t)(__simd_mask_sse2(v, ' ') | __simd_mask_sse2(v, '\t') | __simd_mask_sse2(v, '\n') | __simd_mask_sse2(v, '\r')) << shift;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// structural and whitespace bytes are classified with two nibble lookups (as in simdjson) rather than one compare each:
+// the low and high nibble tables give a bit per class, and a byte is in a class when both nibbles agree on it
+
+#define __SIMD_CLASS_STRUCTURAL_BRACE 0x01 // { } [ ] are 0x7B 0x7D 0x5B 0x5D
+#define __SIMD_CLASS_STRUCTURAL_COLON 0x02 // : is 0x3A
+#define __SIMD_CLASS_WHITESPACE_CTRL  0x04 // tab lf cr are 0x09 0x0A 0x0D
+#define __SIMD_CLASS_WHITESPACE_SPACE 0x08 // space is 0x20
+#define __SIMD_CLASS_STRUCTURAL_COMMA 0x10 // , is 0x2C
+
+__attribute__((target("avx2"))) void simd_json_classify_avx2(const uint8_t *block, simd_json_masks_t *masks) {
+    const __m256i table_low = _mm256_setr_epi8(0x08, 0, 0, 0, 0, 0, 0, 0, 0, 0x04, 0x06, 0x01, 0x10, 0x05, 0, 0, 0x08, 0, 0, 0, 0, 0, 0, 0, 0, 0x04, 0x06, 0x01, 0x10, 0x05, 0, 0);
+    const __m256i table_high = _mm256_setr_epi8(0x04, 0, 0x18, 0x02, 0, 0x01, 0, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0x04, 0, 0x18, 0x02, 0, 0x01, 0, 0x01, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0F), zero = _mm256_setzero_si256();
+    const __m256i structural_bits = _mm256_set1_epi8(__SIMD_CLASS_STRUCTURAL_BRACE | __SIMD_CLASS_STRUCTURAL_COLON | __SIMD_CLASS_STRUCTURAL_COMMA);
+    const __m256i whitespace_bits = _mm256_set1_epi8(__SIMD_CLASS_WHITESPACE_CTRL | __SIMD_CLASS_WHITESPACE_SPACE);
+    masks->quote = masks->backslash = masks->structural = masks->whitespace = 0;
+    for (int i = 0; i < 2; i++) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(block + (i * 32)));
+        const unsigned shift = (unsigned)(i * 32);
+        const __m256i classes = _mm256_and_si256(_mm256_shuffle_epi8(table_low, _mm256_and_si256(v, nibble)), _mm256_shuffle_epi8(table_high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+        masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << shift;
+        masks->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << shift;
+        masks->structural |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(classes, structural_bits), zero)) << shift;
+        masks->whitespace |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(classes, whitespace_bits), zero)) << shift;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// nibbles to lowercase hex by arithmetic, as SSE2 has no byte shuffle: '0' + n, plus 39 more for n > 9
+__attribute__((target("sse2"))) static inline __m128i __simd_hex_ascii_sse2(const __m128i nibbles) {
+    return _mm_add_epi8(nibbles, _mm_add_epi8(_mm_set1_epi8('0'), _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10))));
+}
+
+__attribute__((target("sse2"))) int simd_hex_encode_sse2(const uint8_t *data, const int length, uint8_t *output) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    int i = 0;
+    for (; i + 16 <= length; i += 16, output += 32) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+        const __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), nibble), low = _mm_and_si128(v, nibble);
+        _mm_storeu_si128((__m128i *)(void *)output, __simd_hex_ascii_sse2(_mm_unpacklo_epi8(high, low)));
+        _mm_storeu_si128((__m128i *)(void *)(output + 16), __simd_hex_ascii_sse2(_mm_unpackhi_epi8(high, low)));
+    }
+    return i;
+}
+
+// each byte is widened to 16 bits and split into its nibbles, high in the low byte so they store in order, and the
+// nibbles are mapped to hex digits with one shuffle
+__attribute__((target("avx2"))) int simd_hex_encode_avx2(const uint8_t *data, const int length, uint8_t *output) {
+    const __m256i digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i nibble = _mm256_set1_epi16(0x0F);
+    int i = 0;
+    for (; i + 16 <= length; i += 16, output += 32) {
+        const __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(const void *)(data + i)));
+        const __m256i nibbles = _mm256_or_si256(_mm256_srli_epi16(v, 4), _mm256_slli_epi16(_mm256_and_si256(v, nibble), 8));
+        _mm256_storeu_si256((__m256i *)(void *)output, _mm256_shuffle_epi8(digits, nibbles));
+    }
+    return i;
+}
+
+// base64 as in Mula and Lemire, "Faster Base64 Encoding and Decoding using AVX2 Instructions": 24 bytes are spread to
+// 3 bytes per 32 bit lane, the four 6 bit indices are moved into bytes with a multiply high and low, and the indices
+// are mapped to the alphabet by adding a per range offset found with one shuffle
+__attribute__((target("avx2"))) int simd_base64_encode_avx2(const uint8_t *data, const int length, uint8_t *output) {
+    const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    int i = 0;
+    for (; i + 28 <= length; i += 24, output += 32) {
+        const __m256i v = _mm256_shuffle_epi8(
+            _mm256_set_m128i(_mm_loadu_si128((const __m128i *)(const void *)(data + i + 12)), _mm_loadu_si128((const __m128i *)(const void *)(data + i))), spread);
+        const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        const __m256i low = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(high, low);
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *)(void *)output, _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+    }
+    return i;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// plain string bytes are 0x20 to 0x7F less the quote and backslash: a signed compare against 0x1F rejects both the
+// control bytes and the bytes with the top bit set (UTF-8), which the caller validates
+
+__attribute__((target("sse2"))) int simd_json_string_span_sse2(const uint8_t *data, const int length) {
+    const __m128i control = _mm_set1_epi8(0x1F), quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+        const __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        const unsigned plain = (unsigned)_mm_movemask_epi8(_mm_andnot_si128(special, _mm_cmpgt_epi8(v, control)));
+        if (plain != 0xFFFF)
+            return i + __builtin_ctz(~plain);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) int simd_json_string_span_avx2(const uint8_t *data, const int length) {
+    const __m256i control = _mm256_set1_epi8(0x1F), quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(data + i));
+        const __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        const uint32_t plain = (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(special, _mm256_cmpgt_epi8(v, control)));
+        if (plain != 0xFFFFFFFF)
+            return i + __builtin_ctz(~plain);
+    }
+    return i;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
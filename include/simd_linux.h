@@ -0,0 +1,86 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// vector kernels live in simd_linux.c, which is built as a separate object without the -mno-sse/-mno-mmx restrictions
+// of the main build; the interfaces here only pass pointers and integers, so the two kinds of object link safely, and
+// callers pick a kernel at runtime with simd_supports()
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+typedef enum {
+    SIMD_LEVEL_SCALAR = 0,
+    SIMD_LEVEL_SSE2 = 1,
+    SIMD_LEVEL_AVX2 = 2,
+} simd_level_t;
+
+// per 64-byte block, bit N is set if byte N is the given class
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t structural; // { } [ ] : ,
+    uint64_t whitespace; // space, tab, cr, lf
+} simd_json_masks_t;
+
+#if SIMD_X86
+void simd_json_classify_sse2(const uint8_t *block, simd_json_masks_t *masks);
+void simd_json_classify_avx2(const uint8_t *block, simd_json_masks_t *masks);
+// encoders take whole blocks from the data, returning how many bytes they encoded and leaving the rest to the caller
+int simd_hex_encode_sse2(const uint8_t *data, const int length, uint8_t *output);    // 16 byte blocks
+int simd_hex_encode_avx2(const uint8_t *data, const int length, uint8_t *output);    // 16 byte blocks
+int simd_base64_encode_avx2(const uint8_t *data, const int length, uint8_t *output); // 24 byte blocks, reading 4 bytes beyond each
+// returns the length of the leading run of plain JSON string bytes in whole blocks, stopping at the first other byte
+int simd_json_string_span_sse2(const uint8_t *data, const int length); // 16 byte blocks
+int simd_json_string_span_avx2(const uint8_t *data, const int length); // 32 byte blocks
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline bool simd_supports(const simd_level_t level) {
+    switch (level) {
+    case SIMD_LEVEL_SCALAR:
+        return true;
+#if SIMD_X86
+    case SIMD_LEVEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SIMD_LEVEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+static inline const char *simd_level_tostring(const simd_level_t level) {
+    switch (level) {
+    case SIMD_LEVEL_SSE2:
+        return "sse2";
+    case SIMD_LEVEL_AVX2:
+        return "avx2";
+    case SIMD_LEVEL_SCALAR:
+    default:
+        return "scalar";
+    }
+}
+
+static inline simd_level_t simd_level_parse(const char *level) {
+    if (level != NULL && strcmp(level, "scalar") == 0)
+        return SIMD_LEVEL_SCALAR;
+    else if (level != NULL && strcmp(level, "sse2") == 0)
+        return SIMD_LEVEL_SSE2;
+    else if (level != NULL && strcmp(level, "avx2") == 0)
+        return SIMD_LEVEL_AVX2;
+    return simd_supports(SIMD_LEVEL_AVX2) ? SIMD_LEVEL_AVX2 : simd_supports(SIMD_LEVEL_SSE2) ? SIMD_LEVEL_SSE2 : SIMD_LEVEL_SCALAR;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
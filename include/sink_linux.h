@@ -0,0 +1,428 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define SINK_MAX                       8
+#define SINK_UDP_TTL_DEFAULT           1
+#define SINK_FILE_BATCH_ENTRIES        64
+#define SINK_FILE_BATCH_BYTES          (64 * 1024)
+#define SINK_FILE_FLUSH_MS             1000
+#define SINK_FILE_ROTATE_SIZE_DEFAULT  (16 * 1024 * 1024)
+#define SINK_FILE_ROTATE_COUNT_DEFAULT 3
+
+typedef struct {
+    const char *unix_path;
+    const char *udp_address;
+    int udp_ttl;
+    const char *file_path;
+    int file_rotate_size, file_rotate_count;
+} sink_config_t;
+
+typedef struct {
+    const char *name;
+    bool (*begin)(const sink_config_t *config); // returns false if not configured
+    bool (*send)(const char *topic, const uint8_t *data, const int length);
+    void (*poll)(void);
+    void (*end)(void);
+    bool active;
+    uint32_t sent, failed;
+    char metric_labels[24];
+    int metric_sent, metric_failed;
+} sink_t;
+
+sink_t *sinks[SINK_MAX];
+int sink_count = 0;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// every sink delivers the same record, one NDJSON line: {"ts":<ms>,"topic":"<escaped>","data":<the packet if it is
+// JSON, else ["<hex>"]>}, as a datagram for the socket sinks (which share a buffer, as sinks are only sent to from the
+// main thread) and as a line of the file
+
+#define SINK_RECORD_MAX 2048 // for the socket sinks, enough for a 240 byte packet in hex and a 128 character topic
+
+char __sink_record[SINK_RECORD_MAX];
+
+// worst case: prefix with topic (escaped, up to 6 bytes a character), hex-wrapped payload, suffix
+static inline size_t __sink_record_max(const char *topic, const int length) {
+    return 64 + (strlen(topic) * 6) + 4 + ((size_t)length * 2) + 2;
+}
+
+// into at least __sink_record_max() bytes, returning the length
+static size_t __sink_record_format(char *record, const size_t record_max, const char *topic, const uint8_t *data, const int length) {
+    char *p = record;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    p += snprintf(p, record_max, "{\"ts\":%" PRIu64 ",\"topic\":\"", (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+    p += json_string_escape(p, (int)(record_max - (size_t)(p - record)), topic); // fits, by record_max
+    p += snprintf(p, record_max - (size_t)(p - record), "\",\"data\":");
+    if (json_validate(data, length)) {
+        memcpy(p, data, (size_t)length);
+        p += length;
+    } else {
+        *p++ = '[';
+        *p++ = '"';
+        for (int i = 0; i < length; i++) {
+            *p++ = "0123456789abcdef"[data[i] >> 4];
+            *p++ = "0123456789abcdef"[data[i] & 0x0f];
+        }
+        *p++ = '"';
+        *p++ = ']';
+    }
+    *p++ = '}';
+    *p++ = '\n';
+    return (size_t)(p - record);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+int __sink_unix_fd = -1;
+struct sockaddr_un __sink_unix_addr;
+bool __sink_unix_reachable = true;
+
+bool __sink_unix_begin(const sink_config_t *config) {
+    if (!config->unix_path || !*config->unix_path)
+        return false;
+    if (strlen(config->unix_path) >= sizeof(__sink_unix_addr.sun_path)) {
+        fprintf(stderr, "sink: unix: path too long '%s'\n", config->unix_path);
+        return false;
+    }
+    if ((__sink_unix_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        fprintf(stderr, "sink: unix: error creating socket: %s\n", strerror(errno));
+        return false;
+    }
+    memset(&__sink_unix_addr, 0, sizeof(__sink_unix_addr));
+    __sink_unix_addr.sun_family = AF_UNIX;
+    strcpy(__sink_unix_addr.sun_path, config->unix_path);
+    printf("sink: unix: sending to '%s'\n", config->unix_path);
+    return true;
+}
+
+bool __sink_unix_send(const char *topic, const uint8_t *data, const int length) {
+    const size_t record_max = __sink_record_max(topic, length);
+    if (record_max > sizeof(__sink_record))
+        return false;
+    const size_t record_length = __sink_record_format(__sink_record, record_max, topic, data, length);
+    if (sendto(__sink_unix_fd, __sink_record, record_length, MSG_DONTWAIT | MSG_NOSIGNAL, (const struct sockaddr *)&__sink_unix_addr, sizeof(__sink_unix_addr)) == (ssize_t)record_length) {
+        if (!__sink_unix_reachable)
+            printf("sink: unix: receiver available\n");
+        __sink_unix_reachable = true;
+        return true;
+    }
+    // a missing or slow receiver must not stall the gateway, so report only the transition
+    if (__sink_unix_reachable)
+        fprintf(stderr, "sink: unix: receiver unavailable: %s\n", strerror(errno));
+    __sink_unix_reachable = false;
+    return false;
+}
+
+void __sink_unix_end(void) {
+    if (__sink_unix_fd >= 0)
+        close(__sink_unix_fd);
+    __sink_unix_fd = -1;
+}
+
+sink_t sink_unix = { .name = "unix", .begin = __sink_unix_begin, .send = __sink_unix_send, .poll = NULL, .end = __sink_unix_end };
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+int __sink_udp_fd = -1;
+
+bool __sink_udp_begin(const sink_config_t *config) {
+    if (!config->udp_address || !*config->udp_address)
+        return false;
+    char host[CONFIG_MAX_STRING];
+    strncpy(host, config->udp_address, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    char *port = strrchr(host, ':');
+    if (!port) {
+        fprintf(stderr, "sink: udp: address '%s' is not host:port\n", config->udp_address);
+        return false;
+    }
+    *port++ = '\0';
+    if (host[0] == '[' && port - host > 2 && port[-2] == ']') { // [ipv6]:port
+        memmove(host, host + 1, (size_t)(port - host - 3));
+        port[-3] = '\0';
+    }
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int error;
+    if ((error = getaddrinfo(host, port, &hints, &result)) != 0) {
+        fprintf(stderr, "sink: udp: error resolving '%s': %s\n", config->udp_address, gai_strerror(error));
+        return false;
+    }
+    if ((__sink_udp_fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol)) < 0) {
+        fprintf(stderr, "sink: udp: error creating socket: %s\n", strerror(errno));
+        freeaddrinfo(result);
+        return false;
+    }
+    const int ttl = config->udp_ttl > 0 ? config->udp_ttl : SINK_UDP_TTL_DEFAULT;
+    bool multicast = false;
+    if (result->ai_family == AF_INET && IN_MULTICAST(ntohl(((const struct sockaddr_in *)(const void *)result->ai_addr)->sin_addr.s_addr))) {
+        multicast = true;
+        setsockopt(__sink_udp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    } else if (result->ai_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)(const void *)result->ai_addr)->sin6_addr)) {
+        multicast = true;
+        setsockopt(__sink_udp_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+    }
+    if (connect(__sink_udp_fd, result->ai_addr, result->ai_addrlen) < 0) {
+        fprintf(stderr, "sink: udp: error connecting to '%s': %s\n", config->udp_address, strerror(errno));
+        freeaddrinfo(result);
+        close(__sink_udp_fd);
+        __sink_udp_fd = -1;
+        return false;
+    }
+    freeaddrinfo(result);
+    printf("sink: udp: sending to '%s' (%s, ttl=%d)\n", config->udp_address, multicast ? "multicast" : "unicast", ttl);
+    return true;
+}
+
+bool __sink_udp_send(const char *topic, const uint8_t *data, const int length) {
+    const size_t record_max = __sink_record_max(topic, length);
+    if (record_max > sizeof(__sink_record))
+        return false;
+    const size_t record_length = __sink_record_format(__sink_record, record_max, topic, data, length);
+    return send(__sink_udp_fd, __sink_record, record_length, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)record_length;
+}
+
+void __sink_udp_end(void) {
+    if (__sink_udp_fd >= 0)
+        close(__sink_udp_fd);
+    __sink_udp_fd = -1;
+}
+
+sink_t sink_udp = { .name = "udp", .begin = __sink_udp_begin, .send = __sink_udp_send, .poll = NULL, .end = __sink_udp_end };
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// records are formatted into the batch buffer, one iovec each, and written with a single writev() when
+// the batch fills or ages out; rotation renames path -> path.1 -> ... -> path.N. If the file cannot be opened again
+// after rotating (e.g. the directory is briefly unwritable), each flush tries again, the batch being dropped until then
+
+int __sink_file_fd = -1;
+const char *__sink_file_path = NULL;
+off_t __sink_file_size = 0, __sink_file_rotate_size;
+int __sink_file_rotate_count;
+char __sink_file_batch[SINK_FILE_BATCH_BYTES];
+size_t __sink_file_batch_used = 0;
+struct iovec __sink_file_iov[SINK_FILE_BATCH_ENTRIES];
+int __sink_file_iov_count = 0;
+uint64_t __sink_file_batch_first_us = 0;
+bool __sink_file_openable = true;
+
+// as for the unix sink, only the transition is reported, as a failed open is retried on each flush
+bool __sink_file_open(void) {
+    if ((__sink_file_fd = open(__sink_file_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        if (__sink_file_openable)
+            fprintf(stderr, "sink: file: error opening '%s': %s\n", __sink_file_path, strerror(errno));
+        __sink_file_openable = false;
+        return false;
+    }
+    if (!__sink_file_openable)
+        printf("sink: file: reopened '%s'\n", __sink_file_path);
+    __sink_file_openable = true;
+    struct stat st;
+    __sink_file_size = fstat(__sink_file_fd, &st) == 0 ? st.st_size : 0;
+    return true;
+}
+
+void __sink_file_rotate(void) {
+    char path_from[CONFIG_MAX_STRING + 8], path_to[CONFIG_MAX_STRING + 8];
+    close(__sink_file_fd);
+    __sink_file_fd = -1;
+    for (int i = __sink_file_rotate_count - 1; i >= 1; i--) {
+        snprintf(path_from, sizeof(path_from), "%s.%d", __sink_file_path, i);
+        snprintf(path_to, sizeof(path_to), "%s.%d", __sink_file_path, i + 1);
+        rename(path_from, path_to);
+    }
+    snprintf(path_to, sizeof(path_to), "%s.1", __sink_file_path);
+    if (__sink_file_rotate_count > 0)
+        rename(__sink_file_path, path_to);
+    else
+        unlink(__sink_file_path);
+    __sink_file_open();
+}
+
+bool __sink_file_flush(void) {
+    if (__sink_file_iov_count == 0)
+        return true;
+    if (__sink_file_fd < 0)
+        __sink_file_open();
+    if (__sink_file_fd >= 0 && __sink_file_size + (off_t)__sink_file_batch_used > __sink_file_rotate_size && __sink_file_size > 0)
+        __sink_file_rotate();
+    bool result = __sink_file_fd >= 0;
+    struct iovec *iov = __sink_file_iov;
+    int iov_count = __sink_file_iov_count;
+    while (result && iov_count > 0) {
+        const ssize_t written = writev(__sink_file_fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "sink: file: error writing '%s': %s\n", __sink_file_path, strerror(errno));
+            result = false;
+            break;
+        }
+        __sink_file_size += written;
+        size_t remaining = (size_t)written;
+        while (iov_count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    __sink_file_iov_count = 0;
+    __sink_file_batch_used = 0;
+    return result;
+}
+
+bool __sink_file_begin(const sink_config_t *config) {
+    if (!config->file_path || !*config->file_path)
+        return false;
+    __sink_file_path = config->file_path;
+    __sink_file_rotate_size = config->file_rotate_size > 0 ? config->file_rotate_size : SINK_FILE_ROTATE_SIZE_DEFAULT;
+    __sink_file_rotate_count = config->file_rotate_count >= 0 ? config->file_rotate_count : SINK_FILE_ROTATE_COUNT_DEFAULT;
+    __sink_file_openable = true;
+    if (!__sink_file_open())
+        return false;
+    printf("sink: file: writing to '%s' (rotate-size=%" PRIu32 ", rotate-count=%d)\n", __sink_file_path, (uint32_t)__sink_file_rotate_size, __sink_file_rotate_count);
+    return true;
+}
+
+bool __sink_file_send(const char *topic, const uint8_t *data, const int length) {
+    const size_t record_max = __sink_record_max(topic, length);
+    if (record_max > sizeof(__sink_file_batch))
+        return false;
+    if (__sink_file_iov_count == SINK_FILE_BATCH_ENTRIES || __sink_file_batch_used + record_max > sizeof(__sink_file_batch))
+        if (!__sink_file_flush())
+            return false;
+    const uint64_t now_us = time_monotonic_us();
+    if (__sink_file_iov_count == 0)
+        __sink_file_batch_first_us = now_us;
+    char *record = __sink_file_batch + __sink_file_batch_used;
+    const size_t record_length = __sink_record_format(record, record_max, topic, data, length);
+    __sink_file_iov[__sink_file_iov_count].iov_base = record;
+    __sink_file_iov[__sink_file_iov_count].iov_len = record_length;
+    __sink_file_iov_count++;
+    __sink_file_batch_used += record_length;
+    if (now_us - __sink_file_batch_first_us >= SINK_FILE_FLUSH_MS * 1000ULL)
+        return __sink_file_flush();
+    return true;
+}
+
+void __sink_file_poll(void) {
+    if (__sink_file_iov_count > 0 && time_monotonic_us() - __sink_file_batch_first_us >= SINK_FILE_FLUSH_MS * 1000ULL)
+        __sink_file_flush();
+}
+
+void __sink_file_end(void) {
+    __sink_file_flush();
+    if (__sink_file_fd >= 0)
+        close(__sink_file_fd);
+    __sink_file_fd = -1;
+}
+
+sink_t sink_file = { .name = "file", .begin = __sink_file_begin, .send = __sink_file_send, .poll = __sink_file_poll, .end = __sink_file_end };
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool sink_register(sink_t *sink) {
+    if (sink_count >= SINK_MAX)
+        return false;
+    sinks[sink_count++] = sink;
+    return true;
+}
+
+uint32_t sink_parse(const char *names) {
+    uint32_t mask = 0;
+    const char *p = names;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        const size_t length = end ? (size_t)(end - p) : strlen(p);
+        int i;
+        for (i = 0; i < sink_count; i++)
+            if (strlen(sinks[i]->name) == length && strncmp(sinks[i]->name, p, length) == 0)
+                break;
+        if (i < sink_count)
+            mask |= 1U << i;
+        else
+            fprintf(stderr, "config: unknown sink '%.*s', ignoring\n", (int)length, p);
+        p += length;
+        if (*p == ',')
+            p++;
+    }
+    return mask;
+}
+
+bool sink_begin(const sink_config_t *config) {
+    for (int i = 0; i < sink_count; i++) {
+        sinks[i]->active = sinks[i]->begin ? sinks[i]->begin(config) : true;
+        snprintf(sinks[i]->metric_labels, sizeof(sinks[i]->metric_labels), "sink=\"%s\"", sinks[i]->name);
+        sinks[i]->metric_sent = metrics_counter_register("e22900t22_sink_sent_total", sinks[i]->metric_labels, "Messages sent by the sink.");
+        sinks[i]->metric_failed = metrics_counter_register("e22900t22_sink_failed_total", sinks[i]->metric_labels, "Messages the sink failed to send, or sent to while inactive.");
+    }
+    return true;
+}
+
+// true if any sink sent it: those that fail are counted and report their own failures, so a packet is only lost when
+// every sink fails
+bool sink_send(const uint32_t mask, const char *topic, const uint8_t *data, const int length) {
+    bool result = false;
+    for (int i = 0; i < sink_count; i++)
+        if (mask & (1U << i)) {
+            if (sinks[i]->active && sinks[i]->send(topic, data, length)) {
+                sinks[i]->sent++;
+                metrics_counter_add(sinks[i]->metric_sent, 1);
+                result = true;
+            } else {
+                sinks[i]->failed++;
+                metrics_counter_add(sinks[i]->metric_failed, 1);
+            }
+        }
+    return result;
+}
+
+void sink_poll(void) {
+    for (int i = 0; i < sink_count; i++)
+        if (sinks[i]->active && sinks[i]->poll)
+            sinks[i]->poll();
+}
+
+void sink_end(void) {
+    for (int i = 0; i < sink_count; i++)
+        if (sinks[i]->active && sinks[i]->end)
+            sinks[i]->end();
+    sink_count = 0;
+}
+
+void sink_stats_display(void) {
+    printf("sinks:");
+    for (int i = 0; i < sink_count; i++) {
+        if (sinks[i]->active || sinks[i]->failed)
+            printf(" %s=%" PRIu32 "/%" PRIu32, sinks[i]->name, sinks[i]->sent, sinks[i]->failed);
+        sinks[i]->sent = sinks[i]->failed = 0;
+    }
+    printf(" (sent/failed)\n");
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
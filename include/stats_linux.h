@@ -0,0 +1,132 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// RSSI statistics without floating point: samples are dBm in Q8.8 (as from get_rssi_dbm_q8), the moving averages are
+// kept in Q16.16 and rounded, so that they neither truncate downwards nor lose the half dB steps of the USB module; the
+// window is the last STATS_RSSI_WINDOW samples, held both as a ring and as a histogram in half dB bins, so that an update
+// is O(1) and quantiles, min and max are exact over the window (the bins are the resolution of the device, so there is
+// nothing for an approximate sketch to save); the noise floor follows channel samples down quickly and up slowly, so that
+// it settles on the quiet channel rather than on transmissions
+
+#define STATS_Q8_ONE           256
+#define STATS_RSSI_WINDOW      256
+#define STATS_RSSI_BINS        512 // half dB steps from 0 to -255.5 dBm
+#define STATS_EMA_ALPHA        51  // of 256, so 0.2 as the former uint8 EMA
+#define STATS_FLOOR_ALPHA_DOWN 64  // of 256
+#define STATS_FLOOR_ALPHA_UP   4   // of 256
+
+typedef struct {
+    uint32_t count;
+    int32_t ema_q16, floor_q16; // dBm in Q16.16
+    uint16_t window_next, window_count;
+    uint16_t window[STATS_RSSI_WINDOW]; // as bins
+    uint16_t bins[STATS_RSSI_BINS];
+} stats_rssi_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void stats_rssi_reset(stats_rssi_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+static inline int stats_rssi_bin(const int32_t dbm_q8) {
+    const int32_t bin = ((-dbm_q8) + 64) >> 7;
+    return bin < 0 ? 0 : bin >= STATS_RSSI_BINS ? STATS_RSSI_BINS - 1 : (int)bin;
+}
+
+static inline int32_t stats_rssi_bin_q8(const int bin) {
+    return -(int32_t)bin * (STATS_Q8_ONE / 2);
+}
+
+// a division by 256, rounded half away from zero so that it is not biased either way
+static inline int32_t __stats_div256_round(const int32_t value) {
+    return (value + (value < 0 ? -128 : 128)) / 256;
+}
+
+// moves by alpha/256 of the difference; differences stay within 2^24 for dBm, so the product fits
+static inline int32_t __stats_ema_step(const int32_t ema_q16, const int32_t value_q16, const int32_t alpha) {
+    return ema_q16 + __stats_div256_round((value_q16 - ema_q16) * alpha);
+}
+
+static inline void stats_rssi_update(stats_rssi_t *stats, const int32_t dbm_q8) {
+    const int32_t value_q16 = dbm_q8 * STATS_Q8_ONE;
+    if (stats->count++ == 0)
+        stats->ema_q16 = stats->floor_q16 = value_q16;
+    else {
+        stats->ema_q16 = __stats_ema_step(stats->ema_q16, value_q16, STATS_EMA_ALPHA);
+        stats->floor_q16 = __stats_ema_step(stats->floor_q16, value_q16, value_q16 < stats->floor_q16 ? STATS_FLOOR_ALPHA_DOWN : STATS_FLOOR_ALPHA_UP);
+    }
+    const uint16_t bin = (uint16_t)stats_rssi_bin(dbm_q8);
+    if (stats->window_count == STATS_RSSI_WINDOW)
+        stats->bins[stats->window[stats->window_next]]--;
+    else
+        stats->window_count++;
+    stats->window[stats->window_next] = bin;
+    stats->window_next = (uint16_t)((stats->window_next + 1) % STATS_RSSI_WINDOW);
+    stats->bins[bin]++;
+}
+
+int32_t stats_rssi_ema(const stats_rssi_t *stats) {
+    return __stats_div256_round(stats->ema_q16);
+}
+
+int32_t stats_rssi_floor(const stats_rssi_t *stats) {
+    return __stats_div256_round(stats->floor_q16);
+}
+
+// to whole dBm, e.g. for gauges
+int32_t stats_q8_round(const int32_t value_q8) {
+    return __stats_div256_round(value_q8);
+}
+
+// over the window, the value at or below which permille/1000 of the samples fall, where the bins run from the
+// strongest (0 dBm) to the weakest, so are walked from the weakest end; 1000 is the max and 0 the min
+int32_t stats_rssi_quantile(const stats_rssi_t *stats, const uint32_t permille) {
+    const uint32_t rank = ((stats->window_count * permille) + 999) / 1000;
+    uint32_t seen = 0;
+    for (int bin = STATS_RSSI_BINS - 1; bin >= 0; bin--)
+        if ((seen += stats->bins[bin]) >= (rank > 0 ? rank : 1))
+            return stats_rssi_bin_q8(bin);
+    return 0;
+}
+
+int32_t stats_rssi_min(const stats_rssi_t *stats) {
+    return stats_rssi_quantile(stats, 0);
+}
+
+int32_t stats_rssi_max(const stats_rssi_t *stats) {
+    return stats_rssi_quantile(stats, 1000);
+}
+
+// e.g. -97.50, with two places as Q8.8 resolves to 1/256
+const char *stats_q8_tostring(char *buffer, const size_t size, const int32_t value_q8) {
+    const uint32_t magnitude = value_q8 < 0 ? (uint32_t)0 - (uint32_t)value_q8 : (uint32_t)value_q8;
+    const uint32_t hundredths = ((magnitude * 100) + (STATS_Q8_ONE / 2)) / STATS_Q8_ONE;
+    snprintf(buffer, size, "%s%" PRIu32 ".%02" PRIu32, value_q8 < 0 && hundredths > 0 ? "-" : "", hundredths / 100, hundredths % 100);
+    return buffer;
+}
+
+// e.g. -97.53 dBm (count=12, p10=-99.00, p50=-97.50, p90=-96.00, min=-100.00, max=-95.00[, noise-floor=-99.12])
+void stats_rssi_display(const char *name, const stats_rssi_t *stats, const bool noise_floor) {
+    char ema[16], p10[16], p50[16], p90[16], min[16], max[16], floor[16];
+    printf(", %s=%s dBm (count=%" PRIu32 ", p10=%s, p50=%s, p90=%s, min=%s, max=%s", name, stats_q8_tostring(ema, sizeof(ema), stats_rssi_ema(stats)), stats->count, stats_q8_tostring(p10, sizeof(p10), stats_rssi_quantile(stats, 100)),
+           stats_q8_tostring(p50, sizeof(p50), stats_rssi_quantile(stats, 500)), stats_q8_tostring(p90, sizeof(p90), stats_rssi_quantile(stats, 900)), stats_q8_tostring(min, sizeof(min), stats_rssi_min(stats)),
+           stats_q8_tostring(max, sizeof(max), stats_rssi_max(stats)));
+    if (noise_floor)
+        printf(", noise-floor=%s", stats_q8_tostring(floor, sizeof(floor), stats_rssi_floor(stats)));
+    printf(")");
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,627 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the gateway's side of TDMA (the beacon format and the node's side are in e22xxxtxx.h): nodes are keyed by the hash
+// of what 'tdma-key' renders from their packets, and at the end of each frame each is given as many slots as it sends
+// packets a frame (averaged, at least one, and one more if it sent more than its slots carried, as the rest came in
+// contention), the oldest nodes first, keeping the slots it has so that few change; nodes silent for 'tdma-expire'
+// seconds lose theirs. Slots are an air time of 'tdma-slot-bytes' and the 'tdma-guard' apart. The contention slots,
+// at least 'tdma-contention', double while they find new nodes and halve when they do not, as the gateway cannot hear
+// collisions to size them otherwise. Only the main thread uses it.
+
+#define TDMA_NODES_DEFAULT         1024
+#define TDMA_NODES_MAX             (1 << 16)
+#define TDMA_SLOTS_DEFAULT         1024 // assigned slots, at most
+#define TDMA_SLOTS_MAX             0xFFF0
+#define TDMA_CONTENTION_DEFAULT    8
+#define TDMA_EXPIRE_DEFAULT        3600 // s
+#define TDMA_SLOT_BYTES_DEFAULT    64
+#define TDMA_GUARD_DEFAULT         20 // ms
+#define TDMA_BEACON_PAGES_DEFAULT  8
+#define TDMA_BEACON_PAGES_MAX      16
+#define TDMA_RATE_ONE              256 // a packet a frame, as averaged
+
+typedef struct {
+    uint32_t hash;
+    uint16_t slots[TDMA_NODE_SLOTS_MAX];
+    uint8_t slot_count, wanted;
+    bool changed;
+    uint32_t heard, rate; // packets this frame, and a frame on average (of TDMA_RATE_ONE)
+    uint64_t silent_ms;   // since the last
+    uint64_t listed;      // the frame that last listed it
+} tdma_node_state_t;
+
+typedef struct {
+    uint16_t slot_ms, contention_min, contention_max, slots_max;
+    uint64_t expire_ms;
+    tdma_node_state_t *nodes;
+    int32_t *index, *owners; // node indices by hash (linear probed), and by slot; -1 if none
+    uint32_t index_mask, count, capacity;
+    uint16_t slot_count, contention; // of the current frame
+    uint32_t discovered;             // nodes new in the current frame
+    uint32_t cursor;                 // the next node to list again
+    uint64_t frames, beacons, heard, untracked, assigned, released, expired;
+} tdma_scheduler_t;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+bool tdma_scheduler_begin(tdma_scheduler_t *scheduler, const uint32_t capacity, const uint16_t slot_ms, const uint16_t contention, const uint16_t slots_max, const uint32_t expire_s) {
+    uint32_t index_count = 2;
+    while (index_count < capacity * 2)
+        index_count <<= 1;
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->nodes = (tdma_node_state_t *)calloc(capacity, sizeof(tdma_node_state_t));
+    scheduler->index = (int32_t *)malloc(index_count * sizeof(int32_t));
+    scheduler->owners = (int32_t *)malloc(slots_max * sizeof(int32_t));
+    if (scheduler->nodes == NULL || scheduler->index == NULL || scheduler->owners == NULL) {
+        free(scheduler->nodes);
+        free(scheduler->index);
+        free(scheduler->owners);
+        scheduler->nodes = NULL;
+        scheduler->index = scheduler->owners = NULL;
+        return false;
+    }
+    memset(scheduler->index, 0xFF, index_count * sizeof(int32_t));
+    memset(scheduler->owners, 0xFF, slots_max * sizeof(int32_t));
+    scheduler->index_mask = index_count - 1;
+    scheduler->capacity = capacity;
+    scheduler->slot_ms = slot_ms;
+    scheduler->contention = scheduler->contention_min = contention;
+    scheduler->contention_max = (uint16_t)(contention > slots_max / 4 ? contention : slots_max / 4);
+    scheduler->slots_max = slots_max;
+    scheduler->expire_ms = (uint64_t)expire_s * 1000;
+    return true;
+}
+
+void tdma_scheduler_end(tdma_scheduler_t *scheduler) {
+    free(scheduler->nodes);
+    free(scheduler->index);
+    free(scheduler->owners);
+    scheduler->nodes = NULL;
+    scheduler->index = scheduler->owners = NULL;
+    scheduler->count = scheduler->capacity = 0;
+}
+
+static inline uint32_t tdma_scheduler_frame_ms(const tdma_scheduler_t *scheduler) {
+    return ((uint32_t)scheduler->slot_count + scheduler->contention) * scheduler->slot_ms;
+}
+
+// a packet from the node: added if new (and there is room, else it is left to contention)
+void tdma_heard(tdma_scheduler_t *scheduler, const uint32_t hash) {
+    uint32_t slot = hash & scheduler->index_mask;
+    int32_t index;
+    while ((index = scheduler->index[slot]) >= 0 && scheduler->nodes[index].hash != hash)
+        slot = (slot + 1) & scheduler->index_mask;
+    if (index < 0) {
+        if (scheduler->count == scheduler->capacity) {
+            scheduler->untracked++;
+            return;
+        }
+        index = (int32_t)scheduler->count++;
+        memset(&scheduler->nodes[index], 0, sizeof(tdma_node_state_t));
+        scheduler->nodes[index].hash = hash;
+        scheduler->index[slot] = index;
+        scheduler->discovered++;
+    }
+    scheduler->nodes[index].heard++;
+    scheduler->heard++;
+}
+
+static void __tdma_release(tdma_scheduler_t *scheduler, tdma_node_state_t *node, const uint8_t slot_count) {
+    while (node->slot_count > slot_count) {
+        scheduler->owners[node->slots[--node->slot_count]] = -1;
+        scheduler->released++;
+    }
+    node->changed = true;
+}
+
+// drops the expired, keeping the order (so, oldest first), and indexes those left anew
+static void __tdma_expire(tdma_scheduler_t *scheduler) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        tdma_node_state_t *node = &scheduler->nodes[i];
+        if (node->silent_ms > scheduler->expire_ms) {
+            __tdma_release(scheduler, node, 0);
+            scheduler->expired++;
+            continue;
+        }
+        if (kept != i) {
+            scheduler->nodes[kept] = *node;
+            for (int j = 0; j < node->slot_count; j++)
+                scheduler->owners[node->slots[j]] = (int32_t)kept;
+        }
+        kept++;
+    }
+    if (kept == scheduler->count)
+        return;
+    scheduler->count = kept;
+    memset(scheduler->index, 0xFF, (scheduler->index_mask + 1) * sizeof(int32_t));
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        uint32_t slot = scheduler->nodes[i].hash & scheduler->index_mask;
+        while (scheduler->index[slot] >= 0)
+            slot = (slot + 1) & scheduler->index_mask;
+        scheduler->index[slot] = (int32_t)i;
+    }
+}
+
+// gives each node up to 'limit' of the slots it wants, from the lowest free, in order
+static void __tdma_assign(tdma_scheduler_t *scheduler, const uint8_t limit) {
+    uint32_t free_slot = 0;
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        tdma_node_state_t *node = &scheduler->nodes[i];
+        while (node->slot_count < node->wanted && node->slot_count < limit) {
+            while (free_slot < scheduler->slots_max && scheduler->owners[free_slot] >= 0)
+                free_slot++;
+            if (free_slot == scheduler->slots_max)
+                return;
+            scheduler->owners[free_slot] = (int32_t)i;
+            node->slots[node->slot_count++] = (uint16_t)free_slot;
+            node->changed = true;
+            scheduler->assigned++;
+        }
+    }
+}
+
+// at the end of a frame: averages what each node sent, expires the silent, and assigns the slots for the next
+void tdma_schedule(tdma_scheduler_t *scheduler) {
+    const uint32_t frame_ms = tdma_scheduler_frame_ms(scheduler);
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        tdma_node_state_t *node = &scheduler->nodes[i];
+        node->rate = node->rate - node->rate / 4 + node->heard * (TDMA_RATE_ONE / 4);
+        node->silent_ms = node->heard > 0 ? 0 : node->silent_ms + frame_ms;
+    }
+    __tdma_expire(scheduler);
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        tdma_node_state_t *node = &scheduler->nodes[i];
+        uint32_t wanted = (node->rate + TDMA_RATE_ONE - 1) / TDMA_RATE_ONE;
+        if (node->heard > node->slot_count && wanted <= node->slot_count)
+            wanted = node->slot_count + 1u;
+        node->wanted = (uint8_t)(wanted < 1 ? 1 : wanted > TDMA_NODE_SLOTS_MAX ? TDMA_NODE_SLOTS_MAX : wanted);
+        if (node->wanted < node->slot_count)
+            __tdma_release(scheduler, node, node->wanted);
+        node->heard = 0;
+    }
+    // a first slot for each before more for any: if too few are free, the newest of those with most give one back
+    uint32_t lacking = 0, used = 0;
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        lacking += scheduler->nodes[i].slot_count == 0;
+        used += scheduler->nodes[i].slot_count;
+    }
+    for (uint8_t most = TDMA_NODE_SLOTS_MAX; most > 1 && used + lacking > scheduler->slots_max; most--)
+        for (uint32_t i = scheduler->count; i-- > 0 && used + lacking > scheduler->slots_max;)
+            if (scheduler->nodes[i].slot_count == most) {
+                __tdma_release(scheduler, &scheduler->nodes[i], (uint8_t)(most - 1));
+                used--;
+            }
+    __tdma_assign(scheduler, 1);
+    __tdma_assign(scheduler, TDMA_NODE_SLOTS_MAX);
+    uint32_t slot_count = scheduler->slots_max;
+    while (slot_count > 0 && scheduler->owners[slot_count - 1] < 0)
+        slot_count--;
+    scheduler->slot_count = (uint16_t)slot_count;
+    if (scheduler->discovered > 0)
+        scheduler->contention = (uint16_t)(scheduler->contention * 2 < scheduler->contention_max ? scheduler->contention * 2 : scheduler->contention_max);
+    else
+        scheduler->contention = (uint16_t)(scheduler->contention / 2 > scheduler->contention_min ? scheduler->contention / 2 : scheduler->contention_min);
+    scheduler->discovered = 0;
+    scheduler->frames++;
+}
+
+static inline void __tdma_put_u16(uint8_t *bytes, const uint16_t value) {
+    bytes[0] = (uint8_t)value;
+    bytes[1] = (uint8_t)(value >> 8);
+}
+
+static int __tdma_beacon_list(tdma_scheduler_t *scheduler, tdma_node_state_t *node, uint8_t *entry) {
+    for (int j = 0; j < node->slot_count; j++, entry += TDMA_BEACON_ENTRY_SIZE) {
+        __tdma_put_u16(&entry[0], (uint16_t)node->hash);
+        __tdma_put_u16(&entry[2], (uint16_t)(node->hash >> 16));
+        __tdma_put_u16(&entry[4], node->slots[j]);
+    }
+    node->changed = false;
+    node->listed = scheduler->frames;
+    return node->slot_count;
+}
+
+static void __tdma_beacon_header(const tdma_scheduler_t *scheduler, uint8_t *page, const uint8_t cycle, const uint16_t delay_ms, const int entries) {
+    page[0] = TDMA_BEACON_MAGIC_0;
+    page[1] = TDMA_BEACON_MAGIC_1;
+    page[2] = (uint8_t)scheduler->frames;
+    page[3] = cycle;
+    __tdma_put_u16(&page[4], scheduler->slot_ms);
+    __tdma_put_u16(&page[6], scheduler->slot_count);
+    __tdma_put_u16(&page[8], scheduler->contention);
+    __tdma_put_u16(&page[10], delay_ms);
+    page[14] = (uint8_t)entries;
+}
+
+// the beacon for the frame scheduled, in up to 'pages_max' pages of at most 'size' bytes: the changed assignments, in
+// up to half of them, then those listed longest ago, each node's in one page (so every node is listed within the cycle
+// of frames that the other half takes to list them all); each page has the air time of those after it, and its
+// reading at a node's UART (as fast as the gateway's, with the end of frame gap) as the delay
+int tdma_beacon_build(tdma_scheduler_t *scheduler, uint8_t (*pages)[E22900T22_PACKET_MAXSIZE], int *lengths, const int pages_max, const int size, const uint32_t uart_byte_us) {
+    const int entries_max = (size - TDMA_BEACON_HEADER_SIZE) / TDMA_BEACON_ENTRY_SIZE > 255 ? 255 : (size - TDMA_BEACON_HEADER_SIZE) / TDMA_BEACON_ENTRY_SIZE;
+    uint32_t listable = 0;
+    for (uint32_t i = 0; i < scheduler->count; i++) {
+        listable += scheduler->nodes[i].slot_count;
+        if (scheduler->nodes[i].slot_count == 0)
+            scheduler->nodes[i].changed = false; // a node losing its slots hears of it as they are given to others
+    }
+    const int changes_max = (entries_max * pages_max) / 2;
+    const uint32_t cursor = scheduler->cursor;
+    int page = 0, entries = 0, changes = 0;
+    bool full = false;
+    for (int pass = 0; pass < 2 && !full; pass++)
+        for (uint32_t n = 0; n < scheduler->count; n++) {
+            const uint32_t i = pass == 0 ? n : (cursor + n) % scheduler->count;
+            tdma_node_state_t *node = &scheduler->nodes[i];
+            if (node->slot_count == 0 || node->listed == scheduler->frames || (pass == 0 && (!node->changed || changes + node->slot_count > changes_max)))
+                continue;
+            if (entries + node->slot_count > entries_max) {
+                if ((full = page + 1 == pages_max))
+                    break;
+                lengths[page++] = entries;
+                entries = 0;
+            }
+            entries += __tdma_beacon_list(scheduler, node, &pages[page][TDMA_BEACON_HEADER_SIZE + entries * TDMA_BEACON_ENTRY_SIZE]);
+            if (pass == 0)
+                changes += node->slot_count;
+            else
+                scheduler->cursor = i + 1;
+        }
+    lengths[page++] = entries;
+    const uint32_t refreshes = (uint32_t)(entries_max * pages_max - changes_max), cycle = refreshes > 0 ? 1 + (listable + refreshes - 1) / refreshes : 255;
+    uint32_t after_us = 0;
+    for (int k = page - 1; k >= 0; k--) {
+        const int entries_page = lengths[k];
+        lengths[k] = TDMA_BEACON_HEADER_SIZE + entries_page * TDMA_BEACON_ENTRY_SIZE;
+        __tdma_beacon_header(scheduler, pages[k], (uint8_t)(cycle > 255 ? 255 : cycle), (uint16_t)((uart_byte_us * (uint32_t)lengths[k] + (uart_byte_us ? E22900T22_FRAME_GAP_SLACK_US : 0) + 500) / 1000), entries_page);
+        __tdma_put_u16(&pages[k][12], (uint16_t)((after_us + 500) / 1000));
+        after_us += device_air_time_us(lengths[k]);
+    }
+    scheduler->beacons += (uint32_t)page;
+    return page;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    topic_template_t *key;
+    uint32_t nodes, expire;
+    uint16_t slot_bytes, guard_ms, contention, slots, pages;
+    const char *simulate;
+    uint32_t simulate_interval, simulate_duration; // s
+} tdma_config_t;
+
+tdma_config_t tdma_config = { .key = NULL, .simulate = NULL };
+tdma_scheduler_t tdma_scheduler = { .nodes = NULL };
+uint64_t tdma_beacon_due_us = 0;
+uint32_t tdma_uart_byte_us = 0, tdma_unkeyed = 0, tdma_beacon_failures = 0;
+
+static inline bool tdma_enabled(void) {
+    return tdma_config.key != NULL;
+}
+
+static uint16_t __tdma_config_u16(const char *name, const int value_default, const int value_max) {
+    const int value = config_get_integer(name, value_default);
+    return (uint16_t)(value > 0 && value <= value_max ? value : value_default);
+}
+
+bool config_populate_tdma(void) {
+    const char *key = config_get_string("tdma-key", NULL);
+    tdma_config.simulate = config_get_string("tdma-simulate", NULL);
+    tdma_config.simulate_interval = (uint32_t)__tdma_config_u16("tdma-simulate-interval", 300, 0xFFFF);
+    tdma_config.simulate_duration = (uint32_t)config_get_integer("tdma-simulate-duration", 6 * 3600);
+    tdma_config.slot_bytes = __tdma_config_u16("tdma-slot-bytes", TDMA_SLOT_BYTES_DEFAULT, E22900T22_PACKET_MAXSIZE);
+    tdma_config.guard_ms = __tdma_config_u16("tdma-guard", TDMA_GUARD_DEFAULT, 1000);
+    tdma_config.contention = __tdma_config_u16("tdma-contention", TDMA_CONTENTION_DEFAULT, TDMA_SLOTS_MAX);
+    tdma_config.slots = __tdma_config_u16("tdma-slots", TDMA_SLOTS_DEFAULT, TDMA_SLOTS_MAX);
+    tdma_config.pages = __tdma_config_u16("tdma-beacon-pages", TDMA_BEACON_PAGES_DEFAULT, TDMA_BEACON_PAGES_MAX);
+    tdma_config.nodes = __tdma_config_u16("tdma-nodes", TDMA_NODES_DEFAULT, 0xFFFF);
+    tdma_config.expire = __tdma_config_u16("tdma-expire", TDMA_EXPIRE_DEFAULT, 0xFFFF);
+    if (key == NULL) {
+        printf("config: tdma: off\n");
+        return true;
+    }
+    if ((tdma_config.key = topic_template_compile(key)) == NULL) {
+        fprintf(stderr, "config: tdma: key '%s' must have an extractor, e.g. '{json:id}' or '{hex:0-1}'\n", key);
+        return false;
+    }
+    printf("config: tdma: key='%s', slot-bytes=%" PRIu16 ", guard=%" PRIu16 "ms, contention=%" PRIu16 ", slots=%" PRIu16 ", beacon-pages=%" PRIu16 ", nodes=%" PRIu32 ", expire=%" PRIu32 "s\n", key, tdma_config.slot_bytes, tdma_config.guard_ms,
+           tdma_config.contention, tdma_config.slots, tdma_config.pages, tdma_config.nodes, tdma_config.expire);
+    return true;
+}
+
+static uint16_t __tdma_slot_ms(void) {
+    return (uint16_t)((device_air_time_us(tdma_config.slot_bytes) + 999) / 1000 + tdma_config.guard_ms);
+}
+
+// once the device is configured, as the slot follows its air rate; the first beacon is due at once
+bool tdma_begin(const int uart_rate) {
+    if (!tdma_enabled())
+        return true;
+    if (!tdma_scheduler_begin(&tdma_scheduler, tdma_config.nodes, __tdma_slot_ms(), tdma_config.contention, tdma_config.slots, tdma_config.expire)) {
+        fprintf(stderr, "tdma: could not allocate the scheduler for %" PRIu32 " nodes\n", tdma_config.nodes);
+        return false;
+    }
+    tdma_uart_byte_us = (10 * 1000000) / (uint32_t)(uart_rate > 0 ? uart_rate : 9600);
+    printf("tdma: slot=%" PRIu16 "ms (air time of %" PRIu16 " bytes and guard of %" PRIu16 "ms)\n", tdma_scheduler.slot_ms, tdma_config.slot_bytes, tdma_config.guard_ms);
+    return true;
+}
+
+void tdma_end(void) {
+    tdma_scheduler_end(&tdma_scheduler);
+    topic_template_free(tdma_config.key);
+    tdma_config.key = NULL;
+}
+
+void tdma_heard_packet(const uint8_t *packet, const int packet_size) {
+    char key[TOPIC_LENGTH_MAX];
+    const int length = topic_template_render(tdma_config.key, packet, packet_size, key, sizeof(key));
+    if (length <= 0)
+        tdma_unkeyed++;
+    else
+        tdma_heard(&tdma_scheduler, tdma_key_hash((const uint8_t *)key, length));
+}
+
+// the wait for a packet, cut short by the next beacon
+uint32_t tdma_wait_ms(const uint64_t now_us, const uint32_t timeout_ms) {
+    if (now_us >= tdma_beacon_due_us)
+        return 0;
+    const uint64_t wait_ms = (tdma_beacon_due_us - now_us + 999) / 1000;
+    return wait_ms < timeout_ms ? (uint32_t)wait_ms : timeout_ms;
+}
+
+// when due, schedules the next frame and sends its beacon (unless replaying, without a device), the pages written
+// together; the frame starts as the last leaves the air, which is a UART time after the first is written
+void tdma_poll(const uint64_t now_us, const bool transmit) {
+    if (!tdma_enabled() || now_us < tdma_beacon_due_us)
+        return;
+    uint8_t pages[TDMA_BEACON_PAGES_MAX][E22900T22_PACKET_MAXSIZE];
+    int lengths[TDMA_BEACON_PAGES_MAX];
+    tdma_schedule(&tdma_scheduler);
+    const int page_count = tdma_beacon_build(&tdma_scheduler, pages, lengths, tdma_config.pages, get_packet_size_bytes(_e22900txx_config.packet_size), tdma_uart_byte_us);
+    uint64_t air_us = 0;
+    for (int k = 0; k < page_count; k++) {
+        if (transmit && !device_packet_write(pages[k], lengths[k])) {
+            fprintf(stderr, "tdma: failed to send beacon page (size=%d)\n", lengths[k]);
+            tdma_beacon_failures++;
+        }
+        air_us += device_air_time_us(lengths[k]);
+    }
+    tdma_beacon_due_us = now_us + (uint64_t)tdma_uart_byte_us * (uint32_t)lengths[0] + air_us + (uint64_t)tdma_scheduler_frame_ms(&tdma_scheduler) * 1000;
+}
+
+void tdma_stats_display(void) {
+    if (!tdma_enabled())
+        return;
+    printf("tdma: nodes=%" PRIu32 "/%" PRIu32 ", slots=%" PRIu16 "+%" PRIu16 " (frame=%" PRIu32 "ms), frames=%" PRIu64 ", heard=%" PRIu64 ", unkeyed=%" PRIu32 ", untracked=%" PRIu64 ", assigned=%" PRIu64 ", released=%" PRIu64
+           ", expired=%" PRIu64 ", beacon-failures=%" PRIu32 "\n",
+           tdma_scheduler.count, tdma_scheduler.capacity, tdma_scheduler.slot_count, tdma_scheduler.contention, tdma_scheduler_frame_ms(&tdma_scheduler), tdma_scheduler.frames, tdma_scheduler.heard, tdma_unkeyed,
+           tdma_scheduler.untracked, tdma_scheduler.assigned, tdma_scheduler.released, tdma_scheduler.expired, tdma_beacon_failures);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// 'tdma-simulate=50,200,1000' compares TDMA with pure ALOHA for so many nodes, each sending a packet of 'tdma-slot-bytes'
+// every 'tdma-simulate-interval' seconds (jittered by half either way) over 'tdma-simulate-duration' seconds at the
+// device's air rate: under ALOHA a packet is sent when ready, under TDMA it is queued (up to TDMA_SIMULATE_QUEUE)
+// for the node's slot, or contention, through the scheduler and node helpers with real beacons, each node's timing
+// off by up to TDMA_SIMULATE_JITTER_US either way; a transmission overlapping another (or a beacon) is lost, neither
+// retries, and the gateway hears none while it sends a beacon
+
+#define TDMA_SIMULATE_QUEUE     4
+#define TDMA_SIMULATE_JITTER_US 2000
+
+typedef struct {
+    uint64_t offered, sent, collided, delivered, overflowed, latency_us;
+} tdma_simulate_result_t;
+
+typedef struct {
+    uint64_t start_us, end_us, ready_us;
+    int32_t node; // -1 for a beacon
+    bool collided;
+} __tdma_transmission_t;
+
+typedef struct {
+    __tdma_transmission_t *items;
+    size_t count, size;
+} __tdma_transmissions_t;
+
+static inline uint32_t __tdma_random(uint32_t *state) {
+    *state ^= *state << 13; // xorshift32
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static bool __tdma_transmission_add(__tdma_transmissions_t *transmissions, const uint64_t start_us, const uint64_t end_us, const uint64_t ready_us, const int32_t node) {
+    if (transmissions->count == transmissions->size) {
+        const size_t size = transmissions->size ? transmissions->size * 2 : 1024;
+        __tdma_transmission_t *items = (__tdma_transmission_t *)realloc(transmissions->items, size * sizeof(__tdma_transmission_t));
+        if (items == NULL)
+            return false;
+        transmissions->items = items;
+        transmissions->size = size;
+    }
+    transmissions->items[transmissions->count++] = (__tdma_transmission_t) { .start_us = start_us, .end_us = end_us, .ready_us = ready_us, .node = node, .collided = false };
+    return true;
+}
+
+static int __tdma_transmission_compare(const void *a, const void *b) {
+    const uint64_t a_us = ((const __tdma_transmission_t *)a)->start_us, b_us = ((const __tdma_transmission_t *)b)->start_us;
+    return a_us < b_us ? -1 : a_us > b_us ? 1 : 0;
+}
+
+// in start order, one overlaps an earlier if it starts before the latest end so far, and then overlaps that one too
+static void __tdma_transmissions_collide(__tdma_transmissions_t *transmissions, tdma_simulate_result_t *result, tdma_scheduler_t *scheduler, const tdma_node_t *nodes) {
+    qsort(transmissions->items, transmissions->count, sizeof(__tdma_transmission_t), __tdma_transmission_compare);
+    size_t latest = 0;
+    for (size_t i = 1; i < transmissions->count; i++) {
+        __tdma_transmission_t *transmission = &transmissions->items[i];
+        if (transmission->start_us < transmissions->items[latest].end_us)
+            transmission->collided = transmissions->items[latest].collided = true;
+        if (transmission->end_us > transmissions->items[latest].end_us)
+            latest = i;
+    }
+    for (size_t i = 0; i < transmissions->count; i++) {
+        const __tdma_transmission_t *transmission = &transmissions->items[i];
+        if (transmission->node < 0)
+            continue;
+        result->sent++;
+        if (transmission->collided)
+            result->collided++;
+        else {
+            result->delivered++;
+            result->latency_us += transmission->end_us - transmission->ready_us;
+            if (scheduler != NULL)
+                tdma_heard(scheduler, nodes[transmission->node].hash);
+        }
+    }
+    transmissions->count = 0;
+}
+
+static bool __tdma_simulate_aloha(const uint32_t node_count, const uint64_t interval_us, const uint64_t duration_us, const uint32_t air_us, tdma_simulate_result_t *result) {
+    __tdma_transmissions_t transmissions = { .items = NULL, .count = 0, .size = 0 };
+    uint32_t random = 0x2545F491;
+    for (uint32_t i = 0; i < node_count; i++)
+        for (uint64_t ready_us = __tdma_random(&random) % interval_us; ready_us < duration_us; ready_us += interval_us / 2 + __tdma_random(&random) % interval_us) {
+            result->offered++;
+            if (!__tdma_transmission_add(&transmissions, ready_us, ready_us + air_us, ready_us, (int32_t)i)) {
+                free(transmissions.items);
+                return false;
+            }
+        }
+    __tdma_transmissions_collide(&transmissions, result, NULL, NULL);
+    free(transmissions.items);
+    return true;
+}
+
+typedef struct {
+    uint64_t ready_us[TDMA_SIMULATE_QUEUE], next_us;
+    int queued;
+} __tdma_simulate_queue_t;
+
+static bool __tdma_simulate_tdma(const uint32_t node_count, const uint64_t interval_us, const uint64_t duration_us, const uint32_t air_us, tdma_simulate_result_t *result, uint64_t *settled_us, uint32_t *slotted) {
+    tdma_scheduler_t scheduler;
+    if (!tdma_scheduler_begin(&scheduler, node_count > tdma_config.nodes ? node_count : tdma_config.nodes, __tdma_slot_ms(), tdma_config.contention, tdma_config.slots, tdma_config.expire))
+        return false;
+    tdma_node_t *nodes = (tdma_node_t *)calloc(node_count, sizeof(tdma_node_t));
+    __tdma_simulate_queue_t *queues = (__tdma_simulate_queue_t *)calloc(node_count, sizeof(__tdma_simulate_queue_t));
+    __tdma_transmissions_t transmissions = { .items = NULL, .count = 0, .size = 0 };
+    uint32_t random = 0x2545F491;
+    bool okay = nodes != NULL && queues != NULL;
+    for (uint32_t i = 0; okay && i < node_count; i++) {
+        char key[16];
+        tdma_node_begin(&nodes[i], (const uint8_t *)key, snprintf(key, sizeof(key), "%" PRIu32, i));
+        queues[i].next_us = __tdma_random(&random) % interval_us;
+    }
+    const int beacon_size = get_packet_size_bytes(_e22900txx_config.packet_size);
+    *settled_us = 0;
+    for (uint64_t frame_us = 0; okay && frame_us < duration_us;) {
+        uint8_t pages[TDMA_BEACON_PAGES_MAX][E22900T22_PACKET_MAXSIZE];
+        int lengths[TDMA_BEACON_PAGES_MAX];
+        uint64_t arrived_us[TDMA_BEACON_PAGES_MAX];
+        tdma_schedule(&scheduler);
+        const int page_count = tdma_beacon_build(&scheduler, pages, lengths, tdma_config.pages, beacon_size, 0);
+        uint64_t start_us = frame_us;
+        for (int k = 0; okay && k < page_count; k++) {
+            okay = __tdma_transmission_add(&transmissions, start_us, start_us + device_air_time_us(lengths[k]), start_us, -1);
+            arrived_us[k] = (start_us += device_air_time_us(lengths[k]));
+        }
+        const uint64_t end_us = start_us + (uint64_t)tdma_scheduler_frame_ms(&scheduler) * 1000;
+        uint32_t assigned = 0;
+        for (uint32_t i = 0; okay && i < node_count; i++) {
+            tdma_node_t *node = &nodes[i];
+            __tdma_simulate_queue_t *queue = &queues[i];
+            for (int k = 0; k < page_count; k++)
+                tdma_node_beacon(node, pages[k], lengths[k], (uint32_t)(arrived_us[k] / 1000));
+            assigned += node->slot_count > 0;
+            for (; queue->next_us < end_us && queue->next_us < duration_us; queue->next_us += interval_us / 2 + __tdma_random(&random) % interval_us) {
+                result->offered++;
+                if (queue->queued == TDMA_SIMULATE_QUEUE)
+                    result->overflowed++;
+                else
+                    queue->ready_us[queue->queued++] = queue->next_us;
+            }
+            uint64_t free_us = start_us;
+            uint32_t at_ms = 0;
+            while (okay && queue->queued > 0) {
+                const uint64_t ready_us = queue->ready_us[0] > free_us ? queue->ready_us[0] : free_us;
+                if (ready_us >= end_us || !tdma_node_transmit_ms(node, (uint32_t)((ready_us + 999) / 1000), queue->queued, __tdma_random(&random), &at_ms))
+                    break;
+                const uint64_t at_us = (uint64_t)at_ms * 1000 + TDMA_SIMULATE_JITTER_US - __tdma_random(&random) % (2 * TDMA_SIMULATE_JITTER_US + 1);
+                okay = __tdma_transmission_add(&transmissions, at_us, at_us + air_us, queue->ready_us[0], (int32_t)i);
+                memmove(&queue->ready_us[0], &queue->ready_us[1], (size_t)--queue->queued * sizeof(uint64_t));
+                free_us = (uint64_t)at_ms * 1000 + 1000;
+            }
+        }
+        if (assigned == node_count && *settled_us == 0)
+            *settled_us = frame_us;
+        *slotted = assigned;
+        __tdma_transmissions_collide(&transmissions, result, &scheduler, nodes);
+        frame_us = end_us;
+    }
+    free(transmissions.items);
+    free(queues);
+    free(nodes);
+    tdma_scheduler_end(&scheduler);
+    return okay;
+}
+
+static void __tdma_simulate_display(const char *name, const tdma_simulate_result_t *result, const uint64_t duration_us, const uint32_t air_us) {
+    const uint64_t collided_permille = result->sent ? (result->collided * 1000) / result->sent : 0, delivered_permille = result->offered ? (result->delivered * 1000) / result->offered : 0;
+    const uint64_t per_minute_x100 = (result->delivered * 6000 * 1000000) / duration_us, utilised_permille = (result->delivered * air_us * 1000) / duration_us;
+    printf("tdma: simulate: %-5s offered=%" PRIu64 ", sent=%" PRIu64 ", collided=%" PRIu64 " (%" PRIu64 ".%" PRIu64 "%%), delivered=%" PRIu64 " (%" PRIu64 ".%" PRIu64 "%%, %" PRIu64 ".%02" PRIu64 "/min, channel %" PRIu64 ".%" PRIu64
+           "%%), overflowed=%" PRIu64 ", latency=%" PRIu64 "ms\n",
+           name, result->offered, result->sent, result->collided, collided_permille / 10, collided_permille % 10, result->delivered, delivered_permille / 10, delivered_permille % 10, per_minute_x100 / 100, per_minute_x100 % 100,
+           utilised_permille / 10, utilised_permille % 10, result->overflowed, result->delivered ? result->latency_us / result->delivered / 1000 : 0);
+}
+
+// runs the simulation for each of the node counts listed
+bool tdma_simulate(void) {
+    const uint32_t air_us = device_air_time_us(tdma_config.slot_bytes);
+    const uint64_t interval_us = (uint64_t)tdma_config.simulate_interval * 1000000, duration_us = (uint64_t)(tdma_config.simulate_duration > 0 ? tdma_config.simulate_duration : 1) * 1000000;
+    for (const char *list = tdma_config.simulate; *list != '\0';) {
+        char *end;
+        const long node_count = strtol(list, &end, 10);
+        if (end == list || node_count <= 0 || node_count > TDMA_NODES_MAX || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "tdma: simulate: expected a list of node counts, e.g. '50,200,1000', not '%s'\n", tdma_config.simulate);
+            return false;
+        }
+        list = *end == ',' ? end + 1 : end;
+        const uint64_t load_permille = ((uint64_t)node_count * air_us * 1000) / interval_us;
+        printf("tdma: simulate: nodes=%ld, interval=%" PRIu32 "s, duration=%" PRIu32 "s, air=%" PRIu32 "ms, slot=%" PRIu16 "ms, offered load=%" PRIu64 ".%03" PRIu64 "\n", node_count, tdma_config.simulate_interval,
+               tdma_config.simulate_duration, air_us / 1000, __tdma_slot_ms(), load_permille / 1000, load_permille % 1000);
+        tdma_simulate_result_t aloha = { 0 }, tdma = { 0 };
+        uint64_t settled_us;
+        uint32_t slotted = 0;
+        if (!__tdma_simulate_aloha((uint32_t)node_count, interval_us, duration_us, air_us, &aloha) || !__tdma_simulate_tdma((uint32_t)node_count, interval_us, duration_us, air_us, &tdma, &settled_us, &slotted)) {
+            fprintf(stderr, "tdma: simulate: out of memory\n");
+            return false;
+        }
+        __tdma_simulate_display("aloha", &aloha, duration_us, air_us);
+        __tdma_simulate_display("tdma", &tdma, duration_us, air_us);
+        printf("tdma: simulate: nodes with a slot at the end=%" PRIu32 "/%ld", slotted, node_count);
+        if (settled_us > 0)
+            printf(", every node first had one after %" PRIu64 "s", settled_us / 1000000);
+        printf("\n");
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,272 @@
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// an always on flight recorder: a ring of fixed size binary events, each claimed with one relaxed increment and
+// published by writing its sequence number last, so that any thread (main, mqtt publisher or mosquitto) records without
+// locks, and a dump that catches a slot being written sees it as incomplete rather than torn; the ring is dumped as is
+// (with only open, write and close, so from a signal handler) on SIGUSR1 and on a crash, and decoded by e22900t22trace;
+// a record costs the CLOCK_MONOTONIC read and a few ns more, about 45 ns with the tsc clock source and 110 ns or more
+// with others (see trace/record and trace/clock in the bench), kept rather than CLOCK_MONOTONIC_COARSE, whose 1-4 ms
+// resolution would hide the serial timing the trace is for
+
+#define TRACE_RING_SIZE    8192 // events, a power of two, so 192 KB
+#define TRACE_MAGIC        "E22TRACE"
+#define TRACE_VERSION      1
+#define TRACE_PATH_DEFAULT "/tmp/e22900t22tomqtt.trace"
+#define TRACE_PATH_MAX     256
+
+typedef enum {
+    TRACE_NONE = 0,
+    TRACE_SERIAL_READ_BEGIN = 1, // c=timeout ms, d=max length
+    TRACE_SERIAL_READ_END = 2,   // a=complete (ended by the idle gap), c=result (bytes, 0 timeout, -1 error), d=first bytes
+    TRACE_SERIAL_WRITE = 3,      // c=result, d=first bytes
+    TRACE_COMMAND_SEND = 4,      // a=command, b=address and length, c=bytes
+    TRACE_COMMAND_RECV = 5,      // a=first byte, c=result
+    TRACE_MODE_SWITCH = 6,       // a=mode, b=result
+    TRACE_PACKET = 7,            // a=rssi, c=size, d=first bytes
+    TRACE_ROUTE = 8,             // a=drop reason or TRACE_ROUTE_OKAY, b=route index or TRACE_ROUTE_DEFAULT/NONE, c=size
+    TRACE_PUBLISH = 9,           // a=broker role, b=result (mosquitto), c=mid, d=length
+    TRACE_ACK = 10,              // a=broker role, c=mid
+    TRACE_SIGNAL = 11,           // a=signal
+    TRACE_RELOAD = 12,           // a=result, b=module written, c=routes, d=duration us
+    TRACE_TYPE_COUNT = 13,
+} trace_type_t;
+
+#define TRACE_ROUTE_OKAY    0xFF
+#define TRACE_ROUTE_DEFAULT 0xFFFE
+#define TRACE_ROUTE_NONE    0xFFFF
+
+typedef struct {
+    uint64_t time_ns; // monotonic
+    uint32_t seq;     // the event's sequence number + 1, written last: 0 while being written
+    uint8_t type, a;
+    uint16_t b;
+    uint32_t c, d;
+} trace_event_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version, event_size, ring_size, next; // next is the sequence number of the next event
+    uint64_t realtime_ns, monotonic_ns;            // at the dump, to place events in wall clock time
+    int32_t reason, pid;                           // the signal, or 0
+} trace_header_t;
+
+trace_event_t trace_ring[TRACE_RING_SIZE];
+uint32_t trace_next = 0;
+char trace_path[TRACE_PATH_MAX] = TRACE_PATH_DEFAULT;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t __trace_clock_ns(const clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void trace_record(const trace_type_t type, const uint8_t a, const uint16_t b, const uint32_t c, const uint32_t d) {
+    const uint32_t seq = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    trace_event_t *event = &trace_ring[seq & (TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->time_ns = __trace_clock_ns(CLOCK_MONOTONIC);
+    event->type = (uint8_t)type;
+    event->a = a;
+    event->b = b;
+    event->c = c;
+    event->d = d;
+    __atomic_store_n(&event->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// the first bytes of a buffer, in order, for events that carry them
+static inline uint32_t trace_bytes(const uint8_t *data, const int size) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4 && i < size; i++)
+        value |= (uint32_t)data[i] << (i * 8);
+    return value;
+}
+
+#define TRACE_EVENT(type, a, b, c, d) trace_record(type, (uint8_t)(a), (uint16_t)(b), (uint32_t)(c), (uint32_t)(d))
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static bool __trace_write_all(const int fd, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (size > 0) {
+        const ssize_t written = write(fd, p, size);
+        if (written <= 0)
+            return false;
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// async signal safe
+bool trace_dump(const int reason) {
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.event_size = sizeof(trace_event_t);
+    header.ring_size = TRACE_RING_SIZE;
+    header.next = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+    header.realtime_ns = __trace_clock_ns(CLOCK_REALTIME);
+    header.monotonic_ns = __trace_clock_ns(CLOCK_MONOTONIC);
+    header.reason = reason;
+    header.pid = (int32_t)getpid();
+    const int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    const bool result = __trace_write_all(fd, &header, sizeof(header)) && __trace_write_all(fd, trace_ring, sizeof(trace_ring));
+    close(fd);
+    return result;
+}
+
+static void __trace_crash_handler(const int sig) {
+    trace_record(TRACE_SIGNAL, (uint8_t)sig, 0, 0, 0);
+    trace_dump(sig);
+    raise(sig); // the handler was reset, so this takes the default action
+}
+
+// the ring records from the start; this sets where it is dumped, and dumps it on a crash
+void trace_begin(const char *path) {
+    if (path != NULL)
+        snprintf(trace_path, sizeof(trace_path), "%s", path);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = __trace_crash_handler;
+    action.sa_flags = (int)(SA_RESETHAND | SA_NODEFER);
+    sigemptyset(&action.sa_mask);
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        sigaction(signals[i], &action, NULL);
+    printf("trace: recording (events=%d, size=%zu bytes, dump='%s' on SIGUSR1 or crash)\n", TRACE_RING_SIZE, sizeof(trace_ring), trace_path);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+const char *trace_type_tostring(const uint8_t type) {
+    static const char *names[TRACE_TYPE_COUNT] = { "none", "serial-read-begin", "serial-read-end", "serial-write", "command-send", "command-recv", "mode-switch", "packet", "route", "publish", "ack", "signal", "reload" };
+    return type < TRACE_TYPE_COUNT ? names[type] : "unknown";
+}
+
+// the decoder has neither the gateway's routes nor mqtt, so these follow health_drop_t and mqtt_broker_role_t
+static const char *__trace_drop_tostring(const uint8_t reason) {
+    static const char *names[] = { "drop=not-json", "drop=no-route", "drop=topic-field", "drop=too-large", "drop=sink-failed", "drop=rate-limited" };
+    return reason == TRACE_ROUTE_OKAY ? "okay" : reason < sizeof(names) / sizeof(names[0]) ? names[reason] : "drop=unknown";
+}
+
+static const char *__trace_role_tostring(const uint8_t role) {
+    static const char *names[] = { "primary", "failover", "fanout" };
+    return role < sizeof(names) / sizeof(names[0]) ? names[role] : "unknown";
+}
+
+// e.g. "serial-read-end complete=1 result=14 data=7b226964"
+void trace_event_format(char *buffer, const size_t size, const trace_event_t *event) {
+    const int length = snprintf(buffer, size, "%s", trace_type_tostring(event->type));
+    if (length < 0 || (size_t)length >= size)
+        return;
+    char *p = buffer + length;
+    const size_t remaining = size - (size_t)length;
+    const uint8_t *bytes = (const uint8_t *)&event->d;
+    char data[9];
+    snprintf(data, sizeof(data), "%02x%02x%02x%02x", bytes[0], bytes[1], bytes[2], bytes[3]);
+    switch (event->type) {
+    case TRACE_SERIAL_READ_BEGIN:
+        snprintf(p, remaining, " timeout=%" PRIu32 "ms length=%" PRIu32, event->c, event->d);
+        break;
+    case TRACE_SERIAL_READ_END:
+        snprintf(p, remaining, " complete=%d result=%" PRId32 " data=%s", event->a, (int32_t)event->c, data);
+        break;
+    case TRACE_SERIAL_WRITE:
+        snprintf(p, remaining, " result=%" PRId32 " data=%s", (int32_t)event->c, data);
+        break;
+    case TRACE_COMMAND_SEND:
+        snprintf(p, remaining, " command=%02" PRIX8 " address=%02X length=%02X bytes=%" PRIu32, event->a, event->b >> 8, event->b & 0xFF, event->c);
+        break;
+    case TRACE_COMMAND_RECV:
+        snprintf(p, remaining, " header=%02" PRIX8 " result=%" PRId32, event->a, (int32_t)event->c);
+        break;
+    case TRACE_MODE_SWITCH:
+        snprintf(p, remaining, " mode=%d result=%d", event->a, event->b);
+        break;
+    case TRACE_PACKET:
+        snprintf(p, remaining, " rssi=%d size=%" PRIu32 " data=%s", event->a, event->c, data);
+        break;
+    case TRACE_ROUTE:
+        if (event->b == TRACE_ROUTE_NONE || event->b == TRACE_ROUTE_DEFAULT)
+            snprintf(p, remaining, " route=%s %s size=%" PRIu32, event->b == TRACE_ROUTE_NONE ? "none" : "default", __trace_drop_tostring(event->a), event->c);
+        else
+            snprintf(p, remaining, " route=%d %s size=%" PRIu32, event->b, __trace_drop_tostring(event->a), event->c);
+        break;
+    case TRACE_PUBLISH:
+        snprintf(p, remaining, " broker=%s result=%d mid=%" PRIu32 " length=%" PRIu32, __trace_role_tostring(event->a), (int16_t)event->b, event->c, event->d);
+        break;
+    case TRACE_ACK:
+        snprintf(p, remaining, " broker=%s mid=%" PRIu32, __trace_role_tostring(event->a), event->c);
+        break;
+    case TRACE_SIGNAL:
+        snprintf(p, remaining, " signal=%d", event->a);
+        break;
+    case TRACE_RELOAD:
+        snprintf(p, remaining, " result=%d module-written=%d routes=%" PRIu32 " duration=%" PRIu32 "us", event->a, event->b, event->c, event->d);
+        break;
+    default:
+        snprintf(p, remaining, " a=%d b=%d c=%" PRIu32 " d=%" PRIu32, event->a, event->b, event->c, event->d);
+        break;
+    }
+}
+
+// reads a dump, returning its complete events oldest first (in a buffer to be freed), or NULL
+trace_event_t *trace_load(const char *path, trace_header_t *header, uint32_t *count) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "trace: could not open '%s'\n", path);
+        return NULL;
+    }
+    if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_VERSION || header->event_size != sizeof(trace_event_t) || header->ring_size == 0 ||
+        (header->ring_size & (header->ring_size - 1)) != 0) {
+        fprintf(stderr, "trace: '%s' is not a trace dump (or is of another version)\n", path);
+        fclose(file);
+        return NULL;
+    }
+    trace_event_t *ring = (trace_event_t *)calloc(header->ring_size, sizeof(trace_event_t)), *events = (trace_event_t *)calloc(header->ring_size, sizeof(trace_event_t));
+    if (ring == NULL || events == NULL || fread(ring, sizeof(trace_event_t), header->ring_size, file) != header->ring_size) {
+        fprintf(stderr, "trace: '%s' is truncated\n", path);
+        free(ring);
+        free(events);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    // the ring holds at most the ring_size events before next, each in the slot of its sequence number
+    const uint32_t first = header->next > header->ring_size ? header->next - header->ring_size : 0;
+    *count = 0;
+    for (uint32_t seq = first; seq != header->next; seq++) {
+        const trace_event_t *event = &ring[seq & (header->ring_size - 1)];
+        if (event->seq == seq + 1)
+            events[(*count)++] = *event;
+    }
+    free(ring);
+    return events;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------